@@ -7,6 +7,23 @@
 
 struct Occluder;
 
+// Depth buffer is accessed with 256-bit aligned loads/stores, so std::allocator is not enough
+template<typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+	template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(_mm_malloc(n * sizeof(T), Alignment)); }
+	void deallocate(T* p, size_t) { _mm_free(p); }
+
+	template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
 class Rasterizer
 {
 public:
@@ -51,7 +68,7 @@ private:
 	float m_modelViewProjectionRaw[16];
 
 	std::vector<int64_t> m_precomputedRasterTables;
-	std::vector<__m128i> m_depthBuffer;
+	std::vector<__m128i, AlignedAllocator<__m128i, 32>> m_depthBuffer;
 	std::vector<uint16_t> m_hiZ;
 
 	uint32_t m_width;
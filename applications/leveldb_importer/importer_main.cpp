@@ -0,0 +1,131 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/PagedLOD>
+#include <osg/ProxyNode>
+#include <osg/ArgumentParser>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <osgDB/Archive>
+#include <ghc/filesystem.hpp>
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <set>
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+#include <pipeline/Utilities.h>
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+
+/** Paged nodes read from files keep absolute database paths of the source folder. Remove them so
+    that children are found relative to the parent in the database (e.g., leveldb://x.db/Data/) */
+class ClearDatabasePathVisitor : public osg::NodeVisitor
+{
+public:
+    ClearDatabasePathVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    virtual void apply(osg::PagedLOD& node)
+    { node.setDatabasePath(""); traverse(node); }
+
+    virtual void apply(osg::ProxyNode& node)
+    { node.setDatabasePath(""); traverse(node); }
+};
+
+static std::vector<std::string> collectFiles(const std::string& folder,
+                                             const std::set<std::string>& extensions)
+{
+    std::vector<std::string> files; std::error_code ec;
+    ghc::filesystem::recursive_directory_iterator itr(folder, ec), end;
+    for (; !ec && itr != end; itr.increment(ec))
+    {
+        if (!itr->is_regular_file()) continue;
+        std::string fileName = ghc::filesystem::relative(itr->path(), folder).generic_string();
+        std::string ext = osgDB::convertToLowerCase(osgDB::getFileExtension(fileName));
+        if (extensions.empty() || extensions.find(ext) != extensions.end())
+            files.push_back(fileName);
+    }
+    return files;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    osg::ApplicationUsage* usage = arguments.getApplicationUsage();
+    usage->setCommandLineUsage(arguments.getApplicationName() + " <input_folder> <output.db> [options]");
+    usage->addCommandLineOption("--batch <n>", "Number of files in one write batch, default is 1000");
+    usage->addCommandLineOption("--ext <a,b,...>", "Extensions of files to import, default is osgb");
+    usage->addCommandLineOption("--no-compact", "Don't compact the database at the end");
+    usage->addCommandLineOption("--dedup", "Store identical textures only once");
+    if (arguments.argc() < 3 || arguments.read("--help"))
+    { usage->write(std::cout); return 1; }
+
+    int batchSize = 1000; std::string extString = "osgb";
+    bool compacting = !arguments.read("--no-compact"), deduplicating = arguments.read("--dedup");
+    arguments.read("--batch", batchSize); arguments.read("--ext", extString);
+
+    std::set<std::string> extensions; std::string ext;
+    std::istringstream extStream(extString);
+    while (std::getline(extStream, ext, ',')) { if (!ext.empty()) extensions.insert(ext); }
+
+    std::string inFolder = arguments[1], dbName = arguments[2];
+    std::vector<std::string> files = collectFiles(inFolder, extensions);
+    if (files.empty()) { OSG_WARN << "No file to import from " << inFolder << std::endl; return 1; }
+
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_leveldb"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_leveldb");
+    if (!rw) { OSG_WARN << "LevelDB plugin not found" << std::endl; return 1; }
+
+    // Larger write buffer and table files for bulk importing, to reduce fragments of the database
+    std::stringstream optionString;
+    optionString << "BatchSize=" << batchSize << " WriteBufferSize=268435456 MaxFileSize=67108864"
+                 << " CompactOnClose=" << (compacting ? 1 : 0)
+                 << " Deduplicate=" << (deduplicating ? 1 : 0);
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options(optionString.str());
+    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(rw->openArchive(
+        "leveldb://" + dbName, osgDB::ReaderWriter::CREATE, 4096, options.get()).getObject());
+    if (!archive) { OSG_WARN << "Failed to create " << dbName << std::endl; return 1; }
+
+    // Files are read, serialized and batched in parallel; only appending to batch is serialized
+    std::atomic<int> numImported(0), numFailed(0);
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    int numFiles = (int)files.size();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < numFiles; ++i)
+    {
+        const std::string& fileName = files[i];
+        std::string fullName = inFolder + "/" + fileName;
+        osgDB::ReaderWriter::WriteResult result(osgDB::ReaderWriter::WriteResult::FILE_NOT_HANDLED);
+        osg::ref_ptr<osg::Object> obj = osgDB::readObjectFile(fullName);
+        if (obj.valid())
+        {
+            osg::Node* node = obj->asNode();
+            osg::Image* image = dynamic_cast<osg::Image*>(obj.get());
+            if (node)
+            {
+                ClearDatabasePathVisitor cdpv; node->accept(cdpv);
+                result = archive->writeNode(*node, fileName);
+            }
+            else if (image) result = archive->writeImage(*image, fileName);
+            else result = archive->writeObject(*obj, fileName);
+        }
+
+        if (!result.success())
+        { OSG_WARN << "Failed to import " << fullName << std::endl; numFailed++; }
+        int n = ++numImported;
+        if (n % 1000 == 0) OSG_NOTICE << n << "/" << numFiles << " files imported" << std::endl;
+    }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    archive->close();  // write remaining batch and compact
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    OSG_NOTICE << numFiles << " files imported to " << dbName << ", " << numFailed << " failed; "
+               << "importing = " << osg::Timer::instance()->delta_s(t0, t1) << "s, finishing = "
+               << osg::Timer::instance()->delta_s(t1, t2) << "s" << std::endl;
+    return numFailed > 0 ? 1 : 0;
+}
@@ -3,7 +3,7 @@
 #define M_PI 3.1415926535897932384626433832795
 uniform sampler2D DiffuseMap, NormalMap, SpecularMap, ShininessMap;
 uniform sampler2D AmbientMap, EmissiveMap, ReflectionMap;
-uniform sampler2D LightParameterMap;  // (r0: col+type, r1: pos+att1, r2: dir+att0, r3: spotProp)
+uniform sampler2D LightParameterMap;  // (c0: col+type, c1: pos+range, c2: dir+spotCutoff, c3: unused)
 uniform vec2 LightNumber;  // (num, max_num)
 VERSE_FS_IN vec4 texCoord0, texCoord1, color, eyeVertex;
 VERSE_FS_IN vec3 eyeNormal, eyeTangent, eyeBinormal;
@@ -32,10 +32,10 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 int getLightAttributes(in float id, out vec3 color, out vec3 pos, out vec3 dir,
                        out float range, out float spotCutoff)
 {
-    const vec2 halfP = vec2(0.5 / 1024.0, 0.5 / 4.0), step = vec2(1.0 / 1024.0, 1.0 / 4.0);
-    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 0.0 * step.y)); // color, type
-    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 1.0 * step.y)); // pos, att
-    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 2.0 * step.y)); // dir, spot
+    const vec2 halfP = vec2(0.5 / 4.0, 0.5 / 1024.0), step = vec2(1.0 / 4.0, 1.0 / 1024.0);
+    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(0.0 * step.x, id * step.y)); // color, type
+    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(1.0 * step.x, id * step.y)); // pos, range
+    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(2.0 * step.x, id * step.y)); // dir, spot
     color = attr0.xyz; pos = attr1.xyz; dir = attr2.xyz; range = attr1.w;
     spotCutoff = attr2.w; return int(attr0.w);
 }
@@ -3,9 +3,11 @@
 uniform sampler2D BrdfLutBuffer, PrefilterBuffer, IrradianceBuffer;
 uniform sampler2D NormalBuffer, DepthBuffer, DiffuseMetallicBuffer;
 uniform sampler2D SpecularRoughnessBuffer, EmissionOcclusionBuffer;
-uniform sampler2D LightParameterMap;  // (r0: col+type, r1: pos+att1, r2: dir+att0, r3: spotProp)
+uniform sampler2D LightParameterMap;  // (c0: col+type, c1: pos+range, c2: dir+spotCutoff, c3: unused)
+uniform sampler2D LightClusterMap, LightIndexMap;  // cluster (offset, count), light indices
 uniform mat4 GBufferMatrices[4];  // w2v, v2w, v2p, p2v
 uniform vec2 InvScreenResolution, LightNumber;  // (num, max_num)
+uniform vec4 LightClusterParams;  // (zNear, zFar, num_unlimited, clustered)
 VERSE_FS_IN vec4 texCoord0;
 
 #ifdef VERSE_GLES3
@@ -15,6 +17,8 @@ layout(location = 1) VERSE_FS_OUT vec4 fragData1;
 
 const vec2 invAtan = vec2(0.1591, 0.3183);
 const int maxLights = 1024;
+const vec3 clusterSize = vec3(16.0, 8.0, 16.0);
+const vec2 indexTableSize = vec2(256.0, 64.0);
 
 /// PBR functions
 vec2 sphericalUV(vec3 v)
@@ -38,14 +42,59 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 int getLightAttributes(in float id, out vec3 color, out vec3 pos, out vec3 dir,
                        out float range, out float spotCutoff)
 {
-    const vec2 halfP = vec2(0.5 / 1024.0, 0.5 / 4.0), step = vec2(1.0 / 1024.0, 1.0 / 4.0);
-    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 0.0 * step.y)); // color, type
-    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 1.0 * step.y)); // pos, att
-    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 2.0 * step.y)); // dir, spot
+    const vec2 halfP = vec2(0.5 / 4.0, 0.5 / 1024.0), step = vec2(1.0 / 4.0, 1.0 / 1024.0);
+    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(0.0 * step.x, id * step.y)); // color, type
+    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(1.0 * step.x, id * step.y)); // pos, range
+    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(2.0 * step.x, id * step.y)); // dir, spot
     color = attr0.xyz; pos = attr1.xyz; dir = attr2.xyz; range = attr1.w;
     spotCutoff = attr2.w; return int(attr0.w);
 }
 
+vec2 getLightCluster(in vec2 uv, in float eyeDepth)
+{
+    float zNear = LightClusterParams.x, zFar = LightClusterParams.y;
+    float slice = log(max(eyeDepth, zNear) / zNear) / log(zFar / zNear) * clusterSize.z;
+    vec3 c = clamp(floor(vec3(uv * clusterSize.xy, slice)), vec3(0.0), clusterSize - vec3(1.0));
+    vec2 st = vec2((c.y * clusterSize.x + c.x + 0.5) / (clusterSize.x * clusterSize.y),
+                   (c.z + 0.5) / clusterSize.z);
+    return VERSE_TEX2D(LightClusterMap, st).xy;  // (offset, count)
+}
+
+float getClusterLightIndex(in float index)
+{
+    float texel = floor(index / 4.0), component = index - texel * 4.0;
+    float row = floor(texel / indexTableSize.x), column = texel - row * indexTableSize.x;
+    vec4 v = VERSE_TEX2D(LightIndexMap, (vec2(column, row) + vec2(0.5)) / indexTableSize);
+    return component < 0.5 ? v.x : (component < 1.5 ? v.y : (component < 2.5 ? v.z : v.w));
+}
+
+vec3 getLightContribution(in float id, in vec3 viewDir, in vec3 eyeVertex, in vec3 eyeNormal,
+                          in vec3 albedo, in float metallic, in float roughness)
+{
+    vec3 lightColor, lightPos, lightDir; float lightRange = 0.0, lightSpot = 0.0;
+    int type = getLightAttributes(id, lightColor, lightPos, lightDir, lightRange, lightSpot);
+    if (type == 1)
+    {
+        //return computeDirectionalLight(
+        //      lightDir, lightColor, eyeNormal, viewDir, albedo, specular, roughness, metallic, F0);
+        return get_directional_light_contribution(
+                viewDir, eyeVertex, lightPos, lightDir, lightColor, albedo, metallic, roughness,
+                eyeNormal, lightRange);
+    }
+    else if (type == 2)
+    {
+        return get_point_light_contribution(
+                viewDir, eyeVertex, lightPos, lightColor, albedo, metallic, roughness, eyeNormal, lightRange);
+    }
+    else if (type == 3)
+    {
+        return get_spot_light_contribution(
+                viewDir, eyeVertex, lightPos, lightDir, lightColor, albedo, metallic, roughness,
+                eyeNormal, lightRange, lightSpot);
+    }
+    return vec3(0.0);
+}
+
 void main()
 {
     vec2 uv0 = texCoord0.xy;
@@ -72,31 +121,35 @@ void main()
     // if it's a metal, use the albedo color as F0 (metallic workflow)
     vec3 F0 = mix(vec3(0.04), albedo, metallic), radianceOut = vec3(0.0);
 
-    // Compute direcional lights
-    vec3 lightColor, lightPos, lightDir; float lightRange = 0.0, lightSpot = 0.0;
+    // Compute direcional/point/spot lights
     int numLights = int(min(LightNumber.x, LightNumber.y));
-    for (int i = 0; i < maxLights; ++i)
+    if (LightClusterParams.w > 0.0)
     {
-        if (numLights <= i) break;  // to avoid 'WebGL: Loop index cannot be compared with non-constant expression'
-        int type = getLightAttributes(float(i), lightColor, lightPos, lightDir, lightRange, lightSpot);
-        if (type == 1)
+        // Unlimited lights are placed first, then the ones binned to current cluster
+        int numGlobals = int(min(LightClusterParams.z, LightNumber.y));
+        for (int i = 0; i < maxLights; ++i)
         {
-            //radianceOut += computeDirectionalLight(
-            //      lightDir, lightColor, eyeNormal, viewDir, albedo, specular, roughness, metallic, F0);
-            radianceOut += get_directional_light_contribution(
-                    viewDir, eyeVertex.xyz, lightPos, lightDir, lightColor, albedo, metallic, roughness,
-                    eyeNormal, lightRange);
+            if (numGlobals <= i) break;
+            radianceOut += getLightContribution(float(i), viewDir, eyeVertex.xyz, eyeNormal,
+                                                albedo, metallic, roughness);
         }
-        else if (type == 2)
+
+        vec2 cluster = getLightCluster(uv0, -eyeVertex.z / eyeVertex.w);
+        int numInCluster = int(min(cluster.y, LightNumber.y));
+        for (int i = 0; i < maxLights; ++i)
         {
-            radianceOut += get_point_light_contribution(
-                    viewDir, eyeVertex.xyz, lightPos, lightColor, albedo, metallic, roughness, eyeNormal, lightRange);
+            if (numInCluster <= i) break;
+            radianceOut += getLightContribution(getClusterLightIndex(cluster.x + float(i)),
+                                                viewDir, eyeVertex.xyz, eyeNormal, albedo, metallic, roughness);
         }
-        else if (type == 3)
+    }
+    else
+    {
+        for (int i = 0; i < maxLights; ++i)
         {
-            radianceOut += get_spot_light_contribution(
-                    viewDir, eyeVertex.xyz, lightPos, lightDir, lightColor, albedo, metallic, roughness,
-                    eyeNormal, lightRange, lightSpot);
+            if (numLights <= i) break;  // to avoid 'WebGL: Loop index cannot be compared with non-constant expression'
+            radianceOut += getLightContribution(float(i), viewDir, eyeVertex.xyz, eyeNormal,
+                                                albedo, metallic, roughness);
         }
     }
 
@@ -5,19 +5,18 @@
 #include "GeometryMapper.h"
 using namespace osgVerse;
 
-struct VertexIndex : public osg::Referenced
-{ unsigned int index; VertexIndex(unsigned int i) {index = i;} };
-
 class MapAttributeVisitor : public MeshCollector
 {
 public:
-    MapAttributeVisitor(PointCloudQuery* q) : _query(q) {}
+    MapAttributeVisitor(PointCloudQuery* q)
+    :   _query(q), _colors(NULL), _texcoords(NULL), _owners(NULL), _ownerStateSets(NULL) {}
 
     void setAttributes(std::vector<osg::Vec4>* c, std::vector<osg::Vec4>* u)
     { _colors = c; _texcoords = u; }
 
-    void setStateSets(std::map<osg::StateSet*, std::vector<size_t>>* vss)
-    { _verticesOfStateSets = vss; }
+    /** Reverse index of source vertices: owners[vertex] is the index of its state-set, or -1 */
+    void setStateSetOwners(std::vector<int>* owners, std::vector<osg::StateSet*>* stateSets)
+    { _owners = owners; _ownerStateSets = stateSets; }
 
     virtual void apply(osg::Geometry& geom)
     {
@@ -25,48 +24,60 @@ public:
         if (_matrixStack.size() > 0) matrix = _matrixStack.back();
 
         osg::Vec3Array* va = static_cast<osg::Vec3Array*>(geom.getVertexArray());
-        std::map<osg::StateSet*, unsigned int> stateSetCounts;
-        for (size_t i = 0; i < va->size(); ++i)
+        if (!va || va->empty()) return;
+
+        // Nearest-neighbour queries are read-only, so distribute them to worker threads
+        int numVertices = (int)va->size(), blockSize = 1024;
+        int numBlocks = (numVertices + blockSize - 1) / blockSize;
+        std::vector<uint32_t> nearest(numVertices);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < numBlocks; ++b)
         {
             std::vector<uint32_t> resultIndices(1);
-            _query->findNearest((*va)[i] * matrix, resultIndices, 1);
-
-            unsigned int index = resultIndices[0];
-            if (_verticesOfStateSets)
+            int i1 = osg::minimum(numVertices, (b + 1) * blockSize);
+            for (int i = b * blockSize; i < i1; ++i)
             {
-                for (std::map<osg::StateSet*, std::vector<size_t>>::iterator itr =
-                     _verticesOfStateSets->begin(); itr != _verticesOfStateSets->end(); ++itr)
-                {
-                    std::vector<size_t>::iterator found = std::find(
-                        itr->second.begin(), itr->second.end(), (size_t)index);
-                    if (found != itr->second.end()) stateSetCounts[itr->first]++;
-                }
+                _query->findNearest((*va)[i] * matrix, resultIndices, 1);
+                nearest[i] = resultIndices[0];
             }
+        }
 
-            if (_colors && index < _colors->size())
+        osg::Vec4Array* ca = NULL; osg::Vec2Array* ta = NULL;
+        if (_colors && !_colors->empty())
+        {
+            ca = dynamic_cast<osg::Vec4Array*>(geom.getColorArray());
+            if (!ca || ca->size() != va->size())
             {
-                osg::Vec4Array* ca = static_cast<osg::Vec4Array*>(geom.getColorArray());
-                if (!ca)
-                {
-                    ca = new osg::Vec4Array(va->size());
-                    geom.setColorArray(ca); geom.setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-                }
-                (*ca)[i] = (*_colors)[index];
+                ca = new osg::Vec4Array(va->size());
+                geom.setColorArray(ca); geom.setColorBinding(osg::Geometry::BIND_PER_VERTEX);
             }
+        }
 
-            if (_texcoords && index < _texcoords->size())
-            {
-                osg::Vec2Array* ta = static_cast<osg::Vec2Array*>(geom.getTexCoordArray(0));
-                if (!ta) { ta = new osg::Vec2Array(va->size()); geom.setTexCoordArray(0, ta); }
+        if (_texcoords && !_texcoords->empty())
+        {
+            ta = dynamic_cast<osg::Vec2Array*>(geom.getTexCoordArray(0));
+            if (!ta || ta->size() != va->size())
+            { ta = new osg::Vec2Array(va->size()); geom.setTexCoordArray(0, ta); }
+        }
+
+        std::vector<unsigned int> stateSetCounts(_ownerStateSets ? _ownerStateSets->size() : 0, 0);
+        for (int i = 0; i < numVertices; ++i)
+        {
+            unsigned int index = nearest[i];
+            if (_owners && index < _owners->size())
+            { int owner = (*_owners)[index]; if (owner >= 0) stateSetCounts[owner]++; }
+            if (ca && index < _colors->size()) (*ca)[i] = (*_colors)[index];
+            if (ta && index < _texcoords->size())
                 (*ta)[i] = osg::Vec2((*_texcoords)[index].x(), (*_texcoords)[index].y());
-            }
         }
 
         // Find preferred state-set
         unsigned int bestCount = 0; osg::StateSet* preferred = NULL;
-        for (std::map<osg::StateSet*, unsigned int>::iterator itr = stateSetCounts.begin();
-             itr != stateSetCounts.end(); ++itr)
-        { if (bestCount < itr->second) {bestCount = itr->second; preferred = itr->first;} }
+        for (size_t i = 0; i < stateSetCounts.size(); ++i)
+        {
+            if (bestCount < stateSetCounts[i])
+            { bestCount = stateSetCounts[i]; preferred = (*_ownerStateSets)[i]; }
+        }
 
         if (preferred != NULL) geom.setStateSet(preferred);
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
@@ -78,7 +89,8 @@ protected:
     PointCloudQuery* _query;
     std::vector<osg::Vec4>* _colors;
     std::vector<osg::Vec4>* _texcoords;
-    std::map<osg::StateSet*, std::vector<size_t>>* _verticesOfStateSets;
+    std::vector<int>* _owners;
+    std::vector<osg::StateSet*>* _ownerStateSets;
 };
 
 GeometryMapper::GeometryMapper()
@@ -94,15 +106,27 @@ void GeometryMapper::mapAttributes(osg::Node* source, osg::Node* target)
     std::vector<osg::Vec4>& colors = mc.getAttributes(MeshCollector::ColorAttr);
     std::vector<osg::Vec4>& texcoords = mc.getAttributes(MeshCollector::UvAttr);
     std::map<osg::StateSet*, std::vector<size_t>>& vssMap = mc.getVerticesOfStateSets();
+    if (vertices.empty()) return;
+
+    // Build the vertex-to-stateset reverse index once, instead of searching every list per vertex
+    std::vector<int> owners(vertices.size(), -1);
+    std::vector<osg::StateSet*> ownerStateSets;
+    for (std::map<osg::StateSet*, std::vector<size_t>>::iterator itr = vssMap.begin();
+         itr != vssMap.end(); ++itr)
+    {
+        int owner = (int)ownerStateSets.size();
+        ownerStateSets.push_back(itr->first);
+        for (size_t i = 0; i < itr->second.size(); ++i)
+        { size_t v = itr->second[i]; if (v < owners.size()) owners[v] = owner; }
+    }
 
     PointCloudQuery query;
-    for (size_t i = 0; i < vertices.size(); ++i)
-        query.addPoint(vertices[i], new VertexIndex(i));
+    for (size_t i = 0; i < vertices.size(); ++i) query.addPoint(vertices[i], NULL);
     query.buildIndex();
 
     MapAttributeVisitor mav(&query);
     mav.setAttributes(&colors, &texcoords);
-    mav.setStateSets(&vssMap); target->accept(mav);
+    mav.setStateSetOwners(&owners, &ownerStateSets); target->accept(mav);
 }
 
 float GeometryMapper::computeSimilarity(osg::Node* source, osg::Node* target)
@@ -113,18 +137,23 @@ float GeometryMapper::computeSimilarity(osg::Node* source, osg::Node* target)
     const std::vector<osg::Vec3>& vertices1 = mc1.getVertices();
 
     PointCloudQuery query;
-    for (size_t i = 0; i < vertices0.size(); ++i)
-        query.addPoint(vertices0[i], new VertexIndex(i));
+    for (size_t i = 0; i < vertices0.size(); ++i) query.addPoint(vertices0[i], NULL);
     query.buildIndex();
 
-    std::vector<float> lengthList; float maxD = 0.0f, minD = FLT_MAX;
-    for (size_t i = 0; i < vertices1.size(); ++i)
+    int numVertices = (int)vertices1.size(), blockSize = 1024;
+    int numBlocks = (numVertices + blockSize - 1) / blockSize;
+    std::vector<float> lengthList(numVertices); float maxD = 0.0f, minD = FLT_MAX;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < numBlocks; ++b)
     {
         std::vector<uint32_t> resultIndices(1);
-        float d = sqrt(query.findNearest(vertices1[i], resultIndices, 1));
-        if (maxD < d) maxD = d; if (minD > d) minD = d;
-        lengthList.push_back(d);
+        int i1 = osg::minimum(numVertices, (b + 1) * blockSize);
+        for (int i = b * blockSize; i < i1; ++i)
+            lengthList[i] = sqrt(query.findNearest(vertices1[i], resultIndices, 1));
     }
+
+    for (int i = 0; i < numVertices; ++i)
+    { maxD = osg::maximum(maxD, lengthList[i]); minD = osg::minimum(minD, lengthList[i]); }
     if (vertices1.empty() || maxD == minD) return -1.0f;
 
     float totalLength = 0.0f, diff = maxD - minD, num = (float)lengthList.size();
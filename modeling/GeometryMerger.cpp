@@ -3,6 +3,7 @@
 #include <osg/Texture2D>
 #include <osgDB/FileNameUtils>
 #include <osgDB/WriteFile>
+#include <sstream>
 #include "GeometryMerger.h"
 #include "Utilities.h"
 using namespace osgVerse;
@@ -34,74 +35,105 @@ osg::Geometry* GeometryMerger::process(const std::vector<std::pair<osg::Geometry
 
     // Collect textures and make atlas
     osg::ref_ptr<TexturePacker> packer = new TexturePacker(4096, 4096);
-    std::vector<osg::ref_ptr<osg::Image>> images;
-    std::vector<size_t> gIndices;
-
     std::map<size_t, size_t> geometryIdMap;
     std::string imageName; size_t numImages = 0;
     size_t end = osg::minimum(offset + size, geomList.size());
+    collectTextures(packer.get(), geomList, offset, end, geometryIdMap, imageName);
+
+    osg::ref_ptr<osg::Image> atlas = packer->pack(numImages, true);
+    if (!atlas) { packer->setMaxSize(8192, 8192); atlas = packer->pack(numImages, true); }
+
+    std::vector<size_t> indices;
+    for (size_t i = offset; i < end; ++i) indices.push_back(i);
+    return mergeGeometries(geomList, indices, packer.get(), geometryIdMap,
+                           atlas.get(), imageName, maxTextureSize);
+}
+
+std::vector<osg::ref_ptr<osg::Geometry>> GeometryMerger::processPages(
+        const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
+        size_t offset, size_t size, int maxTextureSize, int pageSize)
+{
+    std::vector<osg::ref_ptr<osg::Geometry>> resultList;
+    if (size == 0) size = geomList.size() - offset;
+    if (geomList.empty()) return resultList;
+
+    // Collect textures and pack them to pages
+    if (pageSize <= 0) pageSize = maxTextureSize;
+    osg::ref_ptr<TexturePacker> packer = new TexturePacker(pageSize, pageSize);
+    std::map<size_t, size_t> geometryIdMap; std::string imageName;
+    size_t end = osg::minimum(offset + size, geomList.size());
+    collectTextures(packer.get(), geomList, offset, end, geometryIdMap, imageName);
+    size_t numPages = packer->packPages();
+
+    // Split geometries by page; those without atlas (-1) are merged together
+    std::map<int, std::vector<size_t>> pageGeometries;
     for (size_t i = offset; i < end; ++i)
     {
-        osg::StateSet* ss = geomList[i].first->getStateSet();
-        if (!ss) continue; else if (ss->getNumTextureAttributeLists() == 0) continue;
-
-        osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(
-            ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
-        if (tex && tex->getImage()) { images.push_back(tex->getImage()); gIndices.push_back(i); }
+        int x = 0, y = 0, w = 0, h = 0, page = -1;
+        std::map<size_t, size_t>::iterator itr = geometryIdMap.find(i);
+        if (itr != geometryIdMap.end()) packer->getPackingData(itr->second, x, y, w, h, &page);
+        pageGeometries[page].push_back(i);
     }
 
-    std::string ext = images.empty() ? "" : osgDB::getFileExtension(images[0]->getFileName());
-    for (size_t i = 0; i < images.size(); ++i)
+    // Compose page images one at a time, so never hold all sources and pages together
+    for (std::map<int, std::vector<size_t>>::iterator itr = pageGeometries.begin();
+         itr != pageGeometries.end(); ++itr)
     {
-        size_t id = gIndices[i]; geometryIdMap[id] = packer->addElement(images[i].get());
-        imageName += osgDB::getStrippedName(images[i]->getFileName()) + ",";
+        osg::ref_ptr<osg::Image> atlas = (itr->first < 0) ? NULL : packer->createPage(itr->first);
+        std::stringstream ss; ss << imageName << "_p" << itr->first;
+        osg::ref_ptr<osg::Geometry> geom = mergeGeometries(
+            geomList, itr->second, packer.get(), geometryIdMap, atlas.get(), ss.str(), maxTextureSize);
+        if (geom.valid()) resultList.push_back(geom);
     }
 
-    // Recompute texture coords
-    osg::ref_ptr<osg::Image> atlas = packer->pack(numImages, true);
-    if (!atlas) { packer->setMaxSize(8192, 8192); atlas = packer->pack(numImages, true); }
-    if (atlas.valid())
-    {
-        float totalW = atlas->s(), totalH = atlas->t();
-        for (size_t i = offset; i < end; ++i)
-        {
-            osg::Geometry* geom = geomList[i].first;
-            osg::Vec2Array* ta = static_cast<osg::Vec2Array*>(geom->getTexCoordArray(0));
-            if (!ta || geometryIdMap.find(i) == geometryIdMap.end()) continue;
+    if (numPages > 1)
+        OSG_INFO << "[GeometryMerger] " << (end - offset) << " geometries merged to "
+                 << resultList.size() << " geometries with " << numPages << " atlas pages" << std::endl;
+    return resultList;
+}
 
-            int x = 0, y = 0, w = 0, h = 0;
-            if (!packer->getPackingData(geometryIdMap[i], x, y, w, h)) continue;
+void GeometryMerger::collectTextures(TexturePacker* packer,
+                                     const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
+                                     size_t offset, size_t end, std::map<size_t, size_t>& geometryIdMap,
+                                     std::string& imageName)
+{
+    // Geometries sharing an image (e.g., after ContentDeduplicator) share one packed element
+    std::map<osg::Image*, size_t> imageIdMap;
+    for (size_t i = offset; i < end; ++i)
+    {
+        osg::StateSet* ss = geomList[i].first->getStateSet();
+        if (!ss) continue; else if (ss->getNumTextureAttributeLists() == 0) continue;
 
-            float tx0 = (float)x / totalW, tw = (float)w / totalW;
-            float ty0 = (float)y / totalH, th = (float)h / totalH;
-            for (size_t j = 0; j < ta->size(); ++j)
-            {
-                const osg::Vec2& t = (*ta)[j];
-                (*ta)[j] = osg::Vec2(t[0] * tw + tx0, t[1] * th + ty0);
-            }
-        }
+        osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(
+            ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+        if (!tex || !tex->getImage()) continue;
 
-        int totalW1 = osg::Image::computeNearestPowerOfTwo(totalW);
-        int totalH1 = osg::Image::computeNearestPowerOfTwo(totalH);
-        if (totalW1 > (totalW * 1.5)) totalW1 = totalW1 / 2;
-        if (totalH1 > (totalH * 1.5)) totalH1 = totalH1 / 2;
-        if (totalW1 > maxTextureSize) totalW1 = maxTextureSize;
-        if (totalH1 > maxTextureSize) totalH1 = maxTextureSize;
-        if (totalW1 != totalW || totalH1 != totalH) atlas->scaleImage(totalW1, totalH1, 1);
+        osg::Image* image = tex->getImage();
+        std::map<osg::Image*, size_t>::iterator itr = imageIdMap.find(image);
+        if (itr != imageIdMap.end()) { geometryIdMap[i] = itr->second; continue; }
 
-        ext = ".jpg";  // packed image should always be saved to JPG at current time...
-        atlas->setFileName(imageName + "_all." + ext);
+        geometryIdMap[i] = imageIdMap[image] = packer->addElement(image);
+        imageName += osgDB::getStrippedName(image->getFileName()) + ",";
     }
+}
 
-    // Concatenate arrays and primitive-sets
+osg::Geometry* GeometryMerger::mergeGeometries(
+        const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
+        const std::vector<size_t>& indices, TexturePacker* packer,
+        std::map<size_t, size_t>& geometryIdMap, osg::Image* atlas,
+        const std::string& imageName, int maxTextureSize)
+{
+    // Concatenate arrays and primitive-sets, and recompute texture coords if atlas is valid
     osg::ref_ptr<osg::Vec3Array> vaAll = new osg::Vec3Array;
     osg::ref_ptr<osg::Vec3Array> naAll = new osg::Vec3Array;
     osg::ref_ptr<osg::Vec2Array> taAll = new osg::Vec2Array;
     osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    float totalW = atlas ? atlas->s() : 0.0f, totalH = atlas ? atlas->t() : 0.0f;
 
     osg::ref_ptr<osg::Geometry> resultGeom = new osg::Geometry;
-    for (size_t i = offset; i < end; ++i)
+    for (size_t n = 0; n < indices.size(); ++n)
     {
+        size_t i = indices[n];
         osg::Geometry* geom = geomList[i].first;
         osg::Vec3Array* va = static_cast<osg::Vec3Array*>(geom->getVertexArray());
         osg::Vec3Array* na = static_cast<osg::Vec3Array*>(geom->getNormalArray());
@@ -121,8 +153,24 @@ osg::Geometry* GeometryMerger::process(const std::vector<std::pair<osg::Geometry
         osg::Matrix matrix = geomList[i].second;
         for (size_t v = 0; v < va->size(); ++v) vaAll->push_back((*va)[v] * matrix);
         if (na) naAll->insert(naAll->end(), na->begin(), na->end());
-        if (ta) taAll->insert(taAll->end(), ta->begin(), ta->end());
+        if (!ta) continue;
+
+        int x = 0, y = 0, w = 0, h = 0;
+        std::map<size_t, size_t>::iterator itr = geometryIdMap.find(i);
+        if (atlas && itr != geometryIdMap.end() && packer->getPackingData(itr->second, x, y, w, h))
+        {
+            float tx0 = (float)x / totalW, tw = (float)w / totalW;
+            float ty0 = (float)y / totalH, th = (float)h / totalH;
+            for (size_t j = 0; j < ta->size(); ++j)
+            {
+                const osg::Vec2& t = (*ta)[j];
+                taAll->push_back(osg::Vec2(t[0] * tw + tx0, t[1] * th + ty0));
+            }
+        }
+        else
+            taAll->insert(taAll->end(), ta->begin(), ta->end());
     }
+    if (vaAll->empty()) return NULL;
 
     resultGeom->setUseDisplayList(false);
     resultGeom->setUseVertexBufferObjects(true);
@@ -136,13 +184,26 @@ osg::Geometry* GeometryMerger::process(const std::vector<std::pair<osg::Geometry
         resultGeom->setTexCoordArray(0, taAll.get());
     resultGeom->addPrimitiveSet(de.get());
 
-    if (atlas.valid())
+    if (atlas != NULL)
     {
+        int totalW1 = osg::Image::computeNearestPowerOfTwo(totalW);
+        int totalH1 = osg::Image::computeNearestPowerOfTwo(totalH);
+        if (totalW1 > (totalW * 1.5)) totalW1 = totalW1 / 2;
+        if (totalH1 > (totalH * 1.5)) totalH1 = totalH1 / 2;
+        if (totalW1 > maxTextureSize) totalW1 = maxTextureSize;
+        if (totalH1 > maxTextureSize) totalH1 = maxTextureSize;
+        if (totalW1 != totalW || totalH1 != totalH) atlas->scaleImage(totalW1, totalH1, 1);
+
+        // packed image should always be saved to JPG at current time...
+        atlas->setFileName(imageName + "_all.jpg");
+
         osg::ref_ptr<osg::Texture2D> tex2D = new osg::Texture2D;
         tex2D->setFilter(osg::Texture2D::MIN_FILTER, osg::Texture2D::LINEAR_MIPMAP_LINEAR);
         tex2D->setFilter(osg::Texture2D::MAG_FILTER, osg::Texture2D::LINEAR);
-        tex2D->setResizeNonPowerOfTwoHint(true); tex2D->setImage(atlas.get());
+        tex2D->setResizeNonPowerOfTwoHint(true); tex2D->setImage(atlas);
         resultGeom->getOrCreateStateSet()->setTextureAttributeAndModes(0, tex2D.get());
     }
+
+    if (_optimizer.valid()) _optimizer->optimize(*resultGeom);
     return resultGeom.release();
 }
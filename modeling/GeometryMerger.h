@@ -6,19 +6,45 @@
 #include <vector>
 #include <iostream>
 #include <osg/Geometry>
+#include "GeometryOptimizer.h"
 
 namespace osgVerse
 {
+    class TexturePacker;
+
     class GeometryMerger
     {
     public:
         GeometryMerger();
         ~GeometryMerger();
 
+        /** Merge geometries to one with a single texture atlas (at most 8192 x 8192, which will
+            then be scaled to maxTextureSize) */
         osg::Geometry* process(const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList, size_t offset,
                                size_t size = 0, int maxTextureSize = 4096);
 
+        /** Merge geometries with multi-page texture atlas: each page is no larger than pageSize
+            (default to maxTextureSize) and then scaled to maxTextureSize if necessary.
+            Geometries are merged to one result per page */
+        std::vector<osg::ref_ptr<osg::Geometry>> processPages(
+            const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList, size_t offset,
+            size_t size = 0, int maxTextureSize = 4096, int pageSize = 0);
+
+        /** Optimize (simplify / reorder) merged geometry with given optimizer, NULL to disable */
+        void setOptimizer(GeometryOptimizer* opt) { _optimizer = opt; }
+        GeometryOptimizer* getOptimizer() const { return _optimizer.get(); }
+
     protected:
+        void collectTextures(TexturePacker* packer,
+                             const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
+                             size_t offset, size_t end, std::map<size_t, size_t>& geometryIdMap,
+                             std::string& imageName);
+        osg::Geometry* mergeGeometries(const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
+                                       const std::vector<size_t>& indices, TexturePacker* packer,
+                                       std::map<size_t, size_t>& geometryIdMap, osg::Image* atlas,
+                                       const std::string& imageName, int maxTextureSize);
+
+        osg::ref_ptr<GeometryOptimizer> _optimizer;
     };
 }
 
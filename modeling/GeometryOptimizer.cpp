@@ -0,0 +1,291 @@
+#include <osg/io_utils>
+#include <osg/Version>
+#include <osg/Geode>
+#include <osg/TriangleIndexFunctor>
+#include <meshoptimizer/meshoptimizer.h>
+#include "GeometryOptimizer.h"
+#include "Utilities.h"
+#include <algorithm>
+using namespace osgVerse;
+
+struct CollectTrianglesOperator
+{
+    std::vector<unsigned int>* _indices;
+    CollectTrianglesOperator() : _indices(NULL) {}
+
+    void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
+    {
+        if (i1 == i2 || i2 == i3 || i1 == i3) return;
+        _indices->push_back(i1); _indices->push_back(i2); _indices->push_back(i3);
+    }
+};
+
+class CollectGeometryVisitor : public osg::NodeVisitor
+{
+public:
+    CollectGeometryVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+    std::vector<osg::Geometry*> geometries;
+
+#if OSG_VERSION_GREATER_THAN(3, 3, 1)
+    virtual void apply(osg::Geometry& geom)
+    { geometries.push_back(&geom); }
+#else
+    virtual void apply(osg::Geode& node)
+    {
+        for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = node.getDrawable(i)->asGeometry();
+            if (geom) geometries.push_back(geom);
+        }
+        traverse(node);
+    }
+#endif
+};
+
+namespace
+{
+    /* A per-vertex array and where it is attached: -1 = vertex, -2 = normal, -3 = color,
+       -4 = secondary color, -5 = fog coord, 0-99 = texture unit, 100+ = vertex attribute */
+    struct VertexArraySlot
+    {
+        VertexArraySlot(osg::Array* a, int s) : array(a), slot(s) {}
+        osg::Array* array; int slot;
+    };
+
+    static bool collectVertexArrays(osg::Geometry& geom, std::vector<VertexArraySlot>& slots)
+    {
+        osg::Array* va = geom.getVertexArray();
+        if (!va || va->getNumElements() < 3) return false;
+
+        unsigned int numVertices = va->getNumElements();
+        std::vector<osg::Array*> arrays; arrays.push_back(va);
+        slots.push_back(VertexArraySlot(va, -1));
+
+#define ADD_VERTEX_ARRAY(a, s) \
+    if (a != NULL && a->getNumElements() == numVertices && \
+        std::find(arrays.begin(), arrays.end(), a) == arrays.end()) \
+    { arrays.push_back(a); slots.push_back(VertexArraySlot(a, s)); }
+
+        if (geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX)
+            ADD_VERTEX_ARRAY(geom.getNormalArray(), -2);
+        if (geom.getColorBinding() == osg::Geometry::BIND_PER_VERTEX)
+            ADD_VERTEX_ARRAY(geom.getColorArray(), -3);
+        if (geom.getSecondaryColorBinding() == osg::Geometry::BIND_PER_VERTEX)
+            ADD_VERTEX_ARRAY(geom.getSecondaryColorArray(), -4);
+        if (geom.getFogCoordBinding() == osg::Geometry::BIND_PER_VERTEX)
+            ADD_VERTEX_ARRAY(geom.getFogCoordArray(), -5);
+        for (unsigned int i = 0; i < geom.getNumTexCoordArrays(); ++i)
+            ADD_VERTEX_ARRAY(geom.getTexCoordArray(i), (int)i);
+        for (unsigned int i = 0; i < geom.getNumVertexAttribArrays(); ++i)
+            ADD_VERTEX_ARRAY(geom.getVertexAttribArray(i), 100 + (int)i);
+#undef ADD_VERTEX_ARRAY
+        return true;
+    }
+
+    static void setVertexArray(osg::Geometry& geom, VertexArraySlot& s, osg::Array* a)
+    {
+        switch (s.slot)
+        {
+        case -1: geom.setVertexArray(a); break;
+        case -2: geom.setNormalArray(a); break;
+        case -3: geom.setColorArray(a); break;
+        case -4: geom.setSecondaryColorArray(a); break;
+        case -5: geom.setFogCoordArray(a); break;
+        default:
+            if (s.slot < 100) geom.setTexCoordArray(s.slot, a);
+            else geom.setVertexAttribArray(s.slot - 100, a);
+            break;
+        }
+        s.array = a;
+    }
+
+    static bool collectTriangles(osg::Geometry& geom, std::vector<unsigned int>& indices)
+    {
+        for (unsigned int i = 0; i < geom.getNumPrimitiveSets(); ++i)
+        {
+            GLenum mode = geom.getPrimitiveSet(i)->getMode();
+            if (mode < GL_TRIANGLES || mode > GL_POLYGON) return false;
+        }
+
+        osg::TriangleIndexFunctor<CollectTrianglesOperator> functor;
+        functor._indices = &indices; geom.accept(functor);
+        return !indices.empty();
+    }
+
+    static unsigned int getElementSize(const osg::Array* a)
+    { return a->getTotalDataSize() / a->getNumElements(); }
+
+    /* meshoptimizer only works with float positions, so convert double ones if necessary */
+    static osg::Vec3Array* getFloatPositions(osg::Geometry& geom)
+    {
+        osg::Vec3Array* va = dynamic_cast<osg::Vec3Array*>(geom.getVertexArray());
+        if (va != NULL) return va;
+
+        osg::Vec3dArray* vaD = dynamic_cast<osg::Vec3dArray*>(geom.getVertexArray());
+        if (vaD == NULL) return NULL;
+        return new osg::Vec3Array(vaD->begin(), vaD->end());
+    }
+
+    /* Remap all per-vertex arrays (as copies, arrays may be shared by other geometries) */
+    static void remapVertexArrays(osg::Geometry& geom, std::vector<VertexArraySlot>& slots,
+                                  const std::vector<unsigned int>& remap, size_t numUnique)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            osg::Array* src = slots[i].array;
+            size_t numVertices = src->getNumElements();
+            osg::ref_ptr<osg::Array> dst =
+                static_cast<osg::Array*>(src->clone(osg::CopyOp::DEEP_COPY_ALL));
+
+            void* data = const_cast<GLvoid*>(dst->getDataPointer());
+            meshopt_remapVertexBuffer(data, data, numVertices, getElementSize(src), &remap[0]);
+            dst->resizeArray(numUnique); setVertexArray(geom, slots[i], dst.get());
+        }
+    }
+}
+
+GeometryOptimizer::GeometryOptimizer()
+:   _simplifyRatio(0.5f), _targetError(0.01f), _overdrawThreshold(1.05f),
+    _normalWeight(0.05f), _uvWeight(0.1f), _simplifyMode(NO_SIMPLIFY), _lockBorder(true),
+    _weldingVertices(true), _optimizingVertexCache(true), _optimizingOverdraw(true),
+    _optimizingVertexFetch(true)
+{}
+
+bool GeometryOptimizer::optimize(osg::Geometry& geom, bool allowSimplifying) const
+{
+    std::vector<VertexArraySlot> slots;
+    std::vector<unsigned int> indices, remap;
+    if (!collectVertexArrays(geom, slots) || !collectTriangles(geom, indices)) return false;
+
+    osg::ref_ptr<osg::Vec3Array> positions = getFloatPositions(geom);
+    if (!positions) return false;
+
+    // Weld binary equivalent vertices, so that simplifier can find connected triangles
+    size_t numVertices = positions->size();
+    if (_weldingVertices && slots.size() <= 16)
+    {
+        std::vector<meshopt_Stream> streams;
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            size_t elemSize = getElementSize(slots[i].array);
+            meshopt_Stream stream = { slots[i].array->getDataPointer(), elemSize, elemSize };
+            streams.push_back(stream);
+        }
+
+        remap.resize(numVertices);
+        size_t numUnique = meshopt_generateVertexRemapMulti(
+            &remap[0], &indices[0], indices.size(), numVertices, &streams[0], streams.size());
+        if (numUnique < numVertices)
+        {
+            meshopt_remapIndexBuffer(&indices[0], &indices[0], indices.size(), &remap[0]);
+            remapVertexArrays(geom, slots, remap, numUnique);
+            positions = getFloatPositions(geom); numVertices = numUnique;
+        }
+    }
+
+    const float* posData = (const float*)&(*positions)[0];
+    if (allowSimplifying && _simplifyMode != NO_SIMPLIFY && _simplifyRatio < 1.0f)
+    {
+        size_t targetCount = (size_t)(indices.size() / 3 * osg::maximum(_simplifyRatio, 0.0f)) * 3;
+        unsigned int options = _lockBorder ? meshopt_SimplifyLockBorder : 0;
+        std::vector<unsigned int> result(indices.size()); size_t numResult = 0;
+        float resultError = 0.0f;
+
+        std::vector<float> attributes, weights;
+        if (_simplifyMode == SIMPLIFY_WITH_ATTRIBUTES)
+        {
+            // Only Vec3 normals and Vec2 UVs (unit 0) are measured
+            osg::Vec3Array* na = NULL; osg::Vec2Array* ta = NULL;
+            for (size_t i = 0; i < slots.size(); ++i)
+            {
+                if (slots[i].slot == -2) na = dynamic_cast<osg::Vec3Array*>(slots[i].array);
+                else if (slots[i].slot == 0) ta = dynamic_cast<osg::Vec2Array*>(slots[i].array);
+            }
+
+            if (na) weights.insert(weights.end(), 3, _normalWeight);
+            if (ta) weights.insert(weights.end(), 2, _uvWeight);
+            if (!weights.empty())
+            {
+                attributes.resize(numVertices * weights.size());
+                for (size_t i = 0; i < numVertices; ++i)
+                {
+                    float* attr = &attributes[i * weights.size()];
+                    if (na)
+                    {
+                        const osg::Vec3& n = (*na)[i];
+                        *(attr++) = n[0]; *(attr++) = n[1]; *(attr++) = n[2];
+                    }
+                    if (ta) { const osg::Vec2& t = (*ta)[i]; attr[0] = t[0]; attr[1] = t[1]; }
+                }
+            }
+        }
+
+        if (_simplifyMode == SIMPLIFY_SLOPPY)
+            numResult = meshopt_simplifySloppy(
+                &result[0], &indices[0], indices.size(), posData, numVertices, sizeof(osg::Vec3),
+                targetCount, _targetError, &resultError);
+        else if (!weights.empty())
+            numResult = meshopt_simplifyWithAttributes(
+                &result[0], &indices[0], indices.size(), posData, numVertices, sizeof(osg::Vec3),
+                &attributes[0], weights.size() * sizeof(float), &weights[0], weights.size(), NULL,
+                targetCount, _targetError, options, &resultError);
+        else
+            numResult = meshopt_simplify(
+                &result[0], &indices[0], indices.size(), posData, numVertices, sizeof(osg::Vec3),
+                targetCount, _targetError, options, &resultError);
+
+        if (numResult > 0) { result.resize(numResult); indices.swap(result); }
+        else
+            OSG_NOTICE << "[GeometryOptimizer] Simplifying " << geom.getName()
+                       << " results in no triangles, which is ignored" << std::endl;
+    }
+
+    if (_optimizingVertexCache)
+    {
+        meshopt_optimizeVertexCache(&indices[0], &indices[0], indices.size(), numVertices);
+        if (_optimizingOverdraw)
+            meshopt_optimizeOverdraw(&indices[0], &indices[0], indices.size(), posData, numVertices,
+                                     sizeof(osg::Vec3), _overdrawThreshold);
+    }
+
+    if (_optimizingVertexFetch)
+    {
+        remap.resize(numVertices);
+        size_t numUnique = meshopt_optimizeVertexFetchRemap(
+            &remap[0], &indices[0], indices.size(), numVertices);
+        meshopt_remapIndexBuffer(&indices[0], &indices[0], indices.size(), &remap[0]);
+        remapVertexArrays(geom, slots, remap, numUnique);
+    }
+
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    de->assign(indices.begin(), indices.end());
+    geom.removePrimitiveSet(0, geom.getNumPrimitiveSets());
+    geom.addPrimitiveSet(de.get()); geom.dirtyBound();
+    return true;
+}
+
+void GeometryOptimizer::optimize(osg::Node& node, bool allowSimplifying) const
+{
+    CollectGeometryVisitor cgv; node.accept(cgv);
+    for (size_t i = 0; i < cgv.geometries.size(); ++i)
+        optimize(*cgv.geometries[i], allowSimplifying);
+}
+
+GeometryOptimizer::Statistics GeometryOptimizer::analyze(osg::Geometry& geom, unsigned int cacheSize)
+{
+    Statistics stats;
+    std::vector<VertexArraySlot> slots;
+    std::vector<unsigned int> indices;
+    if (!collectVertexArrays(geom, slots) || !collectTriangles(geom, indices)) return stats;
+
+    size_t vertexSize = 0, numVertices = slots[0].array->getNumElements();
+    for (size_t i = 0; i < slots.size(); ++i) vertexSize += getElementSize(slots[i].array);
+
+    meshopt_VertexCacheStatistics vcs =
+        meshopt_analyzeVertexCache(&indices[0], indices.size(), numVertices, cacheSize, 0, 0);
+    meshopt_VertexFetchStatistics vfs =
+        meshopt_analyzeVertexFetch(&indices[0], indices.size(), numVertices, vertexSize);
+    stats.numTriangles = indices.size() / 3; stats.numVertices = numVertices;
+    stats.acmr = vcs.acmr; stats.atvr = vcs.atvr; stats.overfetch = vfs.overfetch;
+    return stats;
+}
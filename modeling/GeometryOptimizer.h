@@ -0,0 +1,95 @@
+#ifndef MANA_MODELING_GEOMETRY_OPTIMIZER_HPP
+#define MANA_MODELING_GEOMETRY_OPTIMIZER_HPP
+
+#include <osg/Geometry>
+#include <vector>
+
+namespace osgVerse
+{
+    /** Geometry optimizing pass based on meshoptimizer (3rdparty/meshoptimizer)
+        - Exactly duplicated vertices (all per-vertex arrays equal) are welded first
+        - Triangles can be simplified by edge-collapsing, optionally aware of normals / UVs,
+          or by sloppy vertex clustering, which is much faster but ignores topology
+        - Triangles are then reordered for post-transform vertex cache and overdraw,
+          and vertices are reordered (and unused ones removed) for vertex fetch
+        Only geometries made of triangle primitives are handled; all per-vertex arrays (vertices,
+        normals, colors, texture coordinates and vertex attributes) are remapped together.
+        optimize() doesn't change the optimizer itself, so it is safe to be called from threads.
+    */
+    class GeometryOptimizer : public osg::Referenced
+    {
+    public:
+        GeometryOptimizer();
+
+        enum SimplifyMode
+        {
+            NO_SIMPLIFY, SIMPLIFY,            ///< Edge-collapse simplification
+            SIMPLIFY_WITH_ATTRIBUTES,         ///< Edge-collapse, also measuring normal / UV errors
+            SIMPLIFY_SLOPPY                   ///< Vertex clustering without topology preserving
+        };
+
+        /** Simplify to ratio (0, 1] of original triangles, unless the relative error (to mesh extent)
+            exceeds targetError. Set lockBorder to keep open borders (e.g., tile edges) unchanged */
+        void setSimplifying(SimplifyMode mode, float ratio = 0.5f, float targetError = 0.01f,
+                            bool lockBorder = true)
+        {
+            _simplifyMode = mode; _simplifyRatio = ratio;
+            _targetError = targetError; _lockBorder = lockBorder;
+        }
+
+        SimplifyMode getSimplifyMode() const { return _simplifyMode; }
+        float getSimplifyRatio() const { return _simplifyRatio; }
+        float getTargetError() const { return _targetError; }
+        bool getLockBorder() const { return _lockBorder; }
+
+        /** Weights of normal and UV errors in SIMPLIFY_WITH_ATTRIBUTES mode */
+        void setAttributeWeights(float normalW, float uvW) { _normalWeight = normalW; _uvWeight = uvW; }
+        float getNormalWeight() const { return _normalWeight; }
+        float getUvWeight() const { return _uvWeight; }
+
+        void setWeldingVertices(bool b) { _weldingVertices = b; }
+        bool getWeldingVertices() const { return _weldingVertices; }
+
+        void setOptimizingVertexCache(bool b) { _optimizingVertexCache = b; }
+        bool getOptimizingVertexCache() const { return _optimizingVertexCache; }
+
+        /** Overdraw optimizing will worsen vertex cache efficiency by at most the threshold
+            (1.05 = 5%). It only works after vertex cache optimizing */
+        void setOptimizingOverdraw(bool b, float threshold = 1.05f)
+        { _optimizingOverdraw = b; _overdrawThreshold = threshold; }
+        bool getOptimizingOverdraw() const { return _optimizingOverdraw; }
+
+        void setOptimizingVertexFetch(bool b) { _optimizingVertexFetch = b; }
+        bool getOptimizingVertexFetch() const { return _optimizingVertexFetch; }
+
+        /** Apply all enabled steps to the geometry. Its primitive sets will be replaced by one
+            DrawElementsUInt(GL_TRIANGLES). Set allowSimplifying to false to skip simplification
+            but still do welding / reordering. Return false if geometry is not applicable */
+        bool optimize(osg::Geometry& geom, bool allowSimplifying = true) const;
+
+        /** Apply to all geometries in the node */
+        void optimize(osg::Node& node, bool allowSimplifying = true) const;
+
+        struct Statistics
+        {
+            Statistics() : numTriangles(0), numVertices(0), acmr(0.0f), atvr(0.0f), overfetch(0.0f) {}
+            unsigned int numTriangles, numVertices;
+            float acmr;       ///< Average cache miss ratio (transformed vertices / triangles)
+            float atvr;       ///< Average transformed vertex ratio (transformed / total vertices)
+            float overfetch;  ///< Fetched vertex bytes / total vertex bytes
+        };
+
+        /** Analyze triangles of the geometry with given vertex cache size (FIFO) */
+        static Statistics analyze(osg::Geometry& geom, unsigned int cacheSize = 16);
+
+    protected:
+        virtual ~GeometryOptimizer() {}
+
+        float _simplifyRatio, _targetError, _overdrawThreshold, _normalWeight, _uvWeight;
+        SimplifyMode _simplifyMode;
+        bool _lockBorder, _weldingVertices, _optimizingVertexCache;
+        bool _optimizingOverdraw, _optimizingVertexFetch;
+    };
+}
+
+#endif
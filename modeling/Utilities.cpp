@@ -9,6 +9,7 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <iostream>
+#include <cfloat>
 
 #define STB_RECT_PACK_IMPLEMENTATION
 #define ENABLE_VHACD_IMPLEMENTATION 1
@@ -90,77 +91,157 @@ struct CollectVertexOperator
 {
     void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
     {
-        if (vertices && vertices->size() <= baseIndex)
+        if (vertices && !collected) collectVertices();
+        if (indices)
         {
-            std::vector<bool> vertexAddingList;
-            for (size_t i = 0; i < inputV->size(); ++i)
-            {
-                osg::Vec3 v = (*inputV)[i] * matrix;
-                if (vertexMap)
-                {
-                    if (vertexMap->find(v) == vertexMap->end())
-                    {
-                        (*vertexMap)[v] = vertices->size();
-                        vertexAddingList.push_back(true);
-                        vertices->push_back(v);
-                    }
-                    else
-                        vertexAddingList.push_back(false);
-                    indexMap[baseIndex + i] = (*vertexMap)[v] - baseIndex;
-                }
-                else vertices->push_back(v);
-            }
+            if (vertexMap || weldingTable)
+            { i1 = indexMap[i1]; i2 = indexMap[i2]; i3 = indexMap[i3]; }
+            else
+            { i1 += baseIndex; i2 += baseIndex; i3 += baseIndex; }
 
-            if (attributes)
-            {
-                std::vector<osg::Vec4>& na = (*attributes)[MeshCollector::NormalAttr];
-                std::vector<osg::Vec4>& ca = (*attributes)[MeshCollector::ColorAttr];
-                std::vector<osg::Vec4>& ta = (*attributes)[MeshCollector::UvAttr];
-                for (size_t i = 0; i < inputV->size(); ++i)
-                {
-                    if (vertexMap && !vertexAddingList[i]) continue;
-                    if (inputN)
-                    {
-                        osg::Vec3 n = osg::Matrix::transform3x3(osg::Matrix::inverse(matrix), (*inputN)[i]);
-                        na.push_back(osg::Vec4(n, 0.0));
-                    }
-                    if (inputC) ca.push_back((*inputC)[i]);
-                    if (inputT) ta.push_back(osg::Vec4((*inputT)[i].x(),
-                                                       (*inputT)[i].y(), 0.0f, 1.0));
-                }
-            }
+            if (i1 == i2 || i2 == i3 || i1 == i3) return;
+            indices->push_back(i1); indices->push_back(i2); indices->push_back(i3);
         }
+    }
 
-        if (indices)
+    void collectVertices()
+    {
+        std::vector<osg::Vec4> *na = NULL, *ca = NULL, *ta = NULL;
+        if (attributes)
+        {
+            na = &(*attributes)[MeshCollector::NormalAttr];
+            ca = &(*attributes)[MeshCollector::ColorAttr];
+            ta = &(*attributes)[MeshCollector::UvAttr];
+        }
+
+        size_t numVertices = inputV->size(); collected = true;
+        if (vertexMap || weldingTable) indexMap.resize(numVertices);
+        if (weldingTable) weldingTable->reserve(weldingTable->size() + numVertices);
+
+        osg::Matrix invMatrix = osg::Matrix::inverse(matrix); osg::Vec3 n; osg::Vec2 t;
+        for (size_t i = 0; i < numVertices; ++i)
         {
+            osg::Vec3 v = (*inputV)[i] * matrix;
+            if (inputN) n = osg::Matrix::transform3x3(invMatrix, (*inputN)[i]);
+            if (inputT) t = (*inputT)[i];
+
+            unsigned int index = vertices->size();
             if (vertexMap)
             {
-                i1 = indexMap[baseIndex + i1]; i2 = indexMap[baseIndex + i2];
-                i3 = indexMap[baseIndex + i3];
+                std::map<osg::Vec3, unsigned int, Vec3MapComparer>::iterator itr = vertexMap->find(v);
+                if (itr != vertexMap->end()) { indexMap[i] = itr->second; continue; }
+                (*vertexMap)[v] = index; indexMap[i] = index;
+            }
+            else if (weldingTable)
+            {
+                indexMap[i] = weldingTable->findOrInsert(
+                    v, inputN ? &n : NULL, inputT ? &t : NULL, index);
+                if (indexMap[i] != index) continue;
             }
 
-            if (i1 == i2 || i2 == i3 || i1 == i3) return;
-            indices->push_back(baseIndex + i1); indices->push_back(baseIndex + i2);
-            indices->push_back(baseIndex + i3);
+            vertices->push_back(v);
+            if (!attributes) continue;
+            if (inputN) na->push_back(osg::Vec4(n, 0.0));
+            if (inputC) ca->push_back((*inputC)[i]);
+            if (inputT) ta->push_back(osg::Vec4(t.x(), t.y(), 0.0f, 1.0));
         }
     }
 
     CollectVertexOperator()
-    :   inputV(NULL), inputN(NULL), inputT(NULL), inputC(NULL), vertexMap(NULL),
-        vertices(NULL), indices(NULL), attributes(NULL), baseIndex(0) {}
+    :   inputV(NULL), inputN(NULL), inputT(NULL), inputC(NULL), vertexMap(NULL), weldingTable(NULL),
+        vertices(NULL), indices(NULL), attributes(NULL), baseIndex(0), collected(false) {}
     osg::Vec3Array *inputV, *inputN;
     osg::Vec2Array *inputT; osg::Vec4Array *inputC;
     std::map<osg::Vec3, unsigned int, Vec3MapComparer>* vertexMap;
-    std::map<unsigned int, unsigned int> indexMap;
+    VertexWeldingTable* weldingTable;
+    std::vector<unsigned int> indexMap;  // local index -> collected index, only for welding
 
     std::vector<osg::Vec3>* vertices; std::vector<unsigned int>* indices;
     std::map<MeshCollector::VertexAttribute, std::vector<osg::Vec4>>* attributes;
-    osg::Matrix matrix; unsigned int baseIndex;
+    osg::Matrix matrix; unsigned int baseIndex; bool collected;
 };
 
+/// VertexWeldingTable ///
+
+static inline long long quantizeValue(float v, float epsilon)
+{
+    if (epsilon > 0.0f) return (long long)floor((double)v / epsilon + 0.5);
+    if (v == 0.0f) return 0;  // so that -0.0 equals to 0.0
+
+    int bits = 0; memcpy(&bits, &v, sizeof(float));
+    return bits;
+}
+
+static inline size_t hashWeldingKey(const long long* values)
+{
+    unsigned long long h = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        // splitmix64 finalizer to scatter nearby grid coordinates
+        unsigned long long x = h ^ (unsigned long long)values[i];
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+        h = x ^ (x >> 33);
+    }
+    return (size_t)h;
+}
+
+void VertexWeldingTable::makeKey(Key& key, const osg::Vec3& v, const osg::Vec3* n,
+                                 const osg::Vec2* uv) const
+{
+    memset(key.values, 0, sizeof(key.values));
+    for (int i = 0; i < 3; ++i) key.values[i] = quantizeValue(v[i], _epsilon);
+    if (n && _normalEpsilon >= 0.0f)
+    { for (int i = 0; i < 3; ++i) key.values[3 + i] = quantizeValue((*n)[i], _normalEpsilon); }
+    if (uv && _uvEpsilon >= 0.0f)
+    { for (int i = 0; i < 2; ++i) key.values[6 + i] = quantizeValue((*uv)[i], _uvEpsilon); }
+}
+
+void VertexWeldingTable::reserve(size_t numVertices)
+{
+    size_t capacity = 64;
+    while (capacity < numVertices * 2) capacity *= 2;
+    if (capacity > _slots.size()) rehash(capacity);
+    _keys.reserve(numVertices); _values.reserve(numVertices);
+}
+
+void VertexWeldingTable::rehash(size_t capacity)
+{
+    _slots.assign(capacity, ~0u);
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < _keys.size(); ++i)
+    {
+        size_t pos = hashWeldingKey(_keys[i].values) & mask;
+        while (_slots[pos] != ~0u) pos = (pos + 1) & mask;
+        _slots[pos] = (unsigned int)i;
+    }
+}
+
+unsigned int VertexWeldingTable::findOrInsert(const osg::Vec3& v, const osg::Vec3* n,
+                                              const osg::Vec2* uv, unsigned int index)
+{
+    // Keep load factor under 0.5 for short probing sequences
+    if ((_keys.size() + 1) * 2 > _slots.size())
+        rehash(osg::maximum(_slots.size() * 2, (size_t)64));
+
+    Key key; makeKey(key, v, n, uv);
+    size_t mask = _slots.size() - 1, pos = hashWeldingKey(key.values) & mask;
+    while (_slots[pos] != ~0u)
+    {
+        unsigned int id = _slots[pos];
+        if (_keys[id] == key) return _values[id];
+        pos = (pos + 1) & mask;
+    }
+
+    _slots[pos] = (unsigned int)_keys.size();
+    _keys.push_back(key); _values.push_back(index);
+    return index;
+}
+
 MeshCollector::MeshCollector()
-:   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _weldVertices(false), _globalVertices(false),
-    _loadedFineLevels(false), _onlyVertexAndIndices(false) {}
+:   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _weldVertices(false),
+    _weldingWithMap(false), _globalVertices(false), _loadedFineLevels(false),
+    _onlyVertexAndIndices(false) {}
 
 MeshCollector::NonManifoldType MeshCollector::isManifold() const
 {
@@ -171,7 +252,7 @@ MeshCollector::NonManifoldType MeshCollector::isManifold() const
 void MeshCollector::reset()
 {
     _matrixStack.clear(); _boundingBox.init();
-    _vertexMap.clear(); _attributes.clear();
+    _vertexMap.clear(); _weldingTable.clear(); _attributes.clear();
     _vertices.clear(); _indices.clear();
 }
 
@@ -305,11 +386,16 @@ void MeshCollector::apply(osg::Geometry& geom)
     functor.vertices = &_vertices; functor.attributes = &_attributes;
     functor.indices = &_indices; functor.matrix = matrix;
     functor.baseIndex = _vertices.size();
-    if (_weldVertices)
+    if (_weldVertices && _weldingWithMap)
     {
         if (!_globalVertices) _vertexMap.clear();
         functor.vertexMap = &_vertexMap;
     }
+    else if (_weldVertices)
+    {
+        if (!_globalVertices) _weldingTable.clear();
+        functor.weldingTable = &_weldingTable;
+    }
 
     geom.accept(functor);
     if (!_stateSetStack.empty())
@@ -421,13 +507,32 @@ MeshTopology* MeshTopologyVisitor::generate()
 /// TexturePacker ///
 
 void TexturePacker::clear()
-{ _input.clear(); _result.clear(); _dictIndex = 0; }
+{ _input.clear(); _result.clear(); _pageSizes.clear(); _dictIndex = 0; }
 
 size_t TexturePacker::addElement(osg::Image* image)
-{ _input[++_dictIndex] = InputPair(image, osg::Vec4()); return _dictIndex; }
+{
+    InputData& data = _input[++_dictIndex]; data.image = image;
+    if (image) { data.fileName = image->getFileName(); data.rect.set(0, 0, image->s(), image->t()); }
+    return _dictIndex;
+}
 
 size_t TexturePacker::addElement(int w, int h)
-{ _input[++_dictIndex] = InputPair(NULL, osg::Vec4(0, 0, w, h)); return _dictIndex; }
+{ _input[++_dictIndex].rect.set(0, 0, w, h); return _dictIndex; }
+
+size_t TexturePacker::addElement(const std::string& fileName, int w, int h)
+{
+    if (w <= 0 || h <= 0)
+    {
+        osg::ref_ptr<osg::Image> image = osgDB::readImageFile(fileName);
+        if (!image)
+        { OSG_NOTICE << "[TexturePacker] Failed to read " << fileName << std::endl; return 0; }
+        w = image->s(); h = image->t();
+    }
+
+    InputData& data = _input[++_dictIndex];
+    data.fileName = fileName; data.rect.set(0, 0, w, h);
+    return _dictIndex;
+}
 
 void TexturePacker::removeElement(size_t id)
 { if (_input.find(id) != _input.end()) _input.erase(_input.find(id)); }
@@ -440,74 +545,161 @@ osg::Image* TexturePacker::pack(size_t& numImages, bool generateResult, bool sto
     if (nodes) memset(nodes, 0, sizeof(stbrp_node) * maxSize);
 
     stbrp_rect* rects = (stbrp_rect*)malloc(sizeof(stbrp_rect) * _input.size());
-    for (std::map<size_t, InputPair>::iterator itr = _input.begin();
+    for (std::map<size_t, InputData>::iterator itr = _input.begin();
          itr != _input.end(); ++itr, ++ptr)
     {
         stbrp_rect& r = rects[ptr];
-        InputPair& pair = itr->second;
+        InputData& data = itr->second;
         r.id = itr->first; r.was_packed = 0;
-        r.x = 0; r.w = pair.first.valid() ? pair.first->s() : pair.second[2];
-        r.y = 0; r.h = pair.first.valid() ? pair.first->t() : pair.second[3];
+        r.x = 0; r.w = data.rect[2];
+        r.y = 0; r.h = data.rect[3];
     }
 
     stbrp_init_target(&context, _maxWidth, _maxHeight, nodes, maxSize);
     stbrp_pack_rects(&context, rects, _input.size());
-    free(nodes); _result.clear(); ptr = 0;
+    free(nodes); _result.clear(); _pageSizes.clear(); ptr = 0;
 
-    osg::observer_ptr<osg::Image> validChild;
-    for (std::map<size_t, InputPair>::iterator itr = _input.begin();
+    for (std::map<size_t, InputData>::iterator itr = _input.begin();
          itr != _input.end(); ++itr, ++ptr)
     {
-        InputPair& pair = itr->second;
+        InputData& data = itr->second;
         stbrp_rect& r = rects[ptr];
         osg::Vec4 v(r.x, r.y, r.w, r.h);
 
         if (r.id != itr->first || !r.was_packed)
         {
-            OSG_NOTICE << "[TexturePacker] Bad packing element: " << pair.first->getFileName()
+            OSG_NOTICE << "[TexturePacker] Bad packing element: " << data.fileName
                        << ", order = " << ptr << "/" << _input.size() << ", rect = " << v
                        << ", packed = " << r.was_packed << std::endl;
-            if (stopIfFailed) return NULL; else continue;
+            if (stopIfFailed) { free(rects); return NULL; } else continue;
         }
 
         if (totalW < (r.x + r.w)) totalW = r.x + r.w;
         if (totalH < (r.y + r.h)) totalH = r.y + r.h;
-        _result[itr->first] = InputPair(pair.first, v);
-        if (pair.first.valid()) validChild = pair.first;
+        InputData& result = _result[itr->first];
+        result = data; result.rect = v; result.page = 0;
     }
     free(rects); numImages = _result.size();
+    _pageSizes.push_back(std::pair<int, int>(totalW, totalH));
     if (!generateResult) return NULL;
+    return createPage(0);
+}
 
-    osg::ref_ptr<osg::Image> total = new osg::Image;
-    if (validChild.valid())
+size_t TexturePacker::packPages()
+{
+    std::vector<size_t> remaining, unpacked;
+    std::map<size_t, osg::Vec2> packingSizes;
+    _result.clear(); _pageSizes.clear();
+    for (std::map<size_t, InputData>::iterator itr = _input.begin(); itr != _input.end(); ++itr)
     {
-        total->allocateImage(totalW, totalH, 1,
-            validChild->getPixelFormat(), validChild->getDataType());
-        total->setInternalTextureFormat(validChild->getInternalTextureFormat());
+        const osg::Vec4& rect = itr->second.rect;
+        if (rect[2] <= 0 || rect[3] <= 0)
+        {
+            OSG_NOTICE << "[TexturePacker] Element " << itr->second.fileName
+                       << " is empty and can't be packed" << std::endl; continue;
+        }
+
+        // Elements larger than a page are downscaled (keeping aspect) to occupy a whole page
+        float scale = osg::minimum(1.0f, osg::minimum(_maxWidth / rect[2], _maxHeight / rect[3]));
+        packingSizes[itr->first].set(osg::maximum(1.0f, floorf(rect[2] * scale)),
+                                     osg::maximum(1.0f, floorf(rect[3] * scale)));
+        remaining.push_back(itr->first);
     }
-    else
-        total->allocateImage(totalW, totalH, 1, GL_RGBA, GL_UNSIGNED_BYTE);
 
-    for (std::map<size_t, InputPair>::iterator itr = _result.begin();
+    int maxSize = osg::maximum(_maxWidth, _maxHeight) * 2;
+    std::vector<stbrp_node> nodes(maxSize);
+    while (!remaining.empty())
+    {
+        // Pack as many elements as possible into current page, and leave others to next ones
+        std::vector<stbrp_rect> rects(remaining.size());
+        for (size_t i = 0; i < remaining.size(); ++i)
+        {
+            const osg::Vec2& size = packingSizes[remaining[i]];
+            stbrp_rect& r = rects[i]; r.id = remaining[i]; r.was_packed = 0;
+            r.x = 0; r.w = size[0]; r.y = 0; r.h = size[1];
+        }
+
+        stbrp_context context; int totalW = 0, totalH = 0;
+        stbrp_init_target(&context, _maxWidth, _maxHeight, &nodes[0], maxSize);
+        stbrp_pack_rects(&context, &rects[0], rects.size());
+
+        int page = (int)_pageSizes.size(); unpacked.clear();
+        for (size_t i = 0; i < rects.size(); ++i)
+        {
+            stbrp_rect& r = rects[i];
+            if (!r.was_packed) { unpacked.push_back(r.id); continue; }
+            if (totalW < (r.x + r.w)) totalW = r.x + r.w;
+            if (totalH < (r.y + r.h)) totalH = r.y + r.h;
+
+            InputData& result = _result[r.id];
+            result = _input[r.id]; result.rect.set(r.x, r.y, r.w, r.h); result.page = page;
+        }
+
+        if (unpacked.size() == remaining.size()) break;  // should not happen
+        _pageSizes.push_back(std::pair<int, int>(totalW, totalH));
+        remaining.swap(unpacked);
+    }
+    return _pageSizes.size();
+}
+
+bool TexturePacker::getPageSize(size_t page, int& w, int& h) const
+{
+    if (page >= _pageSizes.size()) return false;
+    w = _pageSizes[page].first; h = _pageSizes[page].second; return true;
+}
+
+osg::Image* TexturePacker::createPage(size_t page)
+{
+    int totalW = 0, totalH = 0;
+    if (!getPageSize(page, totalW, totalH) || totalW <= 0 || totalH <= 0) return NULL;
+
+    osg::ref_ptr<osg::Image> total;
+    for (std::map<size_t, InputData>::iterator itr = _result.begin();
          itr != _result.end(); ++itr)
     {
-        InputPair& pair = itr->second;
-        const osg::Vec4& r = itr->second.second;
-        if (!pair.first.valid()) continue;
+        InputData& data = itr->second;
+        const osg::Vec4& r = data.rect;
+        if (data.page != (int)page) continue;
+
+        osg::ref_ptr<osg::Image> image;
+        if (!data.image.lock(image) && !data.fileName.empty())
+            image = osgDB::readImageFile(data.fileName);
+        if (!image) continue;
+        if (image->s() != (int)r[2] || image->t() != (int)r[3])
+        {
+            // Downscaled in packPages(), and never change the source image itself
+            image = new osg::Image(*image, osg::CopyOp::DEEP_COPY_ALL);
+            image->scaleImage(r[2], r[3], 1);
+        }
+
+        if (!total)
+        {
+            total = new osg::Image;
+            total->allocateImage(totalW, totalH, 1, image->getPixelFormat(), image->getDataType());
+            total->setInternalTextureFormat(image->getInternalTextureFormat());
+            memset(total->data(), 0, total->getTotalSizeInBytes());
+        }
 
-        if (!osg::copyImage(pair.first.get(), 0, 0, 0, r[2], r[3], 1,
-                            total.get(), r[0], r[1], 0))
+        if (!osg::copyImage(image.get(), 0, 0, 0, r[2], r[3], 1, total.get(), r[0], r[1], 0))
         { OSG_WARN << "[TexturePacker] Failed to copy image " << itr->first << std::endl; }
     }
+
+    if (!total)
+    {
+        total = new osg::Image;
+        total->allocateImage(totalW, totalH, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
     return total.release();
 }
 
-bool TexturePacker::getPackingData(size_t id, int& x, int& y, int& w, int& h)
+bool TexturePacker::getPackingData(size_t id, int& x, int& y, int& w, int& h, int* page)
 {
     if (_result.find(id) != _result.end())
     {
-        const osg::Vec4& rect = _result[id].second;
+        const InputData& data = _result[id];
+        const osg::Vec4& rect = data.rect;
         x = rect[0]; y = rect[1]; w = rect[2]; h = rect[3];
+        if (page) *page = data.page;
         return true;
     }
     return false;
@@ -1027,6 +1219,96 @@ namespace osgVerse
     osg::Geometry* createBoundingSphereGeometry(const osg::BoundingSphere& bs)
     { return createEllipsoid(bs.center(), bs.radius(), bs.radius(), bs.radius()); }
 
+    osg::HeightField* createHeightFieldFromMeshes(osg::Node* node, int resX, int resY,
+                                                  const osg::BoundingBox& bound, bool maxHeight)
+    {
+        if (!node || resX < 2 || resY < 2) return NULL;
+        MeshCollector collector; collector.setUseGlobalVertices(true);
+        collector.setOnlyVertexAndIndices(true); node->accept(collector);
+
+        const std::vector<osg::Vec3>& vertices = collector.getVertices();
+        const std::vector<unsigned int>& indices = collector.getTriangles();
+        osg::BoundingBox bbox = bound;
+        if (!bbox.valid())
+        { for (size_t i = 0; i < vertices.size(); ++i) bbox.expandBy(vertices[i]); }
+        if (!bbox.valid()) return NULL;
+
+        double dx = (bbox.xMax() - bbox.xMin()) / (double)(resX - 1);
+        double dy = (bbox.yMax() - bbox.yMin()) / (double)(resY - 1);
+        double zRange = bbox.zMax() - bbox.zMin(), zEps = osg::maximum(zRange, 1.0) * 1e-6;
+        if (dx <= 0.0 || dy <= 0.0) return NULL;
+
+        // Bin triangles into blocks of rows, so that each block can be rasterized by one thread
+        const int blockRows = 16; int numBlocks = (resY + blockRows - 1) / blockRows;
+        std::vector<std::vector<size_t>> blocks(numBlocks);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            double y0 = (double)vertices[indices[i]].y() - bbox.yMin(),
+                   y1 = (double)vertices[indices[i + 1]].y() - bbox.yMin(),
+                   y2 = (double)vertices[indices[i + 2]].y() - bbox.yMin();
+            int r0 = (int)ceil(osg::minimum(y0, osg::minimum(y1, y2)) / dy);
+            int r1 = (int)floor(osg::maximum(y0, osg::maximum(y1, y2)) / dy);
+            r0 = osg::maximum(r0, 0); r1 = osg::minimum(r1, resY - 1);
+            for (int b = r0 / blockRows; r0 <= r1 && b <= r1 / blockRows; ++b) blocks[b].push_back(i);
+        }
+
+        std::vector<float> heights(resX * resY, maxHeight ? -FLT_MAX : FLT_MAX);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            int rowStart = b * blockRows, rowEnd = osg::minimum(rowStart + blockRows, resY) - 1;
+            const std::vector<size_t>& triangles = blocks[b];
+            for (size_t t = 0; t < triangles.size(); ++t)
+            {
+                // Work relative to the bound origin for better precision of large coordinates
+                size_t i = triangles[t];
+                osg::Vec3d v0 = osg::Vec3d(vertices[indices[i]]) - osg::Vec3d(bbox._min);
+                osg::Vec3d v1 = osg::Vec3d(vertices[indices[i + 1]]) - osg::Vec3d(bbox._min);
+                osg::Vec3d v2 = osg::Vec3d(vertices[indices[i + 2]]) - osg::Vec3d(bbox._min);
+                double area = (v1.x() - v0.x()) * (v2.y() - v0.y()) - (v1.y() - v0.y()) * (v2.x() - v0.x());
+                if (area == 0.0) continue;  // vertical triangle, no contribution to a heightfield
+
+                int c0 = (int)ceil(osg::minimum(v0.x(), osg::minimum(v1.x(), v2.x())) / dx);
+                int c1 = (int)floor(osg::maximum(v0.x(), osg::maximum(v1.x(), v2.x())) / dx);
+                int r0 = (int)ceil(osg::minimum(v0.y(), osg::minimum(v1.y(), v2.y())) / dy);
+                int r1 = (int)floor(osg::maximum(v0.y(), osg::maximum(v1.y(), v2.y())) / dy);
+                c0 = osg::maximum(c0, 0); c1 = osg::minimum(c1, resX - 1);
+                r0 = osg::maximum(r0, rowStart); r1 = osg::minimum(r1, rowEnd);
+
+                const double eps = -1e-9;  // inclusive edges, so shared edges leave no cracks
+                for (int r = r0; r <= r1; ++r)
+                {
+                    double y = r * dy;
+                    for (int c = c0; c <= c1; ++c)
+                    {
+                        double x = c * dx;
+                        double w0 = ((v1.x() - x) * (v2.y() - y) - (v1.y() - y) * (v2.x() - x)) / area;
+                        double w1 = ((v2.x() - x) * (v0.y() - y) - (v2.y() - y) * (v0.x() - x)) / area;
+                        double w2 = 1.0 - w0 - w1; if (w0 < eps || w1 < eps || w2 < eps) continue;
+
+                        // Discard heights out of the bound, which the RTT camera will clip too
+                        double zLocal = w0 * v0.z() + w1 * v1.z() + w2 * v2.z();
+                        if (zLocal < -zEps || zLocal > zRange + zEps) continue;
+
+                        float z = bbox.zMin() + (float)osg::clampBetween(zLocal, 0.0, zRange);
+                        float& h = heights[r * resX + c];
+                        h = maxHeight ? osg::maximum(h, z) : osg::minimum(h, z);
+                    }
+                }
+            }
+        }
+
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField;
+        hf->allocate(resX, resY); hf->setOrigin(bbox._min);
+        hf->setXInterval(dx); hf->setYInterval(dy);
+        for (int y = 0; y < resY; ++y) for (int x = 0; x < resX; ++x)
+        {
+            float h = heights[y * resX + x];
+            hf->setHeight(x, y, (h == FLT_MAX || h == -FLT_MAX) ? bbox.zMin() : h);
+        }
+        return hf.release();
+    }
+
     bool optimizeIndices(osg::Geometry& geom)
     {
         bool invalidMode = false;
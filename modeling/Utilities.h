@@ -5,6 +5,7 @@
 #include <osg/PagedLOD>
 #include <osg/Transform>
 #include <osg/Geometry>
+#include <osg/Shape>
 #include <osg/Camera>
 
 namespace osgVerse
@@ -34,11 +35,57 @@ namespace osgVerse
         }
     };
 
+    /** Open-addressing hash table for welding vertices. Positions (and optionally normals / UVs)
+        are quantized by epsilon, and vertices with the same quantized values are treated as one.
+        A zero epsilon means exact matching, and a negative one means not comparing at all */
+    class VertexWeldingTable
+    {
+    public:
+        VertexWeldingTable() : _epsilon(0.0f), _normalEpsilon(-1.0f), _uvEpsilon(-1.0f) {}
+        void setTolerance(float epsilon, float normalEpsilon = -1.0f, float uvEpsilon = -1.0f)
+        { _epsilon = epsilon; _normalEpsilon = normalEpsilon; _uvEpsilon = uvEpsilon; clear(); }
+
+        bool isComparingNormals() const { return _normalEpsilon >= 0.0f; }
+        bool isComparingUVs() const { return _uvEpsilon >= 0.0f; }
+        size_t size() const { return _values.size(); }
+
+        void clear() { _slots.clear(); _keys.clear(); _values.clear(); }
+        void reserve(size_t numVertices);
+
+        /** Return index of an existing equivalent vertex, or record the new one with given index
+            and return the index itself. Normal / UV can be NULL if not available */
+        unsigned int findOrInsert(const osg::Vec3& v, const osg::Vec3* n, const osg::Vec2* uv,
+                                  unsigned int index);
+
+    protected:
+        struct Key
+        {
+            long long values[8];
+            bool operator==(const Key& k) const
+            { for (int i = 0; i < 8; ++i) { if (values[i] != k.values[i]) return false; } return true; }
+        };
+        void makeKey(Key& key, const osg::Vec3& v, const osg::Vec3* n, const osg::Vec2* uv) const;
+        void rehash(size_t capacity);
+
+        std::vector<unsigned int> _slots;  // indices of _keys / _values, ~0 for empty slots
+        std::vector<Key> _keys;
+        std::vector<unsigned int> _values;
+        float _epsilon, _normalEpsilon, _uvEpsilon;
+    };
+
     class MeshCollector : public osg::NodeVisitor
     {
     public:
         MeshCollector();
         void setWeldingVertices(bool b) { _weldVertices = b; }
+
+        /** Weld vertices within a quantizing grid of epsilon (default 0, exact matching).
+            Normals / UVs are also compared if their epsilons >= 0 */
+        void setWeldingTolerance(float epsilon, float normalEpsilon = -1.0f, float uvEpsilon = -1.0f)
+        { _weldingTable.setTolerance(epsilon, normalEpsilon, uvEpsilon); }
+
+        /** Weld by the legacy std::map of exact positions instead of the hash table (slower) */
+        void setWeldingWithMap(bool b) { _weldingWithMap = b; }
         void setUseGlobalVertices(bool b) { _globalVertices = b; }
         void setLoadingFineLevels(bool b) { _loadedFineLevels = b; }
         void setOnlyVertexAndIndices(bool b) { _onlyVertexAndIndices = b; }
@@ -82,12 +129,13 @@ namespace osgVerse
         StateSetStack _stateSetStack;
 
         std::map<osg::Vec3, unsigned int, Vec3MapComparer> _vertexMap;
+        VertexWeldingTable _weldingTable;
         std::map<VertexAttribute, std::vector<osg::Vec4>> _attributes;
         std::map<osg::StateSet*, std::vector<size_t>> _vertexOfStateSetMap;
         std::vector<osg::Vec3> _vertices;
         std::vector<unsigned int> _indices;
         osg::BoundingBoxd _boundingBox;
-        bool _weldVertices, _globalVertices;
+        bool _weldVertices, _weldingWithMap, _globalVertices;
         bool _loadedFineLevels, _onlyVertexAndIndices;
     };
 
@@ -124,7 +172,8 @@ namespace osgVerse
         osg::ref_ptr<osg::StateSet> _stateset;
     };
 
-    /** The 2D texture atlaser */
+    /** The 2D texture atlaser. Elements can be packed into one atlas image with pack(), or into
+        multiple pages (each no larger than max size) with packPages() and createPage() */
     class TexturePacker : public osg::Referenced
     {
     public:
@@ -132,16 +181,40 @@ namespace osgVerse
         void setMaxSize(int w, int h) { _maxWidth = w; _maxHeight = h; }
         void clear();
 
+        /** Add an image. The packer only observes it: if it is released before creating the page,
+            it will be read again from its file name */
         size_t addElement(osg::Image* image);
         size_t addElement(int width, int height);
+
+        /** Add an image file which is read only when creating the page it belongs to.
+            If width / height is not provided, the file will be read once to get the size */
+        size_t addElement(const std::string& fileName, int width = 0, int height = 0);
         void removeElement(size_t id);
 
         osg::Image* pack(size_t& numImages, bool generateResult, bool stopIfFailed = false);
-        bool getPackingData(size_t id, int& x, int& y, int& w, int& h);
+
+        /** Pack all elements into as many pages as needed. Elements larger than max size
+            are downscaled to fit a page. Return number of pages */
+        size_t packPages();
+        size_t getNumPages() const { return _pageSizes.size(); }
+        bool getPageSize(size_t page, int& w, int& h) const;
+
+        /** Compose the page image. Source images are copied one at a time, and those read from
+            files are released at once, so that only the page itself is held in memory */
+        osg::Image* createPage(size_t page);
+
+        /** Get packed rect and page index of the element */
+        bool getPackingData(size_t id, int& x, int& y, int& w, int& h, int* page = NULL);
 
     protected:
-        typedef std::pair<osg::observer_ptr<osg::Image>, osg::Vec4> InputPair;
-        std::map<size_t, InputPair> _input, _result;
+        struct InputData
+        {
+            InputData() : page(-1) {}
+            osg::observer_ptr<osg::Image> image;
+            std::string fileName; osg::Vec4 rect; int page;
+        };
+        std::map<size_t, InputData> _input, _result;
+        std::vector<std::pair<int, int>> _pageSizes;
         int _maxWidth, _maxHeight, _dictIndex;
     };
 
@@ -186,6 +259,14 @@ namespace osgVerse
 
     /** Change primitives to triangles for GL-Core use */
     extern bool optimizeIndices(osg::Geometry& geom);
+
+    /** Create heightmap from given scene graph on CPU, without any viewer or graphics context.
+        Triangles are rasterized to resX * resY grid points of the bound (computed from the node if invalid),
+        keeping max (or min) height at each point; points not covered use zMin of the bound.
+        Rows are rasterized in parallel if OpenMP is available */
+    extern osg::HeightField* createHeightFieldFromMeshes(
+        osg::Node* node, int resX, int resY, const osg::BoundingBox& bound = osg::BoundingBox(),
+        bool maxHeight = true);
 }
 
 #endif
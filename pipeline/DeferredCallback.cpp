@@ -8,20 +8,154 @@
 #if OSG_VERSION_GREATER_THAN(3, 5, 1)
     #include <osg/ContextData>
 #endif
+#include <osg/Transform>
+#include <osg/Projection>
 #include <osgUtil/SceneView>
 #include <iostream>
 #include "DeferredCallback.h"
 #include "Utilities.h"
 
+/** Estimate near/far of the whole scene using cached bounding volumes (same as what
+    COMPUTE_NEAR_FAR_USING_BOUNDING_VOLUMES computes in a full cull). Node bounds are cached
+    and dirtied by OSG itself, so only subgraphs which may extend current range are visited */
+class NearFarEstimator : public osg::NodeVisitor
+{
+public:
+    NearFarEstimator(const osg::Matrix& view, const osg::Matrix& proj, float lodScale)
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN),
+        _lodScale(lodScale), _znear(FLT_MAX), _zfar(-FLT_MAX), numVisited(0)
+    {
+        osg::Polytope frustum; frustum.setToUnitFrustum(false, false);
+        frustum.transformProvidingInverse(proj); _eyeFrustum = frustum;
+        pushMatrix(view);
+    }
+
+    virtual osg::Vec3 getEyePoint() const { return _states.back().eyeLocal; }
+    virtual osg::Vec3 getViewPoint() const { return _states.back().eyeLocal; }
+
+    virtual float getDistanceToEyePoint(const osg::Vec3& pos, bool useLODScale) const
+    { return (pos - getEyePoint()).length() * (useLODScale ? _lodScale : 1.0f); }
+
+    virtual float getDistanceFromEyePoint(const osg::Vec3& pos, bool useLODScale) const
+    { return -distance(pos, _states.back().modelView) * (useLODScale ? _lodScale : 1.0f); }
+
+    virtual float getDistanceToViewPoint(const osg::Vec3& pos, bool useLODScale) const
+    { return getDistanceToEyePoint(pos, useLODScale); }
+
+    virtual void apply(osg::Node& node)
+    { if (checkBound(node)) traverse(node); }
+
+    virtual void apply(osg::Transform& node)
+    {
+        if (!checkBound(node)) return;
+        osg::Matrix matrix = _states.back().modelView;
+        node.computeLocalToWorldMatrix(matrix, this);
+        pushMatrix(matrix); traverse(node); _states.pop_back();
+    }
+
+    virtual void apply(osg::Camera& node) {}      // nested cameras compute their own near/far
+    virtual void apply(osg::Projection& node) {}  // HUD projections are not counted
+
+    virtual void apply(osg::Geode& node)
+    {
+        if (!checkBound(node)) return;
+        for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+        {
+            osg::Drawable* drawable = node.getDrawable(i);
+            if (drawable && (drawable->getNodeMask() & getTraversalMask())) applyDrawable(*drawable);
+        }
+    }
+
+#if OSG_VERSION_GREATER_THAN(3, 3, 1)
+    virtual void apply(osg::Drawable& drawable) { applyDrawable(drawable); }
+#endif
+
+    bool getNearFar(double& znear, double& zfar) const
+    {
+        if (_zfar < _znear) return false;
+        znear = _znear; zfar = _zfar; return true;
+    }
+    unsigned int numVisited;
+
+protected:
+    struct TransformState
+    {
+        osg::Matrix modelView; osg::Polytope frustum;
+        osg::Vec3 eyeLocal; double scale;
+    };
+
+    void pushMatrix(const osg::Matrix& mv)
+    {
+        TransformState state; state.modelView = mv;
+        state.frustum = _eyeFrustum; state.frustum.transformProvidingInverse(mv);
+        state.eyeLocal = osg::Vec3() * osg::Matrix::inverse(mv);
+        state.scale = osg::maximum(osg::maximum(
+            osg::Vec3d(mv(0, 0), mv(0, 1), mv(0, 2)).length(),
+            osg::Vec3d(mv(1, 0), mv(1, 1), mv(1, 2)).length()),
+            osg::Vec3d(mv(2, 0), mv(2, 1), mv(2, 2)).length());
+        _states.push_back(state);
+    }
+
+    bool checkBound(osg::Node& node)
+    {
+        const osg::BoundingSphere& bs = node.getBound(); numVisited++;
+        if (!bs.valid()) return false;
+
+        TransformState& state = _states.back();
+        if (node.isCullingActive() && !state.frustum.contains(bs)) return false;
+
+        // Skip subgraph which is entirely inside current near/far range or behind the eye
+        double d = distance(bs.center(), state.modelView), r = bs.radius() * state.scale;
+        if (d + r < 0.0) return false;
+        return !(_znear <= _zfar && d - r >= _znear && d + r <= _zfar);
+    }
+
+    void applyDrawable(osg::Drawable& drawable)
+    {
+#if OSG_VERSION_GREATER_THAN(3, 3, 1)
+        const osg::BoundingBox& bb = drawable.getBoundingBox();
+#else
+        const osg::BoundingBox& bb = drawable.getBound();
+#endif
+        TransformState& state = _states.back(); numVisited++;
+        if (!bb.valid()) return;
+        if (drawable.isCullingActive() && !state.frustum.contains(bb)) return;
+
+        double dNear = FLT_MAX, dFar = -FLT_MAX;
+        for (int i = 0; i < 8; ++i)
+        {
+            double d = distance(bb.corner(i), state.modelView);
+            dNear = osg::minimum(dNear, d); dFar = osg::maximum(dFar, d);
+        }
+        if (dFar < 0.0) return;  // whole object behind the eye point
+        if (dNear < _znear) _znear = dNear;
+        if (dFar > _zfar) _zfar = dFar;
+    }
+
+    inline static double distance(const osg::Vec3& coord, const osg::Matrix& matrix)
+    {
+        return -((double)coord[0] * matrix(0, 2) + (double)coord[1] * matrix(1, 2) +
+                 (double)coord[2] * matrix(2, 2) + matrix(3, 2));
+    }
+
+    std::vector<TransformState> _states;
+    osg::Polytope _eyeFrustum;
+    float _lodScale;
+    double _znear, _zfar;
+};
+
 namespace osgVerse
 {
     DeferredRenderCallback::DeferredRenderCallback(bool inPipeline)
-    :   _drawBuffer(GL_NONE), _readBuffer(GL_NONE), _cullFrameNumber(0),
-        _forwardMask(0xffffffff), _inPipeline(inPipeline),
-        _drawBufferApplyMask(false), _readBufferApplyMask(false)
+    :   _drawBuffer(GL_NONE), _readBuffer(GL_NONE), _nearFarCalculation(ESTIMATE_NEAR_FAR),
+        _cullFrameNumber(0), _forwardMask(0xffffffff), _numSavedTraversals(0),
+        _inPipeline(inPipeline), _drawBufferApplyMask(false), _readBufferApplyMask(false),
+        _cullOnce(false)
     {
+        _sharedCullResults = new SharedCullResults;
         _nearFarUniform = new osg::Uniform("NearFarPlanes", osg::Vec2());
         _calculatedNearFar.set(-1.0, -1.0);
+        _reportedNearFar.set(FLT_MAX, -FLT_MAX);
         _clearMask = GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
         _clearColor.set(0.0f, 0.0f, 0.0f, 0.0f);
         _clearAccum.set(0.0f, 0.0f, 0.0f, 0.0f);
@@ -71,26 +205,56 @@ namespace osgVerse
         if (frameNo <= _cullFrameNumber) return _calculatedNearFar;
         else _cullFrameNumber = frameNo;
 
-        // Update global near/far using entire scene, ignoring callback/cull-mask/pipeline-mask
-        osg::ref_ptr<osg::CullSettings::ClampProjectionMatrixCallback> clamper =
-            sv->getClampProjectionMatrixCallback();
-        unsigned int cullMask = sv->getCullMask();
-        if (sv->getCullVisitor()) sv->getCullVisitor()->setUserData(_nearFarUniform.get());
-        if (sv->getCullVisitorLeft()) sv->getCullVisitorLeft()->setUserData(_nearFarUniform.get());
-        if (sv->getCullVisitorRight()) sv->getCullVisitorRight()->setUserData(_nearFarUniform.get());
-
-        sv->setClampProjectionMatrixCallback(_userClamperCallback.get());
-        sv->setCullMask(0xffffffff);
-        sv->osgUtil::SceneView::cull();
-        sv->setCullMask(cullMask);
-        sv->setClampProjectionMatrixCallback(clamper.get());
-        if (sv->getCullVisitor()) sv->getCullVisitor()->setUserData(NULL);
-        if (sv->getCullVisitorLeft()) sv->getCullVisitorLeft()->setUserData(NULL);
-        if (sv->getCullVisitorRight()) sv->getCullVisitorRight()->setUserData(NULL);
+        osg::Vec2d reported;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_reportMutex);
+            reported = _reportedNearFar; _reportedNearFar.set(FLT_MAX, -FLT_MAX);
+        }
+
+        osg::Matrixd& proj = sv->getProjectionMatrix();
+        osgUtil::CullVisitor* cv = sv->getCullVisitor();
+        if (_nearFarCalculation == CULL_FOR_NEAR_FAR || !cv)
+        {
+            // Update global near/far using entire scene, ignoring callback/cull-mask/pipeline-mask
+            osg::ref_ptr<osg::CullSettings::ClampProjectionMatrixCallback> clamper =
+                sv->getClampProjectionMatrixCallback();
+            unsigned int cullMask = sv->getCullMask();
+            if (sv->getCullVisitor()) sv->getCullVisitor()->setUserData(_nearFarUniform.get());
+            if (sv->getCullVisitorLeft()) sv->getCullVisitorLeft()->setUserData(_nearFarUniform.get());
+            if (sv->getCullVisitorRight()) sv->getCullVisitorRight()->setUserData(_nearFarUniform.get());
+
+            sv->setClampProjectionMatrixCallback(_userClamperCallback.get());
+            sv->setCullMask(0xffffffff);
+            sv->osgUtil::SceneView::cull();
+            sv->setCullMask(cullMask);
+            sv->setClampProjectionMatrixCallback(clamper.get());
+            if (sv->getCullVisitor()) sv->getCullVisitor()->setUserData(NULL);
+            if (sv->getCullVisitorLeft()) sv->getCullVisitorLeft()->setUserData(NULL);
+            if (sv->getCullVisitorRight()) sv->getCullVisitorRight()->setUserData(NULL);
+        }
+        else
+        {
+            double znear = reported[0], zfar = reported[1];
+            if (_nearFarCalculation == ESTIMATE_NEAR_FAR || zfar < znear)
+            {
+                // Estimate with cached bounds; also used for the first frame of REUSE_LAST_NEAR_FAR
+                NearFarEstimator estimator(sv->getViewMatrix(), proj, sv->getLODScale());
+                estimator.setTraversalMask(0xffffffff);
+                osg::Camera* camera = sv->getCamera();
+                for (unsigned int i = 0; i < camera->getNumChildren(); ++i)
+                    camera->getChild(i)->accept(estimator);
+                if (!estimator.getNearFar(znear, zfar)) return _calculatedNearFar;
+            }
+
+            // Clamp projection matrix in the same way as SceneView::cull()
+            if (_userClamperCallback.valid())
+                _userClamperCallback->clampProjectionMatrixImplementation(proj, znear, zfar);
+            else
+                cv->clampProjectionMatrixImplementation(proj, znear, zfar);
+        }
 
         // Apply near/far variable for future stages and forward pass to use
         double znear = 0.0, zfar = 0.0, epsilon = 1e-6;
-        osg::Matrixd& proj = sv->getProjectionMatrix();
         if (fabs(proj(0, 3)) < epsilon  && fabs(proj(1, 3)) < epsilon  && fabs(proj(2, 3)) < epsilon)
         {
             double left = 0.0, right = 0.0, bottom = 0.0, top = 0.0;
@@ -107,6 +271,14 @@ namespace osgVerse
         return _calculatedNearFar;
     }
 
+    void DeferredRenderCallback::reportComputedNearFar(double znear, double zfar)
+    {
+        if (_nearFarCalculation != REUSE_LAST_NEAR_FAR || zfar < znear) return;
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_reportMutex);
+        if (znear < _reportedNearFar[0]) _reportedNearFar[0] = znear;
+        if (zfar > _reportedNearFar[1]) _reportedNearFar[1] = zfar;
+    }
+
     void DeferredRenderCallback::operator()(osg::RenderInfo& renderInfo) const
     {
         osg::State* state = renderInfo.getState();
@@ -2,7 +2,9 @@
 #define MANA_PP_DEFERRED_CALLBACK_HPP
 
 #include <osg/TextureCubeMap>
+#include <OpenThreads/Mutex>
 #include "Utilities.h"
+#include "OcclusionCuller.h"
 
 namespace osgVerse
 {
@@ -38,6 +40,56 @@ namespace osgVerse
         osg::Vec2d getCalculatedNearFar() const { return _calculatedNearFar; }
         osg::Uniform* getNearFarUniform() { return _nearFarUniform.get(); }
 
+        /** Methods to compute global near/far once per frame
+            - CULL_FOR_NEAR_FAR: run an extra full cull of the whole scene (slowest but exact)
+            - ESTIMATE_NEAR_FAR: traverse cached bounds and skip subgraphs that can't change near/far
+            - REUSE_LAST_NEAR_FAR: no extra traversal; use near/far reported by last frame's culling
+              of all stages, which may lag one frame behind a fast moving camera */
+        enum NearFarCalculation { CULL_FOR_NEAR_FAR, ESTIMATE_NEAR_FAR, REUSE_LAST_NEAR_FAR };
+        void setNearFarCalculation(NearFarCalculation c) { _nearFarCalculation = c; }
+        NearFarCalculation getNearFarCalculation() const { return _nearFarCalculation; }
+
+        /** Report computed near/far of a stage camera (called by its clamp-projection callback) */
+        void reportComputedNearFar(double znear, double zfar);
+
+        /** Cull results recorded by the first stage camera culled in a frame, for cull-once mode */
+        struct SharedCullResults : public osg::Referenced
+        {
+            struct Entry
+            {
+                osg::ref_ptr<osg::Node> node;  // special node to be traversed by every stage
+                osg::ref_ptr<osg::Drawable> drawable;
+                osg::ref_ptr<osg::RefMatrix> modelView;
+                unsigned int stateSetStart, stateSetEnd, maskStart, maskEnd; float depth;
+            };
+
+            SharedCullResults() : traversalMask(0), frameNumber(0), lodScale(1.0f), valid(false) {}
+            void clear() { entries.clear(); stateSets.clear(); masks.clear(); valid = false; }
+
+            std::vector<Entry> entries;
+            std::vector<const osg::StateSet*> stateSets;
+            std::vector<std::pair<unsigned int, unsigned int>> masks;
+            osg::Matrix viewMatrix, projectionMatrix; osg::Vec2 viewportSize;
+            unsigned int traversalMask, frameNumber; float lodScale; bool valid;
+            OpenThreads::Mutex mutex;
+        };
+
+        /** Cull-once mode: the first input stage traverses the scene and records classified render
+            leaves; other stages sharing the same view only filter these leaves by pipeline masks */
+        void setCullOnce(bool b) { _cullOnce = b; }
+        bool getCullOnce() const { return _cullOnce; }
+
+        SharedCullResults* getSharedCullResults() { return _sharedCullResults.get(); }
+        void addNumSavedTraversals(unsigned int n) { _numSavedTraversals += n; }
+
+        /** Number of scene traversals saved by cull-once mode */
+        unsigned int getNumSavedTraversals() const { return _numSavedTraversals; }
+        void resetNumSavedTraversals() { _numSavedTraversals = 0; }
+
+        /** Set CPU occlusion culler, which will work for all input stages of the pipeline */
+        void setOcclusionCuller(OcclusionCuller* oc) { _occlusionCuller = oc; }
+        OcclusionCuller* getOcclusionCuller() { return _occlusionCuller.get(); }
+
         void setClampCallback(osg::CullSettings::ClampProjectionMatrixCallback* cb)
         { _userClamperCallback = cb; }
 
@@ -95,12 +147,16 @@ namespace osgVerse
         osg::ref_ptr<osg::StateSet> _forwardStateSet;
         osg::ref_ptr<osg::CullSettings::ClampProjectionMatrixCallback> _userClamperCallback;
         osg::ref_ptr<osg::Uniform> _nearFarUniform;
+        osg::ref_ptr<OcclusionCuller> _occlusionCuller;
+        osg::ref_ptr<SharedCullResults> _sharedCullResults;
         GLenum _drawBuffer, _readBuffer, _clearMask;
         osg::Vec4 _clearColor, _clearAccum;
-        osg::Vec2d _calculatedNearFar;
+        osg::Vec2d _calculatedNearFar, _reportedNearFar;
+        OpenThreads::Mutex _reportMutex;
+        NearFarCalculation _nearFarCalculation;
         double _clearDepth, _clearStencil;
-        unsigned int _cullFrameNumber, _forwardMask;
-        bool _inPipeline, _drawBufferApplyMask, _readBufferApplyMask;
+        unsigned int _cullFrameNumber, _forwardMask, _numSavedTraversals;
+        bool _inPipeline, _drawBufferApplyMask, _readBufferApplyMask, _cullOnce;
     };
 }
 
@@ -1,12 +1,16 @@
 #include "IntersectionManager.h"
 #include <algorithm>
 #include <functional>
+#include <map>
 #include <iostream>
 #include <osg/io_utils>
 #include <osg/Version>
 #include <osg/Texture>
 #include <osg/TexMat>
 #include <osg/TriangleIndexFunctor>
+#include <osg/Observer>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 using namespace osgVerse;
 
 static osg::Texture* getTextureLookUp(const osgUtil::LineSegmentIntersector::Intersection& it, osg::Vec3& tc)
@@ -122,17 +126,267 @@ osg::Node* IntersectionResult::findNode(IntersectionResult::FindNodeFunc func)
     { if (func(*itr)) return *itr; } return NULL;
 }
 
+/** Bounding volume hierarchy of triangles of a geometry, immutable once built */
+class GeometryBVH : public osg::Referenced
+{
+public:
+    struct Hit
+    {
+        double ratio, r1, r2, r3;
+        unsigned int triangle;
+        osg::Vec3d normal;
+    };
+
+    /** Content signature: vertex array and primitive sets with their modified counts */
+    typedef std::vector<std::pair<const osg::Referenced*, unsigned int>> Signature;
+    static void computeSignature(osg::Geometry* geom, Signature& sig)
+    {
+        osg::Array* va = geom->getVertexArray(); sig.clear();
+        sig.push_back(Signature::value_type(va, va ? va->getModifiedCount() : 0));
+        sig.push_back(Signature::value_type(NULL, va ? va->getNumElements() : 0));
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        {
+            osg::PrimitiveSet* p = geom->getPrimitiveSet(i);
+            sig.push_back(Signature::value_type(p, p->getModifiedCount()));
+        }
+    }
+
+    static unsigned int estimateNumTriangles(osg::Geometry* geom)
+    {
+        unsigned int num = 0;
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        {
+            osg::PrimitiveSet* p = geom->getPrimitiveSet(i);
+            if (p->getMode() >= osg::PrimitiveSet::TRIANGLES &&
+                p->getMode() <= osg::PrimitiveSet::POLYGON) num += p->getNumIndices() / 3;
+        }
+        return num;
+    }
+
+    GeometryBVH() : _maxDepth(0) {}
+
+    bool build(osg::Geometry* geom)
+    {
+        osg::Vec3Array* va = dynamic_cast<osg::Vec3Array*>(geom->getVertexArray());
+        osg::Vec3dArray* vaD = dynamic_cast<osg::Vec3dArray*>(geom->getVertexArray());
+        if (va) _vertices.assign(va->begin(), va->end());
+        else if (vaD)
+        {
+            _vertices.resize(vaD->size());
+            for (size_t i = 0; i < vaD->size(); ++i) _vertices[i] = (*vaD)[i];
+        }
+        else return false;  // not a supported vertex array, leave it to osgUtil
+
+        osg::TriangleIndexFunctor<TriangleCollector> collector;
+        collector.indices = &_indices; geom->accept(collector);
+        unsigned int numTriangles = _indices.size() / 3, numVertices = _vertices.size();
+        for (size_t i = 0; i < _indices.size(); ++i)
+        { if (_indices[i] >= numVertices) return false; }
+        if (!numTriangles) return false;
+
+        _triangles.resize(numTriangles); _centers.resize(numTriangles);
+        for (unsigned int t = 0; t < numTriangles; ++t)
+        {
+            _triangles[t] = t;
+            _centers[t] = (_vertices[_indices[t * 3]] + _vertices[_indices[t * 3 + 1]]
+                        + _vertices[_indices[t * 3 + 2]]) / 3.0f;
+        }
+        _nodes.reserve(numTriangles / 2 + 1); _maxDepth = 0; buildNode(0, numTriangles, 1);
+        std::vector<osg::Vec3>().swap(_centers); return true;
+    }
+
+    /** Intersect with segment s-e (local space), returning hits with ratio <= maxRatio.
+        If nearestOnly is set, only the nearest hit is kept and farther nodes are skipped */
+    void intersect(const osg::Vec3d& s, const osg::Vec3d& e, double maxRatio,
+                   bool nearestOnly, std::vector<Hit>& hits) const
+    {
+        if (_nodes.empty()) return;
+        osg::Vec3d dir = e - s, invDir;
+        for (int i = 0; i < 3; ++i) invDir[i] = (dir[i] != 0.0) ? 1.0 / dir[i] : DBL_MAX;
+
+        // Each level leaves at most one sibling on the stack, so it never grows beyond depth + 1
+        std::vector<unsigned int> stack; stack.reserve(_maxDepth + 1); stack.push_back(0);
+        Hit nearest; nearest.ratio = -1.0;
+        while (!stack.empty())
+        {
+            unsigned int current = stack.back(); stack.pop_back();
+            const Node& node = _nodes[current];
+            if (!intersectBox(node.bound, s, invDir, maxRatio)) continue;
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.start; i < node.start + node.count; ++i)
+                {
+                    Hit hit; if (!intersectTriangle(_triangles[i], s, dir, maxRatio, hit)) continue;
+                    if (nearestOnly) { nearest = hit; maxRatio = hit.ratio; }
+                    else hits.push_back(hit);
+                }
+            }
+            else
+            { stack.push_back(node.right); stack.push_back(current + 1); }
+        }
+        if (nearestOnly && nearest.ratio >= 0.0) hits.push_back(nearest);
+    }
+
+    const unsigned int* getTriangle(unsigned int t) const { return &_indices[t * 3]; }
+    bool valid() const { return !_nodes.empty(); }
+    Signature signature;
+
+protected:
+    struct Node
+    {
+        osg::BoundingBox bound;
+        unsigned int start, count, right;  // leaf if count > 0, else children are (this + 1, right)
+    };
+
+    struct TriangleCollector
+    {
+        std::vector<unsigned int>* indices;
+        void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
+        { indices->push_back(i1); indices->push_back(i2); indices->push_back(i3); }
+    };
+
+    unsigned int buildNode(unsigned int start, unsigned int count, unsigned int depth)
+    {
+        unsigned int index = _nodes.size(); _nodes.push_back(Node());
+        _maxDepth = osg::maximum(_maxDepth, depth);
+        osg::BoundingBox bound, centerBound;
+        for (unsigned int i = start; i < start + count; ++i)
+        {
+            const unsigned int* tri = getTriangle(_triangles[i]);
+            for (int j = 0; j < 3; ++j) bound.expandBy(_vertices[tri[j]]);
+            centerBound.expandBy(_centers[_triangles[i]]);
+        }
+
+        osg::Vec3 extent = centerBound._max - centerBound._min;
+        int axis = (extent[0] > extent[1]) ? 0 : 1;
+        if (extent[2] > extent[axis]) axis = 2;
+        _nodes[index].bound = bound; _nodes[index].start = start;
+        if (count <= 4 || !(extent[axis] > 0.0f))
+        { _nodes[index].count = count; _nodes[index].right = 0; return index; }
+
+        // Median split on longest axis of triangle centers, good enough for picking
+        unsigned int mid = start + count / 2;
+        const std::vector<osg::Vec3>& centers = _centers;
+        std::nth_element(_triangles.begin() + start, _triangles.begin() + mid,
+                         _triangles.begin() + start + count,
+                         [&centers, axis](unsigned int a, unsigned int b)
+                         { return centers[a][axis] < centers[b][axis]; });
+        buildNode(start, mid - start, depth + 1);
+        unsigned int right = buildNode(mid, start + count - mid, depth + 1);
+        _nodes[index].count = 0; _nodes[index].right = right; return index;
+    }
+
+    static bool intersectBox(const osg::BoundingBox& bb, const osg::Vec3d& s,
+                             const osg::Vec3d& invDir, double maxRatio)
+    {
+        double t0 = 0.0, t1 = maxRatio;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (invDir[i] == DBL_MAX)
+            {   // parallel to the slab
+                if (s[i] < bb._min[i] || s[i] > bb._max[i]) return false; else continue;
+            }
+
+            double tNear = (bb._min[i] - s[i]) * invDir[i], tFar = (bb._max[i] - s[i]) * invDir[i];
+            if (tNear > tFar) std::swap(tNear, tFar);
+            t0 = osg::maximum(t0, tNear); t1 = osg::minimum(t1, tFar);
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+
+    bool intersectTriangle(unsigned int t, const osg::Vec3d& s, const osg::Vec3d& dir,
+                           double maxRatio, Hit& hit) const
+    {
+        const unsigned int* tri = getTriangle(t);
+        osg::Vec3d v0 = _vertices[tri[0]], v1 = _vertices[tri[1]], v2 = _vertices[tri[2]];
+        osg::Vec3d e1 = v1 - v0, e2 = v2 - v0, p = dir ^ e2;
+        double det = e1 * p; if (det == 0.0) return false;
+
+        double invDet = 1.0 / det; osg::Vec3d tv = s - v0;
+        double u = (tv * p) * invDet; if (u < 0.0 || u > 1.0) return false;
+        osg::Vec3d q = tv ^ e1;
+        double v = (dir * q) * invDet; if (v < 0.0 || u + v > 1.0) return false;
+        double r = (e2 * q) * invDet; if (r < 0.0 || r > maxRatio) return false;
+
+        hit.ratio = r; hit.triangle = t; hit.r1 = 1.0 - u - v; hit.r2 = u; hit.r3 = v;
+        hit.normal = e1 ^ e2; hit.normal.normalize(); return true;
+    }
+
+    std::vector<Node> _nodes;
+    std::vector<osg::Vec3> _vertices, _centers;
+    std::vector<unsigned int> _indices, _triangles;
+    unsigned int _maxDepth;
+};
+
+/** Global BVH cache keyed by geometry, entries are removed when geometries are deleted */
+class GeometryBVHRegistry : public osg::Observer
+{
+public:
+    static GeometryBVHRegistry* instance()
+    {
+        // Never deleted, as geometries may still notify it while static objects are destructing
+        static GeometryBVHRegistry* s_registry = new GeometryBVHRegistry;
+        return s_registry;
+    }
+
+    osg::ref_ptr<GeometryBVH> getOrCreate(osg::Geometry* geom, unsigned int minTriangles)
+    {
+        if (GeometryBVH::estimateNumTriangles(geom) < minTriangles) return NULL;
+        GeometryBVH::Signature sig; GeometryBVH::computeSignature(geom, sig);
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            BVHMap::iterator itr = _bvhMap.find(geom);
+            if (itr != _bvhMap.end() && itr->second.valid() && itr->second->signature == sig)
+                return itr->second->valid() ? itr->second : NULL;
+        }
+
+        // Build outside the lock so that other geometries can be picked at the same time
+        // An invalid BVH is also recorded so unsupported geometries are not checked again
+        osg::ref_ptr<GeometryBVH> bvh = new GeometryBVH; bvh->signature = sig;
+        bvh->build(geom);
+
+        bool newlyAdded = false;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            newlyAdded = (_bvhMap.find(geom) == _bvhMap.end());
+            _bvhMap[geom] = bvh;
+        }
+        if (newlyAdded) geom->addObserver(this);  // not in our lock to avoid deadlock
+        return bvh->valid() ? bvh : NULL;
+    }
+
+    virtual void objectDeleted(void* ptr)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _bvhMap.erase(static_cast<osg::Referenced*>(ptr));
+    }
+
+    void clear()
+    {
+        // Keep keys (and observers) of alive geometries, only release BVH data
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        for (BVHMap::iterator itr = _bvhMap.begin(); itr != _bvhMap.end(); ++itr)
+            itr->second = NULL;
+    }
+
+protected:
+    typedef std::map<const osg::Referenced*, osg::ref_ptr<GeometryBVH>> BVHMap;
+    BVHMap _bvhMap;
+    OpenThreads::Mutex _mutex;
+};
+
 class LineSegmentIntersectorEx : public osgUtil::LineSegmentIntersector
 {
 public:
     LineSegmentIntersectorEx(const osg::Vec3d& s, const osg::Vec3d& e)
-        : osgUtil::LineSegmentIntersector(s, e) {}
+        : osgUtil::LineSegmentIntersector(s, e), _bvhMinTriangles(1024) {}
 
     LineSegmentIntersectorEx(CoordinateFrame cf, const osg::Vec3d& s, const osg::Vec3d& e)
-        : osgUtil::LineSegmentIntersector(cf, s, e) {}
+        : osgUtil::LineSegmentIntersector(cf, s, e), _bvhMinTriangles(1024) {}
 
     LineSegmentIntersectorEx(CoordinateFrame cf, double x, double y)
-        : osgUtil::LineSegmentIntersector(cf, x, y) {}
+        : osgUtil::LineSegmentIntersector(cf, x, y), _bvhMinTriangles(1024) {}
 
     virtual Intersector* clone(osgUtil::IntersectionVisitor& iv)
     {
@@ -141,6 +395,7 @@ public:
             osg::ref_ptr<LineSegmentIntersectorEx> lsi = new LineSegmentIntersectorEx(_start, _end);
             lsi->_parent = this;
             lsi->_nodesToIgnore = _nodesToIgnore;
+            lsi->_bvhMinTriangles = _bvhMinTriangles;
             lsi->_intersectionLimit = this->_intersectionLimit;
             return lsi.release();
         }
@@ -176,6 +431,7 @@ public:
         osg::ref_ptr<LineSegmentIntersectorEx> lsi = new LineSegmentIntersectorEx(_start * inverse, _end * inverse);
         lsi->_parent = this;
         lsi->_nodesToIgnore = _nodesToIgnore;
+        lsi->_bvhMinTriangles = _bvhMinTriangles;
         lsi->_intersectionLimit = this->_intersectionLimit;
         return lsi.release();
     }
@@ -186,7 +442,38 @@ public:
         return osgUtil::LineSegmentIntersector::enter(node);
     }
 
+    virtual void intersect(osgUtil::IntersectionVisitor& iv, osg::Drawable* drawable)
+    {
+        osg::Geometry* geom = (_bvhMinTriangles > 0) ? drawable->asGeometry() : NULL;
+        osg::ref_ptr<GeometryBVH> bvh = geom ? GeometryBVHRegistry::instance()
+                                             ->getOrCreate(geom, _bvhMinTriangles) : NULL;
+        if (!bvh) { osgUtil::LineSegmentIntersector::intersect(iv, drawable); return; }
+        if (reachedLimit()) return;
+
+        // Only nearest hit of each drawable is necessary unless NO_LIMIT is set
+        double maxRatio = 1.0; std::vector<GeometryBVH::Hit> hits;
+        if (_intersectionLimit == LIMIT_NEAREST && containsIntersections())
+            maxRatio = getFirstIntersection().ratio;
+        bvh->intersect(_start, _end, maxRatio, _intersectionLimit != NO_LIMIT, hits);
+
+        for (size_t i = 0; i < hits.size(); ++i)
+        {
+            const GeometryBVH::Hit& h = hits[i];
+            const unsigned int* tri = bvh->getTriangle(h.triangle);
+            Intersection hit; hit.ratio = h.ratio;
+            hit.nodePath = iv.getNodePath(); hit.drawable = drawable;
+            hit.matrix = iv.getModelMatrix(); hit.primitiveIndex = h.triangle;
+            hit.localIntersectionPoint = _start * (1.0 - h.ratio) + _end * h.ratio;
+            hit.localIntersectionNormal = h.normal;
+            hit.indexList.push_back(tri[0]); hit.ratioList.push_back(h.r1);
+            hit.indexList.push_back(tri[1]); hit.ratioList.push_back(h.r2);
+            hit.indexList.push_back(tri[2]); hit.ratioList.push_back(h.r3);
+            insertIntersection(hit);
+        }
+    }
+
     std::set<osg::Node*> _nodesToIgnore;
+    unsigned int _bvhMinTriangles;
 };
 
 class PolytopeIntersectorEx : public osgUtil::PolytopeIntersector
@@ -267,6 +554,7 @@ static void applyLinesegmentIntersectionCondition(
 {
     // TODO: infinityMask
     intersector->_nodesToIgnore = condition->nodesToIgnore;
+    intersector->_bvhMinTriangles = condition->bvhMinTriangles;
     intersector->setCoordinateFrame(condition->coordinateFrame);
     intersector->setIntersectionLimit(condition->limit);
     iv.setReadCallback(condition->readCallback.get());
@@ -325,6 +613,30 @@ static void savePolytopeIntersectionResult(
     result.primitiveIndex = intersection.primitiveIndex;
 }
 
+class BVHPreparingVisitor : public osg::NodeVisitor
+{
+public:
+    BVHPreparingVisitor(unsigned int minTri)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _minTriangles(minTri) {}
+
+#if OSG_VERSION_GREATER_THAN(3, 3, 1)
+    virtual void apply(osg::Geometry& geom)
+    { GeometryBVHRegistry::instance()->getOrCreate(&geom, _minTriangles); }
+#else
+    virtual void apply(osg::Geode& node)
+    {
+        for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = node.getDrawable(i)->asGeometry();
+            if (geom) GeometryBVHRegistry::instance()->getOrCreate(geom, _minTriangles);
+        }
+    }
+#endif
+
+protected:
+    unsigned int _minTriangles;
+};
+
 namespace osgVerse
 {
     IntersectionResult findNearestIntersection(
@@ -392,6 +704,43 @@ namespace osgVerse
         return results;
     }
 
+    std::vector<IntersectionResult> findNearestIntersections(
+        osg::Node* node, const std::vector<std::pair<osg::Vec3d, osg::Vec3d>>& segments,
+        IntersectionCondition* condition)
+    {
+        // Intersectors in one group share the same scene traversal
+        osg::ref_ptr<osgUtil::IntersectorGroup> group = new osgUtil::IntersectorGroup;
+        std::vector<osg::ref_ptr<LineSegmentIntersectorEx>> intersectors(segments.size());
+        osgUtil::IntersectionVisitor iv(group.get());
+        for (size_t i = 0; i < segments.size(); ++i)
+        {
+            LineSegmentIntersectorEx* intersector = new LineSegmentIntersectorEx(
+                osgUtil::Intersector::MODEL, segments[i].first, segments[i].second);
+            if (condition) applyLinesegmentIntersectionCondition(iv, intersector, condition);
+            intersector->setIntersectionLimit(osgUtil::Intersector::LIMIT_NEAREST);
+            group->addIntersector(intersector); intersectors[i] = intersector;
+        }
+        if (!segments.empty()) node->accept(iv);
+
+        std::vector<IntersectionResult> results(segments.size());
+        for (size_t i = 0; i < intersectors.size(); ++i)
+        {
+            if (intersectors[i]->containsIntersections())
+                saveLinesegmentIntersectionResult(intersectors[i]->getFirstIntersection(), results[i]);
+        }
+        return results;
+    }
+
+    void prepareIntersectionBVH(osg::Node* node, unsigned int minTriangles)
+    {
+        if (!node) return;
+        BVHPreparingVisitor bpv(osg::maximum(minTriangles, 1u));
+        node->accept(bpv);
+    }
+
+    void clearIntersectionBVH()
+    { GeometryBVHRegistry::instance()->clear(); }
+
     IntersectionResult findNearestIntersection(
         osg::Node* node, double xmin, double ymin, double xmax, double ymax,
         IntersectionCondition* condition)
@@ -16,10 +16,11 @@ namespace osgVerse
         osgUtil::Intersector::IntersectionLimit limit;
         unsigned int infinityMask;   // Line only: Infinite start = 1, Infinite end = 2
         unsigned int traversalMask;
+        unsigned int bvhMinTriangles;  // Line only: geometries with more triangles use cached BVH, 0 = never
 
         IntersectionCondition()
             : coordinateFrame(osgUtil::Intersector::MODEL), limit(osgUtil::Intersector::NO_LIMIT),
-            infinityMask(0), traversalMask(0xffffffff) {}
+            infinityMask(0), traversalMask(0xffffffff), bvhMinTriangles(1024) {}
     };
 
     /** The intersection result structure */
@@ -58,6 +59,20 @@ namespace osgVerse
     extern std::vector<IntersectionResult> findAllIntersections(
         osg::Node* node, const osg::Vec3d&, const osg::Vec3d&, IntersectionCondition* condition = 0);
 
+    /** Find nearest intersection results of a batch of 3D linesegments in one traversal.
+        Results are in the same order of input segments; empty ones have no drawable set */
+    extern std::vector<IntersectionResult> findNearestIntersections(
+        osg::Node* node, const std::vector<std::pair<osg::Vec3d, osg::Vec3d>>& segments,
+        IntersectionCondition* condition = 0);
+
+    /** Build BVH of all geometries (with at least minTriangles) under the node for line intersections.
+        BVH is built lazily at the first pick and cached until vertex/primitive data is dirtied,
+        so this is optional: call it from a worker thread to have everything ready in background */
+    extern void prepareIntersectionBVH(osg::Node* node, unsigned int minTriangles = 1024);
+
+    /** Release all cached BVH data, e.g., after unloading a large scene */
+    extern void clearIntersectionBVH();
+
     /** Find nearest intersection result with projected coordinates to form a polytope */
     extern IntersectionResult findNearestIntersection(
         osg::Node* node, double xmin, double ymin, double xmax, double ymax,
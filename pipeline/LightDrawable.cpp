@@ -24,6 +24,7 @@ bool LightCullCallback::cull(osg::NodeVisitor* nv, osg::Drawable* drawable, osg:
         LightGlobalManager::LightData lData;
         lData.light = ld; lData.frameNo = cv->getFrameStamp()->getFrameNumber();
         lData.matrix = ld->getEyeSpace() ? osg::Matrix() : (*cv->getModelViewMatrix());
+        lData.projection = *cv->getProjectionMatrix(); lData.importance = 0.0f;
         LightGlobalManager::instance()->add(lData);
         return !ld->getDebugShow();
     }
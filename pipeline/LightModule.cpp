@@ -2,32 +2,61 @@
 #include <osgDB/ReadFile>
 #include <osgUtil/UpdateVisitor>
 #include <iostream>
+#include <algorithm>
 #include "LightModule.h"
 #include "ShadowModule.h"
 #include "Utilities.h"
 
-namespace osgVerse
+#define MAX_LIGHTS 1024
+#define CLUSTER_X 16
+#define CLUSTER_Y 8
+#define CLUSTER_Z 16
+#define INDEX_TABLE_W 256
+#define INDEX_TABLE_H 64
+
+static osg::Texture2D* createTableTexture(int w, int h, osg::ref_ptr<osg::Image>& image)
 {
-    LightModule::LightModule(const std::string& name, Pipeline* pipeline, int maxLightsInPass)
-        : _pipeline(pipeline), _maxLightsInPass(maxLightsInPass)
-    {
-        _parameterImage = new osg::Image;
-        _parameterImage->allocateImage(1024, 4, 1, GL_RGB, GL_FLOAT);
+    image = new osg::Image;
+    image->allocateImage(w, h, 1, GL_RGBA, GL_FLOAT);
+    memset(image->data(), 0, image->getTotalSizeInBytes());
 #if defined(VERSE_WEBGL1)
-        _parameterImage->setInternalTextureFormat(GL_RGB);
+    image->setInternalTextureFormat(GL_RGBA);
 #else
-        _parameterImage->setInternalTextureFormat(GL_RGB32F_ARB);
+    image->setInternalTextureFormat(GL_RGBA32F_ARB);
 #endif
 
-        _parameterTex = new osg::Texture2D;
-        _parameterTex->setImage(_parameterImage.get());
-        _parameterTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
-        _parameterTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
-        _parameterTex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
-        _parameterTex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER);
-        _parameterTex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f));
+    osg::ref_ptr<osg::Texture2D> tex = new osg::Texture2D;
+    tex->setTextureSize(w, h);
+    tex->setInternalFormat(image->getInternalTextureFormat());
+    tex->setSourceFormat(image->getPixelFormat());
+    tex->setSourceType(image->getDataType());
+    tex->setSubloadCallback(new osgVerse::DirtyRegionSubloadCallback(image.get(), 4));
+    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
+    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER);
+    tex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f));
+    return tex.release();
+}
+
+static inline osgVerse::DirtyRegionSubloadCallback* getUploader(osg::Texture2D* tex)
+{ return static_cast<osgVerse::DirtyRegionSubloadCallback*>(tex->getSubloadCallback()); }
+
+static inline int toCluster(double v, int numClusters)
+{ return osg::clampBetween((int)floor(v * numClusters), 0, numClusters - 1); }
+
+namespace osgVerse
+{
+    LightModule::LightModule(const std::string& name, Pipeline* pipeline, int maxLightsInPass)
+        : _pipeline(pipeline), _maxLightsInPass(maxLightsInPass), _clusteringEnabled(true)
+    {
+        _parameterTex = createTableTexture(4, MAX_LIGHTS, _parameterImage);
+        _clusterTex = createTableTexture(CLUSTER_X * CLUSTER_Y, CLUSTER_Z, _clusterImage);
+        _indexTex = createTableTexture(INDEX_TABLE_W, INDEX_TABLE_H, _indexImage);
+        _clusterCounts.resize(CLUSTER_X * CLUSTER_Y * CLUSTER_Z);
 
         _lightNumber = new osg::Uniform("LightNumber", osg::Vec2(0.0f, (float)maxLightsInPass));
+        _clusterParameters = new osg::Uniform("LightClusterParams", osg::Vec4());
         if (pipeline) pipeline->addModule(name, this);
     }
 
@@ -65,39 +94,164 @@ namespace osgVerse
 
         // Get and sort lights by its importance (e.g., last frame number, distance to eye)
         std::vector<LightGlobalManager::LightData> resultLights;
-        size_t numData = LightGlobalManager::instance()->getSortedResult(resultLights);
-        if (numData > 1024) numData = 1024;
+        size_t numData = LightGlobalManager::instance()->getSortedResult(resultLights, MAX_LIGHTS);
+
+        // Unlimited lights affect every pixel and are not clustered, so place them first
+        std::stable_partition(resultLights.begin(), resultLights.begin() + numData,
+                              [](const LightGlobalManager::LightData& ld) {
+            bool unlimited = false; if (ld.light) ld.light->getType(unlimited); return unlimited;
+        });
 
         // Save all lights to a parameter texture to use in deferred shader
-        osg::Vec3f* paramPtr = (osg::Vec3f*)_parameterImage->data();
+        DirtyRegionSubloadCallback* uploader = getUploader(_parameterTex.get());
+        osg::Vec4f* paramPtr = (osg::Vec4f*)_parameterImage->data();
+        std::vector<osg::Vec4> bounds(numData); int numGlobals = 0;
         for (size_t i = 0; i < numData; ++i)
         {
             LightGlobalManager::LightData& ld = resultLights[i];
             if (!ld.light) continue; bool unlimited = false;
             LightDrawable::Type t = ld.light->getType(unlimited);
             const osg::Vec3& color = ld.light->getColor();
+            float range = ld.light->getRange(), spotCutoff = ld.light->getSpotCutoff();
             osg::Vec3 pos0 = ld.light->getPosition() * ld.matrix;
             osg::Vec3 pos1 = (ld.light->getPosition() +
                               ld.light->getDirection() * dirLength) * ld.matrix;
             osg::Vec3 dir = pos1 - pos0; dir.normalize();
 
-            *(paramPtr + 1024 * 0 + i)/*light color*/ = osg::Vec3(color[0], color[1], color[2]);
-            *(paramPtr + 1024 * 1 + i)/*eye-space position, att*/ = osg::Vec3(pos0[0], pos0[1], pos0[2]);
-            *(paramPtr + 1024 * 2 + i)/*eye-space rotation, spot*/ = osg::Vec3(dir[0], dir[1], dir[2]);
-            *(paramPtr + 1024 * 3 + i)/*type, range, spot-cutoff*/ =
-                osg::Vec3((float)t, ld.light->getRange(), ld.light->getSpotCutoff());
+            osg::Vec4f row[4];
+            row[0]/*light color, type*/ = osg::Vec4(color, (float)t);
+            row[1]/*eye-space position, range*/ = osg::Vec4(pos0, range);
+            row[2]/*eye-space direction, spot-cutoff*/ = osg::Vec4(dir, spotCutoff);
+            row[3]/*type, range, spot-cutoff*/ = osg::Vec4((float)t, range, spotCutoff, 0.0f);
+            if (memcmp(paramPtr + i * 4, row, sizeof(row)) != 0)
+            { memcpy(paramPtr + i * 4, row, sizeof(row)); uploader->dirtyRows((int)i, (int)i + 1); }
+
+            // Compute eye-space bounding sphere of point/spot light for clustering
+            if (unlimited) { numGlobals = (int)i + 1; continue; }
+            if (t == LightDrawable::SpotLight && spotCutoff < osg::PI_2)
+            {
+                if (spotCutoff > osg::PI_4)
+                    bounds[i] = osg::Vec4(pos0 + dir * (range * cosf(spotCutoff)),
+                                          range * sinf(spotCutoff));
+                else
+                {
+                    float radius = range * 0.5f / cosf(spotCutoff);
+                    bounds[i] = osg::Vec4(pos0 + dir * radius, radius);
+                }
+            }
+            else
+                bounds[i] = osg::Vec4(pos0, range);
         }
+        uploader->commit();
         _lightNumber->set(osg::Vec2((float)numData, (float)_maxLightsInPass));
-        _parameterImage->dirty();
+
+        if (_clusteringEnabled && numData > 0)
+            updateClusters(bounds, resultLights[0].projection, numGlobals);
+        else
+            _clusterParameters->set(osg::Vec4(0.0f, 0.0f, (float)numGlobals, 0.0f));
         traverse(node, nv);
     }
 
+    void LightModule::updateClusters(const std::vector<osg::Vec4>& bounds, const osg::Matrix& proj,
+                                     int numGlobals)
+    {
+        // Use global near/far of the pipeline, or the projection matrix itself
+        double zNear = 0.0, zFar = 0.0, dummy = 0.0;
+        osg::Vec2d nearFar = (_pipeline.valid() && _pipeline->getDeferredCallback())
+                           ? _pipeline->getDeferredCallback()->getCalculatedNearFar() : osg::Vec2d();
+        if (nearFar[0] > 0.0 && nearFar[1] > nearFar[0]) { zNear = nearFar[0]; zFar = nearFar[1]; }
+        else if (!proj.getFrustum(dummy, dummy, dummy, dummy, zNear, zFar))
+            proj.getOrtho(dummy, dummy, dummy, dummy, zNear, zFar);
+        zNear = osg::maximum(zNear, 1e-4); zFar = osg::maximum(zFar, zNear * 1.01);
+
+        // Find cluster ranges [x0, x1] x [y0, y1] x [z0, z1] of each light
+        const double logScale = (double)CLUSTER_Z / log(zFar / zNear);
+        std::vector<int> ranges(bounds.size() * 6, -1);
+        std::fill(_clusterCounts.begin(), _clusterCounts.end(), 0);
+        for (size_t i = numGlobals; i < bounds.size(); ++i)
+        {
+            const osg::Vec4& b = bounds[i];
+            double depth = -b.z(), r = b.w();
+            double dMin = osg::maximum(depth - r, zNear), dMax = osg::minimum(depth + r, zFar);
+            if (r <= 0.0 || dMax < dMin) continue;
+
+            // Project the (near-clamped) bounding box of the sphere to screen
+            osg::Vec2d ndcMin(1.0, 1.0), ndcMax(-1.0, -1.0); bool fullScreen = false;
+            for (int c = 0; c < 8 && !fullScreen; ++c)
+            {
+                osg::Vec4d v(b.x() + ((c & 1) ? r : -r), b.y() + ((c & 2) ? r : -r),
+                             (c & 4) ? -dMax : -dMin, 1.0); v = v * proj;
+                if (v.w() < 1e-6) { fullScreen = true; break; }
+                osg::Vec2d ndc(v.x() / v.w(), v.y() / v.w());
+                ndcMin.set(osg::minimum(ndcMin.x(), ndc.x()), osg::minimum(ndcMin.y(), ndc.y()));
+                ndcMax.set(osg::maximum(ndcMax.x(), ndc.x()), osg::maximum(ndcMax.y(), ndc.y()));
+            }
+            if (fullScreen) { ndcMin.set(-1.0, -1.0); ndcMax.set(1.0, 1.0); }
+            else if (ndcMax.x() < -1.0 || ndcMax.y() < -1.0 || ndcMin.x() > 1.0 || ndcMin.y() > 1.0)
+                continue;
+
+            int* range = &ranges[i * 6];
+            range[0] = toCluster(ndcMin.x() * 0.5 + 0.5, CLUSTER_X);
+            range[1] = toCluster(ndcMax.x() * 0.5 + 0.5, CLUSTER_X);
+            range[2] = toCluster(ndcMin.y() * 0.5 + 0.5, CLUSTER_Y);
+            range[3] = toCluster(ndcMax.y() * 0.5 + 0.5, CLUSTER_Y);
+            range[4] = toCluster(log(dMin / zNear) * logScale / CLUSTER_Z, CLUSTER_Z);
+            range[5] = toCluster(log(dMax / zNear) * logScale / CLUSTER_Z, CLUSTER_Z);
+            for (int z = range[4]; z <= range[5]; ++z)
+                for (int y = range[2]; y <= range[3]; ++y)
+                    for (int x = range[0]; x <= range[1]; ++x)
+                        _clusterCounts[(z * CLUSTER_Y + y) * CLUSTER_X + x]++;
+        }
+
+        // Compute offsets of each cluster; lights are sorted so less important ones are dropped
+        // if index table is full
+        const unsigned int maxIndices = INDEX_TABLE_W * INDEX_TABLE_H * 4;
+        osg::Vec4f* clusterPtr = (osg::Vec4f*)_clusterImage->data();
+        unsigned int offset = 0, numClusters = _clusterCounts.size();
+        for (unsigned int c = 0; c < numClusters; ++c)
+        {
+            unsigned int count = osg::minimum(_clusterCounts[c], maxIndices - offset);
+            clusterPtr[c] = osg::Vec4((float)offset, (float)count, 0.0f, 0.0f);
+            _clusterCounts[c] = 0; offset += count;
+        }
+
+        // Fill light indices
+        float* indexPtr = (float*)_indexImage->data();
+        for (size_t i = numGlobals; i < bounds.size(); ++i)
+        {
+            const int* range = &ranges[i * 6]; if (range[0] < 0) continue;
+            for (int z = range[4]; z <= range[5]; ++z)
+                for (int y = range[2]; y <= range[3]; ++y)
+                    for (int x = range[0]; x <= range[1]; ++x)
+                    {
+                        unsigned int c = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+                        unsigned int& cursor = _clusterCounts[c];
+                        const osg::Vec4f& cd = clusterPtr[c];  // (offset, count)
+                        if (cursor < (unsigned int)cd[1])
+                            indexPtr[(unsigned int)cd[0] + (cursor++)] = (float)i;
+                    }
+        }
+
+        int numIndexRows = (offset + INDEX_TABLE_W * 4 - 1) / (INDEX_TABLE_W * 4);
+        getUploader(_clusterTex.get())->dirtyRows(0, CLUSTER_Z);
+        getUploader(_clusterTex.get())->commit();
+        if (numIndexRows > 0)
+        {
+            getUploader(_indexTex.get())->dirtyRows(0, numIndexRows);
+            getUploader(_indexTex.get())->commit();
+        }
+        _clusterParameters->set(osg::Vec4(zNear, zFar, (float)numGlobals, 1.0f));
+    }
+
     int LightModule::applyTextureAndUniforms(Pipeline::Stage* stage,
                                              const std::string& prefix, int startU)
     {
         stage->applyTexture(_parameterTex.get(), prefix, startU);
+        stage->applyTexture(_clusterTex.get(), "LightClusterMap", startU + 1);
+        stage->applyTexture(_indexTex.get(), "LightIndexMap", startU + 2);
         stage->applyUniform(getLightNumber());
-        return startU + 1;
+        stage->applyUniform(getClusterParameters());
+        return startU + 3;
     }
 
     LightGlobalManager* LightGlobalManager::instance()
@@ -109,17 +263,39 @@ namespace osgVerse
     LightGlobalManager::LightGlobalManager()
     { _callback = new LightCullCallback; _dirty = false; }
 
-    size_t LightGlobalManager::getSortedResult(std::vector<LightData>& result)
+    size_t LightGlobalManager::getSortedResult(std::vector<LightData>& result, size_t maxNumber)
     {
+        result.reserve(result.size() + _lights.size());
         for (std::map<LightDrawable*, LightData>::iterator itr = _lights.begin();
              itr != _lights.end(); ++itr)
-        { result.push_back(itr->second); }
+        {
+            LightData ld = itr->second; bool unlimited = false;
+            if (!ld.light) continue; ld.light->getType(unlimited);
+            if (unlimited) ld.importance = FLT_MAX;
+            else
+            {
+                // Brightness attenuated by distance from eye (origin) to the light volume
+                const osg::Vec3& color = ld.light->getColor();
+                float range = osg::maximum(ld.light->getRange(), 1e-4f);
+                float distance = osg::maximum(
+                    (ld.light->getPosition() * ld.matrix).length() - range, 0.0f) / range;
+                ld.importance = osg::maximum(color[0], osg::maximum(color[1], color[2]))
+                              / (1.0f + distance * distance);
+            }
+            result.push_back(ld);
+        }
 
-        std::sort(result.begin(), result.end(),
-                  [](const LightData& l, const LightData& r) {
-            // TODO: more sort comparers, like distance-to-eye?
-            return l.frameNo > r.frameNo;
-        });
+        auto comparer = [](const LightData& l, const LightData& r) {
+            if (l.frameNo != r.frameNo) return l.frameNo > r.frameNo;
+            return l.importance > r.importance;
+        };
+        if (maxNumber > 0 && maxNumber < result.size())
+        {
+            std::partial_sort(result.begin(), result.begin() + maxNumber, result.end(), comparer);
+            result.resize(maxNumber);
+        }
+        else
+            std::sort(result.begin(), result.end(), comparer);
         return result.size();
     }
 
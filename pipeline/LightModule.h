@@ -27,28 +27,51 @@ namespace osgVerse
         LightDrawable* getMainLight() { return _mainLight.get(); }
         const std::string& getShadowModuleName() const { return _shadowModuleName; }
 
-        /** Get light parameter table data:
-            - row0: light color & power (vec3), type (float)
-            - row1: eye-space position (vec3), attenuationMax
-            - row2: eye-space rotation (vec3), attenuationMin
-            - row3: spotExponent, spotCutoff
+        /** Get light parameter table data (4 x 1024, each row for one light):
+            - column0: light color & power (vec3), type (float)
+            - column1: eye-space position (vec3), range
+            - column2: eye-space direction (vec3), spotCutoff
+            - column3: type, range, spotCutoff
+            Only changed rows are uploaded. Unlimited lights (e.g., directional) are placed first
         */
         osg::Texture2D* getParameterTable() { return _parameterTex.get(); }
         const osg::Texture2D* getParameterTable() const { return _parameterTex.get(); }
 
+        /** Get light cluster table (128 x 16): (offset, count) of light indices of each cluster.
+            Clusters are 16 x 8 screen tiles multiplied by 16 exponential slices in near/far range */
+        osg::Texture2D* getClusterTable() { return _clusterTex.get(); }
+        const osg::Texture2D* getClusterTable() const { return _clusterTex.get(); }
+
+        /** Get light index table (256 x 64), each texel containing 4 light indices */
+        osg::Texture2D* getIndexTable() { return _indexTex.get(); }
+        const osg::Texture2D* getIndexTable() const { return _indexTex.get(); }
+
         osg::Uniform* getLightNumber() { return _lightNumber.get(); }
         const osg::Uniform* getLightNumber() const { return _lightNumber.get(); }
 
+        /** Cluster parameters: (zNear, zFar, number of unlimited lights, clustering enabled) */
+        osg::Uniform* getClusterParameters() { return _clusterParameters.get(); }
+        const osg::Uniform* getClusterParameters() const { return _clusterParameters.get(); }
+
+        /** Enable CPU light clustering; otherwise shaders will loop over all lights per pixel */
+        void setClusteringEnabled(bool b) { _clusteringEnabled = b; }
+        bool getClusteringEnabled() const { return _clusteringEnabled; }
+
     protected:
         virtual ~LightModule();
+        void updateClusters(const std::vector<osg::Vec4>& bounds, const osg::Matrix& proj,
+                            int numGlobals);
 
         osg::observer_ptr<Pipeline> _pipeline;
         osg::ref_ptr<LightDrawable> _mainLight;
-        osg::ref_ptr<osg::Texture2D> _parameterTex;
-        osg::ref_ptr<osg::Image> _parameterImage;
+        osg::ref_ptr<osg::Texture2D> _parameterTex, _clusterTex, _indexTex;
+        osg::ref_ptr<osg::Image> _parameterImage, _clusterImage, _indexImage;
         osg::ref_ptr<osg::Uniform> _lightNumber;  // vec2
+        osg::ref_ptr<osg::Uniform> _clusterParameters;  // vec4
+        std::vector<unsigned int> _clusterCounts;
         std::string _shadowModuleName;
         int _maxLightsInPass;
+        bool _clusteringEnabled;
     };
 
     class LightGlobalManager : public osg::Referenced
@@ -61,10 +84,14 @@ namespace osgVerse
         struct LightData
         {
             LightDrawable* light;
-            osg::Matrix matrix;
+            osg::Matrix matrix, projection;
             unsigned int frameNo;
+            float importance;
         };
-        size_t getSortedResult(std::vector<LightData>& result);
+
+        /** Get lights sorted by last culled frame, and then by importance (brightness attenuated
+            by distance from eye to the light volume). Only the first maxNumber lights are kept if set */
+        size_t getSortedResult(std::vector<LightData>& result, size_t maxNumber = 0);
 
         void add(const LightData& ld) { _lights[ld.light] = ld; _dirty = true; }
         void remove(LightDrawable* light);
@@ -0,0 +1,250 @@
+#include <osg/io_utils>
+#include <osg/Texture>
+#include <osg/Geometry>
+#include <modeling/Utilities.h>
+#include "OcclusionCuller.h"
+
+#ifdef VERSE_ENABLE_RASTERIZER
+#   include <rasterizer/Rasterizer.h>
+#   include <rasterizer/Occluder.h>
+#   include <rasterizer/QuadDecomposition.h>
+#   include <rasterizer/SurfaceAreaHeuristic.h>
+#   include <rasterizer/VectorMath.h>
+#   include <algorithm>
+#endif
+using namespace osgVerse;
+
+class OccluderCollector : public MeshCollector
+{
+public:
+    OccluderCollector(std::set<const osg::Drawable*>& d) : _drawables(d)
+    { setWeldingVertices(true); setUseGlobalVertices(true); setOnlyVertexAndIndices(true); }
+
+    virtual void apply(osg::Geometry& geom)
+    { _drawables.insert(&geom); MeshCollector::apply(geom); }
+
+protected:
+    std::set<const osg::Drawable*>& _drawables;
+};
+
+#ifdef VERSE_ENABLE_RASTERIZER
+struct OcclusionCuller::RasterizerData
+{
+    RasterizerData(int w, int h) : rasterizer(w, h) {}
+    ~RasterizerData() { clear(); }
+
+    void clear()
+    {
+        for (size_t i = 0; i < occluders.size(); ++i)
+        { _aligned_free(occluders[i]->m_vertexData); delete occluders[i]; }
+        occluders.clear();
+    }
+
+    Rasterizer rasterizer;
+    std::vector<Occluder*> occluders;
+    std::vector<std::pair<float, Occluder*>> sortedOccluders;
+};
+#else
+struct OcclusionCuller::RasterizerData {};
+#endif
+
+OcclusionCuller::OcclusionCuller(int w, int h)
+:   _data(NULL), _frameNumber(0), _numTested(0), _numCulled(0), _enabled(true), _rasterized(false)
+{
+    _width = osg::maximum(8, (w + 7) & ~7); _height = osg::maximum(8, (h + 7) & ~7);
+#ifdef VERSE_ENABLE_RASTERIZER
+    _data = new RasterizerData(_width, _height);
+#endif
+}
+
+OcclusionCuller::~OcclusionCuller()
+{ delete _data; }
+
+bool OcclusionCuller::isSupported()
+{
+#ifdef VERSE_ENABLE_RASTERIZER
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned int OcclusionCuller::getNumOccluders() const
+{
+#ifdef VERSE_ENABLE_RASTERIZER
+    return _data->occluders.size();
+#else
+    return 0;
+#endif
+}
+
+bool OcclusionCuller::addOccluder(osg::Node* node, const osg::Matrix& localToWorld)
+{
+    if (!node) return false;
+    std::set<const osg::Drawable*> drawables;
+    OccluderCollector collector(drawables);
+    collector.pushMatrix(localToWorld); node->accept(collector);
+
+    const std::vector<osg::Vec3>& vertices = collector.getVertices();
+    const std::vector<unsigned int>& indices = collector.getTriangles();
+    if (vertices.empty() || indices.size() < 3) return false;
+
+#ifdef VERSE_ENABLE_RASTERIZER
+    std::vector<__m128> vertexList(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        const osg::Vec3& v = vertices[i];
+        vertexList[i] = _mm_setr_ps(v[0], v[1], v[2], 1.0f);
+    }
+
+    // Merge triangles to quads, and pad to multiples of 32 for 8-wide SIMD processing
+    std::vector<unsigned int> quadIndices = QuadDecomposition::decompose(indices, vertexList);
+    if (quadIndices.empty()) return false;
+    while (quadIndices.size() % 32 != 0) quadIndices.push_back(quadIndices[0]);
+
+    std::vector<Aabb> quadAabbs;
+    for (size_t q = 0; q < quadIndices.size() / 4; ++q)
+    {
+        Aabb aabb;
+        for (size_t j = 0; j < 4; ++j) aabb.include(vertexList[quadIndices[q * 4 + j]]);
+        quadAabbs.push_back(aabb);
+    }
+
+    // Split quads into spatially coherent batches, each baked as an occluder
+    // Note that SAH splitting only works if there are enough quads to split
+    std::vector<std::vector<uint32_t>> batches;
+    if (quadAabbs.size() < 512)
+    {
+        batches.resize(1);
+        for (uint32_t q = 0; q < quadAabbs.size(); ++q) batches[0].push_back(q);
+    }
+    else
+        batches = SurfaceAreaHeuristic::generateBatches(quadAabbs, 512, 8);
+    Aabb refAabb; for (size_t i = 0; i < vertexList.size(); ++i) refAabb.include(vertexList[i]);
+
+    // Avoid zero extents for flat occluders, which will break quantization
+    __m128 extents = _mm_max_ps(refAabb.getExtents(), _mm_set1_ps(1e-3f));
+    refAabb.m_max = _mm_add_ps(refAabb.m_min, extents);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        std::vector<__m128> batchVertices;
+        const std::vector<uint32_t>& batch = batches[b];
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            for (size_t j = 0; j < 4; ++j)
+                batchVertices.push_back(vertexList[quadIndices[batch[i] * 4 + j]]);
+        }
+
+        std::unique_ptr<Occluder> occluder =
+            Occluder::bake(batchVertices, refAabb.m_min, refAabb.m_max);
+        if (occluder) _data->occluders.push_back(occluder.release());
+    }
+    _occluderDrawables.insert(drawables.begin(), drawables.end());
+    _rasterized = false; return true;
+#else
+    OSG_NOTICE << "[OcclusionCuller] Software rasterizer not compiled, "
+               << "occluder " << node->getName() << " will be ignored" << std::endl;
+    return false;
+#endif
+}
+
+void OcclusionCuller::clearOccluders()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+#ifdef VERSE_ENABLE_RASTERIZER
+    _data->clear();
+#endif
+    _occluderDrawables.clear(); _rasterized = false;
+}
+
+void OcclusionCuller::rasterize(const osg::Matrix& view, const osg::Matrix& proj,
+                                unsigned int frameNo)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (_rasterized && frameNo == _frameNumber && view == _viewMatrix && proj == _projMatrix)
+        return;
+    if (frameNo != _frameNumber) { _numTested = 0; _numCulled = 0; }
+    _viewMatrix = view; _projMatrix = proj; _frameNumber = frameNo;
+    _rasterized = false; if (!_enabled) return;
+
+    // Rasterizer also rejects boxes outside the frustum, which is not our business
+    // So keep the frustum here to make sure only really occluded objects are culled
+    _frustum.setToUnitFrustum(true, true);
+    _frustum.transformProvidingInverse(view * proj);
+
+#ifdef VERSE_ENABLE_RASTERIZER
+    osg::Matrixf mvp(view * proj);
+    Rasterizer& rasterizer = _data->rasterizer;
+    rasterizer.setModelViewProjection(mvp.ptr());
+    rasterizer.clear();
+
+    // Sort occluders front to back for better early rejection in HiZ buffer
+    osg::Vec3 eye = osg::Vec3() * osg::Matrix::inverse(view);
+    __m128 eyeV = _mm_setr_ps(eye[0], eye[1], eye[2], 0.0f);
+    std::vector<std::pair<float, Occluder*>>& sorted = _data->sortedOccluders;
+    sorted.clear();
+    for (size_t i = 0; i < _data->occluders.size(); ++i)
+    {
+        Occluder* occ = _data->occluders[i];
+        __m128 dist = _mm_sub_ps(occ->m_center, eyeV);
+        sorted.push_back(std::pair<float, Occluder*>(
+            _mm_cvtss_f32(_mm_dp_ps(dist, dist, 0x7f)), occ));
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<float, Occluder*>& a, const std::pair<float, Occluder*>& b)
+              { return a.first < b.first; });
+
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        Occluder* occ = sorted[i].second; bool needsClipping = false;
+        if (rasterizer.queryVisibility(occ->m_boundsMin, occ->m_boundsMax, needsClipping))
+        {
+            if (needsClipping) rasterizer.rasterize<true>(*occ);
+            else rasterizer.rasterize<false>(*occ);
+        }
+    }
+    _rasterized = true;
+#endif
+}
+
+bool OcclusionCuller::isOccluded(const osg::BoundingBox& bb)
+{
+    if (!bb.valid()) return false;
+#ifdef VERSE_ENABLE_RASTERIZER
+    // Cull threads of other cameras may rasterize the HiZ buffer again at the same time
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (!_rasterized) return false;
+
+    bool needsClipping = false; _numTested++;
+    if (!_frustum.contains(bb)) return false;  // already culled by frustum
+    __m128 bbMin = _mm_setr_ps(bb.xMin(), bb.yMin(), bb.zMin(), 1.0f);
+    __m128 bbMax = _mm_setr_ps(bb.xMax(), bb.yMax(), bb.zMax(), 1.0f);
+    if (_data->rasterizer.queryVisibility(bbMin, bbMax, needsClipping)) return false;
+    _numCulled++; return true;
+#else
+    return false;
+#endif
+}
+
+bool OcclusionCuller::isOccluded(const osg::BoundingBox& localBound, const osg::Matrix& localToWorld)
+{
+    if (!localBound.valid()) return false;
+    osg::BoundingBox worldBound;
+    for (int i = 0; i < 8; ++i) worldBound.expandBy(localBound.corner(i) * localToWorld);
+    return isOccluded(worldBound);
+}
+
+osg::Image* OcclusionCuller::createDepthImage()
+{
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(_width, _height, 1, GL_LUMINANCE, GL_FLOAT);
+    image->setInternalTextureFormat(GL_R32F);
+    memset(image->data(), 0, image->getTotalSizeInBytes());
+#ifdef VERSE_ENABLE_RASTERIZER
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (_rasterized) _data->rasterizer.readBackDepth(image->data());
+#endif
+    return image.release();
+}
@@ -0,0 +1,71 @@
+#ifndef MANA_PP_OCCLUSION_CULLER_HPP
+#define MANA_PP_OCCLUSION_CULLER_HPP
+
+#include <osg/Matrix>
+#include <osg/BoundingBox>
+#include <osg/Drawable>
+#include <osg/Image>
+#include <osg/Polytope>
+#include <OpenThreads/Mutex>
+#include <set>
+
+namespace osgVerse
+{
+    /** CPU occlusion culler based on the AVX2 rasterizer in 3rdparty/rasterizer
+        - Occluders (walls, buildings, terrain) are baked once into quantized quad batches
+        - Every frame they are rasterized into a small HiZ buffer using current view/projection
+        - Drawables whose bounding boxes are fully hidden will be rejected by the pipeline cull visitor
+        If osgVerse is built without AVX2 support, isSupported() returns false and nothing is culled.
+    */
+    class OcclusionCuller : public osg::Referenced
+    {
+    public:
+        /** Size of the HiZ buffer, which will be aligned to multiples of 8 */
+        OcclusionCuller(int width = 320, int height = 192);
+        static bool isSupported();
+
+        /** Collect triangles of the node (in world space) and bake them as occluders.
+            Drawables added here will never be rejected by the culler itself */
+        bool addOccluder(osg::Node* node, const osg::Matrix& localToWorld = osg::Matrix());
+        void clearOccluders();
+
+        unsigned int getNumOccluders() const;
+        bool isOccluder(const osg::Drawable* d) const
+        { return _occluderDrawables.find(d) != _occluderDrawables.end(); }
+
+        /** Rasterize all occluders to the HiZ buffer. It only works once per frame for the same
+            matrices, so it is safe to be called from every input stage camera */
+        void rasterize(const osg::Matrix& view, const osg::Matrix& proj, unsigned int frameNo);
+
+        /** Check if a world-space bounding box is hidden behind rasterized occluders */
+        bool isOccluded(const osg::BoundingBox& worldBound);
+
+        /** Check if a local bounding box (with local-to-world matrix) is hidden */
+        bool isOccluded(const osg::BoundingBox& localBound, const osg::Matrix& localToWorld);
+
+        void setEnabled(bool b) { _enabled = b; }
+        bool getEnabled() const { return _enabled; }
+
+        /** Statistics of the last rasterized frame */
+        unsigned int getNumTested() const { return _numTested; }
+        unsigned int getNumCulled() const { return _numCulled; }
+
+        /** Read back depth of the HiZ buffer for debugging (GL_LUMINANCE / GL_FLOAT) */
+        osg::Image* createDepthImage();
+
+    protected:
+        virtual ~OcclusionCuller();
+
+        struct RasterizerData;
+        RasterizerData* _data;
+        std::set<const osg::Drawable*> _occluderDrawables;
+        OpenThreads::Mutex _mutex;
+        osg::Matrix _viewMatrix, _projMatrix;
+        osg::Polytope _frustum;
+        int _width, _height;
+        unsigned int _frameNumber, _numTested, _numCulled;
+        bool _enabled, _rasterized;
+    };
+}
+
+#endif
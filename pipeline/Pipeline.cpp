@@ -2,11 +2,16 @@
 #include <osg/Version>
 #include <osg/ValueObject>
 #include <osg/Depth>
+#include <osg/LightSource>
+#include <osg/ClipNode>
+#include <osg/TexGenNode>
+#include <osg/OcclusionQueryNode>
 #include <osgDB/ReadFile>
 #include <osgUtil/RenderStage>
 #include <osgViewer/Renderer>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <stdarg.h>
 #include "ShaderLibrary.h"
 #include "Pipeline.h"
@@ -40,6 +45,7 @@ struct MyClampProjectionCallback : public osg::CullSettings::ClampProjectionMatr
     bool _clampProjectionMatrix(MatrixType& proj, double& znear, double& zfar) const
     {
         static double epsilon = 1e-6;
+        _callback->reportComputedNearFar(znear, zfar);  // for next frame to reuse
         osg::Vec2d nearFar = _callback->getCalculatedNearFar();
         if (nearFar[0] > 0.0 && nearFar[1] > 0.0)
         {
@@ -87,24 +93,45 @@ struct MyClampProjectionCallback : public osg::CullSettings::ClampProjectionMatr
     osg::observer_ptr<osgVerse::DeferredRenderCallback> _callback;
 };
 
+static inline bool readPipelineMask(osg::Object& node, unsigned int& mask, unsigned int& flags)
+{
+    osg::UserDataContainer* udc = node.getUserDataContainer();
+    if (udc == NULL) return false;
+
+    osgVerse::PipelineMaskContainer* pmc = dynamic_cast<osgVerse::PipelineMaskContainer*>(udc);
+    if (pmc != NULL) return pmc->getPipelineMask(mask, flags);
+
+    // Compatible with user values set directly or read from files
+    if (!node.getUserValue("PipelineMask", mask)) return false;
+    node.getUserValue("PipelineFlags", flags); return true;
+}
+
 class MyCullVisitor : public osgUtil::CullVisitor
 {
 public:
+    typedef osgVerse::DeferredRenderCallback::SharedCullResults SharedCullResults;
     MyCullVisitor()
-    :   osgUtil::CullVisitor(), _cullMask(0xffffffff), _defaultMask(0xffffffff) {}
+    :   osgUtil::CullVisitor(), _recording(NULL), _baseStateGraph(NULL),
+        _cullMask(0xffffffff), _defaultMask(0xffffffff) {}
     MyCullVisitor(const MyCullVisitor& v)
     :   osgUtil::CullVisitor(v), _callback(v._callback), _shadowData(v._shadowData),
-        _shadowViewport(v._shadowViewport), _pipelineMaskPath(v._pipelineMaskPath),
-        _shadowModelViews(v._shadowModelViews), _shadowProjections(v._shadowProjections),
-        _pixelSizeVectorList(v._pixelSizeVectorList), _cullMask(v._cullMask), _defaultMask(v._defaultMask) {}
+        _occlusionCuller(v._occlusionCuller), _shadowViewport(v._shadowViewport),
+        _pipelineMaskPath(v._pipelineMaskPath), _shadowModelViews(v._shadowModelViews),
+        _shadowProjections(v._shadowProjections), _pixelSizeVectorList(v._pixelSizeVectorList),
+        _invViewMatrix(v._invViewMatrix), _recording(NULL), _baseStateGraph(NULL),
+        _cullMask(v._cullMask), _defaultMask(v._defaultMask) {}
 
     virtual CullVisitor* clone() const { return new MyCullVisitor(*this); }
     void setDeferredCallback(osgVerse::DeferredRenderCallback* cb) { _callback = cb; }
     osgVerse::DeferredRenderCallback* getDeferredCallback() { return _callback.get(); }
 
+    void setOcclusionCuller(osgVerse::OcclusionCuller* oc, const osg::Matrix& viewMatrix)
+    { _occlusionCuller = oc; if (oc) _invViewMatrix = osg::Matrix::inverse(viewMatrix); }
+
     virtual void reset()
     {
         _cullMask = 0xffffffff; _pipelineMaskPath.clear(); _shadowData = NULL;
+        _recording = NULL; _baseStateGraph = NULL;
         if (_callback.valid()) _defaultMask = _callback->getForwardMask();
 
         osg::Camera* cam = this->getCurrentCamera();
@@ -143,9 +170,8 @@ public:
         {
             // Use this to replace nodemasks while checking deferred/forward graphs
             unsigned int nodePipMask = 0xffffffff, flags = 0;
-            if (node.getUserValue("PipelineMask", nodePipMask))
+            if (readPipelineMask(node, nodePipMask, flags))
             {
-                node.getUserValue("PipelineFlags", flags);
                 if (!_pipelineMaskPath.empty())
                 {
                     std::pair<unsigned int, unsigned int> lastM = _pipelineMaskPath.back();
@@ -182,13 +208,11 @@ public:
         return true;
     }
 
-    bool passable(osg::Drawable& node)
+    unsigned int getPipelineMask(osg::Drawable& node) const
     {
         unsigned int nodePipMask = 0xffffffff, flags = 0;
-        if (this->getUserData() != NULL) return true;  // computing near/far mode
-        if (node.getUserValue("PipelineMask", nodePipMask))
+        if (readPipelineMask(node, nodePipMask, flags))
         {
-            node.getUserValue("PipelineFlags", flags);
             if (!_pipelineMaskPath.empty())
             {
                 std::pair<unsigned int, unsigned int> lastM = _pipelineMaskPath.back();
@@ -198,24 +222,63 @@ public:
                     { nodePipMask = lastM.first; flags = lastM.second; }
                 }
             }
+            if (flags & osg::StateAttribute::ON) return nodePipMask;
+        }
+
+        // Handle drawables which is never been set pipeline masks:
+        // if pipeline mask is never set, we will treat current node as forward one
+        // to avoid it being rendered multiple times.
+        if (_pipelineMaskPath.empty()) return _defaultMask;
+        return _pipelineMaskPath.back().first;
+    }
 
-            if (flags & osg::StateAttribute::ON)
+    bool passable(osg::Drawable& node)
+    {
+        if (this->getUserData() != NULL) return true;  // computing near/far mode
+        if ((_cullMask & getPipelineMask(node)) == 0) return false;
+        return !checkSmallPixelSizeCulling(node.getBound());
+    }
+
+    /** Check if cull-once mode can work: not for shadow cameras or computing near/far */
+    bool canShareCullResults() const
+    {
+#if OSG_VERSION_GREATER_THAN(3, 5, 9)
+        return this->getUserData() == NULL && !_shadowData.valid();
+#else
+        return false;  // we can't intercept render leaves in older CullVisitor::apply(Drawable&)
+#endif
+    }
+
+    /** Traverse the camera, or reuse results recorded by another stage camera in this frame */
+    void cullWithSharedResults(osg::Camera& camera, osgVerse::DeferredRenderCallback& cb)
+    {
+        SharedCullResults& results = *cb.getSharedCullResults();
+        unsigned int frameNo = getFrameStamp() ? getFrameStamp()->getFrameNumber() : 0;
+        const osg::Viewport* vp = getViewport(); bool shared = true;
+        osg::Vec2 vpSize = vp ? osg::Vec2(vp->width(), vp->height()) : osg::Vec2();
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(results.mutex);
+            if (results.frameNumber != frameNo)
             {
-                if ((_cullMask & nodePipMask) != 0)
-                    return !checkSmallPixelSizeCulling(node.getBound());
-                return false;
+                // The first camera culled in this frame: record leaves of all pipeline masks
+                results.clear(); results.frameNumber = frameNo;
+                results.viewMatrix = *getModelViewMatrix();
+                results.projectionMatrix = *getProjectionMatrix();
+                results.viewportSize = vpSize; results.lodScale = getLODScale();
+                results.traversalMask = getTraversalMask();
+                recordSharedResults(camera, results); results.valid = true;
             }
+            else if (results.valid && vpSize == results.viewportSize &&
+                     getLODScale() == results.lodScale && getTraversalMask() == results.traversalMask &&
+                     *getModelViewMatrix() == results.viewMatrix &&
+                     isSameFrustum(*getProjectionMatrix(), results.projectionMatrix))
+                cb.addNumSavedTraversals(1);
+            else
+                shared = false;
         }
 
-        if (checkSmallPixelSizeCulling(node.getBound())) return false;
-        if (_pipelineMaskPath.empty())
-        {
-            // Handle drawables which is never been set pipeline masks:
-            // if pipeline mask is never set, we will treat current node as forward one
-            // to avoid it being rendered multiple times.
-            return (_cullMask & _defaultMask) != 0;
-        }
-        return (_cullMask & _pipelineMaskPath.back().first) != 0;
+        if (shared) replaySharedResults(results);
+        else traverse(camera);
     }
 
     virtual void apply(osg::Node& node)
@@ -238,7 +301,7 @@ public:
 
     virtual void apply(osg::Projection& node)
     {
-        int s = 0;
+        int s = 0; if (recordSharedEntry(&node)) return;
         if (passable(node, s))
         {
             pushProjectionMatrixInShadow(node);
@@ -255,10 +318,29 @@ public:
     { int s = 0; if (passable(node, s)) osgUtil::CullVisitor::apply(node); popM(s); }
 
     virtual void apply(osg::ClearNode& node)
-    { int s = 0; if (passable(node, s)) osgUtil::CullVisitor::apply(node); popM(s); }
+    {
+        int s = 0; if (recordSharedEntry(&node)) return;
+        if (passable(node, s)) osgUtil::CullVisitor::apply(node); popM(s);
+    }
 
     virtual void apply(osg::Camera& node)
-    { int s = 0; if (passable(node, s)) osgUtil::CullVisitor::apply(node); popM(s); }
+    {
+        int s = 0; if (recordSharedEntry(&node)) return;
+        if (passable(node, s)) osgUtil::CullVisitor::apply(node); popM(s);
+    }
+
+    // Nodes below add positional states or render stages, so every stage camera must visit them
+    virtual void apply(osg::LightSource& node)
+    { if (!recordSharedEntry(&node)) osgUtil::CullVisitor::apply(node); }
+
+    virtual void apply(osg::ClipNode& node)
+    { if (!recordSharedEntry(&node)) osgUtil::CullVisitor::apply(node); }
+
+    virtual void apply(osg::TexGenNode& node)
+    { if (!recordSharedEntry(&node)) osgUtil::CullVisitor::apply(node); }
+
+    virtual void apply(osg::OcclusionQueryNode& node)
+    { if (!recordSharedEntry(&node)) osgUtil::CullVisitor::apply(node); }
 
 #if OSG_VERSION_GREATER_THAN(3, 2, 3)
     virtual void apply(osg::Geode& node)
@@ -279,6 +361,7 @@ public:
         }
 
         if (drawable.isCullingActive() && isCulled(bb)) return;
+        if (isOccludedBySoftware(drawable, bb)) return;
         if (_computeNearFar && bb.valid()) { if (!updateCalculatedNearFar(matrix, drawable, false)) return; }
 
         // push the geoset's state on the geostate stack.
@@ -304,10 +387,13 @@ public:
                        << " Camera: " << getCurrentCamera()->getName() << ", Center: " << bb.center().valid()
                        << ", Matrix: " << matrix.valid() << std::endl;
         }
+        else if (_recording != NULL)
+            recordSharedEntry(NULL, &drawable, &matrix, depth);
         else
             addDrawableAndDepth(&drawable, &matrix, depth);
         for (unsigned int i = 0; i < numPopStateSetRequired; ++i) { popStateSet(); }
 #   else
+        if (isOccludedBySoftware(drawable, drawable.getBoundingBox())) return;
         osgUtil::CullVisitor::apply(drawable);
 #   endif
     }
@@ -330,7 +416,7 @@ public:
             for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
             {
                 osg::Drawable* drawable = node.getDrawable(i);
-                if (!passable(*drawable))
+                if (!passable(*drawable) || isOccludedBySoftware(*drawable, drawable->getBound()))
                 {
                     drawablesToHide.push_back(DrawablePair(drawable, drawable->getCullCallback()));
                     drawable->setCullCallback(new DisableDrawableCallbackInternal);
@@ -352,6 +438,97 @@ public:
 #endif
 
 protected:
+    void recordSharedResults(osg::Camera& camera, SharedCullResults& results)
+    {
+        unsigned int cullMask = _cullMask; _cullMask = 0xffffffff;
+        _recording = &results; _baseStateGraph = getCurrentStateGraph();
+        traverse(camera);
+        _recording = NULL; _cullMask = cullMask;
+        _computed_znear = FLT_MAX; _computed_zfar = -FLT_MAX;  // will be updated while replaying
+    }
+
+    bool recordSharedEntry(osg::Node* node, osg::Drawable* drawable = NULL,
+                           osg::RefMatrix* modelView = NULL, float depth = 0.0f)
+    {
+        if (_recording == NULL) return false;
+        SharedCullResults::Entry entry;
+        entry.node = node; entry.drawable = drawable; entry.depth = depth;
+        entry.modelView = (modelView != NULL) ? modelView : getModelViewMatrix();
+
+        // Record state-sets from current state graph up to the camera's one
+        std::vector<const osg::StateSet*>& stateSets = _recording->stateSets;
+        entry.stateSetStart = stateSets.size();
+        for (osgUtil::StateGraph* sg = getCurrentStateGraph();
+             sg != NULL && sg != _baseStateGraph; sg = sg->_parent)
+        { if (sg->getStateSet()) stateSets.push_back(sg->getStateSet()); }
+        std::reverse(stateSets.begin() + entry.stateSetStart, stateSets.end());
+        entry.stateSetEnd = stateSets.size();
+
+        // Record all pipeline masks on the path, which should all match the stage's cull mask
+        std::vector<std::pair<unsigned int, unsigned int>>& masks = _recording->masks;
+        entry.maskStart = masks.size();
+        masks.insert(masks.end(), _pipelineMaskPath.begin(), _pipelineMaskPath.end());
+        if (drawable != NULL)
+            masks.push_back(std::pair<unsigned int, unsigned int>(getPipelineMask(*drawable), 0));
+        entry.maskEnd = masks.size();
+        _recording->entries.push_back(entry); return true;
+    }
+
+    void replaySharedResults(const SharedCullResults& results)
+    {
+        std::vector<const osg::StateSet*> stateSetPath;
+        for (size_t i = 0; i < results.entries.size(); ++i)
+        {
+            const SharedCullResults::Entry& entry = results.entries[i]; bool passed = true;
+            for (unsigned int m = entry.maskStart; m < entry.maskEnd && passed; ++m)
+                passed = (_cullMask & results.masks[m].first) != 0;
+            if (!passed) continue;
+
+            // Only pop/push the different part of state-set paths between neighbor entries
+            size_t numStateSets = entry.stateSetEnd - entry.stateSetStart, common = 0;
+            while (common < stateSetPath.size() && common < numStateSets &&
+                   stateSetPath[common] == results.stateSets[entry.stateSetStart + common]) common++;
+            while (stateSetPath.size() > common) { popStateSet(); stateSetPath.pop_back(); }
+            for (size_t j = common; j < numStateSets; ++j)
+            {
+                const osg::StateSet* ss = results.stateSets[entry.stateSetStart + j];
+                pushStateSet(ss); stateSetPath.push_back(ss);
+            }
+
+            if (entry.node.valid())
+            {
+                std::vector<std::pair<unsigned int, unsigned int>> maskPath(
+                    results.masks.begin() + entry.maskStart, results.masks.begin() + entry.maskEnd);
+                _pipelineMaskPath.swap(maskPath);
+                pushModelViewMatrix(entry.modelView.get(), osg::Transform::ABSOLUTE_RF);
+                entry.node->accept(*this);
+                popModelViewMatrix(); _pipelineMaskPath.swap(maskPath);
+            }
+#if OSG_VERSION_GREATER_THAN(3, 5, 9)
+            else if (entry.drawable.valid())
+            {
+                osg::RefMatrix* matrix = entry.modelView.get();
+                if (_computeNearFar && !updateCalculatedNearFar(*matrix, *entry.drawable, false))
+                    continue;
+                addDrawableAndDepth(entry.drawable.get(), matrix, entry.depth);
+            }
+#endif
+        }
+        while (!stateSetPath.empty()) { popStateSet(); stateSetPath.pop_back(); }
+    }
+
+    static bool isSameFrustum(const osg::Matrix& proj0, const osg::Matrix& proj1)
+    {
+        // Depth terms may differ as some stages have near/far clamped already
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c)
+            {
+                if (c == 2 && (r == 2 || r == 3)) continue;
+                if (proj0(r, c) != proj1(r, c)) return false;
+            }
+        return true;
+    }
+
     void pushModelViewMatrixInShadow(osg::Transform& t)
     {
         osg::Matrix matrix; if (!_shadowData) return;
@@ -394,6 +571,13 @@ protected:
         return false;
     }
 
+    bool isOccludedBySoftware(osg::Drawable& drawable, const osg::BoundingBox& bb)
+    {
+        if (!_occlusionCuller.valid() || this->getUserData() != NULL) return false;
+        if (!drawable.isCullingActive() || _occlusionCuller->isOccluder(&drawable)) return false;
+        return _occlusionCuller->isOccluded(bb, (*getModelViewMatrix()) * _invViewMatrix);
+    }
+
     inline value_type distance(const osg::Vec3& coord, const osg::Matrix& matrix)
     {
         return -((value_type)coord[0] * (value_type)matrix(0, 2) +
@@ -415,15 +599,37 @@ protected:
 
     osg::observer_ptr<osgVerse::DeferredRenderCallback> _callback;
     osg::observer_ptr<osgVerse::ShadowModule::ShadowData> _shadowData;
+    osg::observer_ptr<osgVerse::OcclusionCuller> _occlusionCuller;
     osg::observer_ptr<osg::Viewport> _shadowViewport;
     std::vector<std::pair<unsigned int, unsigned int>> _pipelineMaskPath;
 
     typedef std::vector<osg::Matrix> MatrixValueStack;
     MatrixValueStack _shadowModelViews, _shadowProjections;
     std::vector<osg::Vec4> _pixelSizeVectorList;
+    osg::Matrix _invViewMatrix;
+    SharedCullResults* _recording;
+    osgUtil::StateGraph* _baseStateGraph;
     unsigned int _cullMask, _defaultMask;
 };
 
+class SharedCullCallback : public osg::NodeCallback
+{
+public:
+    SharedCullCallback(osgVerse::DeferredRenderCallback* cb) : _callback(cb) {}
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        MyCullVisitor* cv = dynamic_cast<MyCullVisitor*>(nv);
+        osg::Camera* camera = dynamic_cast<osg::Camera*>(node);
+        if (cv && camera && _callback.valid() && _callback->getCullOnce() &&
+            cv->canShareCullResults()) cv->cullWithSharedResults(*camera, *_callback);
+        else traverse(node, nv);
+    }
+
+protected:
+    osg::observer_ptr<osgVerse::DeferredRenderCallback> _callback;
+};
+
 class MySceneView : public osgUtil::SceneView
 {
 public:
@@ -439,9 +645,17 @@ public:
         bool calcNearFar = false; getCamera()->getUserValue("NeedNearFarCalculation", calcNearFar);
         if (calcNearFar && _callback.valid()) _callback->cullWithNearFarCalculation(this);
 
-        // TODO!! add software-rasterizer for occlusion culling here
-        // Drawable AABBs should be collect in culling stage above, and pixels computed here
-        // Results will be check in customized CullVisitor then
+        // Rasterize occluders with software-rasterizer (only once per frame) for occlusion culling
+        // Results will be checked in customized CullVisitor then; shadow cameras are excluded
+        MyCullVisitor* cv = dynamic_cast<MyCullVisitor*>(getCullVisitor());
+        osgVerse::OcclusionCuller* oc = (calcNearFar && _callback.valid())
+                                      ? _callback->getOcclusionCuller() : NULL;
+        if (oc != NULL && oc->getEnabled() && getFrameStamp() != NULL)
+        {
+            oc->rasterize(getViewMatrix(), getProjectionMatrix(), getFrameStamp()->getFrameNumber());
+            if (cv) cv->setOcclusionCuller(oc, getViewMatrix());
+        }
+        else if (cv) cv->setOcclusionCuller(NULL, osg::Matrix());
 
         // Do regular culling and apply every input camera's inverse(ViewProj) uniform to all sceneViews
         // This uniform is helpful for deferred passes to rebuild world vertex and normals
@@ -676,6 +890,21 @@ struct MyResizedCallback : public osg::GraphicsContext::ResizedCallback
 
 namespace osgVerse
 {
+    osgUtil::SceneView* createPipelineSceneView(DeferredRenderCallback* cb, osg::Camera* camera,
+                                                unsigned int flags)
+    {
+        osg::ref_ptr<osgUtil::SceneView> sceneView = new MySceneView(cb);
+        sceneView->setDefaults(flags);
+        sceneView->setCamera(camera, false);
+
+        MyCullVisitor* cullVisitor = new MyCullVisitor;
+        cullVisitor->setDeferredCallback(cb);
+        cullVisitor->setStateGraph(sceneView->getStateGraph());
+        cullVisitor->setRenderStage(sceneView->getRenderStage());
+        sceneView->setCullVisitor(cullVisitor);
+        return sceneView.release();
+    }
+
     Pipeline::Pipeline(int glContextVer, int glslVer)
     {
         _deferredCallback = new osgVerse::DeferredRenderCallback(true);
@@ -984,6 +1213,8 @@ namespace osgVerse
         forwardCam->setUserValue("PipelineCullMask", defForwardMask);  // replacing setCullMask()
         forwardCam->setClampProjectionMatrixCallback(customClamper.get());
         forwardCam->setComputeNearFarMode(g_nearFarMode);
+        if (!forwardCam->getCullCallback())
+            forwardCam->setCullCallback(new SharedCullCallback(_deferredCallback.get()));
         _deferredCallback->setup(forwardCam.get(), PRE_DRAW);
 
         forwardCam->setViewport(0, 0, _stageSize.x(), _stageSize.y());
@@ -1096,6 +1327,7 @@ namespace osgVerse
         s->camera->setUserValue("NeedNearFarCalculation", true);
         s->camera->setClampProjectionMatrixCallback(
             new MyClampProjectionCallback(s, _deferredCallback.get()));
+        s->camera->setCullCallback(new SharedCullCallback(_deferredCallback.get()));
         s->camera->setComputeNearFarMode(g_nearFarMode);
         s->inputStage = true; _stages.push_back(s);
 
@@ -1296,10 +1528,12 @@ namespace osgVerse
 
     void Pipeline::setPipelineMask(osg::Object& node, unsigned int mask, unsigned int flags)
     {
-        if (node.getUserDataContainer() != NULL)
+        osg::UserDataContainer* udc = node.getUserDataContainer();
+        if (udc == NULL)
+            node.setUserDataContainer(new PipelineMaskContainer);
+        else if (!dynamic_cast<PipelineMaskContainer*>(udc))
         {
-            osg::DefaultUserDataContainer* defUdc =
-                dynamic_cast<osg::DefaultUserDataContainer*>(node.getUserDataContainer());
+            osg::DefaultUserDataContainer* defUdc = dynamic_cast<osg::DefaultUserDataContainer*>(udc);
             if (!defUdc)
             {
                 OSG_NOTICE << "The node already has a user-define data container '"
@@ -1307,6 +1541,8 @@ namespace osgVerse
                            << "' before setting pipeline mask, which may cause overwriting problems. "
                            << "Consider a better way to handle user values!" << std::endl;
             }
+            else  // keep existing user data and replace with the typed container
+                node.setUserDataContainer(new PipelineMaskContainer(*defUdc));
         }
         node.setUserValue("PipelineMask", mask);  // replacing setNodeMask()
         node.setUserValue("PipelineFlags", flags);
@@ -1314,16 +1550,44 @@ namespace osgVerse
 
     unsigned int Pipeline::getPipelineMask(osg::Object& node)
     {
-        unsigned int mask = 0xffffffff;
-        if (node.getUserDataContainer() != NULL)
-            node.getUserValue("PipelineMask", mask); return mask;
+        unsigned int mask = 0xffffffff, flags = 0xffffffff;
+        readPipelineMask(node, mask, flags); return mask;
     }
 
     unsigned int Pipeline::getPipelineMaskFlags(osg::Object& node)
     {
-        unsigned int flags = 0xffffffff;
-        if (node.getUserDataContainer() != NULL)
-            node.getUserValue("PipelineFlags", flags); return flags;
+        unsigned int mask = 0xffffffff, flags = 0xffffffff;
+        readPipelineMask(node, mask, flags); return flags;
+    }
+
+    PipelineMaskContainer::PipelineMaskContainer()
+    :   osg::DefaultUserDataContainer(), _maskObject(NULL), _flagsObject(NULL) {}
+
+    PipelineMaskContainer::PipelineMaskContainer(const osg::DefaultUserDataContainer& udc,
+                                                 const osg::CopyOp& op)
+    :   osg::DefaultUserDataContainer(udc, op), _maskObject(NULL), _flagsObject(NULL)
+    { updateCachedValues(); }
+
+    unsigned int PipelineMaskContainer::addUserObject(osg::Object* obj)
+    {
+        unsigned int index = osg::DefaultUserDataContainer::addUserObject(obj);
+        updateCachedValues(); return index;
+    }
+
+    void PipelineMaskContainer::setUserObject(unsigned int i, osg::Object* obj)
+    { osg::DefaultUserDataContainer::setUserObject(i, obj); updateCachedValues(); }
+
+    void PipelineMaskContainer::removeUserObject(unsigned int i)
+    { osg::DefaultUserDataContainer::removeUserObject(i); updateCachedValues(); }
+
+    void PipelineMaskContainer::updateCachedValues()
+    {
+        unsigned int maskIndex = getUserObjectIndex("PipelineMask");
+        unsigned int flagsIndex = getUserObjectIndex("PipelineFlags");
+        _maskObject = (maskIndex < getNumUserObjects())
+                    ? dynamic_cast<osg::UIntValueObject*>(getUserObject(maskIndex)) : NULL;
+        _flagsObject = (flagsIndex < getNumUserObjects())
+                     ? dynamic_cast<osg::UIntValueObject*>(getUserObject(flagsIndex)) : NULL;
     }
 
     osg::Texture* Pipeline::createTexture(BufferType type, int w, int h, int glVer)
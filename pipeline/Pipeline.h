@@ -8,6 +8,7 @@
 #include <osg/Texture2D>
 #include <osg/Group>
 #include <osg/Geode>
+#include <osg/ValueObject>
 #include <osgViewer/Viewer>
 #include <string>
 #include "DeferredCallback.h"
@@ -49,6 +50,42 @@ namespace osgVerse
     class ShadowModule;
     class UserInputModule;
 
+    /** User data container which caches pipeline mask/flags of a node as typed values.
+        Cull visitors can read them directly instead of searching user values by name.
+        Values are still kept as "PipelineMask" & "PipelineFlags" user objects, so getUserValue()
+        and serialization work as before (it is written as a DefaultUserDataContainer) */
+    class PipelineMaskContainer : public osg::DefaultUserDataContainer
+    {
+    public:
+        PipelineMaskContainer();
+        PipelineMaskContainer(const osg::DefaultUserDataContainer& udc,
+                              const osg::CopyOp& op = osg::CopyOp::SHALLOW_COPY);
+
+        virtual osg::Object* cloneType() const { return new PipelineMaskContainer; }
+        virtual osg::Object* clone(const osg::CopyOp& op) const
+        { return new PipelineMaskContainer(*this, op); }
+        virtual bool isSameKindAs(const osg::Object* obj) const
+        { return dynamic_cast<const PipelineMaskContainer*>(obj) != NULL; }
+        virtual const char* libraryName() const { return "osg"; }
+        virtual const char* className() const { return "DefaultUserDataContainer"; }
+
+        virtual unsigned int addUserObject(osg::Object* obj);
+        virtual void setUserObject(unsigned int i, osg::Object* obj);
+        virtual void removeUserObject(unsigned int i);
+
+        /** Read cached mask/flags, returns false if mask is not set */
+        inline bool getPipelineMask(unsigned int& mask, unsigned int& flags) const
+        {
+            if (!_maskObject) return false; mask = _maskObject->getValue();
+            if (_flagsObject) flags = _flagsObject->getValue(); return true;
+        }
+
+    protected:
+        void updateCachedValues();
+        osg::UIntValueObject* _maskObject;
+        osg::UIntValueObject* _flagsObject;
+    };
+
     /** OpenGL version data for graphics hardware adpation.
         OpenGL Version: GLSL Version
         - 2.0: #version 110
@@ -164,7 +201,8 @@ namespace osgVerse
         void createShaderDefinitionsFromPipeline(
             osg::Shader* s, const std::vector<std::string>& defs = std::vector<std::string>());
 
-        /** Set pipeline mask of scene graph nodes */
+        /** Set pipeline mask of scene graph nodes. A PipelineMaskContainer will be applied
+            to the node to make mask reading faster while culling */
         static void setPipelineMask(osg::Object& node, unsigned int mask,
                                     unsigned int flags = osg::StateAttribute::ON);
         static unsigned int getPipelineMask(osg::Object& node);
@@ -239,6 +277,10 @@ namespace osgVerse
         /** Make deferred stage active/inactive (one-time stage will re-run only once) */
         void activateDeferredStage(const std::string& n, bool active);
 
+        /** Set a CPU occlusion culler to reject drawables hidden by occluders in input stages */
+        void setOcclusionCuller(OcclusionCuller* oc) { _deferredCallback->setOcclusionCuller(oc); }
+        OcclusionCuller* getOcclusionCuller() { return _deferredCallback->getOcclusionCuller(); }
+
         osgVerse::DeferredRenderCallback* getDeferredCallback() { return _deferredCallback.get(); }
         const osgVerse::DeferredRenderCallback* getDeferredCallback() const { return _deferredCallback.get(); }
 
@@ -362,6 +404,11 @@ namespace osgVerse
     extern GLVersionData* queryOpenGLVersion(Pipeline* p, bool asEmbedded,
                                              osg::GraphicsContext* embeddedGC = NULL);
 
+    /** Create a scene view with the customized cull visitor used by all pipeline cameras
+        (pipeline masks, cull-once and occlusion culling), e.g. to cull a camera without window */
+    extern osgUtil::SceneView* createPipelineSceneView(DeferredRenderCallback* cb, osg::Camera* camera,
+                                                       unsigned int flags = 0);
+
     /** Create a quick PBR+deferred pipeline viewer */
     class StandardPipelineViewer : public osgViewer::Viewer
     {
@@ -3,8 +3,10 @@
 #include <osg/ProxyNode>
 #include <osgDB/ConvertUTF>
 #include <osgDB/WriteFile>
-#include <3rdparty/dkm_parallel.hpp>
+#include <algorithm>
+#include <cfloat>
 #include "SymbolManager.h"
+#include "Utilities.h"
 
 #define RES 512
 #define RESV "512"
@@ -24,6 +26,502 @@ static osg::Texture2D* createParameterTable(osg::Image* image)
     tex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f)); return tex;
 }
 
+/** Dynamic R-tree (quadratic split) indexing symbol positions by ID */
+struct SymbolManager::SymbolTree
+{
+    enum { MAX_ENTRIES = 16, MIN_ENTRIES = 6 };
+    typedef std::pair<int, osg::Vec3d> Entry;
+
+    struct Node
+    {
+        Node(bool l) : parent(NULL), leaf(l) {}
+        ~Node() { for (size_t i = 0; i < children.size(); ++i) delete children[i]; }
+        size_t size() const { return leaf ? entries.size() : children.size(); }
+
+        void recomputeBound()
+        {
+            bound.init();
+            for (size_t i = 0; i < entries.size(); ++i) bound.expandBy(entries[i].second);
+            for (size_t i = 0; i < children.size(); ++i) bound.expandBy(children[i]->bound);
+        }
+
+        osg::BoundingBoxd bound;
+        std::vector<Node*> children;  // for internal nodes
+        std::vector<Entry> entries;   // for leaf nodes
+        Node* parent; bool leaf;
+    };
+
+    /** Box classifiers return 0 if outside, 1 if intersecting, and 2 if fully inside */
+    struct SphereClassifier
+    {
+        SphereClassifier(const osg::Vec3d& c, double r) : center(c), radius2(r * r) {}
+        int operator()(const osg::BoundingBoxd& bb) const
+        {
+            double dMin = 0.0, dMax = 0.0;
+            for (int k = 0; k < 3; ++k)
+            {
+                double lo = bb._min[k] - center[k], hi = bb._max[k] - center[k];
+                if (lo > 0.0) dMin += lo * lo; else if (hi < 0.0) dMin += hi * hi;
+                double farthest = osg::maximum(fabs(lo), fabs(hi)); dMax += farthest * farthest;
+            }
+            if (dMin >= radius2) return 0;
+            return (dMax < radius2) ? 2 : 1;
+        }
+        osg::Vec3d center; double radius2;
+    };
+
+    struct PolytopeClassifier
+    {
+        PolytopeClassifier(const osg::Polytope& p) : planes(p.getPlaneList()) {}
+        int operator()(const osg::BoundingBoxd& bb) const
+        {
+            int result = 2;
+            for (size_t i = 0; i < planes.size(); ++i)
+            {
+                const osg::Plane& p = planes[i]; double dMin = p[3], dMax = p[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    double a = p[k] * bb._min[k], b = p[k] * bb._max[k];
+                    dMin += osg::minimum(a, b); dMax += osg::maximum(a, b);
+                }
+                if (dMax < 0.0) return 0; else if (dMin < 0.0) result = 1;
+            }
+            return result;
+        }
+        const osg::Polytope::PlaneList& planes;
+    };
+
+    struct BoxClassifier
+    {
+        BoxClassifier(const osg::BoundingBoxd& b) : box(b) {}
+        int operator()(const osg::BoundingBoxd& bb) const
+        {
+            if (!box.intersects(bb)) return 0;
+            return (box.contains(bb._min) && box.contains(bb._max)) ? 2 : 1;
+        }
+        osg::BoundingBoxd box;
+    };
+
+    struct IdCollector
+    {
+        IdCollector(std::vector<int>& i) : ids(i) {}
+        bool operator()(int id, const osg::Vec3d&) { ids.push_back(id); return true; }
+        std::vector<int>& ids;
+    };
+
+    SymbolTree() : root(new Node(true)) {}
+    ~SymbolTree() { delete root; }
+
+    void clear()
+    { delete root; root = new Node(true); leafOfId.clear(); }
+
+    void insert(int id, const osg::Vec3d& pos)
+    {
+        Node* node = root;
+        while (!node->leaf)
+        {
+            Node* best = NULL; double bestGrowth = DBL_MAX, bestMargin = DBL_MAX;
+            for (size_t i = 0; i < node->children.size(); ++i)
+            {
+                Node* child = node->children[i]; osg::BoundingBoxd bb = child->bound;
+                double m = margin(bb); bb.expandBy(pos); double growth = margin(bb) - m;
+                if (growth < bestGrowth || (growth == bestGrowth && m < bestMargin))
+                { best = child; bestGrowth = growth; bestMargin = m; }
+            }
+            node = best;
+        }
+
+        node->entries.push_back(Entry(id, pos)); leafOfId[id] = node;
+        for (Node* n = node; n != NULL; n = n->parent) n->bound.expandBy(pos);
+        if (node->entries.size() > MAX_ENTRIES) split(node);
+    }
+
+    bool remove(int id)
+    {
+        std::map<int, Node*>::iterator itr = leafOfId.find(id);
+        if (itr == leafOfId.end()) return false;
+
+        Node* leaf = itr->second; leafOfId.erase(itr);
+        for (size_t i = 0; i < leaf->entries.size(); ++i)
+        {
+            if (leaf->entries[i].first != id) continue;
+            leaf->entries[i] = leaf->entries.back();
+            leaf->entries.pop_back(); break;
+        }
+        condense(leaf); return true;
+    }
+
+    void move(int id, const osg::Vec3d& pos)
+    {
+        std::map<int, Node*>::iterator itr = leafOfId.find(id);
+        if (itr != leafOfId.end())
+        {
+            // Still inside the leaf: bounds stay conservative, so only update the entry
+            Node* leaf = itr->second;
+            if (leaf->bound.contains(pos))
+            {
+                for (size_t i = 0; i < leaf->entries.size(); ++i)
+                { if (leaf->entries[i].first == id) { leaf->entries[i].second = pos; return; } }
+            }
+            remove(id);
+        }
+        insert(id, pos);
+    }
+
+    bool getPosition(int id, osg::Vec3d& pos) const
+    {
+        std::map<int, Node*>::const_iterator itr = leafOfId.find(id);
+        if (itr == leafOfId.end()) return false;
+
+        const std::vector<Entry>& entries = itr->second->entries;
+        for (size_t i = 0; i < entries.size(); ++i)
+        { if (entries[i].first == id) { pos = entries[i].second; return true; } }
+        return false;
+    }
+
+    template<typename Classifier>
+    void query(const Classifier& classify, std::vector<int>& ids) const
+    { IdCollector collector(ids); visit(classify, collector); }
+
+    /** Visit entries accepted by the classifier, until the visitor returns false */
+    template<typename Classifier, typename Visitor>
+    void visit(const Classifier& classify, Visitor& visitor) const
+    { if (root->bound.valid()) visit(root, classify, visitor, false); }
+
+protected:
+    template<typename Classifier, typename Visitor>
+    bool visit(const Node* node, const Classifier& classify, Visitor& visitor, bool inside) const
+    {
+        int c = inside ? 2 : classify(node->bound);
+        if (c == 0) return true;
+        if (node->leaf)
+        {
+            for (size_t i = 0; i < node->entries.size(); ++i)
+            {
+                const Entry& e = node->entries[i];
+                if (c == 2 || classify(osg::BoundingBoxd(e.second, e.second)) > 0)
+                { if (!visitor(e.first, e.second)) return false; }
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < node->children.size(); ++i)
+            { if (!visit(node->children[i], classify, visitor, c == 2)) return false; }
+        }
+        return true;
+    }
+
+    void split(Node* node)
+    {
+        std::vector<osg::BoundingBoxd> boxes(node->size());
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            if (node->leaf) boxes[i].expandBy(node->entries[i].second);
+            else boxes[i] = node->children[i]->bound;
+        }
+
+        std::vector<int> groups = quadraticSplit(boxes);
+        Node* sibling = new Node(node->leaf);
+        if (node->leaf)
+        {
+            std::vector<Entry> entries; entries.swap(node->entries);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                if (groups[i] == 0) { node->entries.push_back(entries[i]); continue; }
+                sibling->entries.push_back(entries[i]); leafOfId[entries[i].first] = sibling;
+            }
+        }
+        else
+        {
+            std::vector<Node*> children; children.swap(node->children);
+            for (size_t i = 0; i < children.size(); ++i)
+            {
+                Node* parent = (groups[i] == 0) ? node : sibling;
+                parent->children.push_back(children[i]); children[i]->parent = parent;
+            }
+        }
+        node->recomputeBound(); sibling->recomputeBound();
+
+        Node* parent = node->parent;
+        if (!parent)
+        {
+            root = new Node(false);
+            root->children.push_back(node); root->children.push_back(sibling);
+            node->parent = root; sibling->parent = root;
+            root->recomputeBound(); return;
+        }
+
+        parent->children.push_back(sibling); sibling->parent = parent;
+        if (parent->children.size() > MAX_ENTRIES) split(parent);
+    }
+
+    void condense(Node* node)
+    {
+        // Remove underflowed nodes along the path, and reinsert their entries later
+        std::vector<Entry> orphans;
+        while (node != root)
+        {
+            Node* parent = node->parent;
+            if (node->size() < MIN_ENTRIES)
+            {
+                std::vector<Node*>& siblings = parent->children;
+                siblings.erase(std::find(siblings.begin(), siblings.end(), node));
+                collect(node, orphans); delete node;
+            }
+            else
+                node->recomputeBound();
+            node = parent;
+        }
+
+        root->recomputeBound();
+        while (!root->leaf && root->children.size() < 2)
+        {
+            Node* child = root->children.empty() ? new Node(true) : root->children[0];
+            root->children.clear(); delete root;
+            root = child; root->parent = NULL;
+        }
+        for (size_t i = 0; i < orphans.size(); ++i) insert(orphans[i].first, orphans[i].second);
+    }
+
+    static void collect(Node* node, std::vector<Entry>& entries)
+    {
+        entries.insert(entries.end(), node->entries.begin(), node->entries.end());
+        for (size_t i = 0; i < node->children.size(); ++i) collect(node->children[i], entries);
+    }
+
+    static double margin(const osg::BoundingBoxd& bb)
+    {
+        if (!bb.valid()) return 0.0;
+        return (bb.xMax() - bb.xMin()) + (bb.yMax() - bb.yMin()) + (bb.zMax() - bb.zMin());
+    }
+
+    static std::vector<int> quadraticSplit(const std::vector<osg::BoundingBoxd>& boxes)
+    {
+        // Pick two seeds which waste the most if they are put together
+        size_t num = boxes.size(), seed0 = 0, seed1 = 1; double worst = -DBL_MAX;
+        for (size_t i = 0; i < num; ++i)
+            for (size_t j = i + 1; j < num; ++j)
+            {
+                osg::BoundingBoxd bb = boxes[i]; bb.expandBy(boxes[j]);
+                double waste = margin(bb) - margin(boxes[i]) - margin(boxes[j]);
+                if (waste > worst) { worst = waste; seed0 = i; seed1 = j; }
+            }
+
+        std::vector<int> groups(num, -1); size_t counts[2] = { 1, 1 };
+        osg::BoundingBoxd bounds[2] = { boxes[seed0], boxes[seed1] };
+        groups[seed0] = 0; groups[seed1] = 1;
+        for (size_t remaining = num - 2; remaining > 0; --remaining)
+        {
+            // Assign the box with the strongest preference first
+            size_t next = 0; double maxDiff = -1.0, growth[2] = { 0.0, 0.0 };
+            for (size_t i = 0; i < num; ++i)
+            {
+                if (groups[i] >= 0) continue;
+                osg::BoundingBoxd bb0 = bounds[0], bb1 = bounds[1];
+                bb0.expandBy(boxes[i]); bb1.expandBy(boxes[i]);
+                double d0 = margin(bb0) - margin(bounds[0]), d1 = margin(bb1) - margin(bounds[1]);
+                if (fabs(d0 - d1) > maxDiff)
+                { maxDiff = fabs(d0 - d1); next = i; growth[0] = d0; growth[1] = d1; }
+            }
+
+            // Make sure each group will have at least MIN_ENTRIES
+            int g = (growth[0] < growth[1]) ? 0 : ((growth[1] < growth[0]) ? 1
+                  : (counts[0] <= counts[1] ? 0 : 1));
+            if (counts[0] + remaining <= MIN_ENTRIES) g = 0;
+            else if (counts[1] + remaining <= MIN_ENTRIES) g = 1;
+            groups[next] = g; counts[g]++; bounds[g].expandBy(boxes[next]);
+        }
+        return groups;
+    }
+
+    std::map<int, Node*> leafOfId;
+    Node* root;
+};
+
+static osg::Polytope createDistanceBand(const osg::Polytope& eyeFrustum, const osg::Matrix& view,
+                                        double dNear, double dFar)
+{
+    // Eye-space frustum clipped to (dNear <= -z <= dFar), then transformed to world space
+    osg::Polytope polytope(eyeFrustum);
+    if (dNear > 0.0) polytope.add(osg::Plane(0.0, 0.0, -1.0, -dNear));
+    polytope.add(osg::Plane(0.0, 0.0, 1.0, dFar));
+    polytope.transformProvidingInverse(view); return polytope;
+}
+
+/** Multi-level grid clusters of symbols for 'far' mode display, updated incrementally.
+    Cell size of each level is doubled, and so is the distance range it is used for */
+struct SymbolManager::SymbolClusters
+{
+    struct Cell
+    {
+        bool operator<(const Cell& rhs) const
+        {
+            if (x != rhs.x) return x < rhs.x;
+            if (y != rhs.y) return y < rhs.y;
+            return z < rhs.z;
+        }
+        bool operator==(const Cell& rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z; }
+        int x, y, z;
+    };
+
+    struct Cluster
+    {
+        Cluster() : count(0), representative(-1) {}
+        osg::Vec3d sum; int count, representative;
+    };
+
+    struct Level
+    {
+        Level(double s) : cellSize(s) {}
+        Cell getCell(const osg::Vec3d& p) const
+        {
+            Cell c; c.x = (int)floor(p[0] / cellSize);
+            c.y = (int)floor(p[1] / cellSize); c.z = (int)floor(p[2] / cellSize); return c;
+        }
+
+        std::map<Cell, int> cellToCluster;
+        std::map<int, Cluster> clusters;
+        SymbolTree tree;  // indexing cluster centers
+        double cellSize;
+    };
+
+    struct Result
+    {
+        Result(int r, int c, const osg::Vec3d& p) : representative(r), count(c), center(p) {}
+        int representative, count; osg::Vec3d center;
+    };
+
+    struct MemberFinder
+    {
+        MemberFinder(const Level& l, const Cell& c, int e)
+            : level(l), cell(c), excluded(e), found(-1) {}
+        bool operator()(int id, const osg::Vec3d& pos)
+        {
+            if (id == excluded || !(level.getCell(pos) == cell)) return true;
+            found = id; return false;
+        }
+        const Level& level; Cell cell; int excluded, found;
+    };
+
+    SymbolClusters(SymbolTree& t) : symbols(t), idCounter(0) {}
+    ~SymbolClusters() { clear(); }
+
+    void clear()
+    { for (size_t i = 0; i < levels.size(); ++i) delete levels[i]; levels.clear(); }
+
+    void rebuild(double baseCellSize, int numLevels, const std::map<int, osg::ref_ptr<Symbol>>& all)
+    {
+        clear();
+        for (int i = 0; i < numLevels; ++i)
+            levels.push_back(new Level(baseCellSize * pow(2.0, (double)i)));
+
+        osg::Vec3d pos;
+        for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = all.begin();
+             itr != all.end(); ++itr) { if (symbols.getPosition(itr->first, pos)) add(itr->first, pos); }
+    }
+
+    void add(int id, const osg::Vec3d& pos)
+    { for (size_t i = 0; i < levels.size(); ++i) addToLevel(*levels[i], id, pos); }
+
+    void remove(int id, const osg::Vec3d& pos)
+    { for (size_t i = 0; i < levels.size(); ++i) removeFromLevel(*levels[i], id, pos); }
+
+    void move(int id, const osg::Vec3d& oldPos, const osg::Vec3d& newPos)
+    {
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            Level& lv = *levels[i]; Cell cell = lv.getCell(newPos);
+            std::map<Cell, int>::iterator itr = lv.cellToCluster.find(cell);
+            if (!(lv.getCell(oldPos) == cell) || itr == lv.cellToCluster.end())
+            { removeFromLevel(lv, id, oldPos); addToLevel(lv, id, newPos); continue; }
+
+            // Still in the same cell: only the cluster center changes
+            Cluster& c = lv.clusters[itr->second]; c.sum += newPos - oldPos;
+            lv.tree.move(itr->second, c.sum / (double)c.count);
+        }
+    }
+
+    /** Find clusters in the frustum from dNear to dFar. Each level only works in its own range */
+    void query(const osg::Polytope& eyeFrustum, const osg::Matrix& view,
+               double dNear, double dFar, std::vector<Result>& results) const
+    {
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            double start = dNear * pow(2.0, (double)i), end = start * 2.0;
+            if (start >= dFar) break; else if (end > dFar || i == levels.size() - 1) end = dFar;
+
+            std::vector<int> ids; const Level& lv = *levels[i];
+            lv.tree.query(SymbolTree::PolytopeClassifier(
+                createDistanceBand(eyeFrustum, view, start, end)), ids);
+            for (size_t j = 0; j < ids.size(); ++j)
+            {
+                const Cluster& c = lv.clusters.find(ids[j])->second;
+                results.push_back(Result(c.representative, c.count, c.sum / (double)c.count));
+            }
+        }
+    }
+
+protected:
+    void addToLevel(Level& lv, int id, const osg::Vec3d& pos)
+    {
+        Cell cell = lv.getCell(pos);
+        std::map<Cell, int>::iterator itr = lv.cellToCluster.find(cell);
+        if (itr == lv.cellToCluster.end())
+        {
+            int clusterId = idCounter++; lv.cellToCluster[cell] = clusterId;
+            Cluster& c = lv.clusters[clusterId]; c.sum = pos; c.count = 1;
+            c.representative = id; lv.tree.insert(clusterId, pos); return;
+        }
+
+        Cluster& c = lv.clusters[itr->second]; c.sum += pos; c.count++;
+        lv.tree.move(itr->second, c.sum / (double)c.count);
+    }
+
+    void removeFromLevel(Level& lv, int id, const osg::Vec3d& pos)
+    {
+        Cell cell = lv.getCell(pos);
+        std::map<Cell, int>::iterator itr = lv.cellToCluster.find(cell);
+        if (itr == lv.cellToCluster.end()) return;
+
+        int clusterId = itr->second; Cluster& c = lv.clusters[clusterId];
+        if (--c.count <= 0)
+        {
+            lv.tree.remove(clusterId); lv.clusters.erase(clusterId);
+            lv.cellToCluster.erase(itr); return;
+        }
+
+        c.sum -= pos; lv.tree.move(clusterId, c.sum / (double)c.count);
+        if (c.representative == id)
+        {   // Pick another member in the same cell from the symbol tree
+            osg::Vec3d minPt(cell.x * lv.cellSize, cell.y * lv.cellSize, cell.z * lv.cellSize);
+            osg::Vec3d maxPt = minPt + osg::Vec3d(lv.cellSize, lv.cellSize, lv.cellSize);
+            MemberFinder finder(lv, cell, id);
+            symbols.visit(SymbolTree::BoxClassifier(osg::BoundingBoxd(minPt, maxPt)), finder);
+            c.representative = finder.found;
+        }
+    }
+
+    std::vector<Level*> levels;
+    SymbolTree& symbols;
+    int idCounter;
+};
+
+struct SymbolInOrder
+{
+    SymbolInOrder(double d, Symbol* s, const osg::Vec4& p)
+        : distance(d), symbol(s), posAndScale(p) {}
+
+    bool operator<(const SymbolInOrder& rhs) const
+    {
+        if (distance < rhs.distance) return true;
+        else if (distance > rhs.distance) return false;
+        return symbol->id < rhs.symbol->id;
+    }
+
+    double distance; Symbol* symbol;
+    osg::Vec4 posAndScale;
+};
+
 osg::Vec3 Symbol::getCorner2D(SymbolManager* mgr, int index) const
 {
     osg::Viewport* vp = mgr->getMainCamera()->getViewport();
@@ -53,8 +551,11 @@ osg::Vec3 Symbol::getCorner2D(SymbolManager* mgr, int index) const
 }
 
 SymbolManager::SymbolManager()
-    : _idCounter(0), _firstRun(true), _showIconsInMidDistance(true)
+    : _clusterDensity(0.05), _idCounter(0), _firstRun(true), _showIconsInMidDistance(true),
+      _clusteringEnabled(true), _clustersDirty(true)
 {
+    _tree = new SymbolTree;
+    _clusters = new SymbolClusters(*_tree);
     osg::Image* posImage = new osg::Image;
     osg::Image* posImage2 = new osg::Image;
     osg::Image* dirImage = new osg::Image;
@@ -83,8 +584,18 @@ SymbolManager::SymbolManager()
     _bgIconTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
     _bgIconTexture->setImage(emptyImage);
 
+    // Text atlas is persistent and only changed slots are uploaded, so no mipmaps here
+    _textAtlas = new osg::Image;
+    _textAtlas->allocateImage(2048, 1024, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    memset(_textAtlas->data(), 0, _textAtlas->getTotalSizeInBytes());
+
     _textTexture = new osg::Texture2D; _textTexture->setResizeNonPowerOfTwoHint(false);
-    _textTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
+    _textTexture->setTextureSize(_textAtlas->s(), _textAtlas->t());
+    _textTexture->setInternalFormat(GL_RGBA);
+    _textTexture->setSourceFormat(_textAtlas->getPixelFormat());
+    _textTexture->setSourceType(_textAtlas->getDataType());
+    _textTexture->setSubloadCallback(new DirtyRegionSubloadCallback(_textAtlas.get()));
+    _textTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
     _textTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
 
     _drawer = new Drawer2D; _lodIconScaleFactor.set(1.5f, 1.4f, 1.0f);
@@ -93,6 +604,9 @@ SymbolManager::SymbolManager()
     _midDistanceScale = new osg::Uniform("Scale", osg::Vec3(3.0f, 1.0f, 1.0f / 10.0f));
 }
 
+SymbolManager::~SymbolManager()
+{ delete _clusters; delete _tree; }
+
 void SymbolManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
     osg::Group* group = node->asGroup();
@@ -112,19 +626,31 @@ void SymbolManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
 
 int SymbolManager::updateSymbol(Symbol* sym)
 {
-    // TODO: add to RTree
     if (sym && sym->id < 0) sym->id = _idCounter++;
-
     if (!sym || (sym && sym->id < 0)) return -1;
-    _symbols[sym->id] = sym; return sym->id;
+
+    osg::Vec3d oldPosition; bool existed = _tree->getPosition(sym->id, oldPosition);
+    _symbols[sym->id] = sym; _tree->move(sym->id, sym->position);
+    if (!_clustersDirty)
+    {
+        if (existed) _clusters->move(sym->id, oldPosition, sym->position);
+        else _clusters->add(sym->id, sym->position);
+    }
+    return sym->id;
 }
 
 bool SymbolManager::removeSymbol(Symbol* sym)
 {
-    // TODO: remove from RTree
     if (!sym || (sym && sym->id < 0)) return false;
     if (_symbols.find(sym->id) != _symbols.end())
         _symbols.erase(_symbols.find(sym->id));
+
+    osg::Vec3d position;
+    if (_tree->getPosition(sym->id, position))
+    {
+        _tree->remove(sym->id);
+        if (!_clustersDirty) _clusters->remove(sym->id, position);
+    }
     return true;
 }
 
@@ -142,34 +668,20 @@ const Symbol* SymbolManager::getSymbol(int id) const
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec3d& pos, double radius) const
 {
-    // TODO: use RTree query
-    std::vector<Symbol*> result;
-    for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
-    {
-        Symbol* sym = itr->second.get();
-        double length = (sym->position - pos).length();
-        if (length < radius) result.push_back(sym);
-    }
-    return result;
+    std::vector<int> ids;
+    _tree->query(SymbolTree::SphereClassifier(pos, radius), ids);
+    return collectSymbols(ids);
 }
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Polytope& polytope) const
 {
-    // TODO: use RTree query
-    std::vector<Symbol*> result;
-    for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
-    {
-        Symbol* sym = itr->second.get();
-        if (polytope.contains(sym->position)) result.push_back(sym);
-    }
-    return result;
+    std::vector<int> ids;
+    _tree->query(SymbolTree::PolytopeClassifier(polytope), ids);
+    return collectSymbols(ids);
 }
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec2d& proj, double e) const
 {
-    // TODO: use RTree query
     osg::BoundingBox bb;
     bb._min.set(proj[0] - e, proj[1] - e, -1.0);
     bb._max.set(proj[0] + e, proj[1] + e, 1.0);
@@ -178,17 +690,28 @@ std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec2d& proj, double
     polytope.setToBoundingBox(bb);
     polytope.transformProvidingInverse(
         _camera->getViewMatrix() * _camera->getProjectionMatrix());
+    return querySymbols(polytope);
+}
 
+std::vector<Symbol*> SymbolManager::collectSymbols(const std::vector<int>& ids) const
+{
     std::vector<Symbol*> result;
-    for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
+    for (size_t i = 0; i < ids.size(); ++i)
     {
-        Symbol* sym = itr->second.get();
-        if (polytope.contains(sym->position)) result.push_back(sym);
+        std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.find(ids[i]);
+        if (itr != _symbols.end()) result.push_back(itr->second.get());
     }
     return result;
 }
 
+void SymbolManager::rebuildClusters()
+{
+    double ratio = _lodDistances[0] / osg::maximum(_lodDistances[1], 1e-6);
+    int numLevels = osg::clampBetween((int)ceil(log(ratio) / log(2.0)), 1, 16);
+    _clusters->rebuild(osg::maximum(_clusterDensity * _lodDistances[1], 1e-3), numLevels, _symbols);
+    _clustersDirty = false;
+}
+
 void SymbolManager::initialize(osg::Group* group)
 {
     if (!_instanceGeom)
@@ -319,7 +842,7 @@ void SymbolManager::initialize(osg::Group* group)
                 "    Color = texture2D(ColorTexture, vec2(r, c));\n"
                 "    mat4 proj = gl_ProjectionMatrix; float ar = proj[0][0] / proj[1][1];\n"
 
-                "    float tx = float(gl_InstanceID) * Scale.z;\n"
+                "    float tx = dir.w * Scale.z;  // dir.w = text slot\n"
                 "    float ty = floor(tx) * Scale.z; tx = fract(tx);\n"
                 "    TexCoord = vec2(tx, ty) + gl_MultiTexCoord0.xy * Scale.z;\n"
                 "    TexCoordBG = gl_MultiTexCoord0.xy * dir.z + dir.xy;\n"
@@ -392,14 +915,29 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
     Symbol* nearestSym = NULL; double nearest = FLT_MAX;
     int numInstances = 0, numInstances2 = 0;
 
+    // Use RTree to query symbols inside the frustum and within the far distance
+    // If clustering, 'far' mode symbols are queried from precomputed clusters instead
     osg::Polytope frustum;
     frustum.setToUnitFrustum(false, false);
-    frustum.transformProvidingInverse(viewMatrix * projMatrix);
+    frustum.transformProvidingInverse(projMatrix);
 
-    // Use RTree to query symbols and find visible ones
-    // TODO
+    std::vector<int> visibleIds; std::vector<SymbolClusters::Result> clusters;
+    double farDistance = _clusteringEnabled ? _lodDistances[1] : _lodDistances[0];
+    _tree->query(SymbolTree::PolytopeClassifier(
+        createDistanceBand(frustum, viewMatrix, 0.0, farDistance)), visibleIds);
+    if (_clusteringEnabled)
+    {
+        if (_clustersDirty) rebuildClusters();
+        _clusters->query(frustum, viewMatrix, _lodDistances[1], _lodDistances[0], clusters);
+    }
+    for (size_t i = 0; i < _activeSymbols.size(); ++i)
+    {   // Symbols not queried this time will be hidden
+        std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.find(_activeSymbols[i]);
+        if (itr != _symbols.end()) itr->second->state = Symbol::Hidden;
+    }
+    _activeSymbols.swap(visibleIds);
 
-    // Traverse all symbols
+    // Traverse visible symbols
     osg::Vec4f* posHandle = (osg::Vec4f*)_posTexture->getImage()->data();
     osg::Vec4f* posHandle2 = (osg::Vec4f*)_posTexture2->getImage()->data();
     osg::Vec4f* dirHandle = (osg::Vec4f*)_dirTexture->getImage()->data();
@@ -410,19 +948,20 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
     float lodScale1 = _lodIconScaleFactor[1] - _lodIconScaleFactor[2];
 
     std::vector<Symbol*> texts;
-    std::map<double, std::vector<std::pair<Symbol*, osg::Vec4>>> symbolsInOrder;
-    for (std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
+    std::vector<SymbolInOrder> symbolsInOrder;
+    for (size_t i = 0; i < _activeSymbols.size(); ++i)
     {
         // Update state and eye-space position
+        std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.find(_activeSymbols[i]);
+        if (itr == _symbols.end()) continue;
+
         Symbol* sym = itr->second.get();
         osg::Vec3f eyePos = sym->position * viewMatrix;
         double distance = -eyePos.z(), interpo = 0.0, scale = sym->scale;
         if (distance < nearest) { nearest = distance; nearestSym = sym; }
 
         // Check distance state of each symbol
-        if (distance > _lodDistances[0] || !frustum.contains(sym->position))
-            sym->state = Symbol::Hidden;
+        if (distance > _lodDistances[0]) sym->state = Symbol::Hidden;
         else if (distance > _lodDistances[1])
         {
             sym->state = Symbol::FarDistance;
@@ -448,79 +987,77 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
             else sym->state = Symbol::MidDistance;
         }
 
-        if (sym->state != Symbol::NearDistance && sym->loadedModel.valid())
-        {
-            // If not in NearDistance mode, hide the model and see if we should delete it
-            int dt = frameNo - sym->modelFrame0;
-            if (dt > 120) group->removeChild(sym->loadedModel.get());
-            else sym->loadedModel->setNodeMask(0);
-        }
-
-        // TODO: when convert to FarClustered?
         if (sym->state == Symbol::Hidden || sym->state == Symbol::NearDistance) continue;
-        symbolsInOrder[distance].push_back(
-            std::pair<Symbol*, osg::Vec4>(sym, osg::Vec4(eyePos, (float)scale)));
+        if (symbolsInOrder.size() >= (size_t)(RES * RES))
+        { OSG_WARN << "[SymbolManager] Data overflow!" << std::endl; break; }
+        symbolsInOrder.push_back(SymbolInOrder(distance, sym, osg::Vec4(eyePos, (float)scale)));
+    }
 
-        int y = itr->first / RES, x = itr->first % RES;
-        if (y < 0 || y >(RES - 1)) { OSG_WARN << "[SymbolManager] Data overflow!" << std::endl; break; }
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+        // Show representative of each cluster at the cluster center
+        const SymbolClusters::Result& cluster = clusters[i];
+        Symbol* sym = getSymbol(cluster.representative);
+        if (!sym || sym->state != Symbol::Hidden) continue;  // already shown
+
+        osg::Vec3f eyePos = cluster.center * viewMatrix;
+        double distance = -eyePos.z(), interpo = (distance - _lodDistances[1]) * inv1;
+        double scale = sym->scale * (interpo * lodScale0 + _lodIconScaleFactor[1]);
+        if (symbolsInOrder.size() >= (size_t)(RES * RES))
+        { OSG_WARN << "[SymbolManager] Data overflow!" << std::endl; break; }
+
+        sym->state = (cluster.count > 1) ? Symbol::FarClustered : Symbol::FarDistance;
+        symbolsInOrder.push_back(SymbolInOrder(distance, sym, osg::Vec4(eyePos, (float)scale)));
+        _activeSymbols.push_back(sym->id);
     }
 
-    std::vector<std::array<float, 2>> kmeansPoints;
-    std::vector<std::pair<Symbol*, osg::Vec4>> symbolsInOrder2;
-    std::map<double, std::vector<std::pair<Symbol*, osg::Vec4>>>::iterator itr;
-    for (itr = symbolsInOrder.begin(); itr != symbolsInOrder.end(); ++itr)
+    for (std::set<int>::iterator mItr = _symbolsWithModels.begin();
+         mItr != _symbolsWithModels.end();)
     {
-        // Save ordered points to vector and prepare for clustering
-        std::vector<std::pair<Symbol*, osg::Vec4>>& pairList = itr->second;
-        for (size_t n = 0; n < pairList.size(); ++n)
+        // If not in NearDistance mode, hide the model and see if we should delete it
+        Symbol* sym = getSymbol(*mItr);
+        if (!sym || !sym->loadedModel.valid()) { _symbolsWithModels.erase(mItr++); continue; }
+        if (sym->state != Symbol::NearDistance)
         {
-            std::pair<Symbol*, osg::Vec4>& pair = pairList[n];
-            osg::Vec3 proj = osg::Vec3(pair.second[0], pair.second[1],
-                                       pair.second[2]) * projMatrix;
-            std::array<float, 2> vec; vec[0] = proj[0]; vec[1] = proj[1];
-            pair.first->projAndScale = osg::Vec4(proj, pair.second[3]);
-            kmeansPoints.push_back(vec); symbolsInOrder2.push_back(pair);
+            int dt = frameNo - sym->modelFrame0;
+            if (dt > 120) group->removeChild(sym->loadedModel.get());
+            else sym->loadedModel->setNodeMask(0);
         }
+        ++mItr;
     }
 
-    if (!kmeansPoints.empty())
+    int grid = osg::maximum((int)(1.0f / getMidDistanceTextScale().z() + 0.5f), 1);
+    int numSlots = grid * grid;
+    bool atlasChanged = (int)_textSlots.size() != numSlots || !_textTexture->getSubloadCallback();
+    if (!_drawGridCallback && atlasChanged) resetTextAtlas(numSlots);
+
+    std::sort(symbolsInOrder.begin(), symbolsInOrder.end());
+    for (size_t n = 0; n < symbolsInOrder.size(); ++n)
     {
-        size_t numK = kmeansPoints.size() / 4; if (numK == 0) numK = 1;
-        auto result = dkm::kmeans_lloyd_parallel(kmeansPoints, numK);
-        std::vector<std::array<float, 2>> centers = std::get<0>(result);
-        std::vector<uint32_t> classIndices = std::get<1>(result);
-        std::set<uint32_t> usedIndices;
+        const SymbolInOrder& data = symbolsInOrder[n]; Symbol* sym = data.symbol;
+        const osg::Vec4& posAndScale = data.posAndScale;
+        osg::Vec3 proj = osg::Vec3(posAndScale[0], posAndScale[1], posAndScale[2]) * projMatrix;
+        sym->projAndScale = osg::Vec4(proj, posAndScale[3]);
 
-        for (size_t n = 0; n < symbolsInOrder2.size(); ++n)
+        // Save to parameter textures
+        if (sym->state == Symbol::MidDistance)
         {
-            Symbol* sym = symbolsInOrder2[n].first;
-            uint32_t classId = classIndices[n];
-            osg::Vec2 offset(kmeansPoints[n][0] - centers[classId][0],
-                             kmeansPoints[n][1] - centers[classId][1]);
-            if (offset.length() < 0.01f)
-            {
-                //if (usedIndices.find(classId) == usedIndices.end())
-                //    { usedIndices.insert(classId); }
-                //else
-                //    { continue; }
-            }
-
-            // Save to parameter textures
-            const osg::Vec4 posAndScale = symbolsInOrder2[n].second;
-            if (sym->state == Symbol::MidDistance)
+            // Text board uses a persistent atlas slot, or the i-th grid of a custom atlas
+            int slot = _drawGridCallback.valid() ? numInstances2 : getTextSlot(sym, frameNo);
+            if (slot >= 0 && slot < numSlots)
             {
                 *(posHandle2 + numInstances2) = posAndScale;
-                *(dirHandle2 + numInstances2) = osg::Vec4(sym->tiling2, 1.0f);
-                *(colorHandle2 + numInstances) = sym->color;
+                *(dirHandle2 + numInstances2) = osg::Vec4(sym->tiling2, (float)slot);
+                *(colorHandle2 + numInstances2) = sym->color;
                 texts.push_back(sym); numInstances2++;
-                if (!_showIconsInMidDistance) continue;
             }
-
-            *(posHandle + numInstances) = posAndScale;
-            *(dirHandle + numInstances) = osg::Vec4(sym->tiling, sym->rotateAngle);
-            *(colorHandle + numInstances) = sym->color;
-            boundBox.expandBy(sym->position); numInstances++;  // FarDistance
+            if (!_showIconsInMidDistance) continue;
         }
+
+        *(posHandle + numInstances) = posAndScale;
+        *(dirHandle + numInstances) = osg::Vec4(sym->tiling, sym->rotateAngle);
+        *(colorHandle + numInstances) = sym->color;
+        boundBox.expandBy(sym->position); numInstances++;  // FarDistance / FarClustered
     }
 
     // If only one symbol left and near enough, select it as NearDistance one
@@ -559,16 +1096,115 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
         _posTexture2->getImage()->dirty(); _dirTexture2->getImage()->dirty();
         _colorTexture2->getImage()->dirty();
 
-        // Collect labels and recreate texture
+        // Rasterize new or changed labels only
         if (_drawGridCallback.valid())
-            _textTexture->setImage(_drawGridCallback->create(_drawer.get(), texts));
+        {
+            std::vector<std::pair<int, std::string>> customTexts;
+            for (size_t i = 0; i < texts.size(); ++i)
+                customTexts.push_back(std::pair<int, std::string>(texts[i]->id, texts[i]->name));
+            if (customTexts != _customTexts || _textTexture->getSubloadCallback() != NULL)
+            {
+                _textTexture->setSubloadCallback(NULL); _textSlots.clear();
+                _textTexture->setImage(_drawGridCallback->create(_drawer.get(), texts));
+                _textTexture->dirtyTextureObject(); _customTexts.swap(customTexts);
+            }
+        }
         else
-            _textTexture->setImage(createGrid(2048, 1024, 10, texts));
+            updateTextAtlas(grid);
     }
     else
         _instanceBoard->getParent(0)->setNodeMask(0);
 }
 
+int SymbolManager::getTextSlot(Symbol* sym, unsigned int frameNo)
+{
+    std::map<int, int>::iterator itr = _textSlotOfSymbol.find(sym->id);
+    if (itr != _textSlotOfSymbol.end())
+    {
+        TextSlot& slot = _textSlots[itr->second]; slot.lastFrame = frameNo;
+        if (slot.text != sym->name || slot.color != sym->textColor)
+        {
+            slot.text = sym->name; slot.color = sym->textColor;
+            _dirtyTextSlots.push_back(itr->second);
+        }
+        return itr->second;
+    }
+
+    // Find a free slot, or the least recently used one which is not used in current frame
+    int index = -1; unsigned int oldest = frameNo;
+    for (size_t i = 0; i < _textSlots.size(); ++i)
+    {
+        const TextSlot& slot = _textSlots[i];
+        if (slot.symbolId < 0) { index = (int)i; break; }
+        else if (slot.lastFrame < oldest) { oldest = slot.lastFrame; index = (int)i; }
+    }
+    if (index < 0) return -1;
+
+    TextSlot& slot = _textSlots[index];
+    if (slot.symbolId >= 0) _textSlotOfSymbol.erase(slot.symbolId);
+    slot.symbolId = sym->id; slot.lastFrame = frameNo;
+    slot.text = sym->name; slot.color = sym->textColor;
+    _textSlotOfSymbol[sym->id] = index;
+    _dirtyTextSlots.push_back(index); return index;
+}
+
+void SymbolManager::resetTextAtlas(int numSlots)
+{
+    _textSlots.assign(numSlots, TextSlot());
+    _textSlotOfSymbol.clear(); _dirtyTextSlots.clear(); _customTexts.clear();
+    memset(_textAtlas->data(), 0, _textAtlas->getTotalSizeInBytes());
+
+    DirtyRegionSubloadCallback* uploader =
+        static_cast<DirtyRegionSubloadCallback*>(_textTexture->getSubloadCallback());
+    if (!uploader)
+    {   // Switched back from custom text-grid callback
+        uploader = new DirtyRegionSubloadCallback(_textAtlas.get());
+        _textTexture->setImage(NULL); _textTexture->setSubloadCallback(uploader);
+        _textTexture->setTextureSize(_textAtlas->s(), _textAtlas->t());
+        _textTexture->dirtyTextureObject();
+    }
+    uploader->dirtyRect(0, 0, _textAtlas->s(), _textAtlas->t());
+    uploader->commit();
+}
+
+void SymbolManager::updateTextAtlas(int grid)
+{
+    DirtyRegionSubloadCallback* uploader =
+        static_cast<DirtyRegionSubloadCallback*>(_textTexture->getSubloadCallback());
+    if (_dirtyTextSlots.empty() || !uploader) return;
+
+    int stepW = _textAtlas->s() / grid, stepH = _textAtlas->t() / grid;
+    if (stepW != _drawer->s() || stepH != _drawer->t())
+        _drawer->allocateImage(stepW, stepH, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    std::sort(_dirtyTextSlots.begin(), _dirtyTextSlots.end());
+    _dirtyTextSlots.erase(std::unique(_dirtyTextSlots.begin(), _dirtyTextSlots.end()),
+                          _dirtyTextSlots.end());
+
+    float textSize = 30.0f;
+    for (size_t j = 0; j < _dirtyTextSlots.size(); ++j)
+    {
+        // Draw label of the slot and copy it to the atlas
+        int index = _dirtyTextSlots[j]; const TextSlot& slot = _textSlots[index];
+        std::vector<std::string> lines;
+        osgDB::split(slot.text, lines, '\n');
+
+        _drawer->start(false); _drawer->clear();
+        float y = (stepH + textSize) * 0.5f;
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            std::wstring t = osgDB::convertUTF8toUTF16(lines[i]);
+            _drawer->drawText(osg::Vec2(30.0f, y + i * textSize), textSize, t, "",
+                              Drawer2D::StyleData(slot.color, true));
+        }
+        _drawer->finish();
+
+        int x0 = (index % grid) * stepW, y0 = (index / grid) * stepH;
+        _textAtlas->copySubImage(x0, y0, 0, _drawer.get());
+        uploader->dirtyRect(x0, y0, stepW, stepH);
+    }
+    _dirtyTextSlots.clear(); uploader->commit();
+}
+
 void SymbolManager::updateNearDistance(Symbol* sym, osg::Group* group)
 {
     if (!sym->loadedModel)
@@ -579,6 +1215,7 @@ void SymbolManager::updateNearDistance(Symbol* sym, osg::Group* group)
         mt->setMatrix(osg::Matrix::rotate(osg::PI - sym->rotateAngle, osg::Z_AXIS) *
                       osg::Matrix::rotate(q) * osg::Matrix::translate(sym->position));
         group->addChild(mt.get()); sym->loadedModel = mt.get();
+        _symbolsWithModels.insert(sym->id);
 
         osg::ref_ptr<osg::ProxyNode> proxy = new osg::ProxyNode;
         proxy->setFileName(0, sym->fileName); mt->addChild(proxy.get());
@@ -6,6 +6,7 @@
 #include <osg/ShapeDrawable>
 #include <osg/Texture2D>
 #include <osg/MatrixTransform>
+#include <set>
 #include "Drawer2D.h"
 
 namespace osgVerse
@@ -49,7 +50,7 @@ namespace osgVerse
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
         enum LodLevel { LOD0 = 0/*->Far->*/, LOD1/*->Mid->*/, LOD2/*->Near->*/ };
-        void setLodDistance(LodLevel lv, double d) { _lodDistances[(int)lv] = d; }
+        void setLodDistance(LodLevel lv, double d) { _lodDistances[(int)lv] = d; _clustersDirty = true; }
         double getLodDistance(LodLevel lv) const { return _lodDistances[(int)lv]; }
 
         // Whether to scale the symbol when changing among far/mid/mear states
@@ -60,6 +61,13 @@ namespace osgVerse
         void setLodScaleFactor(const osg::Vec3& factor) { _lodIconScaleFactor = factor; }
         const osg::Vec3& getLodScaleFactor() const { return _lodIconScaleFactor; }
 
+        // Whether to merge 'far' mode symbols using precomputed multi-level grid clusters
+        // Density is the cell size relative to viewing distance (default 0.05). Larger value merges more
+        void setFarClustering(bool b, double density = 0.05)
+        { _clusteringEnabled = b; _clusterDensity = density; _clustersDirty = true; }
+        bool getFarClustering() const { return _clusteringEnabled; }
+        double getFarClusterDensity() const { return _clusterDensity; }
+
         // Set a custom instance geometry for 'far' mode display
         void setInstanceGeometry(osg::Geometry* g) { _instanceGeom = g; }
         osg::Geometry* getInstanceGeometry() { return _instanceGeom.get(); }
@@ -111,7 +119,8 @@ namespace osgVerse
         void setShowIconsInMidDistance(bool b) { _showIconsInMidDistance = b; }
         bool getShowIconsInMidDistance() const { return _showIconsInMidDistance; }
 
-        /** Add or update symbol data to manager */
+        /** Add or update symbol data to manager.
+            Call it again after changing position of the symbol, to update the spatial index */
         int updateSymbol(Symbol* sym);
 
         /** Remove symbol data from manager */
@@ -121,7 +130,7 @@ namespace osgVerse
         Symbol* getSymbol(int id);
         const Symbol* getSymbol(int id) const;
 
-        /** Query symbols by position / polytope */
+        /** Query symbols by position / polytope, using the spatial index (R-tree) */
         std::vector<Symbol*> querySymbols(const osg::Vec3d& pos, double radius) const;
         std::vector<Symbol*> querySymbols(const osg::Polytope& polytope) const;
         std::vector<Symbol*> querySymbols(const osg::Vec2d& proj, double eplsion) const;
@@ -132,22 +141,47 @@ namespace osgVerse
         struct DrawTextGridCallback : public osg::Referenced
         {
             // Draw atlased text-grid image for mid-distance symbols
+            // It is only called when the list of texts changes, and i-th text uses i-th grid
             virtual osg::Image* create(Drawer2D* drawer, const std::vector<Symbol*>& texts) = 0;
         };
         void setDrawTextGridCallback(DrawTextGridCallback* cb) { _drawGridCallback = cb; }
         DrawTextGridCallback* getDrawTextGridCallback() { return _drawGridCallback.get(); }
     
     protected:
-        virtual ~SymbolManager() {}
+        virtual ~SymbolManager();
         void initialize(osg::Group* group);
         void update(osg::Group* group, unsigned int frameNo);
         void updateNearDistance(Symbol* sym, osg::Group* group);
+        std::vector<Symbol*> collectSymbols(const std::vector<int>& ids) const;
+        void rebuildClusters();
+        int getTextSlot(Symbol* sym, unsigned int frameNo);
+        void resetTextAtlas(int numSlots);
+        void updateTextAtlas(int grid);
 
         osg::Image* createLabel(int w, int h, const std::string& text,
                                 const osg::Vec4& color = osg::Vec4(1.0f, 1.0f, 0.0f, 1.0f));
         osg::Image* createGrid(int w, int h, int grid, const std::vector<Symbol*>& texts);
 
+        struct SymbolTree;
+        struct SymbolClusters;
+        SymbolTree* _tree;
+        SymbolClusters* _clusters;
+
         std::map<int, osg::ref_ptr<Symbol>> _symbols;
+        std::vector<int> _activeSymbols;     // visible symbols of last frame
+        std::set<int> _symbolsWithModels;    // symbols having 'near' models loaded
+
+        struct TextSlot
+        {
+            TextSlot() : symbolId(-1), lastFrame(0) {}
+            std::string text; osg::Vec4 color;
+            int symbolId; unsigned int lastFrame;
+        };
+        std::vector<TextSlot> _textSlots;    // LRU slots of the persistent text atlas
+        std::map<int, int> _textSlotOfSymbol;
+        std::vector<int> _dirtyTextSlots;
+        std::vector<std::pair<int, std::string>> _customTexts;
+        osg::ref_ptr<osg::Image> _textAtlas;
         osg::ref_ptr<osg::Geometry> _instanceGeom, _instanceBoard;
         osg::ref_ptr<osg::Texture2D> _posTexture, _dirTexture, _colorTexture;
         osg::ref_ptr<osg::Texture2D> _posTexture2, _dirTexture2, _colorTexture2;
@@ -157,8 +191,8 @@ namespace osgVerse
         osg::ref_ptr<Drawer2D> _drawer;
         osg::observer_ptr<osg::Camera> _camera;
         osg::Vec3 _lodIconScaleFactor;
-        double _lodDistances[3]; int _idCounter;
-        bool _firstRun, _showIconsInMidDistance;
+        double _lodDistances[3], _clusterDensity; int _idCounter;
+        bool _firstRun, _showIconsInMidDistance, _clusteringEnabled, _clustersDirty;
     };
 }
 
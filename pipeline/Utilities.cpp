@@ -14,6 +14,7 @@
 #include <osgDB/ConvertUTF>
 #include <osgViewer/GraphicsWindow>
 #include <osgViewer/Viewer>
+#include <OpenThreads/ScopedLock>
 #include <codecvt>
 #include <iostream>
 #include <array>
@@ -926,6 +927,68 @@ namespace osgVerse
         return AABB(lightSpaceBB0._min, lightSpaceBB0._max);
     }
 
+    void DirtyRegionSubloadCallback::dirtyRect(int x, int y, int w, int h)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (!_pendingRects.empty())
+        {
+            osg::Vec4i& last = _pendingRects.back();
+            if (last[0] == x && last[2] == w && last[1] <= y && last[1] + last[3] + _mergeGap >= y)
+            { last[3] = osg::maximum(last[1] + last[3], y + h) - last[1]; return; }
+        }
+        _pendingRects.push_back(osg::Vec4i(x, y, w, h));
+    }
+
+    void DirtyRegionSubloadCallback::commit()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_pendingRects.empty()) return;
+        _committedRects.swap(_pendingRects); _pendingRects.clear(); _version++;
+    }
+
+    void DirtyRegionSubloadCallback::load(const osg::Texture2D& texture, osg::State& state) const
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, _image->getPacking());
+        glTexImage2D(GL_TEXTURE_2D, 0, texture.getInternalFormat(), _image->s(), _image->t(), 0,
+                     _image->getPixelFormat(), _image->getDataType(), _image->data());
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _uploadedVersions[state.getContextID()] = _version;
+    }
+
+    void DirtyRegionSubloadCallback::subload(const osg::Texture2D& texture, osg::State& state) const
+    {
+        std::vector<osg::Vec4i> rects;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            unsigned int& uploaded = _uploadedVersions[state.getContextID()];
+            if (uploaded == _version) return;
+            else if (uploaded + 1 == _version) rects = _committedRects;
+            else rects.push_back(osg::Vec4i(0, 0, _image->s(), _image->t()));  // missed some frames
+            uploaded = _version;
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, _image->getPacking());
+#ifdef GL_UNPACK_ROW_LENGTH
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, _image->s());
+#endif
+        for (size_t i = 0; i < rects.size(); ++i)
+        {
+            const osg::Vec4i& r = rects[i];
+            int x0 = osg::maximum(r[0], 0), x1 = osg::minimum(r[0] + r[2], _image->s());
+            int y0 = osg::maximum(r[1], 0), y1 = osg::minimum(r[1] + r[3], _image->t());
+#ifndef GL_UNPACK_ROW_LENGTH
+            x0 = 0; x1 = _image->s();  // no row length support (GLES2 / WebGL1): upload full rows
+#endif
+            if (x1 <= x0 || y1 <= y0) continue;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, _image->getPixelFormat(),
+                            _image->getDataType(), _image->data(x0, y0));
+        }
+#ifdef GL_UNPACK_ROW_LENGTH
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+    }
+
     bool QuickEventHandler::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
     {
         if (ea.getEventType() == osgGA::GUIEventAdapter::PUSH)
@@ -9,7 +9,10 @@
 #include <osg/Texture3D>
 #include <osg/TextureCubeMap>
 #include <osg/Camera>
+#include <osg/Vec4i>
+#include <osg/buffered_value>
 #include <osgGA/GUIEventHandler>
+#include <OpenThreads/Mutex>
 #include "Global.h"
 #include <functional>
 struct SMikkTSpaceContext;
@@ -61,7 +64,8 @@ namespace osgVerse
     extern void alignCameraToBox(osg::Camera* camera, const osg::BoundingBoxd& bb, int resW, int resH,
                                  osg::TextureCubeMap::Face face = osg::TextureCubeMap::POSITIVE_Z);
 
-    /** Create heightmap from given scene graph */
+    /** Create heightmap from given scene graph by rendering it with an RTT camera.
+        For headless use, see createHeightFieldFromMeshes() in modeling/Utilities.h */
     extern osg::HeightField* createHeightField(osg::Node* node, int resX, int resY, osg::View* viewer = NULL);
 
     /** The tangent/binormal computing visitor */
@@ -116,6 +120,35 @@ namespace osgVerse
         AABB createShadowBound(const std::vector<osg::Vec3d>& refPoints, const osg::Matrix& worldToLocal);
     };
 
+    /** Texture subload callback which uploads only changed regions of the image each frame.
+        Regions are rectangles (x, y, w, h); a row range is treated as a full-width rectangle */
+    class DirtyRegionSubloadCallback : public osg::Texture2D::SubloadCallback
+    {
+    public:
+        DirtyRegionSubloadCallback(osg::Image* image, int mergeGap = 0)
+        :   _image(image), _mergeGap(mergeGap), _version(0) {}
+
+        /** Mark a rectangle as changed. It is merged into the last one if they share the same
+            columns and are at most 'mergeGap' rows apart, so call it in ascending row order */
+        void dirtyRect(int x, int y, int w, int h);
+
+        /** Mark rows [start, end) as changed */
+        void dirtyRows(int start, int end) { dirtyRect(0, start, _image->s(), end - start); }
+
+        /** Submit all dirty regions of current frame to draw thread */
+        void commit();
+
+        virtual void load(const osg::Texture2D& texture, osg::State& state) const;
+        virtual void subload(const osg::Texture2D& texture, osg::State& state) const;
+
+    protected:
+        osg::ref_ptr<osg::Image> _image;
+        std::vector<osg::Vec4i> _pendingRects, _committedRects;
+        mutable osg::buffered_value<unsigned int> _uploadedVersions;
+        mutable OpenThreads::Mutex _mutex;
+        int _mergeGap; unsigned int _version;
+    };
+
     /** Quick event handler for testing purpose */
     class QuickEventHandler : public osgGA::GUIEventHandler
     {
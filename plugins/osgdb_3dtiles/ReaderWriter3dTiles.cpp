@@ -1,21 +1,28 @@
 #include <osg/io_utils>
+#include <osg/Version>
 #include <osg/ValueObject>
 #include <osg/Geometry>
 #include <osg/CoordinateSystemNode>
 #include <osg/MatrixTransform>
 #include <osg/ProxyNode>
 #include <osg/PagedLOD>
+#include <osg/CullStack>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 
 #include "3rdparty/rapidxml/rapidxml.hpp"
 #include "3rdparty/picojson.h"
 #include "pipeline/Global.h"
+#include "modeling/Math.h"
+#include <readerwriter/LoadSceneGLTF.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <limits.h>
 #define WRITE_TO_OSG 0
 
@@ -42,10 +49,259 @@ static std::vector<std::string> split(const std::string& src, const char* sepera
     return slist;
 }
 
+/** Parsed tileset JSON shared by all tiles created from it. Tiles are indexed in pre-order, so
+    that a PagedLOD only has to remember the tileset and its index to create children later */
+class TilesetDocument : public osg::Referenced
+{
+public:
+    TilesetDocument(const std::string& uri) : _uri(uri) {}
+    const std::string& getURI() const { return _uri; }
+
+    picojson::value& getDocument() { return _document; }
+    picojson::value& getRoot() { return _document.get("root"); }
+
+    /** Index all tiles, which must be called after the document is parsed and never changed */
+    void index()
+    {
+        _tiles.clear(); _indices.clear();
+        if (_document.is<picojson::object>() && getRoot().is<picojson::object>())
+            indexTile(getRoot());
+    }
+
+    picojson::value* getTile(int index)
+    { return (index >= 0 && index < (int)_tiles.size()) ? _tiles[index] : NULL; }
+
+    int getTileIndex(const picojson::value& tile) const
+    {
+        std::map<const picojson::value*, int>::const_iterator itr = _indices.find(&tile);
+        return (itr != _indices.end()) ? itr->second : -1;
+    }
+
+protected:
+    void indexTile(picojson::value& tile)
+    {
+        _indices[&tile] = (int)_tiles.size(); _tiles.push_back(&tile);
+        picojson::value& children = tile.get("children");
+        if (!children.is<picojson::array>()) return;
+
+        picojson::array& cArray = children.get<picojson::array>();
+        for (size_t i = 0; i < cArray.size(); ++i)
+        { if (cArray[i].is<picojson::object>()) indexTile(cArray[i]); }
+    }
+
+    picojson::value _document;
+    std::vector<picojson::value*> _tiles;
+    std::map<const picojson::value*, int> _indices;
+    std::string _uri;
+};
+
+/** PagedLOD of a tile, which is refined when screen-space error of its <geometricError> exceeds
+    the maximum in current view. The error is computed at cull time from the viewport and
+    projection of each camera, and children are requested with it as the priority */
+class TilesetPagedLOD : public osg::PagedLOD
+{
+public:
+    TilesetPagedLOD(double geometricError = 0.0, double maxSSE = 16.0, bool additive = false)
+    :   _geometricError(geometricError), _maxScreenSpaceError(maxSSE), _additive(additive) {}
+
+    TilesetPagedLOD(const TilesetPagedLOD& copy, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY)
+    :   osg::PagedLOD(copy, copyop), _geometricError(copy._geometricError),
+        _maxScreenSpaceError(copy._maxScreenSpaceError), _additive(copy._additive) {}
+    META_Node(osgVerse, TilesetPagedLOD)
+
+    void setGeometricError(double e) { _geometricError = e; }
+    double getGeometricError() const { return _geometricError; }
+
+    void setMaxScreenSpaceError(double e) { _maxScreenSpaceError = e; }
+    double getMaxScreenSpaceError() const { return _maxScreenSpaceError; }
+
+    /** Screen-space error in pixels, or a negative value if the visitor has no view */
+    double computeScreenSpaceError(osg::NodeVisitor& nv) const
+    {
+        osg::CullStack* cs = nv.asCullStack();
+        const osg::Viewport* vp = cs ? cs->getViewport() : NULL;
+        const osg::RefMatrix* proj = cs ? cs->getProjectionMatrix() : NULL;
+        if (!vp || !proj || cs->getLODScale() <= 0.0f) return -1.0;
+
+        // Pixels of a unit length: at unit distance for perspective, or anywhere for ortho
+        double pixels = (*proj)(1, 1) * vp->height() * 0.5;
+        if ((*proj)(3, 3) != 0.0) return _geometricError * pixels / cs->getLODScale();
+
+        const osg::BoundingSphere& bs = getBound();
+        double distance = nv.getDistanceToViewPoint(bs.center(), true) - bs.radius();
+        return _geometricError * pixels / osg::maximum(distance, 1e-4);
+    }
+
+    virtual void traverse(osg::NodeVisitor& nv)
+    {
+        double sse = (nv.getTraversalMode() == osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN)
+                   ? computeScreenSpaceError(nv) : -1.0;
+        if (sse < 0.0 || _children.empty() || _perRangeDataList.size() < 2)
+        { osg::PagedLOD::traverse(nv); return; }  // distance ranges for other visitors
+
+        const osg::FrameStamp* fs = nv.getFrameStamp();
+        bool updateTimeStamp = (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR);
+        if (fs && updateTimeStamp) setFrameNumberOfLastTraversal(fs->getFrameNumber());
+
+        bool refining = sse > _maxScreenSpaceError, loaded = _children.size() > 1;
+        if (_additive || !refining || !loaded) traverseChild(0, nv, fs, updateTimeStamp);
+        if (!refining) return;
+
+        if (loaded) traverseChild(1, nv, fs, updateTimeStamp);
+        else if (nv.getDatabaseRequestHandler())
+        {
+            // Larger errors are more visible, so the pager should load them first
+            PerRangeData& data = _perRangeDataList[1];
+            nv.getDatabaseRequestHandler()->requestNodeFile(
+                _databasePath + data._filename, nv.getNodePath(), (float)(sse / _maxScreenSpaceError),
+                fs, data._databaseRequest, _databaseOptions.get());
+        }
+    }
+
+protected:
+    void traverseChild(unsigned int i, osg::NodeVisitor& nv, const osg::FrameStamp* fs,
+                       bool updateTimeStamp)
+    {
+        if (fs && updateTimeStamp && i < _perRangeDataList.size())
+        {
+            _perRangeDataList[i]._timeStamp = fs->getReferenceTime();
+            _perRangeDataList[i]._frameNumber = fs->getFrameNumber();
+        }
+        _children[i]->accept(nv);
+    }
+
+    double _geometricError, _maxScreenSpaceError;
+    bool _additive;
+};
+
+/** Collect geometries of a tile as its content, and PagedLODs / external files as sub-tiles.
+    Transforms and states above geometries are flattened, so the content is saved as one model */
+class TileContentVisitor : public osg::NodeVisitor
+{
+public:
+    struct SubTile
+    {
+        osg::ref_ptr<osg::PagedLOD> pagedLOD;  // NULL for external files
+        osg::ref_ptr<osg::StateSet> stateSet;
+        std::string fileName; osg::Matrixd matrix;
+    };
+
+    TileContentVisitor(const std::string& dir, osg::StateSet* ss)
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _directory(dir)
+    {
+        _content = new osg::Group; _matrixStack.push_back(osg::Matrixd());
+        if (ss) _stateSetStack.push_back(ss);
+    }
+
+    osg::Group* getContent() { return _content.get(); }
+    const std::vector<SubTile>& getSubTiles() const { return _subTiles; }
+
+    virtual void apply(osg::Node& node)
+    {
+        pushStateSet(node.getStateSet());
+        traverse(node);
+        popStateSet(node.getStateSet());
+    }
+
+    virtual void apply(osg::Transform& node)
+    {
+        osg::Matrixd matrix = _matrixStack.back();
+        node.computeLocalToWorldMatrix(matrix, this);
+        _matrixStack.push_back(matrix);
+        apply(static_cast<osg::Node&>(node));
+        _matrixStack.pop_back();
+    }
+
+    virtual void apply(osg::Geode& node) { addContent(node); }
+#if OSG_VERSION_GREATER_THAN(3, 4, 1)
+    virtual void apply(osg::Drawable& node) { addContent(node); }
+#endif
+
+    virtual void apply(osg::PagedLOD& node)
+    {
+        SubTile sub; sub.pagedLOD = &node;
+        sub.stateSet = mergeStateSets(); sub.matrix = _matrixStack.back();
+        _subTiles.push_back(sub);
+    }
+
+    virtual void apply(osg::ProxyNode& node)
+    {
+        pushStateSet(node.getStateSet());
+        for (unsigned int i = 0; i < node.getNumFileNames(); ++i)
+        {
+            if (i < node.getNumChildren()) node.getChild(i)->accept(*this);
+            else if (!node.getFileName(i).empty())
+                addFile(getFullPath(node.getDatabasePath(), node.getFileName(i)));
+        }
+        popStateSet(node.getStateSet());
+    }
+
+    /** Apply to the PagedLOD of current tile: children in memory are its content, and the
+        children in files are sub-tiles, which share the same transform of current tile */
+    void applyPagedLOD(osg::PagedLOD& node)
+    {
+        pushStateSet(node.getStateSet());
+        for (unsigned int i = 0; i < node.getNumFileNames(); ++i)
+        {
+            if (!node.getFileName(i).empty())
+                addFile(getFullPath(node.getDatabasePath(), node.getFileName(i)));
+            else if (i < node.getNumChildren()) node.getChild(i)->accept(*this);
+        }
+        popStateSet(node.getStateSet());
+    }
+
+protected:
+    void pushStateSet(osg::StateSet* ss) { if (ss) _stateSetStack.push_back(ss); }
+    void popStateSet(osg::StateSet* ss) { if (ss) _stateSetStack.pop_back(); }
+
+    osg::StateSet* mergeStateSets() const
+    {
+        if (_stateSetStack.empty()) return NULL;
+        else if (_stateSetStack.size() == 1) return _stateSetStack.front();
+
+        osg::StateSet* ss = new osg::StateSet;
+        for (size_t i = 0; i < _stateSetStack.size(); ++i) ss->merge(*_stateSetStack[i]);
+        return ss;
+    }
+
+    std::string getFullPath(const std::string& dbPath, const std::string& fileName) const
+    {
+        if (osgDB::isAbsolutePath(fileName)) return fileName;
+        return osgDB::concatPaths(dbPath.empty() ? _directory : dbPath, fileName);
+    }
+
+    void addFile(const std::string& fileName)
+    {
+        SubTile sub; sub.fileName = fileName;
+        sub.stateSet = mergeStateSets(); sub.matrix = _matrixStack.back();
+        _subTiles.push_back(sub);
+    }
+
+    /** Add a copy of the Geode / Drawable sharing its arrays and states, so that the input
+        scene is never reparented (which may be traversed by other threads meanwhile) */
+    void addContent(osg::Node& node)
+    {
+        osg::ref_ptr<osg::Node> copied = osg::clone(&node, osg::CopyOp::DEEP_COPY_DRAWABLES);
+        osg::ref_ptr<osg::StateSet> ss = mergeStateSets();
+        const osg::Matrixd& matrix = _matrixStack.back();
+        if (!ss && matrix.isIdentity()) { _content->addChild(copied.get()); return; }
+
+        osg::MatrixTransform* mt = new osg::MatrixTransform(matrix);
+        mt->setStateSet(ss.get()); mt->addChild(copied.get());
+        _content->addChild(mt);
+    }
+
+    osg::ref_ptr<osg::Group> _content;
+    std::vector<SubTile> _subTiles;
+    std::vector<osg::Matrixd> _matrixStack;
+    std::vector<osg::StateSet*> _stateSetStack;
+    std::string _directory;
+};
+
 class ReaderWriter3dtiles : public osgDB::ReaderWriter
 {
 public:
-    ReaderWriter3dtiles() : _maxScreenSpaceError(16.0 * 0.1)
+    ReaderWriter3dtiles() : _maxScreenSpaceError(16.0)
     {
         _ellipsoid = new osg::EllipsoidModel;
         _subOptions = new osgDB::Options;
@@ -54,6 +310,10 @@ public:
         supportsExtension("xml", "coordinate file of ContextCapture (metadata.xml)");
         supportsExtension("json", "Decription file of 3dtiles");
         supportsExtension("children", "Internal use of 3dtiles' <children> tag");
+        supportsOption("MaxScreenSpaceError=<v>", "Maximum screen-space error in pixels, default is 16");
+        supportsOption("Version=<1.0/1.1>", "Writing: 3D Tiles version, using b3dm (1.0) or glb (1.1)");
+        supportsOption("UseDraco=<0/1>", "Writing: compress geometries with Draco");
+        supportsOption("UseKTX2=<0/1>", "Writing: save textures as KTX2 (Basis Universal)");
     }
 
     virtual const char* className() const
@@ -79,18 +339,37 @@ public:
         if (options) localOptions = options->cloneOptions();
         else localOptions = new osgDB::Options();
         localOptions->setPluginStringData("prefix", osgDB::getFilePath(path));
+        if (localOptions->getPluginStringData("max_sse").empty())
+        {
+            double maxSSE = getMaxScreenSpaceError(options);
+            localOptions->setPluginStringData("max_sse", std::to_string(maxSSE));
+        }
         if (ext == "children" && options)
         {
-            picojson::value children;
-            std::string err = picojson::parse(children, localOptions->getOptionString());
-            if (err.empty() && children.is<picojson::array>())
-                return createTileChildren(children.get<picojson::array>(),
+            // Find the parsed tileset from options of the PagedLOD, or the cache if not there
+            std::string uri = options->getPluginStringData("tileset");
+            osg::ref_ptr<TilesetDocument> doc = dynamic_cast<TilesetDocument*>(
+                const_cast<osg::Referenced*>(options->getUserData()));
+            if (!doc || doc->getURI() != uri) doc = getOrLoadTileset(uri);
+
+            int index = atoi(options->getPluginStringData("tile_index").c_str());
+            picojson::value* tile = doc.valid() ? doc->getTile(index) : NULL;
+            if (tile != NULL && tile->get("children").is<picojson::array>())
+                return createTileChildren(doc.get(), tile->get("children").get<picojson::array>(),
                                           osgDB::getStrippedName(fileName), localOptions.get());
             else
-                OSG_WARN << "[ReaderWriter3dtiles] Failed to parse from "
-                         << options->getOptionString() << ": " << err << std::endl;
+                OSG_WARN << "[ReaderWriter3dtiles] Failed to find children of tile " << index
+                         << " in " << uri << std::endl;
             return ReadResult::ERROR_IN_READING_FILE;
         }
+        else if (ext == "json")
+        {
+            // Tilesets may be referred by multiple tiles, or reloaded after expired by the pager
+            osg::ref_ptr<TilesetDocument> doc = getOrLoadTileset(fileName);
+            if (!doc) return ReadResult::FILE_NOT_FOUND;
+            localOptions->setPluginStringData("simple_name", osgDB::getStrippedName(fileName));
+            return createFromTileset(doc.get(), localOptions.get());
+        }
         else
         {
             std::ifstream fin(fileName.c_str());
@@ -123,29 +402,441 @@ public:
                 return ReadResult::ERROR_IN_READING_FILE;
         }
 
-        picojson::value document;
-        std::string err = picojson::parse(document, fin);
-        if (err.empty())
+        // Tileset from a stream: it is not cached but kept by its PagedLODs
+        osg::ref_ptr<TilesetDocument> doc = parseTileset(fin, "");
+        if (!doc) return ReadResult::ERROR_IN_READING_FILE;
+        return createFromTileset(doc.get(), options);
+    }
+
+    /** Write the scene as a tileset, which is usually an OSGB PagedLOD hierarchy (e.g., created
+        by TileOptimizer or read from metadata.xml). Every PagedLOD becomes a REPLACE tile, whose
+        in-memory children are the content and children in files are sub-tiles; contents of
+        each level are converted to b3dm/glb in parallel. The root is georeferenced from SRS and
+        SRSOrigin of the scene (see getRootTransform()) */
+    virtual WriteResult writeNode(const osg::Node& node, const std::string& path,
+                                  const osgDB::Options* options) const
+    {
+        std::string fileName(path);
+        std::string ext = osgDB::getLowerCaseFileExtension(path);
+        if (!acceptsExtension(ext)) return WriteResult::FILE_NOT_HANDLED;
+
+        if (ext == "verse_tiles")
+        {
+            fileName = osgDB::getNameLessExtension(path);
+            ext = osgDB::getLowerCaseFileExtension(fileName);
+        }
+        if (ext != "json") return WriteResult::FILE_NOT_HANDLED;
+
+        std::string version = getOptionValue(options, "Version", "1.0");
+        if (version != "1.0" && version != "1.1")
         {
-            picojson::value& root = document.get("root");
-            if (root.is<picojson::object>())
+            OSG_WARN << "[ReaderWriter3dtiles] Unsupported version " << version
+                     << ", which should be 1.0 or 1.1" << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        osg::ref_ptr<osgDB::Options> gltfOptions = new osgDB::Options;
+        gltfOptions->setPluginStringData("UseDraco", getOptionValue(options, "UseDraco", "0"));
+        gltfOptions->setPluginStringData("UseKTX2", getOptionValue(options, "UseKTX2", "0"));
+        double maxSSE = getMaxScreenSpaceError(options);
+        std::string prefix = osgDB::getFilePath(fileName);
+
+        // Breadth-first: tiles of the same level are loaded and encoded in parallel, and then
+        // their sub-tiles are appended in order, so that parents always have smaller indices
+        std::vector<TileRecord> tiles(1);
+        tiles[0].node = const_cast<osg::Node*>(&node);
+        size_t levelStart = 0, levelEnd = 1;
+        for (int level = 0; levelStart < levelEnd; ++level)
+        {
+            std::string folder = "tiles/L" + std::to_string(level);
+            osgDB::makeDirectory(osgDB::concatPaths(prefix, folder));
+
+            int numTiles = (int)(levelEnd - levelStart);
+            std::vector<std::vector<TileRecord>> subTiles(numTiles);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < numTiles; ++i)
             {
-                std::string name = options ? options->getPluginStringData("simple_name") : "";
-                osg::ref_ptr<osg::Node> node = createTile(root, prefix, name, "", options);
-#if WRITE_TO_OSG
-                osgDB::writeNodeFile(*node, prefix + "/root.osgt");
-#endif
-                if (node.valid()) return node.get();
+                int index = (int)levelStart + i;
+                std::string uri = folder + "/" + std::to_string(index) +
+                                  (version == "1.0" ? ".b3dm" : ".glb");
+                processTile(tiles[index], subTiles[i], prefix, uri, maxSSE, gltfOptions.get());
+            }
+
+            for (int i = 0; i < numTiles; ++i)
+            {
+                int parent = (int)levelStart + i;
+                for (size_t j = 0; j < subTiles[i].size(); ++j)
+                {
+                    subTiles[i][j].parent = parent;
+                    tiles[parent].children.push_back((int)tiles.size());
+                    tiles.push_back(subTiles[i][j]);
+                }
+            }
+            levelStart = levelEnd; levelEnd = tiles.size();
+        }
+        finishTiles(tiles);
+        tiles[0].transform = getRootTransform(node);
+
+        picojson::object asset, document;
+        asset["version"] = picojson::value(version);
+        asset["generator"] = picojson::value(std::string("osgVerse"));
+        document["asset"] = picojson::value(asset);
+        document["geometricError"] = picojson::value(tiles[0].error);
+        document["root"] = createTileJson(tiles, 0);
+
+        std::ofstream out(fileName.c_str());
+        if (!out)
+        {
+            OSG_WARN << "[ReaderWriter3dtiles] Failed to write " << fileName << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        out << picojson::value(document).serialize(true);
+        return WriteResult::FILE_SAVED;
+    }
+
+protected:
+    struct TileRecord
+    {
+        TileRecord() : parent(-1), error(-1.0), additive(true) {}
+        osg::ref_ptr<osg::Node> node;  // PagedLOD of REPLACE tiles, or the root node
+        osg::ref_ptr<osg::StateSet> stateSet;
+        std::string fileName, content;
+        std::vector<int> children;
+        osg::Matrixd transform;
+        osg::BoundingSphered bound;
+        int parent; double error; bool additive;
+    };
+
+    /** Load (if from file), collect and write content of the tile, and find its sub-tiles */
+    void processTile(TileRecord& tile, std::vector<TileRecord>& subTiles, const std::string& prefix,
+                     const std::string& uri, double maxSSE, const osgDB::Options* gltfOptions) const
+    {
+        osg::ref_ptr<osg::Node> node = tile.node; tile.node = NULL;
+        if (!tile.fileName.empty())
+        {
+            node = osgDB::readNodeFile(tile.fileName);
+            if (!node) OSG_WARN << "[ReaderWriter3dtiles] Failed to read " << tile.fileName << std::endl;
+        }
+        if (!node) return;
+
+        osg::ref_ptr<TileContentVisitor> tcv =
+            new TileContentVisitor(osgDB::getFilePath(tile.fileName), tile.stateSet.get());
+        osg::PagedLOD* plod = tile.additive ? NULL : dynamic_cast<osg::PagedLOD*>(node.get());
+        {
+            // Copying drawables and merging state sets change parent lists of shared state sets
+            // and attributes, which must not be done by multiple threads at the same time
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_contentMutex);
+            if (plod != NULL)
+            {
+                tile.error = computeGeometricError(*plod, maxSSE);
+                tcv->applyPagedLOD(*plod);
+            }
+            else node->accept(*tcv);
+        }
+
+        osg::Group* content = tcv->getContent();
+        if (content->getNumChildren() > 0)
+        {
+            if (writeContent(*content, osgDB::concatPaths(prefix, uri), gltfOptions))
+            {
+                const osg::BoundingSphere& bs = content->getBound();
+                tile.content = uri; tile.bound.set(bs.center(), bs.radius());
+            }
+            else
+                OSG_WARN << "[ReaderWriter3dtiles] Failed to write content " << uri << std::endl;
+        }
+
+        const std::vector<TileContentVisitor::SubTile>& subs = tcv->getSubTiles();
+        for (size_t i = 0; i < subs.size(); ++i)
+        {
+            TileRecord sub; sub.node = subs[i].pagedLOD; sub.stateSet = subs[i].stateSet;
+            sub.fileName = subs[i].fileName; sub.transform = subs[i].matrix;
+            sub.additive = !subs[i].pagedLOD; subTiles.push_back(sub);
+        }
+
+        // Copied contents and the source node (often the last reference to a loaded file, whose
+        // state sets may be shared with sibling tiles) are also released with the lock
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_contentMutex);
+        tcv = NULL; plod = NULL; node = NULL;
+    }
+
+    /** Geometric error from the range where the PagedLOD loads its file child, as the inverse
+        of fallback ranges computed when reading; negative if it should follow the parent */
+    double computeGeometricError(osg::PagedLOD& plod, double maxSSE) const
+    {
+        for (unsigned int i = 0; i < plod.getNumFileNames() && i < plod.getNumRanges(); ++i)
+        {
+            if (plod.getFileName(i).empty()) continue;
+            if (plod.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN)
+            {
+                // Pixel size of the radius reaches the minimum when its error reaches maxSSE
+                double radius = (plod.getRadius() > 0.0f) ? plod.getRadius() : plod.getBound().radius();
+                float minPixels = plod.getMinRange(i);
+                return (minPixels > 0.0f) ? radius * maxSSE / minPixels : -1.0;
             }
             else
-                OSG_WARN << "[ReaderWriter3dtiles] Bad <root> type" << std::endl;
+                return plod.getMaxRange(i) * maxSSE * 0.5359 / 1080.0;
+        }
+        return -1.0;
+    }
+
+    /** Fix geometric errors, remove empty tiles and compute bounds after all tiles are processed.
+        Parents always have smaller indices, so a reversed loop is bottom-up */
+    void finishTiles(std::vector<TileRecord>& tiles) const
+    {
+        // The root (always added) refines at twice the largest error; a tile can't have a larger
+        // error than its parent, and tiles from files refine together with their parents
+        std::vector<double> maxErrors(tiles.size(), 0.0);
+        for (int i = (int)tiles.size() - 1; i > 0; --i)
+        {
+            double e = osg::maximum(maxErrors[i], tiles[i].error);
+            maxErrors[tiles[i].parent] = osg::maximum(maxErrors[tiles[i].parent], e);
+        }
+
+        tiles[0].error = maxErrors[0] * 2.0;
+        for (size_t i = 1; i < tiles.size(); ++i)
+        {
+            TileRecord& tile = tiles[i]; double parentError = tiles[tile.parent].error;
+            if (tile.additive || tile.error < 0.0) tile.error = parentError;
+            else tile.error = osg::minimum(tile.error, parentError);
+        }
+
+        // Replace tiles from files without content by their children, and remove empty tiles
+        for (int i = (int)tiles.size() - 1; i > 0; --i)
+        {
+            TileRecord& tile = tiles[i];
+            if (!tile.content.empty() || !(tile.additive || tile.children.empty())) continue;
+
+            std::vector<int>& siblings = tiles[tile.parent].children;
+            std::vector<int>::iterator itr = std::find(siblings.begin(), siblings.end(), i);
+            if (itr == siblings.end()) continue;
+            itr = siblings.erase(itr);
+            for (size_t j = 0; j < tile.children.size(); ++j)
+            {
+                TileRecord& child = tiles[tile.children[j]];
+                child.transform = child.transform * tile.transform; child.parent = tile.parent;
+            }
+            siblings.insert(itr, tile.children.begin(), tile.children.end());
+            tile.children.clear(); tile.parent = 0;
+        }
+
+        // Bounding spheres in coordinates of each tile, united from content and children
+        for (int i = (int)tiles.size() - 1; i >= 0; --i)
+        {
+            TileRecord& tile = tiles[i];
+            for (size_t j = 0; j < tile.children.size(); ++j)
+            {
+                const TileRecord& child = tiles[tile.children[j]];
+                if (!child.bound.valid()) continue;
+
+                const osg::Matrixd& m = child.transform;
+                osg::Vec3d scale = m.getScale();
+                double maxScale = osg::maximum(scale[0], osg::maximum(scale[1], scale[2]));
+                tile.bound.expandBy(osg::BoundingSphered(
+                    child.bound.center() * m, child.bound.radius() * maxScale));
+            }
+        }
+    }
+
+    picojson::value createTileJson(const std::vector<TileRecord>& tiles, int index) const
+    {
+        const TileRecord& tile = tiles[index];
+        const osg::BoundingSphered& bs = tile.bound;
+        picojson::array sphere(4, picojson::value(0.0));
+        if (bs.valid())
+        {
+            sphere[0] = picojson::value(bs.center()[0]); sphere[1] = picojson::value(bs.center()[1]);
+            sphere[2] = picojson::value(bs.center()[2]); sphere[3] = picojson::value(bs.radius());
+        }
+
+        picojson::object obj, bound; bound["sphere"] = picojson::value(sphere);
+        obj["boundingVolume"] = picojson::value(bound);
+        obj["geometricError"] = picojson::value(tile.children.empty() ? 0.0 : tile.error);
+        obj["refine"] = picojson::value(std::string(tile.additive ? "ADD" : "REPLACE"));
+        if (!tile.transform.isIdentity())
+        {
+            picojson::array matrix;  // column-major, same as OSG matrix in memory
+            for (int i = 0; i < 16; ++i) matrix.push_back(picojson::value(tile.transform.ptr()[i]));
+            obj["transform"] = picojson::value(matrix);
+        }
+
+        if (!tile.content.empty())
+        {
+            picojson::object content; content["uri"] = picojson::value(tile.content);
+            obj["content"] = picojson::value(content);
+        }
+
+        if (!tile.children.empty())
+        {
+            picojson::array children;
+            for (size_t i = 0; i < tile.children.size(); ++i)
+                children.push_back(createTileJson(tiles, tile.children[i]));
+            obj["children"] = picojson::value(children);
+        }
+        return picojson::value(obj);
+    }
+
+    /** Save GLB content, or wrap it in b3dm with a feature table containing BATCH_LENGTH only */
+    bool writeContent(const osg::Node& content, const std::string& file,
+                      const osgDB::Options* gltfOptions) const
+    {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        if (!osgVerse::saveGltf2(content, ss, true, gltfOptions)) return false;
+
+        std::ofstream out(file.c_str(), std::ios::out | std::ios::binary);
+        if (!out) return false;
+
+        std::string glb = ss.str();
+        if (osgDB::getLowerCaseFileExtension(file) == "b3dm")
+        {
+            // Feature table and body must both end at 8-byte boundaries
+            unsigned int header[7] = { 0, 1, 0, 0, 0, 0, 0 }, hSize = sizeof(header);
+            std::string featureTable = "{\"BATCH_LENGTH\":0}";
+            while ((hSize + featureTable.size()) % 8) featureTable.push_back(' ');
+            while (glb.size() % 8) glb.push_back('\0');
+
+            memcpy(header, "b3dm", 4); header[3] = (unsigned int)featureTable.size();
+            header[2] = hSize + header[3] + (unsigned int)glb.size();
+            out.write((char*)header, hSize);
+            out.write(featureTable.data(), featureTable.size());
+        }
+        out.write(glb.data(), glb.size());
+        return out.good();
+    }
+
+    /** Root transform from SRS and SRSOrigin of ContextCapture (see createFromMetadata()):
+        - ENU:lat,lon: east-north-up coordinates at the location, offset by SRSOrigin
+        - EPSG:4978: SRSOrigin is already in ECEF coordinates
+        - EPSG:3857 and UTM (EPSG:326xx / 327xx): SRSOrigin is reprojected to ECEF, and tiles
+          are placed in the east-north-up frame there (grid convergence is ignored)
+        Other SRS (e.g., WKT or other EPSG codes) are only translated by SRSOrigin */
+    osg::Matrixd getRootTransform(const osg::Node& node) const
+    {
+        std::string srs; osg::Vec3d origin;
+        node.getUserValue("SRSOrigin", origin);
+        if (!node.getUserValue("SRS", srs) || srs.empty()) return osg::Matrixd::translate(origin);
+
+        double latitude = 0.0, longitude = 0.0, scale = 1.0; bool supported = true;
+        if (srs.find("ENU:") == 0)
+        {
+            std::vector<std::string> coords = split(srs.substr(4), ",", true);
+            if (coords.size() < 2) return osg::Matrixd::translate(origin);
+            latitude = osg::DegreesToRadians(atof(coords[0].c_str()));
+            longitude = osg::DegreesToRadians(atof(coords[1].c_str()));
+        }
+        else if (srs.find("EPSG:") == 0)
+        {
+            int code = atoi(srs.substr(5).c_str());
+            if (code == 4978) return osg::Matrixd::translate(origin);
+            else if (code == 3857)
+            {
+                // Web Mercator takes (y, x) and returns (lat, lon); its lengths are scaled by 1/cos(lat)
+                osg::Vec3d lla = osgVerse::Coordinate::convertWebMercatorToLLA(
+                    osg::Vec3d(origin.y(), origin.x(), 0.0));
+                latitude = lla[0]; longitude = lla[1]; scale = cos(latitude);
+            }
+            else if ((code > 32600 && code <= 32660) || (code > 32700 && code <= 32760))
+            {
+                // UTM conversion returns (lon, lat)
+                osg::Vec3d lla = osgVerse::Coordinate::convertUTMtoLLA(
+                    osg::Vec3d(origin.x(), origin.y(), 0.0), osgVerse::Coordinate::UTM(code));
+                latitude = lla[1]; longitude = lla[0];
+            }
+            else supported = false;
+            if (supported) { origin.x() = 0.0; origin.y() = 0.0; }  // now at the ENU center
+        }
+        else supported = false;
+
+        if (!supported)
+        {
+            OSG_WARN << "[ReaderWriter3dtiles] Unsupported SRS " << srs << ", tileset is "
+                     << "not georeferenced but only translated by SRSOrigin" << std::endl;
+            return osg::Matrixd::translate(origin);
+        }
+
+        osg::Matrixd localToWorld;
+        _ellipsoid->computeLocalToWorldTransformFromLatLongHeight(
+            latitude, longitude, 0.0, localToWorld);
+        return osg::Matrixd::scale(scale, scale, 1.0) * osg::Matrixd::translate(origin) * localToWorld;
+    }
+
+    std::string getOptionValue(const osgDB::Options* options, const std::string& key,
+                               const std::string& defaultValue) const
+    {
+        std::string optionString = options ? options->getOptionString() : "";
+        std::istringstream iss(optionString); std::string opt;
+        while (iss >> opt)
+        {
+            size_t pos = opt.find('=');
+            if (pos != std::string::npos && opt.substr(0, pos) == key) return opt.substr(pos + 1);
+        }
+        return defaultValue;
+    }
+
+    double getMaxScreenSpaceError(const osgDB::Options* options) const
+    {
+        std::string value = getOptionValue(options, "MaxScreenSpaceError", "");
+        return value.empty() ? _maxScreenSpaceError : atof(value.c_str());
+    }
+
+    osg::ref_ptr<TilesetDocument> parseTileset(std::istream& fin, const std::string& uri) const
+    {
+        osg::ref_ptr<TilesetDocument> doc = new TilesetDocument(uri);
+        std::string err = picojson::parse(doc->getDocument(), fin);
+        if (!err.empty())
+        {
+            OSG_WARN << "[ReaderWriter3dtiles] Failed to parse JSON " << uri << ": "
+                     << err << std::endl; return NULL;
+        }
+        doc->index(); return doc;
+    }
+
+    /** Get parsed tileset from cache, or parse it again if no tile refers to it now */
+    osg::ref_ptr<TilesetDocument> getOrLoadTileset(const std::string& uri) const
+    {
+        osg::ref_ptr<TilesetDocument> doc;
+        if (uri.empty()) return NULL;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tilesetMutex);
+            std::map<std::string, osg::observer_ptr<TilesetDocument>>::iterator itr =
+                _tilesets.find(uri);
+            if (itr != _tilesets.end() && itr->second.lock(doc)) return doc;
+        }
+
+        std::ifstream fin(uri.c_str());
+        if (!fin) return NULL;
+        doc = parseTileset(fin, uri);
+        if (!doc) return NULL;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tilesetMutex);
+        osg::ref_ptr<TilesetDocument> doc2;  // another thread may have parsed it meanwhile
+        if (_tilesets[uri].lock(doc2)) return doc2;
+        _tilesets[uri] = doc.get();
+
+        std::map<std::string, osg::observer_ptr<TilesetDocument>>::iterator itr = _tilesets.begin();
+        while (itr != _tilesets.end())
+        { if (!itr->second.valid()) _tilesets.erase(itr++); else ++itr; }
+        return doc;
+    }
+
+    ReadResult createFromTileset(TilesetDocument* doc, const osgDB::Options* options) const
+    {
+        picojson::value* root = doc->getTile(0);  // the <root> tile if indexed
+        if (root != NULL)
+        {
+            std::string prefix = options ? options->getPluginStringData("prefix") : "";
+            std::string name = options ? options->getPluginStringData("simple_name") : "";
+            osg::ref_ptr<osg::Node> node = createTile(doc, *root, prefix, name, "", options);
+#if WRITE_TO_OSG
+            osgDB::writeNodeFile(*node, prefix + "/root.osgt");
+#endif
+            if (node.valid()) return node.get();
         }
         else
-            OSG_WARN << "[ReaderWriter3dtiles] Failed to parse JSON: " << err << std::endl;
+            OSG_WARN << "[ReaderWriter3dtiles] Bad <root> type" << std::endl;
         return ReadResult::ERROR_IN_READING_FILE;
     }
 
-protected:
     osg::Node* createFromMetadata(const std::string& prefix, char* srs, char* origin) const
     {
         std::string dataFolder = prefix + "/Data/";
@@ -198,17 +889,19 @@ protected:
         return tileProxy.release();
     }
     
-    osg::Node* createTileChildren(picojson::array& children, const std::string& name,
-                                  const osgDB::Options* localOptions) const
+    osg::Node* createTileChildren(TilesetDocument* doc, picojson::array& children,
+                                  const std::string& name, const osgDB::Options* localOptions) const
     {
         osg::ref_ptr<osgDB::Options> opt = _subOptions->cloneOptions();
+        opt->setPluginStringData("max_sse", localOptions->getPluginStringData("max_sse"));
         std::string refine = localOptions->getPluginStringData("refinement");
         std::string prefix = localOptions->getPluginStringData("prefix");
 
         osg::Group* group = new osg::Group;
         for (size_t i = 0; i < children.size(); ++i)
         {
-            osg::ref_ptr<osg::Node> child = createTile(children[i], prefix, name, refine, opt.get());
+            osg::ref_ptr<osg::Node> child =
+                createTile(doc, children[i], prefix, name, refine, opt.get());
             if (child.valid()) group->addChild(child.get());
         }
 
@@ -223,10 +916,13 @@ protected:
         return group;
     }
 
-    osg::Node* createTile(picojson::value& root, const std::string& prefix, const std::string& name,
-                          const std::string& parentRefine, const osgDB::Options* options) const
+    osg::Node* createTile(TilesetDocument* doc, picojson::value& root, const std::string& prefix,
+                          const std::string& name, const std::string& parentRefine,
+                          const osgDB::Options* options) const
     {
         osg::ref_ptr<osgDB::Options> opt = _subOptions->cloneOptions();
+        std::string maxSSE = options ? options->getPluginStringData("max_sse") : "";
+        opt->setPluginStringData("max_sse", maxSSE);  // for external tilesets in <content>
         picojson::value& bound = root.get("boundingVolume");
         picojson::value& content = root.get("content");
         picojson::value& rangeV = root.get("geometricError");
@@ -234,17 +930,16 @@ protected:
         picojson::value& children = root.get("children");
         picojson::value& trans = root.get("transform");
 
-        double range = rangeV.is<double>() ? rangeV.get<double>() : 0.0;
-        double sseDenominator = 0.5629, height = 1080.0; // FIXME
-        if (range < 0.0 || range > 99999.0) range = FLT_MAX;  // invalid range
-        range = (range * height) / (_maxScreenSpaceError * sseDenominator);
+        double error = rangeV.is<double>() ? rangeV.get<double>() : 0.0;
+        if (error < 0.0 || error > 99999.0) error = FLT_MAX;  // invalid error: always refine
 
         osg::BoundingSphered bs = getBoundingSphere(bound);
         std::string st = rangeSt.is<std::string>() ? rangeSt.get<std::string>() : "";
         if (st.empty()) st = parentRefine;
 
         osg::ref_ptr<osg::Node> tile = createTile(
-            content, children, bs, range, st, prefix, name, opt.get());
+            doc, doc->getTileIndex(root), content, children, bs, error,
+            maxSSE.empty() ? _maxScreenSpaceError : atof(maxSSE.c_str()), st, prefix, name, opt.get());
         if (trans.is<picojson::array>())
         {
             picojson::array& tArray = trans.get<picojson::array>();
@@ -260,8 +955,10 @@ protected:
         else return tile.release();
     }
 
-    osg::Node* createTile(picojson::value& content, picojson::value& children,
-                          const osg::BoundingSphered& bound, double range, const std::string& st,
+    osg::Node* createTile(TilesetDocument* doc, int tileIndex,
+                          picojson::value& content, picojson::value& children,
+                          const osg::BoundingSphered& bound, double geometricError, double maxSSE,
+                          const std::string& st,
                           const std::string& prefix, const std::string& name,
                           const osgDB::Options* options) const
     {
@@ -284,7 +981,7 @@ protected:
             if (ext == "json") child0 = osgDB::readNodeFile(uri + ".verse_tiles", options);
             else if (!ext.empty()) child0 = osgDB::readNodeFile(uri + ".verse_gltf", options);
 
-            osg::PagedLOD* plod = new osg::PagedLOD;
+            osg::PagedLOD* plod = new TilesetPagedLOD(geometricError, maxSSE, additive);
             plod->setDatabasePath(prefix);
             plod->addChild(child0.valid() ? child0.get() : new osg::Node);
             if (!child0 && !uri.empty())
@@ -294,11 +991,16 @@ protected:
                 plod->getChild(0)->setName(uri);
             }
 
-            // Put <children> to a virtual file with options to fit OSG's LOD structure
+            // Refer <children> by a virtual file with options to fit OSG's LOD structure. Options
+            // only keep the parsed tileset and index of current tile, without copying the JSON
             osgDB::StringList parts; osgDB::split(name, parts, '-');
-            osgDB::Options* childOpt = new osgDB::Options(children.serialize());
+            osgDB::Options* childOpt = new osgDB::Options;
+            childOpt->setUserData(doc);
+            childOpt->setPluginStringData("tileset", doc->getURI());
+            childOpt->setPluginStringData("tile_index", std::to_string(tileIndex));
             childOpt->setPluginStringData("fallback", uri + (ext == "json" ? ".verse_tiles" : ".verse_gltf"));
             childOpt->setPluginStringData("refinement", st);
+            childOpt->setPluginStringData("max_sse", std::to_string(maxSSE));
             plod->setDatabaseOptions(childOpt);
             plod->setFileName(1, name + "-" + std::to_string(parts.size()) + ".children.verse_tiles");
 
@@ -324,17 +1026,14 @@ protected:
             }
             else
                 OSG_WARN << "[ReaderWriter3dtiles] Missing <boundingVolume>?" << std::endl;
-#if true
+
+            // Culling uses screen-space errors; ranges are only for visitors without a view,
+            // assuming a 1080p viewport with vertical FOV of 30 degrees (2 * tan(15) = 0.5359)
+            double range = (geometricError * 1080.0) / (maxSSE * 0.5359);
             plod->setRangeMode(osg::LOD::DISTANCE_FROM_EYE_POINT);
             if (additive) plod->setRange(0, 0.0f, FLT_MAX);
-            else plod->setRange(0, (float)range * 0.25f, FLT_MAX);
-            plod->setRange(1, 0.0f, (float)range * 0.25f);
-#else
-            plod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
-            if (additive) plod->setRange(0, 0.0f, FLT_MAX);
-            else plod->setRange(0, 0.0f, 5000.0f / (float)range);
-            plod->setRange(1, 5000.0f / (float)range, FLT_MAX);
-#endif
+            else plod->setRange(0, (float)range, FLT_MAX);
+            plod->setRange(1, 0.0f, (float)range);
             return plod;
         }
         else
@@ -404,6 +1103,8 @@ protected:
 
     osg::ref_ptr<osg::EllipsoidModel> _ellipsoid;
     osg::ref_ptr<osgDB::Options> _subOptions;
+    mutable std::map<std::string, osg::observer_ptr<TilesetDocument>> _tilesets;
+    mutable OpenThreads::Mutex _tilesetMutex, _contentMutex;
     double _maxScreenSpaceError;
 };
 
@@ -7,6 +7,8 @@
 #include <osgDB/Registry>
 #include <osgDB/ConvertUTF>
 #include <readerwriter/LoadSceneGLTF.h>
+#include <mio.hpp>
+#include <sstream>
 
 class ReaderWriterGLTF : public osgDB::ReaderWriter
 {
@@ -21,6 +23,8 @@ public:
         supportsExtension("cmpt", "Cesium cmposite tiles");
         supportsOption("Directory", "Setting the working directory");
         supportsOption("Mode", "Set to 'ascii/binary' to read specific GLTF data");
+        supportsOption("UseDraco=<0/1>", "Writing: compress geometries with Draco");
+        supportsOption("UseKTX2=<0/1>", "Writing: save textures as KTX2 (Basis Universal)");
     }
 
     virtual const char* className() const
@@ -76,36 +80,97 @@ public:
         return osgVerse::loadGltf2(fin, dir, isBinary).get();
     }
 
+    virtual WriteResult writeNode(const osg::Node& node, const std::string& path,
+                                  const osgDB::Options* options) const
+    {
+        std::string fileName(path);
+        std::string ext = osgDB::getLowerCaseFileExtension(path);
+        if (!acceptsExtension(ext)) return WriteResult::FILE_NOT_HANDLED;
+
+        bool usePseudo = (ext == "verse_gltf");
+        if (usePseudo)
+        {
+            fileName = osgDB::getNameLessExtension(path);
+            ext = osgDB::getLowerCaseFileExtension(fileName);
+        }
+        if (ext != "gltf" && ext != "glb") return WriteResult::FILE_NOT_HANDLED;
+
+        osg::ref_ptr<osgDB::Options> saveOptions = createSaveOptions(options);
+        if (!osgVerse::saveGltf(node, fileName, ext == "glb", saveOptions.get()))
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        return WriteResult::FILE_SAVED;
+    }
+
+    virtual WriteResult writeNode(const osg::Node& node, std::ostream& fout,
+                                  const osgDB::Options* options) const
+    {
+        std::string mode = options ? options->getPluginStringData("Mode") : "";
+        std::transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+
+        osg::ref_ptr<osgDB::Options> saveOptions = createSaveOptions(options);
+        if (!osgVerse::saveGltf2(node, fout, mode == "binary", saveOptions.get()))
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        return WriteResult::FILE_SAVED;
+    }
+
 protected:
+    /** Option string like "UseDraco=1 UseKTX2=1" to plugin string data used by saveGltf() */
+    osgDB::Options* createSaveOptions(const osgDB::Options* options) const
+    {
+        osgDB::Options* saveOptions = options ? options->cloneOptions() : new osgDB::Options;
+        std::istringstream iss(saveOptions->getOptionString()); std::string opt;
+        while (iss >> opt)
+        {
+            size_t pos = opt.find('=');
+            if (pos != std::string::npos)
+                saveOptions->setPluginStringData(opt.substr(0, pos), opt.substr(pos + 1));
+        }
+        return saveOptions;
+    }
+
     osg::Group* readCesiumFormatCmpt(const std::string& fileName, const std::string& dir) const
     {
-        std::ifstream fin(fileName, std::ios::in | std::ios::binary);
-        if (!fin) return NULL;
+        // Map the whole file and load inner tiles from the mapping without extra copies,
+        // or read it into memory if mapping is not possible
+        std::error_code error; mio::mmap_source mapping; std::vector<char> fileData;
+        const char* data = NULL; size_t dataSize = 0;
+        mapping.map(fileName, error);
+        if (!error && mapping.size() > 0)
+            { data = mapping.data(); dataSize = mapping.size(); }
+        else
+        {
+            std::ifstream fin(fileName, std::ios::in | std::ios::binary);
+            if (!fin) return NULL;
 
-        unsigned char magic[4]; unsigned int version = 0, bytes = 0, tiles = 0;
-        fin.read((char*)magic, sizeof(char) * 4); fin.read((char*)&version, sizeof(int));
-        fin.read((char*)&bytes, sizeof(int)); fin.read((char*)&tiles, sizeof(int));
-        if (magic[0] != 'c' || magic[1] != 'm' || magic[2] != 'p' || magic[3] != 't') return NULL;
+            std::istreambuf_iterator<char> eos;
+            fileData.assign(std::istreambuf_iterator<char>(fin), eos);
+            if (!fileData.empty()) { data = &fileData[0]; dataSize = fileData.size(); }
+        }
+
+        // magic + version + byteLength + tilesLength, and then inner tiles
+        unsigned int version = 0, bytes = 0, tiles = 0, headerSize = 4 + sizeof(int) * 3;
+        if (dataSize < headerSize) return NULL;
+        memcpy(&version, data + 4, sizeof(int)); memcpy(&bytes, data + 8, sizeof(int));
+        memcpy(&tiles, data + 12, sizeof(int));
+        if (data[0] != 'c' || data[1] != 'm' || data[2] != 'p' || data[3] != 't') return NULL;
 
         osg::ref_ptr<osg::Group> group = new osg::Group;
+        size_t offset = headerSize;
         for (unsigned int t = 0; t < tiles; ++t)
         {
-            std::stringstream binaryData;
-            fin.read((char*)magic, sizeof(char) * 4); binaryData.write((char*)magic, sizeof(char) * 4);
-            fin.read((char*)&version, sizeof(int)); binaryData.write((char*)&version, sizeof(int));
-            fin.read((char*)&bytes, sizeof(int)); binaryData.write((char*)&bytes, sizeof(int));
-
-            std::vector<unsigned char> remain(bytes - sizeof(char) * 4 - sizeof(int) * 2);
-            if (!remain.empty())
+            // Every inner tile starts with magic + version + byteLength
+            if (offset + 4 + sizeof(int) * 2 > dataSize) break;
+            const char* magic = data + offset; memcpy(&bytes, magic + 8, sizeof(int));
+            if (bytes < 4 + sizeof(int) * 2 || offset + bytes > dataSize)
             {
-                fin.read((char*)&remain[0], remain.size());
-                binaryData.write((char*)&remain[0], remain.size());
+                OSG_NOTICE << "[ReaderWriterGLTF] Invalid inner tile size " << bytes
+                           << ", found in " << fileName << std::endl; break;
             }
 
             if ((magic[0] == 'b' && magic[1] == '3' && magic[2] == 'd' && magic[3] == 'm') ||
                 (magic[0] == 'i' && magic[1] == '3' && magic[2] == 'd' && magic[3] == 'm'))
             {
-                osg::ref_ptr<osg::Node> child = osgVerse::loadGltf2(binaryData, dir, true);
+                osg::ref_ptr<osg::Node> child = osgVerse::loadGltf2(magic, bytes, dir, true);
                 if (child.valid()) group->addChild(child.get());
             }
             else
@@ -113,6 +178,7 @@ protected:
                 OSG_NOTICE << "[ReaderWriterGLTF] Unknown format: " << std::string(magic, magic + 4)
                            << ", found in " << fileName << std::endl;
             }
+            offset += bytes;
         }
         group->setName(fileName); return group.release();
     }
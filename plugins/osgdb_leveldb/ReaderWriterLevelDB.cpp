@@ -1,19 +1,220 @@
 #include <osg/io_utils>
+#include <osg/Version>
 #include <osg/Geometry>
+#include <osg/Texture2D>
 #include <osg/MatrixTransform>
 #include <osg/PagedLOD>
+#include <osg/Timer>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 #include <osgDB/Archive>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <readerwriter/Utilities.h>
 #include "3rdparty/leveldb/db.h"
+#include "3rdparty/leveldb/cache.h"
+#include "3rdparty/leveldb/filter_policy.h"
+#include "3rdparty/leveldb/iterator.h"
+#include "3rdparty/leveldb/write_batch.h"
+#include <sstream>
 
 enum LevelDBObjectType { OBJECT, ARCHIVE, IMAGE, HEIGHTFIELD, NODE, SHADER };
+class LevelDBHandle;
+
+/** Keys of deduplicated images, which are always at root of the database */
+static const std::string s_blobPrefix = "__blobs__/";
+
+/** Read-only stream buffer over existing memory, so that values got from the database can be
+    passed to other reader/writers without copying to a std::stringstream again */
+class LevelDBValueBuffer : public std::streambuf
+{
+public:
+    LevelDBValueBuffer(const char* data, size_t size)
+    { char* ptr = const_cast<char*>(data); setg(ptr, ptr, ptr + size); }
+
+protected:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                             std::ios_base::openmode which = std::ios_base::in)
+    {
+        char* ptr = (dir == std::ios_base::beg) ? eback()
+                  : (dir == std::ios_base::cur ? gptr() : egptr());
+        if ((which & std::ios_base::out) || off < eback() - ptr || off > egptr() - ptr)
+            return pos_type(off_type(-1));
+        setg(eback(), ptr + off, egptr()); return pos_type(gptr() - eback());
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in)
+    { return seekoff(off_type(pos), std::ios_base::beg, which); }
+};
+
+/** Database settings read from option string of osgDB::Options, e.g., "CacheSize=67108864".
+    Opening settings only work when the database is opened for the first time.
+    An archive parses its settings once when opened, and options passed to each reading /
+    writing call are merged on top of them */
+struct LevelDBSettings
+{
+    size_t writeBufferSize, cacheSize, maxFileSize;  // in bytes
+    int bloomBitsPerKey;                // bloom filter is disabled if <= 0
+    int batchSize;                      // writing of archives is batched if > 0
+    bool verifyChecksums, fillCache, compactOnClose, deduplicate;
+
+    LevelDBSettings(const osgDB::Options* options = NULL)
+    :   writeBufferSize(256 * 1024 * 1024), cacheSize(64 * 1024 * 1024),
+        maxFileSize(2 * 1024 * 1024), bloomBitsPerKey(10), batchSize(0),
+        verifyChecksums(false), fillCache(true), compactOnClose(false), deduplicate(false)
+    { apply(options); }
+
+    LevelDBSettings merged(const osgDB::Options* options) const
+    {
+        LevelDBSettings settings(*this);
+        settings.apply(options); return settings;
+    }
+
+    void apply(const osgDB::Options* options)
+    {
+        std::string optionString = options ? options->getOptionString() : "";
+        std::istringstream iss(optionString); std::string opt;
+        while (iss >> opt)
+        {
+            size_t pos = opt.find('='); if (pos == std::string::npos) continue;
+            std::string key = opt.substr(0, pos), value = opt.substr(pos + 1);
+            if (key == "WriteBufferSize") writeBufferSize = (size_t)atoll(value.c_str());
+            else if (key == "CacheSize") cacheSize = (size_t)atoll(value.c_str());
+            else if (key == "MaxFileSize") maxFileSize = (size_t)atoll(value.c_str());
+            else if (key == "BloomBitsPerKey") bloomBitsPerKey = atoi(value.c_str());
+            else if (key == "VerifyChecksums") verifyChecksums = getBoolean(value);
+            else if (key == "FillCache") fillCache = getBoolean(value);
+            else if (key == "BatchSize") batchSize = atoi(value.c_str());
+            else if (key == "CompactOnClose") compactOnClose = getBoolean(value);
+            else if (key == "Deduplicate") deduplicate = getBoolean(value);
+        }
+    }
+
+    leveldb::ReadOptions getReadOptions() const
+    {
+        leveldb::ReadOptions options;
+        options.verify_checksums = verifyChecksums;
+        options.fill_cache = fillCache; return options;
+    }
+
+    static bool getBoolean(const std::string& v)
+    { return !(v == "0" || v == "false" || v == "False" || v == "FALSE" || v == "off"); }
+};
+
+/** Registry of opened databases, shared by the reader/writer, its archives and handles.
+    leveldb::DB is thread-safe itself, so the mutex only guards the registry bookkeeping and
+    reading / writing with handles is done concurrently. A database is deleted only when it is
+    closed and no handle is using it any more */
+class LevelDBRegistry : public osg::Referenced
+{
+public:
+    LevelDBRegistry() {}
+
+    LevelDBHandle* acquire(const std::string& name, bool createdIfMissing,
+                           const LevelDBSettings& settings);
+    void release(const std::string& name);
+    void close(const std::string& name);
+
+protected:
+    virtual ~LevelDBRegistry()
+    {
+        for (std::map<std::string, DatabaseEntry>::iterator itr = _databases.begin();
+             itr != _databases.end(); ++itr) itr->second.destroy();
+    }
+
+    struct DatabaseEntry
+    {
+        leveldb::DB* db; leveldb::Cache* cache; const leveldb::FilterPolicy* filter;
+        unsigned int numHandles; bool keepOpen;
+        DatabaseEntry() : db(NULL), cache(NULL), filter(NULL), numHandles(0), keepOpen(true) {}
+
+        // Cache and filter policy must outlive the database
+        void destroy()
+        { delete db; delete cache; delete filter; db = NULL; cache = NULL; filter = NULL; }
+    };
+    std::map<std::string, DatabaseEntry> _databases;
+    OpenThreads::Mutex _mutex;
+};
+
+/** Reference-counted handle of an opened database */
+class LevelDBHandle : public osg::Referenced
+{
+public:
+    LevelDBHandle(LevelDBRegistry* r, const std::string& name, leveldb::DB* db)
+        : _registry(r), _name(name), _db(db) {}
+    leveldb::DB* get() const { return _db; }
+
+protected:
+    virtual ~LevelDBHandle() { _registry->release(_name); }
+    osg::ref_ptr<LevelDBRegistry> _registry;
+    std::string _name; leveldb::DB* _db;
+};
+
+LevelDBHandle* LevelDBRegistry::acquire(const std::string& name, bool createdIfMissing,
+                                        const LevelDBSettings& settings)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    std::map<std::string, DatabaseEntry>::iterator itr = _databases.find(name);
+    if (itr == _databases.end())
+    {
+        DatabaseEntry entry; leveldb::Options options;
+        options.create_if_missing = createdIfMissing;
+        options.write_buffer_size = settings.writeBufferSize;
+        options.max_file_size = settings.maxFileSize;
+        if (settings.cacheSize > 0)
+        {
+            entry.cache = leveldb::NewLRUCache(settings.cacheSize);
+            options.block_cache = entry.cache;
+        }
+        if (settings.bloomBitsPerKey > 0)
+        {
+            entry.filter = leveldb::NewBloomFilterPolicy(settings.bloomBitsPerKey);
+            options.filter_policy = entry.filter;
+        }
+
+        leveldb::Status status = leveldb::DB::Open(options, name, &entry.db);
+        if (!status.ok())
+        {
+            OSG_NOTICE << "[ReaderWriterLevelDB] Failed to open " << name << ": "
+                       << status.ToString() << std::endl;
+            entry.destroy(); return NULL;
+        }
+        itr = _databases.insert(std::pair<std::string, DatabaseEntry>(name, entry)).first;
+    }
+
+    // A database closed but still being used is also reused here
+    itr->second.numHandles++; itr->second.keepOpen = true;
+    return new LevelDBHandle(this, name, itr->second.db);
+}
+
+void LevelDBRegistry::release(const std::string& name)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    std::map<std::string, DatabaseEntry>::iterator itr = _databases.find(name);
+    if (itr == _databases.end()) return;
+
+    DatabaseEntry& entry = itr->second;
+    if (entry.numHandles > 0) entry.numHandles--;
+    if (entry.numHandles == 0 && !entry.keepOpen) { entry.destroy(); _databases.erase(itr); }
+}
+
+void LevelDBRegistry::close(const std::string& name)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    std::map<std::string, DatabaseEntry>::iterator itr = _databases.find(name);
+    if (itr == _databases.end()) return;
+
+    DatabaseEntry& entry = itr->second; entry.keepOpen = false;
+    if (entry.numHandles == 0) { entry.destroy(); _databases.erase(itr); }
+}
+
 class LevelDBArchive : public osgDB::Archive
 {
 public:
-    LevelDBArchive(const osgDB::ReaderWriter* rw, ArchiveStatus status, const std::string& dbName);
-    virtual ~LevelDBArchive() { close(); }
+    LevelDBArchive(const osgDB::ReaderWriter* rw, ArchiveStatus status, const std::string& dbName,
+                   const osgDB::Options* options);
+    virtual ~LevelDBArchive() { close(); delete _batch; }
 
     virtual const char* libraryName() const { return "osgVerse"; }
     virtual const char* className() const { return "LevelDBArchive"; }
@@ -24,14 +225,14 @@ public:
     virtual std::string getArchiveFileName() const { return _dbName; }
     virtual std::string getMasterFileName() const { return "leveldb://" + _dbName + "/"; }
 
-    virtual osgDB::FileType getFileType(const std::string& filename) const
-    {
-        if (fileExists(filename)) return osgDB::REGULAR_FILE;
-        else return osgDB::FILE_NOT_FOUND;
-    }
+    virtual osgDB::FileType getFileType(const std::string& filename) const;
+    virtual bool getFileNames(osgDB::DirectoryContents& fileNames) const;
+    virtual osgDB::DirectoryContents getDirectoryContents(const std::string& dirName) const;
 
-    virtual bool getFileNames(osgDB::DirectoryContents& fileNames) const { return false; }
-    //virtual osgDB::DirectoryContents getDirectoryContents(const std::string& dirName) const;
+    /** Get all keys starting with prefix in range [start, end), which can be empty to be unlimited.
+        It can be used to enumerate a huge database page by page (start from last key got) */
+    bool getFileNames(osgDB::DirectoryContents& fileNames, const std::string& prefix,
+                      const std::string& start, const std::string& end) const;
 
     osgDB::ReaderWriter::ReadResult readFile(
         LevelDBObjectType type, const std::string& f, const osgDB::Options* o) const;
@@ -59,9 +260,63 @@ public:
     virtual WriteResult writeShader(const osg::Shader& obj,
         const std::string& f, const osgDB::Options* o = NULL) const { return writeFile(obj, SHADER, f, o); }
 
+    /** Write all batched files to the database. It is also done automatically when closing */
+    bool flush() const;
+
 protected:
     osg::observer_ptr<osgDB::ReaderWriter> _readerWriter;
-    leveldb::DB* _db; std::string _dbName;
+    osg::ref_ptr<const osgDB::Options> _options;
+    osg::ref_ptr<LevelDBHandle> _db; std::string _dbName;
+
+    /** Bulk writing: files are collected in a write batch, and written together when
+        BatchSize is reached, which is much faster than putting them one by one.
+        Note that batched files are not readable until they are flushed */
+    mutable leveldb::WriteBatch* _batch;
+    mutable OpenThreads::Mutex _batchMutex;
+    mutable int _numBatched;
+    LevelDBSettings _settings;
+};
+
+/** Share textures using same blob images among loaded tiles, so that they are also uploaded
+    to GPU only once. Only textures of the plugin are cached, unlike osgDB::SharedStateManager
+    which would affect all paged data of the application */
+class BlobTextureSharer : public osg::NodeVisitor
+{
+public:
+    typedef std::map<osg::Image*, osg::observer_ptr<osg::Texture2D>> TextureMap;
+    BlobTextureSharer(TextureMap& textures)
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _textures(textures) {}
+
+    virtual void apply(osg::Node& node) { share(node.getStateSet()); traverse(node); }
+#if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
+    virtual void apply(osg::Geode& geode)
+    {
+        for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+            share(geode.getDrawable(i)->getStateSet());
+        apply(static_cast<osg::Node&>(geode));
+    }
+#endif
+
+protected:
+    void share(osg::StateSet* ss)
+    {
+        if (!ss) return;
+        for (unsigned int u = 0; u < ss->getTextureAttributeList().size(); ++u)
+        {
+            const osg::StateSet::RefAttributePair* pair =
+                ss->getTextureAttributePair(u, osg::StateAttribute::TEXTURE);
+            osg::Texture2D* tex = pair ? dynamic_cast<osg::Texture2D*>(pair->first.get()) : NULL;
+            if (!tex || !tex->getImage()) continue;
+
+            // Blob images are already shared, so textures of same image and parameters are same
+            osg::ref_ptr<osg::Texture2D> shared;
+            osg::observer_ptr<osg::Texture2D>& cached = _textures[tex->getImage()];
+            if (!cached.lock(shared) || shared->compare(*tex) != 0) { cached = tex; continue; }
+            if (shared != tex) ss->setTextureAttribute(u, shared.get(), pair->second);
+        }
+    }
+
+    TextureMap& _textures;
 };
 
 class ReaderWriterLevelDB : public osgDB::ReaderWriter
@@ -70,19 +325,22 @@ public:
     ReaderWriterLevelDB()
     {
         supportsProtocol("leveldb", "Read from LevelDB database.");
-        supportsOption("WriteBufferSize=<s>", "Size in byte, default is 4Mb");
+        supportsOption("WriteBufferSize=<s>", "Size in byte, default is 256Mb");
+        supportsOption("CacheSize=<s>", "Size of LRU block cache in byte, default is 64Mb, 0 to disable");
+        supportsOption("BloomBitsPerKey=<n>", "Bits per key of bloom filter, default is 10, 0 to disable");
+        supportsOption("VerifyChecksums=<0/1>", "Verify checksums of all data read, default is 0");
+        supportsOption("FillCache=<0/1>", "Put data read into block cache, default is 1");
+        supportsOption("MaxFileSize=<s>", "Size of each table file in byte, default is 2Mb");
+        supportsOption("BatchSize=<n>", "Files written by archive in one batch, default is 0");
+        supportsOption("CompactOnClose=<0/1>", "Compact database when closing archive, default is 0");
+        supportsOption("Deduplicate=<0/1>", "Store identical images of nodes only once, default is 0");
 
         // Examples:
         // - Writing: osgconv cessna.osg leveldb://test.db/cessna.osg.verse_leveldb
         // - Reading: osgviewer leveldb://test.db/cessna.osg.verse_leveldb
         supportsExtension("verse_leveldb", "Pseudo file extension, used to select DB plugin.");
         supportsExtension("*", "Passes all read files to other plugins to handle actual model loading.");
-    }
-
-    virtual ~ReaderWriterLevelDB()
-    {
-        for (std::map<std::string, leveldb::DB*>::iterator itr = _dbMap.begin();
-             itr != _dbMap.end(); ++itr) { delete itr->second; }
+        _registry = new LevelDBRegistry;
     }
     
     bool acceptsProtocol(const std::string& protocol) const
@@ -99,7 +357,7 @@ public:
     {
         // Create archive from DB
         std::string dbName = osgDB::getServerAddress(fullFileName);
-        return new LevelDBArchive(this, status, dbName);
+        return new LevelDBArchive(this, status, dbName, options);
     }
 
     virtual ReadResult readObject(const std::string& fileName, const Options* options) const
@@ -171,12 +429,10 @@ public:
         if (scheme == "leveldb")
         {
             std::string dbName = osgDB::getServerAddress(filename);
-            std::string keyName = osgDB::getServerFileName(filename), value;
-            leveldb::DB* db = getOrCreateDatabase(dbName, false);
-            if (!db) return false;
-
-            leveldb::Status status = db->Get(leveldb::ReadOptions(), keyName, &value);
-            return status.ok();
+            std::string keyName = osgDB::getServerFileName(filename);
+            LevelDBSettings settings(options);
+            osg::ref_ptr<LevelDBHandle> db = getOrCreateDatabase(dbName, false, settings);
+            return db.valid() ? hasKey(db->get(), keyName, settings) : false;
         }
         return ReaderWriter::fileExists(filename, options);
     }
@@ -200,11 +456,15 @@ public:
             {
                 if (osgDB::containsServerAddress(options->getDatabasePathList().front()))
                 {
-                    scheme = osgDB::getServerProtocol(options->getDatabasePathList().front());
+                    const std::string& dbPath = options->getDatabasePathList().front();
+                    scheme = osgDB::getServerProtocol(dbPath);
                     if (acceptsProtocol(scheme))
                     {
-                        std::string newFileName = options->getDatabasePathList().front() + "/" + fileName;
-                        return readFile(objectType, newFileName, options);
+                        // Shared blobs are at root of the database, wherever the referring tile is
+                        std::string newFileName = (fileName.find(s_blobPrefix) == 0)
+                                                ? (scheme + "://" + osgDB::getServerAddress(dbPath))
+                                                : dbPath;
+                        return readFile(objectType, newFileName + "/" + fileName, options);
                     }
                 }
             }
@@ -222,18 +482,34 @@ public:
         // Read data from DB
         std::string dbName = osgDB::getServerAddress(fullFileName);
         std::string keyName = osgDB::getServerFileName(fullFileName);
-        leveldb::DB* db = getOrCreateDatabase(dbName, false);
+        LevelDBSettings settings(options);
+        osg::ref_ptr<LevelDBHandle> db = getOrCreateDatabase(dbName, false, settings);
         if (!db) return ReadResult::ERROR_IN_READING_FILE;
-        else return read(db, fileName, keyName, objectType, reader, options);
+        else return read(db->get(), fileName, keyName, objectType, reader, options, settings);
     }
 
     ReadResult read(leveldb::DB* db, const std::string& fileName, const std::string& keyName,
-                    LevelDBObjectType type, osgDB::ReaderWriter* rw, const osgDB::Options* options) const
+                    LevelDBObjectType type, osgDB::ReaderWriter* rw, const osgDB::Options* options,
+                    const LevelDBSettings& settings) const
     {
-        std::stringstream buffer; std::string value;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(), keyName, &value);
+        // LevelDB always copies the value out in Get(). Keep it here until reading finishes,
+        // and let the reader work on it directly
+        bool isBlob = (type == IMAGE && keyName.find(s_blobPrefix) == 0);
+        if (isBlob)
+        {
+            // Return a shared image if it is already loaded by another tile
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_blobMutex);
+            std::map<std::string, osg::observer_ptr<osg::Image>>::iterator itr = _blobs.find(fileName);
+            osg::ref_ptr<osg::Image> image;
+            if (itr != _blobs.end() && itr->second.lock(image)) return image.get();
+        }
+
+        std::string value;
+        leveldb::Status status = db->Get(settings.getReadOptions(), keyName, &value);
         if (!status.ok()) return ReadResult::FILE_NOT_FOUND;
-        else buffer.write(value.data(), value.length());
+
+        LevelDBValueBuffer valueBuffer(value.data(), value.size());
+        std::istream buffer(&valueBuffer);
 
         // Load by other readerwriter
         osg::ref_ptr<Options> lOptions = options ?
@@ -244,6 +520,21 @@ public:
 
         ReadResult readResult = readFile(type, rw, buffer, lOptions.get());
         lOptions->getDatabasePathList().pop_front();
+        if (isBlob && readResult.getImage())
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_blobMutex);
+            osg::ref_ptr<osg::Image> image;  // another thread may have loaded it meanwhile
+            if (_blobs[fileName].lock(image)) return image.get();
+            _blobs[fileName] = readResult.getImage();
+            if (_blobs.size() % 1024 == 0) pruneBlobs();
+        }
+        else if (type == NODE && readResult.getNode() && value.find(s_blobPrefix) != std::string::npos)
+        {
+            // The node refers to shared blobs (names are saved as they are): share textures
+            // using same images among tiles, so that they are also uploaded to GPU only once
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_blobMutex);
+            BlobTextureSharer sharer(_blobTextures); readResult.getNode()->accept(sharer);
+        }
         return readResult;
     }
 
@@ -275,73 +566,223 @@ public:
 
         std::string dbName = osgDB::getServerAddress(fullFileName);
         std::string keyName = osgDB::getServerFileName(fullFileName);
-        leveldb::DB* db = getOrCreateDatabase(dbName, true);
+        LevelDBSettings settings(options);
+        osg::ref_ptr<LevelDBHandle> db = getOrCreateDatabase(dbName, true, settings);
         if (!db) return WriteResult::ERROR_IN_WRITING_FILE;
 
         osgDB::ReaderWriter* writer = osgDB::Registry::instance()->getReaderWriterForExtension(ext);
         if (!writer) return WriteResult::FILE_NOT_HANDLED;
-        else return write(db, obj, keyName, writer, options);
+        else return write(db->get(), obj, keyName, writer, options, settings);
     }
 
     WriteResult write(leveldb::DB* db, const osg::Object& obj, const std::string& keyName,
-                      osgDB::ReaderWriter* rw, const osgDB::Options* options) const
+                      osgDB::ReaderWriter* rw, const osgDB::Options* options,
+                      const LevelDBSettings& settings) const
     {
-        std::stringstream requestBuffer;
-        osgDB::ReaderWriter::WriteResult result = writeFile(obj, rw, requestBuffer, options);
+        std::string value;
+        osgDB::ReaderWriter::WriteResult result = serialize(db, obj, rw, options, settings, value);
         if (!result.success()) return result;
 
-        leveldb::Status status = db->Put(leveldb::WriteOptions(), keyName, requestBuffer.str());
+        leveldb::Status status = db->Put(leveldb::WriteOptions(), keyName, value);
         return status.ok() ? WriteResult::FILE_SAVED : WriteResult::FILE_NOT_HANDLED;
     }
 
-    leveldb::DB* getOrCreateDatabase(const std::string& name, bool createdIfMissing) const
+    /** Serialize the object to value. With Deduplicate=1 and an OSG native format, images of the
+        node are saved as content-addressed blobs (only if not existing) and the node refers to them */
+    WriteResult serialize(leveldb::DB* db, const osg::Object& obj, osgDB::ReaderWriter* rw,
+                          const osgDB::Options* options, const LevelDBSettings& settings,
+                          std::string& value) const
     {
-        leveldb::DB* db = NULL;
-        DatabaseMap& dbMap = const_cast<DatabaseMap&>(_dbMap);
-        if (dbMap.find(name) == dbMap.end())
+        std::stringstream buffer; WriteResult result = WriteResult::FILE_NOT_HANDLED;
+        const osg::Node* node = dynamic_cast<const osg::Node*>(&obj);
+        if (!node || !settings.deduplicate || !rw->acceptsExtension("osgb"))
         {
-            leveldb::Options options;
-            options.create_if_missing = createdIfMissing;
-            options.write_buffer_size = 256 * 1024 * 1024;
+            result = writeFile(obj, rw, buffer, options);
+            if (result.success()) value = buffer.str();
+            return result;
+        }
+
+        // Work on a copy with the same arrays and images, as textures will use proxy images
+        osg::ref_ptr<osg::Node> copied = static_cast<osg::Node*>(node->clone(
+            osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES |
+            osg::CopyOp::DEEP_COPY_STATESETS | osg::CopyOp::DEEP_COPY_STATEATTRIBUTES |
+            osg::CopyOp::DEEP_COPY_TEXTURES));
+        osg::ref_ptr<osgVerse::ContentDeduplicator> deduplicator =
+            new osgVerse::ContentDeduplicator(s_blobPrefix);
+        copied->accept(*deduplicator);
+
+        osg::ref_ptr<osgDB::Options> blobOptions = new osgDB::Options("WriteImageHint=IncludeData");
+        osgVerse::ContentDeduplicator::ImageMap images = deduplicator->getNamedImages();
+        for (osgVerse::ContentDeduplicator::ImageMap::iterator itr = images.begin();
+             itr != images.end(); ++itr)
+        {
+            if (hasKey(db, itr->first, settings)) continue;
+            std::stringstream blobBuffer;
+            if (!rw->writeImage(*itr->second, blobBuffer, blobOptions.get()).success() ||
+                !db->Put(leveldb::WriteOptions(), itr->first, blobBuffer.str()).ok())
+                return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        result = writeFile(*copied, rw, buffer, options);
+        if (result.success()) value = buffer.str();
+        return result;
+    }
+
+    /** Get a handle of the database, which is kept valid until the handle is released,
+        even if the database is closed by other threads in the meantime */
+    LevelDBHandle* getOrCreateDatabase(const std::string& name, bool createdIfMissing,
+                                       const LevelDBSettings& settings) const
+    { return _registry->acquire(name, createdIfMissing, settings); }
+
+    /** Check if the key exists by seeking an iterator to it and comparing the key only, so that
+        the value is never copied out (Get() copies the whole value, which may be a huge tile).
+        Not filling the block cache here, as checked values may never be read afterwards.
+        If 'asPrefix' is set, check if there is any key starting with it instead */
+    bool hasKey(leveldb::DB* db, const std::string& keyName, const LevelDBSettings& settings,
+                bool asPrefix = false) const
+    {
+        leveldb::ReadOptions readOptions = settings.getReadOptions();
+        readOptions.fill_cache = false;
+
+        leveldb::Iterator* itr = db->NewIterator(readOptions); itr->Seek(keyName);
+        bool found = itr->Valid() && (asPrefix ? itr->key().starts_with(keyName)
+                                               : itr->key() == leveldb::Slice(keyName));
+        delete itr; return found;
+    }
 
-            leveldb::Status status = leveldb::DB::Open(options, name, &db);
-            if (!status.ok()) return NULL; else dbMap[name] = db;
+    /** List keys starting with prefix in range [start, end). If 'directChildren' is set, prefix
+        is treated as a directory: only names of its children are listed, and keys of each
+        sub-directory are skipped at once by seeking to the end of it */
+    void listKeys(leveldb::DB* db, const std::string& prefix, const std::string& start,
+                  const std::string& end, bool directChildren, osgDB::DirectoryContents& names) const
+    {
+        leveldb::ReadOptions readOptions; readOptions.fill_cache = false;
+        leveldb::Iterator* itr = db->NewIterator(readOptions);
+        itr->Seek(start > prefix ? start : prefix);
+        while (itr->Valid())
+        {
+            leveldb::Slice key = itr->key();
+            if (!key.starts_with(prefix)) break;
+            else if (!end.empty() && key.compare(end) >= 0) break;
+            if (!directChildren) { names.push_back(key.ToString()); itr->Next(); continue; }
+
+            std::string child(key.data() + prefix.size(), key.size() - prefix.size());
+            size_t pos = child.find('/');
+            if (pos == std::string::npos) { names.push_back(child); itr->Next(); continue; }
+
+            // '0' follows '/' in ASCII, so seeking to "dir0" skips all keys of "dir/"
+            names.push_back(child.substr(0, pos));
+            itr->Seek(prefix + child.substr(0, pos) + "0");
         }
-        else
-            db = dbMap[name];
-        return db;
+        delete itr;
     }
 
     void closeDatabase(const std::string& name)
+    { _registry->close(name); }
+
+    /** Remove expired blob images and textures, which must be called with _blobMutex locked */
+    void pruneBlobs() const
     {
-        DatabaseMap::iterator itr = _dbMap.find(name);
-        if (itr != _dbMap.end()) { delete itr->second; _dbMap.erase(itr); }
+        std::map<std::string, osg::observer_ptr<osg::Image>>::iterator itr = _blobs.begin();
+        while (itr != _blobs.end())
+        { if (!itr->second.valid()) _blobs.erase(itr++); else ++itr; }
+
+        BlobTextureSharer::TextureMap::iterator itr2 = _blobTextures.begin();
+        while (itr2 != _blobTextures.end())
+        { if (!itr2->second.valid()) _blobTextures.erase(itr2++); else ++itr2; }
     }
 
 protected:
-    typedef std::map<std::string, leveldb::DB*> DatabaseMap;
-    DatabaseMap _dbMap;
+    osg::ref_ptr<LevelDBRegistry> _registry;
+    mutable std::map<std::string, osg::observer_ptr<osg::Image>> _blobs;
+    mutable BlobTextureSharer::TextureMap _blobTextures;
+    mutable OpenThreads::Mutex _blobMutex;
 };
 
-LevelDBArchive::LevelDBArchive(const osgDB::ReaderWriter* rw, ArchiveStatus status, const std::string& dbName)
-    : _readerWriter(NULL), _dbName(dbName)
+LevelDBArchive::LevelDBArchive(const osgDB::ReaderWriter* rw, ArchiveStatus status, const std::string& dbName,
+                               const osgDB::Options* options)
+    : _readerWriter(NULL), _options(options), _dbName(dbName), _batch(NULL), _numBatched(0),
+      _settings(options)
 {
     ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(const_cast<ReaderWriter*>(rw));
-    if (!rwdb) { _db = NULL; return; } else _readerWriter = rwdb;
-    _db = rwdb->getOrCreateDatabase(dbName, status == ArchiveStatus::CREATE);
+    if (!rwdb) return; else _readerWriter = rwdb;
+    _db = rwdb->getOrCreateDatabase(dbName, status == ArchiveStatus::CREATE, _settings);
 }
 
 void LevelDBArchive::close()
 {
     ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
-    if (rwdb) rwdb->closeDatabase(_dbName); _db = NULL; _readerWriter = NULL;
+    if (rwdb && _db.valid())
+    {
+        flush();
+        if (_settings.compactOnClose)
+        {
+            // Merge all levels into fewer and sorted table files, which is slow but makes later
+            // reading faster after bulk importing
+            osg::Timer_t t0 = osg::Timer::instance()->tick();
+            _db->get()->CompactRange(NULL, NULL);
+            OSG_NOTICE << "[LevelDBArchive] Compacted " << _dbName << " in "
+                       << osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick())
+                       << "s" << std::endl;
+        }
+        rwdb->closeDatabase(_dbName);
+    }
+    _db = NULL; _readerWriter = NULL;
+}
+
+bool LevelDBArchive::flush() const
+{
+    leveldb::WriteBatch* batch = NULL;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_batchMutex);
+        if (!_db || !_batch || _numBatched == 0) return true;
+        batch = _batch; _batch = NULL; _numBatched = 0;
+    }
+
+    leveldb::Status status = _db->get()->Write(leveldb::WriteOptions(), batch);
+    if (!status.ok())
+        OSG_WARN << "[LevelDBArchive] Failed to write batch: " << status.ToString() << std::endl;
+    delete batch; return status.ok();
 }
 
 bool LevelDBArchive::fileExists(const std::string& filename) const
 {
-    std::string value; if (!_db) return false;
-    leveldb::Status status = _db->Get(leveldb::ReadOptions(), filename, &value);
-    return status.ok();
+    ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
+    if (!rwdb || !_db) return false;
+    return rwdb->hasKey(_db->get(), filename, _settings);
+}
+
+osgDB::FileType LevelDBArchive::getFileType(const std::string& filename) const
+{
+    if (fileExists(filename)) return osgDB::REGULAR_FILE;
+
+    // A directory is any prefix of keys ending with '/'
+    ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
+    std::string prefix = filename.empty() ? "" : (filename.back() == '/' ? filename : filename + "/");
+    if (rwdb && _db.valid() && rwdb->hasKey(_db->get(), prefix, _settings, true))
+        return osgDB::DIRECTORY;
+    return osgDB::FILE_NOT_FOUND;
+}
+
+bool LevelDBArchive::getFileNames(osgDB::DirectoryContents& fileNames) const
+{ return getFileNames(fileNames, "", "", ""); }
+
+bool LevelDBArchive::getFileNames(osgDB::DirectoryContents& fileNames, const std::string& prefix,
+                                  const std::string& start, const std::string& end) const
+{
+    ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
+    if (!rwdb || !_db) return false;
+    rwdb->listKeys(_db->get(), prefix, start, end, false, fileNames); return true;
+}
+
+osgDB::DirectoryContents LevelDBArchive::getDirectoryContents(const std::string& dirName) const
+{
+    osgDB::DirectoryContents contents;
+    ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
+    if (!rwdb || !_db) return contents;
+
+    std::string prefix = dirName.empty() ? "" : (dirName.back() == '/' ? dirName : dirName + "/");
+    rwdb->listKeys(_db->get(), prefix, "", "", true, contents); return contents;
 }
 
 osgDB::ReaderWriter::ReadResult LevelDBArchive::readFile(
@@ -353,7 +794,8 @@ osgDB::ReaderWriter::ReadResult LevelDBArchive::readFile(
 
     ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
     if (!rwdb || !_db) return ReadResult::FILE_NOT_HANDLED;
-    return rwdb->read(_db, getMasterFileName() + fileName, fileName, type, reader, op);
+    return rwdb->read(_db->get(), getMasterFileName() + fileName, fileName, type, reader,
+                      op ? op : _options.get(), op ? _settings.merged(op) : _settings);
 }
 
 osgDB::ReaderWriter::WriteResult LevelDBArchive::writeFile(const osg::Object& obj,
@@ -365,7 +807,23 @@ osgDB::ReaderWriter::WriteResult LevelDBArchive::writeFile(const osg::Object& ob
 
     ReaderWriterLevelDB* rwdb = static_cast<ReaderWriterLevelDB*>(_readerWriter.get());
     if (!rwdb || !_db) return WriteResult::FILE_NOT_HANDLED;
-    return rwdb->write(_db, obj, fileName, writer, op);
+    const osgDB::Options* options = op ? op : _options.get();
+    LevelDBSettings settings = op ? _settings.merged(op) : _settings;
+    if (settings.batchSize <= 0)
+        return rwdb->write(_db->get(), obj, fileName, writer, options, settings);
+
+    // Serialize outside the lock, so that files can be converted by multiple threads
+    std::string value;
+    WriteResult result = rwdb->serialize(_db->get(), obj, writer, options, settings, value);
+    if (!result.success()) return result;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_batchMutex);
+        if (!_batch) _batch = new leveldb::WriteBatch;
+        _batch->Put(fileName, value);
+        if (++_numBatched < settings.batchSize) return WriteResult::FILE_SAVED;
+    }
+    return flush() ? WriteResult::FILE_SAVED : WriteResult::ERROR_IN_WRITING_FILE;
 }
 
 // Now register with Registry to instantiate the above reader/writer.
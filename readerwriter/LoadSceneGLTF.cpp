@@ -25,6 +25,7 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "LoadSceneGLTF.h"
 #include "Utilities.h"
+#include <mio.hpp>
 
 namespace osgVerse
 {
@@ -136,9 +137,9 @@ namespace osgVerse
         }
     };*/
 
-    static osg::Vec3d ReadRtcCenterFeatureTable(std::vector<char>& data, int offset, int size)
+    static osg::Vec3d ReadRtcCenterFeatureTable(const char* data, int offset, int size)
     {
-        std::string json; json.assign(data.begin() + offset, data.begin() + size + offset);
+        std::string json; json.assign(data + offset, data + size + offset);
         picojson::value root; std::string err = picojson::parse(root, json);
         if (err.empty() && root.contains("RTC_CENTER"))
         {
@@ -153,23 +154,23 @@ namespace osgVerse
         return osg::Vec3d();
     }
 
-    unsigned int ReadB3dmHeader(std::vector<char>& data, osg::Vec3d* rtcCenter = NULL)
+    unsigned int ReadB3dmHeader(const char* data, osg::Vec3d* rtcCenter = NULL)
     {
         // https://github.com/CesiumGS/3d-tiles/blob/main/specification/TileFormats/Batched3DModel/README.adoc#tileformats-batched3dmodel-batched-3d-model
         // magic + version + length + featureTableJsonLength + featureTableBinLength +
         // batchTableJsonLength + batchTableBinLength + <Real feature table> + <Real batch table> + GLTF body
-        int header[7], hSize = 7 * sizeof(int); memcpy(header, data.data(), hSize);
+        int header[7], hSize = 7 * sizeof(int); memcpy(header, data, hSize);
         if (rtcCenter && header[3] > 0) *rtcCenter = ReadRtcCenterFeatureTable(data, hSize, header[3]);
         return hSize + header[3] + header[4] + header[5] + header[6];
     }
 
-    unsigned int ReadI3dmHeader(std::vector<char>& data, unsigned int& format)
+    unsigned int ReadI3dmHeader(const char* data, unsigned int& format)
     {
         // https://github.com/CesiumGS/3d-tiles/blob/main/specification/TileFormats/Instanced3DModel/README.adoc#tileformats-instanced3dmodel-instanced-3d-model
         // magic + version + length + featureTableJsonLength + featureTableBinLength +
         // batchTableJsonLength + batchTableBinLength + gltfFormat +
         // <Real feature table> + <Real batch table> + GLTF body
-        int header[8]; memcpy(header, data.data(), 8 * sizeof(int)); format = header[7];
+        int header[8]; memcpy(header, data, 8 * sizeof(int)); format = header[7];
         return 8 * sizeof(int) + header[3] + header[4] + header[5] + header[6];
     }
 
@@ -275,7 +276,39 @@ namespace osgVerse
         stbi_image_free(data); return true;
     }
 
+    static bool StoreImageData(tinygltf::Image* image, const int image_idx, std::string* err,
+                               std::string* warn, int req_width, int req_height,
+                               const unsigned char* bytes, int size, void* user_data)
+    {
+        // Only keep encoded bytes here, they will be decoded in parallel by decodeImages()
+        if (size <= 0 || bytes == NULL)
+        {
+            if (warn) (*warn) += "Empty image data for image[" + std::to_string(image_idx) +
+                                 "] name = \"" + image->name + "\"\n";
+            return true;
+        }
+
+        // Images in buffer views are read from model buffers later, others (URI / data URI)
+        // come from temporary memory and must be copied
+        if (image->bufferView < 0) image->image.assign(bytes, bytes + size);
+        image->as_is = true; return true;
+    }
+
     LoaderGLTF::LoaderGLTF(std::istream& in, const std::string& d, bool isBinary)
+    {
+        std::istreambuf_iterator<char> eos;
+        std::vector<char> data(std::istreambuf_iterator<char>(in), eos);
+        if (data.empty()) { OSG_WARN << "[LoaderGLTF] Unable to read from stream\n"; return; }
+        load(&data[0], data.size(), d, isBinary);
+    }
+
+    LoaderGLTF::LoaderGLTF(const char* data, size_t size, const std::string& d, bool isBinary)
+    {
+        if (!data || !size) { OSG_WARN << "[LoaderGLTF] Unable to read from empty data\n"; return; }
+        load(data, size, d, isBinary);
+    }
+
+    void LoaderGLTF::load(const char* data, size_t dataSize, const std::string& d, bool isBinary)
     {
         std::string protocol = osgDB::getServerProtocol(d);
         osgDB::ReaderWriter* rwWeb = (protocol.empty()) ? NULL
@@ -286,37 +319,32 @@ namespace osgVerse
             (rwWeb ? NULL : &tinygltf::GetFileSizeInBytes), rwWeb };
         //_rtcCenterCallback = new RTCCenterCallback;
 
-        std::string err, warn; bool loaded = false;
-        std::istreambuf_iterator<char> eos; osg::Vec3d rtcCenter;
-        std::vector<char> data(std::istreambuf_iterator<char>(in), eos);
-        if (data.empty()) { OSG_WARN << "[LoaderGLTF] Unable to read from stream\n"; return; }
+        std::string err, warn; bool loaded = false; osg::Vec3d rtcCenter;
 
         tinygltf::TinyGLTF loader;
         loader.SetStoreOriginalJSONForExtrasAndExtensions(true);
-        loader.SetImageLoader(&LoadImageDataEx, this);
+        loader.SetImageLoader(&StoreImageData, this);
         loader.SetFsCallbacks(fs);
         if (isBinary)
         {
             unsigned int version = 2, offset = 0, format = 0;  // 0: url, 1: raw GLTF
             std::string externalFileURI;
-            if (data.size() > 4)
+            if (dataSize > 4)
             {
                 if (data[0] == 'b' && data[1] == '3' && data[2] == 'd' && data[3] == 'm')
                 {
                     offset = ReadB3dmHeader(data, &rtcCenter);
-                    memcpy(&version, &data[0] + offset + 4, 4); tinygltf::swap4(&version);
+                    memcpy(&version, data + offset + 4, 4); tinygltf::swap4(&version);
                 }
                 else if (data[0] == 'i' && data[1] == '3' && data[2] == 'd' && data[3] == 'm')
                 {
                     offset = ReadI3dmHeader(data, format);
                     if (format == 0)
                     {
-                        std::vector<char> uri(data.size() - offset);
-                        memcpy(&uri[0], &data[0] + offset, uri.size()); char* p = &uri[0];
-                        externalFileURI = std::string(p, p + uri.size());
+                        externalFileURI = std::string(data + offset, data + dataSize);
                     }
                     else
-                        { memcpy(&version, &data[0] + offset + 4, 4); tinygltf::swap4(&version); }
+                        { memcpy(&version, data + offset + 4, 4); tinygltf::swap4(&version); }
                 }
             }
 
@@ -330,16 +358,21 @@ namespace osgVerse
             else if (version >= 2)
             {
                 loaded = loader.LoadBinaryFromMemory(
-                    &_modelDef, &err, &warn, (unsigned char*)&data[0] + offset, data.size() - offset, d);
+                    &_modelDef, &err, &warn, (unsigned char*)data + offset, dataSize - offset, d);
+            }
+            else
+            {
+                std::vector<char> dataV1(data, data + dataSize);
+                loaded = LoadBinaryV1(dataV1, d);
             }
-            else loaded = LoadBinaryV1(data, d);
         }
         else
-            loaded = loader.LoadASCIIFromString(&_modelDef, &err, &warn, &data[0], data.size(), d);
+            loaded = loader.LoadASCIIFromString(&_modelDef, &err, &warn, data, dataSize, d);
         
         if (!err.empty()) OSG_WARN << "[LoaderGLTF] Errors found: " << err << std::endl;
         if (!warn.empty()) OSG_WARN << "[LoaderGLTF] Warnings found: " << warn << std::endl;
         if (!loaded) { OSG_WARN << "[LoaderGLTF] Unable to load GLTF scene" << std::endl; return; }
+        decodeImages();
 
         if (rtcCenter.length2() > 0.0)
         {
@@ -395,7 +428,7 @@ namespace osgVerse
         for (size_t i = 0; i < _deferredMeshList.size(); ++i)
         {
             DeferredMeshData& mData = _deferredMeshList[i];
-            createMesh(mData.meshRoot.get(), mData.mesh, mData.skinIndex);
+            createMesh(mData.meshRoot.get(), _modelDef.meshes[mData.meshIndex], mData.skinIndex);
         }
 
         // Configure skinning data and player objects
@@ -487,6 +520,40 @@ namespace osgVerse
         }  // end of for (animations)
     }
 
+    void LoaderGLTF::decodeImages()
+    {
+        std::vector<int> pendingList;
+        for (size_t i = 0; i < _modelDef.images.size(); ++i)
+        { if (_modelDef.images[i].as_is) pendingList.push_back((int)i); }
+        if (pendingList.empty()) return;
+
+        // Images are independent from each other, so decode them concurrently
+        tinygltf::LoadImageDataOption option; option.preserve_channels = true;
+        std::vector<std::string> errList(pendingList.size());
+        int numPending = (int)pendingList.size();
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < numPending; ++i)
+        {
+            tinygltf::Image& image = _modelDef.images[pendingList[i]];
+            std::vector<unsigned char> encoded; encoded.swap(image.image);
+            const unsigned char* bytes = encoded.empty() ? NULL : &encoded[0];
+            size_t size = encoded.size(); image.as_is = false;
+            if (!bytes && image.bufferView >= 0)
+            {
+                const tinygltf::BufferView& view = _modelDef.bufferViews[image.bufferView];
+                bytes = &_modelDef.buffers[view.buffer].data[view.byteOffset];
+                size = view.byteLength;
+            }
+
+            if (!bytes || !LoadImageDataEx(&image, pendingList[i], &errList[i], NULL, 0, 0,
+                                           bytes, (int)size, &option))
+                image.image.clear();
+        }
+
+        for (size_t i = 0; i < errList.size(); ++i)
+        { if (!errList[i].empty()) OSG_WARN << "[LoaderGLTF] " << errList[i]; }
+    }
+
     osg::Node* LoaderGLTF::createNode(int id, tinygltf::Node& node)
     {
         osg::ref_ptr<osg::Geode> geode = (node.mesh >= 0) ? new osg::Geode : NULL;
@@ -495,8 +562,7 @@ namespace osgVerse
         if (geode.valid())
         {
             geode->setName(node.name + "_Geode");
-            _deferredMeshList.push_back(
-                DeferredMeshData(geode.get(), _modelDef.meshes[node.mesh], node.skin));
+            _deferredMeshList.push_back(DeferredMeshData(geode.get(), node.mesh, node.skin));
         }
         /*if (emptyTRS && emptyM && node.children.empty())
         {
@@ -545,11 +611,11 @@ namespace osgVerse
             geom->setName(mesh.name + "_" + std::to_string(i));
             geom->setUseDisplayList(false); geom->setUseVertexBufferObjects(true);
 
-            tinygltf::Primitive primitive = mesh.primitives[i];
-            for (std::map<std::string, int>::iterator attrib = primitive.attributes.begin();
+            const tinygltf::Primitive& primitive = mesh.primitives[i];
+            for (std::map<std::string, int>::const_iterator attrib = primitive.attributes.begin();
                 attrib != primitive.attributes.end(); ++attrib)
             {
-                tinygltf::Accessor& attrAccessor = _modelDef.accessors[attrib->second];
+                const tinygltf::Accessor& attrAccessor = _modelDef.accessors[attrib->second];
                 const tinygltf::BufferView& attrView = _modelDef.bufferViews[attrAccessor.bufferView];
                 int size = attrAccessor.count; if (!size || attrView.buffer < 0) continue;
 
@@ -647,16 +713,17 @@ namespace osgVerse
             }
 
             // Configure primitive index array
-            tinygltf::Accessor indexAccessor = _modelDef.accessors[primitive.indices];
-            const tinygltf::BufferView& indexView = _modelDef.bufferViews[indexAccessor.bufferView];
             osg::Vec3Array* va = static_cast<osg::Vec3Array*>(geom->getVertexArray());
             if (!va || (va && va->empty())) continue;
 
             osg::ref_ptr<osg::PrimitiveSet> p;
-            if (indexView.target == 0)
+            if (primitive.indices < 0 || _modelDef.bufferViews[
+                _modelDef.accessors[primitive.indices].bufferView].target == 0)
                 p = new osg::DrawArrays(GL_POINTS, 0, va->size());
             else  // ELEMENT_ARRAY_BUFFER = 34963
             {
+                const tinygltf::Accessor& indexAccessor = _modelDef.accessors[primitive.indices];
+                const tinygltf::BufferView& indexView = _modelDef.bufferViews[indexAccessor.bufferView];
                 const tinygltf::Buffer& indexBuffer = _modelDef.buffers[indexView.buffer];
                 int compSize = tinygltf::GetComponentSizeInBytes(indexAccessor.componentType);
                 int size = indexAccessor.count; if (!size) continue;
@@ -771,7 +838,7 @@ namespace osgVerse
         tex2D->setImage(image.get()); return tex2D.release();
     }
 
-    void LoaderGLTF::createMaterial(osg::StateSet* ss, tinygltf::Material material)
+    void LoaderGLTF::createMaterial(osg::StateSet* ss, const tinygltf::Material& material)
     {
         // Shininess(RGB) = Occlusion/Roughness/Metallic, Ambient = Occlusion
         int baseID = material.pbrMetallicRoughness.baseColorTexture.index;
@@ -824,11 +891,10 @@ namespace osgVerse
         }
 
         tinygltf::Image& imageSrc = _modelDef.images[tex.source];
-        if (imageSrc.image.empty()) return;
-
         osg::ref_ptr<osg::Image> image2D = _imageMap[tex.source].get();
         if (!image2D)
         {
+            if (imageSrc.image.empty()) return;
             //std::cout << name << ": " << imageSrc.uri << ", Size = "
             //          << imageSrc.width << "x" << imageSrc.height << "\n";
             osg::ref_ptr<osg::Image> image;
@@ -863,6 +929,8 @@ namespace osgVerse
                 memcpy(image->data(), &imageSrc.image[0], image->getTotalSizeInBytes());
             }
 
+            // Pixels are now owned by osg::Image, so release the source copy at once
+            std::vector<unsigned char>().swap(imageSrc.image);
             image2D = image.get(); _imageMap[tex.source] = image2D;
             image2D->setFileName(imageSrc.uri); image2D->setName(imageSrc.name);
             if (!imageSrc.name.empty())
@@ -1006,13 +1074,13 @@ namespace osgVerse
         }
     }
 
-    void LoaderGLTF::createBlendshapeData(osg::Geometry* geom, std::map<std::string, int>& target)
+    void LoaderGLTF::createBlendshapeData(osg::Geometry* geom, const std::map<std::string, int>& target)
     {
         osg::Vec3Array *va = NULL, *na = NULL; osg::Vec4Array *ta = NULL;
-        for (std::map<std::string, int>::iterator attrib = target.begin();
+        for (std::map<std::string, int>::const_iterator attrib = target.begin();
              attrib != target.end(); ++attrib)
         {
-            tinygltf::Accessor& attrAccessor = _modelDef.accessors[attrib->second];
+            const tinygltf::Accessor& attrAccessor = _modelDef.accessors[attrib->second];
             const tinygltf::BufferView& attrView = _modelDef.bufferViews[attrAccessor.bufferView];
             int size = attrAccessor.count; if (!size || attrView.buffer < 0) continue;
 
@@ -1093,14 +1161,26 @@ namespace osgVerse
         std::string workDir = osgDB::getFilePath(file), http = osgDB::getServerProtocol(file);
         if (!http.empty() && http.find("file") == std::string::npos) return NULL;
 
-        std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
-        if (!in)
+        osg::ref_ptr<LoaderGLTF> loader;
+        if (isBinary)
         {
-            OSG_WARN << "[LoaderGLTF] file " << file << " not readable" << std::endl;
-            return NULL;
+            // Parse binary files directly from a read-only mapping, to save one full-size copy
+            std::error_code error; mio::mmap_source mapping;
+            mapping.map(file, error);
+            if (!error && mapping.size() > 0)
+                loader = new LoaderGLTF(mapping.data(), mapping.size(), workDir, isBinary);
         }
 
-        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, workDir, isBinary);
+        if (!loader)
+        {
+            std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+            if (!in)
+            {
+                OSG_WARN << "[LoaderGLTF] file " << file << " not readable" << std::endl;
+                return NULL;
+            }
+            loader = new LoaderGLTF(in, workDir, isBinary);
+        }
         if (loader->getRoot()) loader->getRoot()->setName(file);
         return loader->getRoot();
     }
@@ -1110,4 +1190,10 @@ namespace osgVerse
         osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, dir, isBinary);
         return loader->getRoot();
     }
+
+    osg::ref_ptr<osg::Group> loadGltf2(const char* data, size_t size, const std::string& dir, bool isBinary)
+    {
+        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(data, size, dir, isBinary);
+        return loader->getRoot();
+    }
 }
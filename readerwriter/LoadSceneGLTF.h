@@ -1,6 +1,7 @@
 #include <osg/Texture2D>
 #include <osg/Geode>
 #include <osg/MatrixTransform>
+#include <osgDB/Options>
 #include <iterator>
 #include <fstream>
 #include <iostream>
@@ -17,6 +18,9 @@ namespace osgVerse
     public:
         LoaderGLTF(std::istream& in, const std::string& d, bool isBinary);
 
+        /** Load from memory (e.g., a file mapping) which must be valid during construction */
+        LoaderGLTF(const char* data, size_t size, const std::string& d, bool isBinary);
+
         osg::Group* getRoot() { return _root.get(); }
         tinygltf::Model& getModelData() { return _modelDef; }
 
@@ -24,10 +28,10 @@ namespace osgVerse
         struct DeferredMeshData
         {
             osg::ref_ptr<osg::Geode> meshRoot;
-            tinygltf::Mesh mesh; int skinIndex;
-            DeferredMeshData() : skinIndex(-1) {}
-            DeferredMeshData(osg::Geode* g, tinygltf::Mesh& m, int i)
-                : meshRoot(g), mesh(m), skinIndex(i) {}
+            int meshIndex, skinIndex;  // index of _modelDef.meshes, to avoid copying mesh data
+            DeferredMeshData() : meshIndex(-1), skinIndex(-1) {}
+            DeferredMeshData(osg::Geode* g, int m, int i)
+                : meshRoot(g), meshIndex(m), skinIndex(i) {}
         };
 
         struct SkinningData
@@ -42,32 +46,36 @@ namespace osgVerse
         };
 
         virtual ~LoaderGLTF() {}
+        void load(const char* data, size_t size, const std::string& d, bool isBinary);
+        void decodeImages();
         osg::Node* createNode(int id, tinygltf::Node& node);
         bool createMesh(osg::Geode* geode, tinygltf::Mesh& mesh, int skinIndex);
-        void createMaterial(osg::StateSet* ss, tinygltf::Material mat);
+        void createMaterial(osg::StateSet* ss, const tinygltf::Material& mat);
         void createTexture(osg::StateSet* ss, int u, const std::string& name, tinygltf::Texture& tex);
         void createInvBindMatrices(SkinningData& sd, const std::vector<osg::Transform*>& bones,
                                    tinygltf::Accessor& accessor);
         void createAnimationSampler(PlayerAnimation::AnimationData& anim, const std::string& p,
                                     tinygltf::Accessor& in, tinygltf::Accessor& out);
-        void createBlendshapeData(osg::Geometry* geom, std::map<std::string, int>& target);
+        void createBlendshapeData(osg::Geometry* geom, const std::map<std::string, int>& target);
         void applyBlendshapeWeights(osg::Geode* geode, const std::vector<double>& weights,
                                     const tinygltf::Value& targetNames);
 
+        /** Copy accessor data to dst. Tightly packed data (stride = 0 or element size) is copied
+            at once, and only interleaved data is copied element by element */
         inline void copyBufferData(void* dst, const void* src, size_t size,
                                    size_t stride, size_t count)
         {
-            if (stride > 0 && count > 0)
+            size_t elemSize = (count > 0) ? size / count : 0;
+            if (stride > 0 && stride != elemSize && count > 0)
             {
-                size_t elemSize = size / count;
                 for (size_t i = 0; i < count; ++i)
                     memcpy((char*)dst + i * elemSize, (const char*)src + i * stride, elemSize);
             }
-            else
+            else if (size > 0)
                 memcpy(dst, src, size);
         }
 
-        std::map<int, osg::observer_ptr<osg::Image>> _imageMap;
+        std::map<int, osg::ref_ptr<osg::Image>> _imageMap;
         std::map<int, osg::Node*> _nodeCreationMap;
         std::vector<DeferredMeshData> _deferredMeshList;
         std::vector<SkinningData> _skinningDataList;
@@ -79,4 +87,16 @@ namespace osgVerse
 
     OSGVERSE_RW_EXPORT osg::ref_ptr<osg::Group> loadGltf(const std::string& file, bool isBinary);
     OSGVERSE_RW_EXPORT osg::ref_ptr<osg::Group> loadGltf2(std::istream& in, const std::string& dir, bool isBinary);
+    OSGVERSE_RW_EXPORT osg::ref_ptr<osg::Group> loadGltf2(const char* data, size_t size,
+                                                          const std::string& dir, bool isBinary);
+
+    /** Save the scene as GLTF 2.0 (GLB if isBinary is true), in Y-up coordinates as required by
+        the specification. Plugin string data of options:
+        - UseDraco=1: compress triangles with KHR_draco_mesh_compression (built with Draco only)
+        - UseKTX2=1: save textures as Basis Universal KTX2 with KHR_texture_basisu, instead of
+          PNG (with alpha) or JPEG (without alpha) */
+    OSGVERSE_RW_EXPORT bool saveGltf(const osg::Node& node, const std::string& file, bool isBinary,
+                                     const osgDB::Options* opt = NULL);
+    OSGVERSE_RW_EXPORT bool saveGltf2(const osg::Node& node, std::ostream& out, bool isBinary,
+                                      const osgDB::Options* opt = NULL);
 }
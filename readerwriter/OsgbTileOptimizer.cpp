@@ -14,48 +14,22 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osgUtil/Simplifier>
+#include <OpenThreads/ScopedLock>
+#include <marl/defer.h>
+#include <marl/scheduler.h>
+#include <marl/waitgroup.h>
+#include <ghc/filesystem.hpp>
+#include <algorithm>
 #include <vector>
 #include <regex>
 #include <limits>
+#include <memory>
+#include <fstream>
 #include <iomanip>
+#define XXH_INLINE_ALL
+#include <xxhash.h>
 using namespace osgVerse;
 
-class ProcessThread : public OpenThreads::Thread
-{
-public:
-    ProcessThread(size_t id, TileOptimizer* opt) : _optimizer(opt), _id(id), _done(false) {}
-    bool done() const { return _done; }
-
-    void add(const std::string& name, const TileOptimizer::TileNameList& src)
-    { _sourceTiles.push_back(TileNamePair(name, src)); }
-
-    virtual void run()
-    {
-        while (!_done)
-        {
-            if (_sourceTiles.empty()) { _done = true; break; }
-            std::string outTileFolder = _sourceTiles[0].first;
-            TileOptimizer::TileNameList srcTiles = _sourceTiles[0].second;
-            _sourceTiles.erase(_sourceTiles.begin());
-
-            std::cout << outTileFolder << " is being processed at " << "Thread-" << _id
-                      << "... " << _sourceTiles.size() << " remains." << std::endl;
-            _optimizer->processTileFiles(outTileFolder, srcTiles);
-            OpenThreads::Thread::microSleep(50);
-        }
-        _done = true;
-    }
-
-    virtual int cancel()
-    { _done = true; return OpenThreads::Thread::cancel(); }
-
-protected:
-    typedef std::pair<std::string, TileOptimizer::TileNameList> TileNamePair;
-    std::vector<TileNamePair> _sourceTiles;
-    TileOptimizer* _optimizer;
-    size_t _id;  bool _done;
-};
-
 class FindPlodVisitor : public osg::NodeVisitor
 {
 public:
@@ -115,7 +89,8 @@ TileOptimizer::TileOptimizer(const std::string& outFolder, const std::string& ou
         if (endChar != '/' && endChar != '\\') _outFolder += '/';
     }
     _lodScaleAdjacency = 1.0f; _lodScaleTopLevels = 1.0f; _mulForDistanceMode = 2.0f;
-    _simplifyRatio = 0.4f; _numThreads = 10; _withThreads = true;
+    _simplifyRatio = 0.4f; _numThreads = 10; _withThreads = true; _resumable = false;
+    _deduplicating = false;
 }
 
 TileOptimizer::~TileOptimizer()
@@ -170,7 +145,7 @@ bool TileOptimizer::prepare(const std::string& inputFolder, const std::string& i
 bool TileOptimizer::processGroundLevel(int combinedX0, int combinedY0, const std::string& subDir)
 {
     std::vector<std::string> rootFileNames;
-    osgDB::makeDirectory(_outFolder); osgDB::makeDirectory(_outFolder + subDir);
+    osgDB::makeDirectory(_outFolder); osgDB::makeDirectory(_outFolder + subDir); loadJournal();
     for (std::map<std::string, NumberMap>::iterator itr = _srcNumberMap.begin();
          itr != _srcNumberMap.end(); ++itr)
     {
@@ -216,7 +191,8 @@ bool TileOptimizer::processGroundLevel(int combinedX0, int combinedY0, const std
                 srcTiles2.push_back(NameAndRoughLevel(srcTiles[n], NULL));
 
             std::string outFileName = subDir + "/" + outSubName + ".osgb";
-            osg::ref_ptr<osg::Node> rough = processTopTileFiles(outFileName, false, srcTiles2);
+            osg::ref_ptr<osg::Node> rough =
+                processTopTileFilesWithJournal(outFileName, false, srcTiles2);
             combination[itr2->first] = NameAndRoughLevel(outFileName, rough);
         }
 
@@ -256,7 +232,8 @@ bool TileOptimizer::processGroundLevel(int combinedX0, int combinedY0, const std
                 //std::string outFileName = isRootNode ? (tilePrefix + "root.osgb")
                 //                        : (subDir + "/" + outSubName + ".osgb");
                 std::string outFileName = subDir + "/" + outSubName + ".osgb";
-                osg::ref_ptr<osg::Node> rough = processTopTileFiles(outFileName, isRootNode, srcTiles);
+                osg::ref_ptr<osg::Node> rough =
+                    processTopTileFilesWithJournal(outFileName, isRootNode, srcTiles);
                 combination[itr2->first] = NameAndRoughLevel(outFileName, rough);
                 if (isRootNode) rootFileNames.push_back(outFileName);
             }
@@ -266,6 +243,7 @@ bool TileOptimizer::processGroundLevel(int combinedX0, int combinedY0, const std
     osg::ref_ptr<osg::ProxyNode> root = new osg::ProxyNode;
     for (size_t i = 0; i < rootFileNames.size(); ++i) root->setFileName(i, rootFileNames[i]);
     osgDB::writeNodeFile(*root, _outFolder + "Tile_Root.osgb");
+    if (_resumable) clearJournal();  // all finished, no temporary files left in output
     return true;
 }
 
@@ -275,8 +253,9 @@ bool TileOptimizer::processAdjacency(int adjacentX, int adjacentY)
     std::fill(adjX.begin(), adjX.end(), 'x'); std::fill(adjY.begin(), adjY.end(), 'y');
     if (adjacentX < 1 || adjacentY < 1) return false;
 
-    char outSubFolder[1024] = ""; osgDB::makeDirectory(_outFolder);
-    std::vector<ProcessThread*> threads(_numThreads); size_t ptr = 0;
+    char outSubFolder[1024] = ""; osgDB::makeDirectory(_outFolder); loadJournal();
+    typedef std::pair<std::string, TileNameList> TileJob;
+    std::vector<TileJob> jobs; size_t numSkipped = 0;
     for (std::map<std::string, NumberMap>::iterator itr = _srcNumberMap.begin();
         itr != _srcNumberMap.end(); ++itr)
     {
@@ -315,38 +294,57 @@ bool TileOptimizer::processAdjacency(int adjacentX, int adjacentY)
             std::string dstY = tileNumberToString(itr2->first.y()) + "+" + adjY;
             snprintf(outSubFolder, 1024, outFormat.c_str(), dstX.data(), dstY.data());
 
-            TileNameList& srcTiles = itr2->second;
             std::string outTileFolder = std::string(outSubFolder) + '/';
+            if (isFinished("adjacency " + outTileFolder)) { numSkipped++; continue; }
             osgDB::makeDirectory(_outFolder + outTileFolder);
+            jobs.push_back(TileJob(outTileFolder, itr2->second));
+        }
+    }
 
-            if (_numThreads > 0)
-            {
-                size_t index = (ptr++) % _numThreads; ProcessThread* th = threads[index];
-                if (!th) { th = new ProcessThread(index, this); threads[index] = th; }
-                th->add(outTileFolder, srcTiles);
-            }
-            else
-                processTileFiles(outTileFolder, srcTiles);
+    if (numSkipped > 0)
+        OSG_NOTICE << "[TileOptimizer] " << numSkipped
+                   << " tiles already finished in journal" << std::endl;
+    if (_numThreads < 1 || jobs.size() < 2)
+    {
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            processTileFiles(jobs[i].first, jobs[i].second);
+            markFinished("adjacency " + jobs[i].first);
         }
+        if (_resumable) clearJournal();
+        return true;
     }
 
-    int numCPUs = OpenThreads::GetNumberOfProcessors(); if (numCPUs < 1) numCPUs = 1;
-    for (size_t i = 0; i < _numThreads; ++i)
+    // Start with larger jobs, so that a huge tile is less likely to be the last one
+    std::stable_sort(jobs.begin(), jobs.end(), [](const TileJob& a, const TileJob& b)
+                     { return a.second.size() > b.second.size(); });
+
+    // Idle workers steal tasks from busy ones; reuse the scheduler if caller has bound one
+    std::unique_ptr<marl::Scheduler> scheduler;
+    if (marl::Scheduler::get() == NULL)
     {
-        ProcessThread* th = threads[i]; if (th == NULL) continue;
-        th->setProcessorAffinity(i % numCPUs); th->start();
+        marl::Scheduler::Config config; config.setWorkerThreadCount(_numThreads);
+        scheduler.reset(new marl::Scheduler(config)); scheduler->bind();
     }
 
-    bool allThreadDone = false;
-    while (!allThreadDone)
+    marl::WaitGroup waitGroup(jobs.size()); size_t numRemains = jobs.size();
+    for (size_t i = 0; i < jobs.size(); ++i)
     {
-        allThreadDone = true;
-        for (size_t i = 0; i < _numThreads; ++i)
+        const TileJob& job = jobs[i];
+        marl::schedule([this, &job, &numRemains, waitGroup]()
         {
-            ProcessThread* th = threads[i]; if (!th) continue; else allThreadDone = false;
-            if (th->done()) { th->join(); delete th; threads[i] = NULL; }
-        }
+            defer(waitGroup.done());
+            processTileFiles(job.first, job.second);
+            markFinished("adjacency " + job.first);
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_journalMutex);
+            OSG_NOTICE << "[TileOptimizer] " << job.first << " finished, "
+                       << --numRemains << " remains" << std::endl;
+        });
     }
+    waitGroup.wait();  // block (not polling) until all tiles are done
+    if (scheduler) scheduler->unbind();
+    if (_resumable) clearJournal();  // all finished, no temporary files left in output
     return true;
 }
 
@@ -407,6 +405,14 @@ void TileOptimizer::processTileFiles(const std::string& outTileFolder, const Til
                 loadedNodes.push_back(tile);
             }
         }
+
+        if (_deduplicating)
+        {
+            // Source tiles often repeat same textures, which should be packed and compressed
+            // only once, so share them before merging
+            osg::ref_ptr<ContentDeduplicator> dedup = new ContentDeduplicator;
+            for (size_t i = 0; i < loadedNodes.size(); ++i) loadedNodes[i]->accept(*dedup);
+        }
         if (_withThreads) OpenThreads::Thread::YieldCurrentThread();
 
         // Merge and generate new tile node
@@ -437,6 +443,7 @@ osg::Node* TileOptimizer::processTopTileFiles(const std::string& outTileFileName
 {
     osg::ref_ptr<osg::Group> root = new osg::Group;
     std::vector<std::pair<osg::ref_ptr<osg::Geometry>, osg::Matrix>> geomList;
+    osg::ref_ptr<ContentDeduplicator> dedup = _deduplicating ? new ContentDeduplicator : NULL;
 
     // Have to merge textures later, so must read RGBA
     setReadingKtxFlag(osgVerse::ReadKtx_ToRGBA, 1);
@@ -452,6 +459,7 @@ osg::Node* TileOptimizer::processTopTileFiles(const std::string& outTileFileName
         {
             if (ext.empty() && _filterNodeCallback.valid())
                 _filterNodeCallback->prefilter(fileName, *fineNode);
+            if (dedup.valid()) fineNode->accept(*dedup);
 
             FindPlodVisitor fpv; fineNode->accept(fpv);
             if (!fpv.plodList.empty())
@@ -466,6 +474,7 @@ osg::Node* TileOptimizer::processTopTileFiles(const std::string& outTileFileName
         }
         else if (roughNode.valid())
         {
+            if (dedup.valid()) roughNode->accept(*dedup);
             FindGeometryVisitor fgv(true); roughNode->accept(fgv);
             geomList.insert(geomList.end(), fgv.geomList.begin(), fgv.geomList.end());
         }
@@ -524,6 +533,128 @@ osg::Node* TileOptimizer::processTopTileFiles(const std::string& outTileFileName
     return mergedNode.release();  // return merged rough level node
 }
 
+osg::Node* TileOptimizer::processTopTileFilesWithJournal(
+        const std::string& outTileFileName, bool isRootNode, const TileNameAndRoughList& srcTiles)
+{
+    // Rough level of a finished tile is needed by upper levels, so it is also kept by journal
+    std::string key = "ground " + outTileFileName, roughFile = getJournalRoughFile(outTileFileName);
+    if (isFinished(key))
+    {
+        OSG_NOTICE << "[TileOptimizer] " << outTileFileName
+                   << " already finished in journal" << std::endl;
+        return isRootNode ? NULL : osgDB::readNodeFile(roughFile);
+    }
+
+    osg::ref_ptr<osg::Node> rough = processTopTileFiles(outTileFileName, isRootNode, srcTiles);
+    if (_resumable && rough.valid() && !isRootNode)
+    {
+        osg::ref_ptr<osgDB::Options> options = new osgDB::Options("WriteImageHint=IncludeData");
+        osgDB::makeDirectoryForFile(roughFile);
+        osgDB::writeNodeFile(*rough, roughFile, options.get());
+    }
+    markFinished(key); return rough.release();
+}
+
+std::string TileOptimizer::getJournalRoughFile(const std::string& outTileFileName) const
+{
+    std::string name = outTileFileName;
+    std::replace(name.begin(), name.end(), '/', '_');
+    std::replace(name.begin(), name.end(), '\\', '_');
+    return getJournalRoughFolder() + name;
+}
+
+std::string TileOptimizer::computeJournalSignature() const
+{
+    // Options affecting results, and names / sizes / times of all input files. Files are
+    // combined regardless of order, as directory iterating order is not guaranteed
+    std::stringstream ss;
+    ss << _inFolder << "|" << _inFormat << "|" << _outFormat << "|" << _withDraco << _withBasisu
+       << _deduplicating << _geomOptimizer.valid() << "|" << _simplifyRatio << ","
+       << _lodScaleAdjacency << "," << _lodScaleTopLevels << "," << _mulForDistanceMode;
+
+    unsigned long long filesHash = 0;
+    for (std::map<std::string, NumberMap>::const_iterator itr = _srcNumberMap.begin();
+         itr != _srcNumberMap.end(); ++itr)
+    {
+        for (NumberMap::const_iterator itr2 = itr->second.begin(); itr2 != itr->second.end(); ++itr2)
+        {
+            std::error_code ec;
+            ghc::filesystem::recursive_directory_iterator dir(_inFolder + itr2->second, ec), end;
+            for (; !ec && dir != end; dir.increment(ec))
+            {
+                if (!dir->is_regular_file(ec)) continue;
+                std::stringstream file;
+                file << dir->path().string() << "," << dir->file_size(ec) << ","
+                     << dir->last_write_time(ec).time_since_epoch().count();
+                std::string entry = file.str(); filesHash += XXH3_64bits(entry.data(), entry.size());
+            }
+        }
+    }
+    ss << "|" << filesHash;
+
+    std::string data = ss.str(); std::stringstream signature;
+    signature << std::hex << std::setw(16) << std::setfill('0')
+              << XXH3_64bits(data.data(), data.size());
+    return signature.str();
+}
+
+void TileOptimizer::removeJournalFiles()
+{
+    std::error_code ec; ghc::filesystem::remove_all(getJournalRoughFolder(), ec);
+    remove(getJournalFile().c_str());
+}
+
+void TileOptimizer::loadJournal()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_journalMutex);
+    _finishedTiles.clear(); if (!_resumable) return;
+
+    // The journal is invalid if inputs or options are changed since it was written
+    std::string signature = "signature " + computeJournalSignature(), line; bool valid = false;
+    {
+        std::ifstream in(getJournalFile().c_str());
+        if (std::getline(in, line) && line == signature)
+        {
+            valid = true;
+            while (std::getline(in, line)) { if (!line.empty()) _finishedTiles.insert(line); }
+        }
+    }
+
+    if (!valid)
+    {
+        if (!line.empty())
+            OSG_NOTICE << "[TileOptimizer] Inputs or options changed, ignoring "
+                       << getJournalFile() << std::endl;
+        removeJournalFiles();
+        std::ofstream out(getJournalFile().c_str()); out << signature << std::endl;
+    }
+    else if (!_finishedTiles.empty())
+        OSG_NOTICE << "[TileOptimizer] Resuming from " << getJournalFile() << " with "
+                   << _finishedTiles.size() << " finished tiles" << std::endl;
+}
+
+bool TileOptimizer::isFinished(const std::string& key)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_journalMutex);
+    return _finishedTiles.find(key) != _finishedTiles.end();
+}
+
+void TileOptimizer::markFinished(const std::string& key)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_journalMutex);
+    _finishedTiles.insert(key); if (!_resumable) return;
+
+    // Append and flush at once, so that a crash loses at most the tile being written
+    std::ofstream out(getJournalFile().c_str(), std::ios::out | std::ios::app);
+    out << key << std::endl;
+}
+
+void TileOptimizer::clearJournal()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_journalMutex);
+    _finishedTiles.clear(); removeJournalFiles();
+}
+
 osg::Vec3s TileOptimizer::getNumberFromTileName(const std::string& name, const std::string& inRegex,
                                                 std::string* textPrefix)
 {
@@ -660,11 +791,17 @@ osg::Node* TileOptimizer::mergeGeometries(const std::vector<std::pair<osg::Geome
 #if true
     for (size_t i = 0; i < geomList.size(); i += 16)
     {
+        // Textures are packed to 4096 x 4096 pages and then scaled to highest resolution;
+        // instead of one huge atlas, every page results in a merged geometry
         GeometryMerger merger;
-        osg::ref_ptr<osg::Geometry> result = merger.process(geomList, i, 16, highestRes);
-        if (result.valid())
+        std::vector<osg::ref_ptr<osg::Geometry>> results =
+            merger.processPages(geomList, i, 16, highestRes, 4096);
+        for (size_t r = 0; r < results.size(); ++r)
         {
-            if (simplify && _simplifyRatio > 0.0f)
+            osg::ref_ptr<osg::Geometry> result = results[r];
+            if (_geomOptimizer.valid())
+                _geomOptimizer->optimize(*result, simplify);
+            else if (simplify && _simplifyRatio > 0.0f)
             {
                 // FIXME: not good to weld vertices, it makes wrong texture mapping
                 // A better way is to render all to textures to get heightmap for use.
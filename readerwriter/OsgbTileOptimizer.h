@@ -4,6 +4,9 @@
 #include <osg/Transform>
 #include <osg/Geometry>
 #include <osgDB/ReaderWriter>
+#include <OpenThreads/Mutex>
+#include <set>
+#include <modeling/GeometryOptimizer.h>
 #include "Export.h"
 
 namespace osgVerse
@@ -13,8 +16,29 @@ namespace osgVerse
     public:
         TileOptimizer(const std::string& outFolder, const std::string& outFormat = "%s_%s");
 
+        /** Number of worker threads of the work-stealing scheduler used by processAdjacency() */
         void setUseThreads(int num) { _numThreads = num; _withThreads = (num > 0); }
+
+        /** Record every finished tile in a journal file of the output folder, so that an interrupted
+            processAdjacency() / processGroundLevel() resumes from the last finished tile (disabled
+            by default). The journal is ignored if input files or options changed since it was
+            written, and is removed with its temporary files when processing completes.
+            Call clearJournal() (or delete the journal file) to process everything again */
+        void setResumable(bool b) { _resumable = b; }
+        bool getResumable() const { return _resumable; }
+        void clearJournal();
         void setMergingSimplifyRatio(float r) { _simplifyRatio = r; }
+
+        /** Share identical textures and arrays of merged tiles by content, so that each of them
+            is written only once in the output tile file */
+        void setDeduplicating(bool b) { _deduplicating = b; }
+        bool getDeduplicating() const { return _deduplicating; }
+
+        /** Use meshoptimizer based pass for merged geometries instead of welding + osgUtil::Simplifier.
+            Simplifying mode / ratio of the optimizer will be used instead of setMergingSimplifyRatio();
+            merged leaf tiles are not simplified but still reordered for vertex cache / fetch */
+        void setGeometryOptimizer(GeometryOptimizer* opt) { _geomOptimizer = opt; }
+        GeometryOptimizer* getGeometryOptimizer() const { return _geomOptimizer.get(); }
         void setLodScale(float adjacency, float groundLv, float mulForDistanceMode)
         {
             _lodScaleAdjacency = adjacency; _lodScaleTopLevels = groundLv;
@@ -48,14 +72,28 @@ namespace osgVerse
                               const std::map<std::string, std::string>& plodNameMap);
         osg::Node* mergeGeometries(const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList,
                                    int highestRes, bool simplify);
+        osg::Node* processTopTileFilesWithJournal(const std::string& outTileFileName, bool isRootNode,
+                                                  const TileNameAndRoughList& srcTiles);
+
+        std::string getJournalFile() const { return _outFolder + "tile_optimizer.journal"; }
+        std::string getJournalRoughFolder() const { return _outFolder + "tile_optimizer_journal/"; }
+        std::string getJournalRoughFile(const std::string& outTileFileName) const;
+        std::string computeJournalSignature() const;
+        void removeJournalFiles();
+        void loadJournal();
+        bool isFinished(const std::string& key);
+        void markFinished(const std::string& key);
 
         typedef std::map<osg::Vec2s, std::string> NumberMap;
         std::map<std::string, NumberMap> _srcNumberMap;
         std::map<std::string, std::pair<osg::Vec2s, osg::Vec2s>> _minMaxMap;
+        std::set<std::string> _finishedTiles;
+        OpenThreads::Mutex _journalMutex;
         osg::ref_ptr<FilterNodeCallback> _filterNodeCallback;
+        osg::ref_ptr<GeometryOptimizer> _geomOptimizer;
         std::string _inFolder, _outFolder, _inFormat, _outFormat;
         float _lodScaleAdjacency, _lodScaleTopLevels, _mulForDistanceMode, _simplifyRatio;
-        int _numThreads; bool _withDraco, _withBasisu, _withThreads;
+        int _numThreads; bool _withDraco, _withBasisu, _withThreads, _resumable, _deduplicating;
     };
 
 }
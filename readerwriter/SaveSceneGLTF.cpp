@@ -0,0 +1,508 @@
+#include <osg/io_utils>
+#include <osg/Version>
+#include <osg/Material>
+#include <osg/Texture2D>
+#include <osg/Geometry>
+#include <osg/TriangleIndexFunctor>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+
+#include "LoadSceneGLTF.h"
+#include "LoadTextureKTX.h"
+#include "DracoProcessor.h"
+#include <algorithm>
+#include <set>
+#include <fstream>
+#include <sstream>
+
+namespace osgVerse
+{
+    struct CollectTriangleOperator
+    {
+        std::vector<unsigned int> indices;
+        void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
+        { indices.push_back(i1); indices.push_back(i2); indices.push_back(i3); }
+    };
+
+    /** Convert the scene graph to a GLTF model. Every geometry becomes a mesh with one node,
+        which uses the accumulated matrix of its parents; stateset inheritance is also flattened */
+    class SaverGLTF : public osg::NodeVisitor
+    {
+    public:
+        SaverGLTF(tinygltf::Model& model, const osgDB::Options* opt)
+        :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _model(model),
+            _useDracoForMesh(false)
+        {
+            _useDraco = opt && atoi(opt->getPluginStringData("UseDraco").c_str()) > 0;
+            _useKTX2 = opt && atoi(opt->getPluginStringData("UseKTX2").c_str()) > 0;
+#ifndef VERSE_USE_DRACO
+            if (_useDraco)
+            {
+                OSG_NOTICE << "[SaverGLTF] Draco is not found, "
+                           << "geometries will be saved without compression" << std::endl;
+                _useDraco = false;
+            }
+#endif
+            _model.asset.version = "2.0"; _model.asset.generator = "osgVerse";
+            _model.buffers.resize(1); _model.scenes.resize(1); _model.defaultScene = 0;
+
+            // Root node to convert Z-up (OSG) to Y-up (GLTF)
+            tinygltf::Node root; root.name = "Root";
+            osg::Matrixd zUpToYUp = osg::Matrixd::rotate(-osg::PI_2, osg::X_AXIS);
+            root.matrix.assign(zUpToYUp.ptr(), zUpToYUp.ptr() + 16);
+            _model.nodes.push_back(root); _model.scenes[0].nodes.push_back(0);
+            _matrixStack.push_back(osg::Matrixd());
+        }
+
+        virtual void apply(osg::Node& node)
+        {
+            pushStateSet(node.getStateSet());
+            traverse(node);
+            popStateSet(node.getStateSet());
+        }
+
+        virtual void apply(osg::Transform& node)
+        {
+            osg::Matrixd matrix = _matrixStack.back();
+            node.computeLocalToWorldMatrix(matrix, this);
+            _matrixStack.push_back(matrix);
+            apply(static_cast<osg::Node&>(node));
+            _matrixStack.pop_back();
+        }
+
+        virtual void apply(osg::Geode& node)
+        {
+            pushStateSet(node.getStateSet());
+#if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
+            for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+            { if (node.getDrawable(i)) apply(*node.getDrawable(i)); }
+#else
+            traverse(node);
+#endif
+            popStateSet(node.getStateSet());
+        }
+
+        virtual void apply(osg::Drawable& drawable)
+        {
+            osg::Geometry* geom = drawable.asGeometry();
+            if (!geom) return;
+
+            pushStateSet(geom->getStateSet());
+            int meshIndex = createMesh(*geom);
+            popStateSet(geom->getStateSet());
+            if (meshIndex < 0) return;
+
+            tinygltf::Node node; node.mesh = meshIndex; node.name = geom->getName();
+            const osg::Matrixd& matrix = _matrixStack.back();
+            if (!matrix.isIdentity()) node.matrix.assign(matrix.ptr(), matrix.ptr() + 16);
+            _model.nodes[0].children.push_back((int)_model.nodes.size());
+            _model.nodes.push_back(node);
+        }
+
+        void finish()
+        {
+            tinygltf::Buffer& buffer = _model.buffers[0];
+            while (buffer.data.size() % 4) buffer.data.push_back(0);
+        }
+
+    protected:
+        void pushStateSet(osg::StateSet* ss) { if (ss) _stateSetStack.push_back(ss); }
+        void popStateSet(osg::StateSet* ss) { if (ss) _stateSetStack.pop_back(); }
+
+        void addExtension(const std::string& name, bool required)
+        {
+            if (std::find(_model.extensionsUsed.begin(), _model.extensionsUsed.end(), name)
+                == _model.extensionsUsed.end()) _model.extensionsUsed.push_back(name);
+            if (required && std::find(_model.extensionsRequired.begin(),
+                _model.extensionsRequired.end(), name) == _model.extensionsRequired.end())
+                _model.extensionsRequired.push_back(name);
+        }
+
+        int addBufferView(const void* data, size_t size, int target)
+        {
+            std::vector<unsigned char>& buffer = _model.buffers[0].data;
+            while (buffer.size() % 4) buffer.push_back(0);
+
+            tinygltf::BufferView view; view.buffer = 0; view.target = target;
+            view.byteOffset = buffer.size(); view.byteLength = size;
+            buffer.insert(buffer.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+            _model.bufferViews.push_back(view);
+            return (int)_model.bufferViews.size() - 1;
+        }
+
+        int addAccessor(int view, int componentType, int type, size_t count)
+        {
+            tinygltf::Accessor accessor; accessor.bufferView = view;
+            accessor.componentType = componentType; accessor.type = type; accessor.count = count;
+            _model.accessors.push_back(accessor);
+            return (int)_model.accessors.size() - 1;
+        }
+
+        template<typename T>
+        int addAttribute(const std::vector<T>& data, int type)
+        {
+            int view = _useDracoForMesh ? -1 : addBufferView(
+                &data[0], data.size() * sizeof(T), TINYGLTF_TARGET_ARRAY_BUFFER);
+            return addAccessor(view, TINYGLTF_COMPONENT_TYPE_FLOAT, type, data.size());
+        }
+
+        int addIndices(const std::vector<unsigned int>& indices, size_t numVertices)
+        {
+            if (_useDracoForMesh)
+                return addAccessor(-1, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+                                   TINYGLTF_TYPE_SCALAR, indices.size());
+            if (numVertices < 65536)
+            {
+                std::vector<unsigned short> indices16(indices.begin(), indices.end());
+                int view = addBufferView(&indices16[0], indices16.size() * sizeof(unsigned short),
+                                         TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+                return addAccessor(view, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                                   TINYGLTF_TYPE_SCALAR, indices.size());
+            }
+
+            int view = addBufferView(&indices[0], indices.size() * sizeof(unsigned int),
+                                     TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+            return addAccessor(view, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+                               TINYGLTF_TYPE_SCALAR, indices.size());
+        }
+
+        int createMesh(osg::Geometry& geom)
+        {
+            osg::Array* va = geom.getVertexArray();
+            if (!va || va->getNumElements() == 0) return -1;
+
+            size_t numVertices = va->getNumElements();
+            std::vector<osg::Vec3f> vertices(numVertices), normals;
+            std::vector<osg::Vec2f> texCoords; std::vector<osg::Vec4f> colors;
+            if (va->getType() == osg::Array::Vec3ArrayType)
+                vertices.assign(static_cast<osg::Vec3Array*>(va)->begin(),
+                                static_cast<osg::Vec3Array*>(va)->end());
+            else if (va->getType() == osg::Array::Vec3dArrayType)
+            {
+                osg::Vec3dArray* va3d = static_cast<osg::Vec3dArray*>(va);
+                for (size_t i = 0; i < numVertices; ++i) vertices[i] = (*va3d)[i];
+            }
+            else return -1;
+
+            osg::Vec3Array* na = dynamic_cast<osg::Vec3Array*>(geom.getNormalArray());
+            if (na && na->size() == numVertices &&
+                geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX)
+                normals.assign(na->begin(), na->end());
+
+            osg::Vec4Array* ca = dynamic_cast<osg::Vec4Array*>(geom.getColorArray());
+            osg::Vec4ubArray* ca4ub = dynamic_cast<osg::Vec4ubArray*>(geom.getColorArray());
+            if (geom.getColorBinding() == osg::Geometry::BIND_PER_VERTEX)
+            {
+                if (ca && ca->size() == numVertices) colors.assign(ca->begin(), ca->end());
+                else if (ca4ub && ca4ub->size() == numVertices)
+                {
+                    for (size_t i = 0; i < numVertices; ++i)
+                    {
+                        const osg::Vec4ub& c = (*ca4ub)[i];
+                        colors.push_back(osg::Vec4(c[0], c[1], c[2], c[3]) / 255.0f);
+                    }
+                }
+            }
+
+            // OSG writers save bottom-left images upside down, as GLTF images start from top
+            int material = createMaterial(geom);
+            int texIndex = (material < 0) ? -1
+                         : _model.materials[material].pbrMetallicRoughness.baseColorTexture.index;
+            osg::Vec2Array* ta = dynamic_cast<osg::Vec2Array*>(geom.getTexCoordArray(0));
+            if (ta && ta->size() == numVertices && texIndex >= 0)
+            {
+                texCoords.assign(ta->begin(), ta->end());
+                if (_flippedTextures.find(texIndex) != _flippedTextures.end())
+                { for (size_t i = 0; i < numVertices; ++i) texCoords[i].y() = 1.0f - texCoords[i].y(); }
+            }
+
+            // Collect triangles, lines and points
+            osg::TriangleIndexFunctor<CollectTriangleOperator> functor; geom.accept(functor);
+            std::vector<unsigned int> lines, points;
+            for (unsigned int i = 0; i < geom.getNumPrimitiveSets(); ++i)
+            {
+                osg::PrimitiveSet* p = geom.getPrimitiveSet(i);
+                unsigned int numIndices = p->getNumIndices();
+                switch (p->getMode())
+                {
+                case GL_POINTS:
+                    for (unsigned int j = 0; j < numIndices; ++j) points.push_back(p->index(j));
+                    break;
+                case GL_LINES:
+                    for (unsigned int j = 0; j < numIndices; ++j) lines.push_back(p->index(j));
+                    break;
+                case GL_LINE_STRIP: case GL_LINE_LOOP:
+                    for (unsigned int j = 1; j < numIndices; ++j)
+                    { lines.push_back(p->index(j - 1)); lines.push_back(p->index(j)); }
+                    if (p->getMode() == GL_LINE_LOOP && numIndices > 2)
+                    { lines.push_back(p->index(numIndices - 1)); lines.push_back(p->index(0)); }
+                    break;
+                default: break;
+                }
+            }
+
+            const std::vector<unsigned int>& triangles = functor.indices;
+            if (triangles.empty() && lines.empty() && points.empty()) return -1;
+
+            // Draco only encodes triangles, and attributes in its own order
+            std::string dracoData; _useDracoForMesh = false;
+            if (_useDraco && lines.empty() && points.empty() &&
+                va->getType() == osg::Array::Vec3ArrayType)
+            {
+                bool validTexCoords = !geom.getTexCoordArray(0) || !texCoords.empty();
+                bool validNormals = !geom.getNormalArray() || !normals.empty() ||
+                                    geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX;
+                bool validColors = !geom.getColorArray() || (ca && !colors.empty()) ||
+                                   geom.getColorBinding() != osg::Geometry::BIND_PER_VERTEX;
+                if (validTexCoords && validNormals && validColors)
+                {
+                    // Draco should encode flipped texture coordinates as saved ones. Build a new
+                    // geometry from arrays instead of copying: copying adds it as a parent of
+                    // the state set, which may be shared with geometries saved by other threads
+                    osg::ref_ptr<osg::Geometry> geom2 = new osg::Geometry;
+                    geom2->setUseDisplayList(false); geom2->setUseVertexBufferObjects(false);
+                    geom2->setVertexArray(geom.getVertexArray());
+                    geom2->setNormalArray(geom.getNormalArray());  // bindings are kept in arrays
+                    geom2->setColorArray(geom.getColorArray());
+                    if (!texCoords.empty()) geom2->setTexCoordArray(
+                        0, new osg::Vec2Array(texCoords.begin(), texCoords.end()));
+                    for (unsigned int i = 0; i < geom.getNumPrimitiveSets(); ++i)
+                        geom2->addPrimitiveSet(geom.getPrimitiveSet(i));
+
+                    osg::ref_ptr<DracoProcessor> dp = new DracoProcessor;
+                    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+                    if (dp->encodeDracoData(ss, geom2.get())) dracoData = ss.str();
+                    _useDracoForMesh = !dracoData.empty();
+                }
+            }
+
+            tinygltf::Primitive primitive; primitive.material = material;
+            osg::BoundingBox bb;  // POSITION requires min/max values
+            for (size_t i = 0; i < numVertices; ++i) bb.expandBy(vertices[i]);
+            primitive.attributes["POSITION"] = addAttribute(vertices, TINYGLTF_TYPE_VEC3);
+            _model.accessors.back().minValues = { bb.xMin(), bb.yMin(), bb.zMin() };
+            _model.accessors.back().maxValues = { bb.xMax(), bb.yMax(), bb.zMax() };
+            if (!texCoords.empty())
+                primitive.attributes["TEXCOORD_0"] = addAttribute(texCoords, TINYGLTF_TYPE_VEC2);
+            if (!normals.empty())
+                primitive.attributes["NORMAL"] = addAttribute(normals, TINYGLTF_TYPE_VEC3);
+            if (!colors.empty())
+                primitive.attributes["COLOR_0"] = addAttribute(colors, TINYGLTF_TYPE_VEC4);
+
+            tinygltf::Mesh mesh; mesh.name = geom.getName();
+            if (_useDracoForMesh)
+            {
+                // Attribute IDs follow the adding order of DracoProcessor::encodeDracoData()
+                tinygltf::Value::Object attributes, draco; int attrID = 0;
+                attributes["POSITION"] = tinygltf::Value(attrID++);
+                if (!texCoords.empty()) attributes["TEXCOORD_0"] = tinygltf::Value(attrID++);
+                if (!normals.empty()) attributes["NORMAL"] = tinygltf::Value(attrID++);
+                if (!colors.empty()) attributes["COLOR_0"] = tinygltf::Value(attrID++);
+                int view = addBufferView(dracoData.data(), dracoData.size(), 0);
+                draco["bufferView"] = tinygltf::Value(view);
+                draco["attributes"] = tinygltf::Value(attributes);
+                primitive.extensions["KHR_draco_mesh_compression"] = tinygltf::Value(draco);
+                addExtension("KHR_draco_mesh_compression", true);
+            }
+
+            if (!triangles.empty())
+            {
+                primitive.mode = TINYGLTF_MODE_TRIANGLES;
+                primitive.indices = addIndices(triangles, numVertices);
+                mesh.primitives.push_back(primitive);
+            }
+
+            primitive.extensions.clear(); _useDracoForMesh = false;
+            if (!lines.empty())
+            {
+                primitive.mode = TINYGLTF_MODE_LINE;
+                primitive.indices = addIndices(lines, numVertices);
+                mesh.primitives.push_back(primitive);
+            }
+
+            if (!points.empty())
+            {
+                primitive.mode = TINYGLTF_MODE_POINTS;
+                primitive.indices = addIndices(points, numVertices);
+                mesh.primitives.push_back(primitive);
+            }
+            _model.meshes.push_back(mesh);
+            return (int)_model.meshes.size() - 1;
+        }
+
+        int createMaterial(osg::Geometry& geom)
+        {
+            // Find effective texture and material from the stateset stack
+            osg::Texture* tex = NULL; osg::Material* mtl = NULL;
+            osg::StateAttribute::GLModeValue lighting = osg::StateAttribute::INHERIT;
+            for (std::vector<osg::StateSet*>::reverse_iterator itr = _stateSetStack.rbegin();
+                 itr != _stateSetStack.rend(); ++itr)
+            {
+                osg::StateSet* ss = *itr;
+                if (!tex) tex = dynamic_cast<osg::Texture*>(
+                    ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+                if (!mtl) mtl = dynamic_cast<osg::Material*>(
+                    ss->getAttribute(osg::StateAttribute::MATERIAL));
+                if (lighting & osg::StateAttribute::INHERIT) lighting = ss->getMode(GL_LIGHTING);
+            }
+
+            // Geometries without normals (e.g., oblique photography) are also unlit
+            bool unlit = !geom.getNormalArray() || (!(lighting & osg::StateAttribute::INHERIT) &&
+                                                    !(lighting & osg::StateAttribute::ON));
+            MaterialKey key(std::pair<osg::Texture*, osg::Material*>(tex, mtl), unlit);
+            std::map<MaterialKey, int>::iterator itr = _materials.find(key);
+            if (itr != _materials.end()) return itr->second;
+
+            tinygltf::Material material; material.doubleSided = true;
+            material.pbrMetallicRoughness.metallicFactor = 0.0;
+            material.pbrMetallicRoughness.roughnessFactor = 1.0;
+            if (mtl != NULL)
+            {
+                const osg::Vec4& c = mtl->getDiffuse(osg::Material::FRONT);
+                material.pbrMetallicRoughness.baseColorFactor = { c[0], c[1], c[2], c[3] };
+                if (c[3] < 1.0f) material.alphaMode = "BLEND";
+            }
+
+            int texIndex = tex ? createTexture(*tex) : -1;
+            if (texIndex >= 0) material.pbrMetallicRoughness.baseColorTexture.index = texIndex;
+            if (unlit)
+            {
+                material.extensions["KHR_materials_unlit"] =
+                    tinygltf::Value(tinygltf::Value::Object());
+                addExtension("KHR_materials_unlit", false);
+            }
+
+            _model.materials.push_back(material);
+            _materials[key] = (int)_model.materials.size() - 1;
+            return _materials[key];
+        }
+
+        int createTexture(osg::Texture& tex)
+        {
+            std::map<osg::Texture*, int>::iterator itr = _textures.find(&tex);
+            if (itr != _textures.end()) return itr->second;
+
+            int imageIndex = tex.getImage(0) ? createImage(*tex.getImage(0)) : -1;
+            if (imageIndex < 0) { _textures[&tex] = -1; return -1; }
+
+            tinygltf::Sampler sampler;
+            sampler.wrapS = getWrapMode(tex.getWrap(osg::Texture::WRAP_S));
+            sampler.wrapT = getWrapMode(tex.getWrap(osg::Texture::WRAP_T));
+            sampler.magFilter = (tex.getFilter(osg::Texture::MAG_FILTER) == osg::Texture::NEAREST)
+                              ? TINYGLTF_TEXTURE_FILTER_NEAREST : TINYGLTF_TEXTURE_FILTER_LINEAR;
+            switch (tex.getFilter(osg::Texture::MIN_FILTER))
+            {
+            case osg::Texture::NEAREST: sampler.minFilter = TINYGLTF_TEXTURE_FILTER_NEAREST; break;
+            case osg::Texture::LINEAR: sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR; break;
+            default: sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR; break;
+            }
+            _model.samplers.push_back(sampler);
+
+            tinygltf::Texture texture; texture.sampler = (int)_model.samplers.size() - 1;
+            if (_useKTX2)
+            {
+                tinygltf::Value::Object basisu; basisu["source"] = tinygltf::Value(imageIndex);
+                texture.extensions["KHR_texture_basisu"] = tinygltf::Value(basisu);
+                addExtension("KHR_texture_basisu", true);
+            }
+            else
+                texture.source = imageIndex;
+
+            _model.textures.push_back(texture);
+            _textures[&tex] = (int)_model.textures.size() - 1;
+            if (!_useKTX2 && tex.getImage(0)->getOrigin() == osg::Image::BOTTOM_LEFT)
+                _flippedTextures.insert(_textures[&tex]);
+            return _textures[&tex];
+        }
+
+        int createImage(osg::Image& image)
+        {
+            std::map<osg::Image*, int>::iterator itr = _images.find(&image);
+            if (itr != _images.end()) return itr->second;
+
+            std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+            std::string mimeType; bool encoded = false;
+            if (image.valid() && !image.isCompressed())
+            {
+                if (_useKTX2)
+                {
+                    osg::ref_ptr<osgDB::Options> ktxOptions = new osgDB::Options;
+                    ktxOptions->setPluginStringData("UseBASISU", "1");
+                    std::vector<osg::Image*> images; images.push_back(&image);
+                    encoded = saveKtx2(ss, false, ktxOptions.get(), images);
+                    mimeType = "image/ktx2";
+                }
+                else
+                {
+                    bool hasAlpha = osg::Image::computeNumComponents(image.getPixelFormat()) == 4 ||
+                                    image.getPixelFormat() == GL_LUMINANCE_ALPHA;
+                    std::string ext = hasAlpha ? "png" : "jpg";
+                    osgDB::ReaderWriter* rw =
+                        osgDB::Registry::instance()->getReaderWriterForExtension(ext);
+                    if (!rw && !hasAlpha)
+                    { ext = "png"; rw = osgDB::Registry::instance()->getReaderWriterForExtension(ext); }
+                    if (rw) encoded = rw->writeImage(image, ss).success();
+                    mimeType = (ext == "png") ? "image/png" : "image/jpeg";
+                }
+            }
+
+            std::string data = ss.str();
+            if (!encoded || data.empty())
+            {
+                OSG_NOTICE << "[SaverGLTF] Failed to encode image " << image.getFileName()
+                           << ", which will be ignored" << std::endl;
+                _images[&image] = -1; return -1;
+            }
+
+            tinygltf::Image gltfImage; gltfImage.mimeType = mimeType;
+            gltfImage.name = osgDB::getStrippedName(image.getFileName());
+            gltfImage.bufferView = addBufferView(data.data(), data.size(), 0);
+            _model.images.push_back(gltfImage);
+            _images[&image] = (int)_model.images.size() - 1;
+            return _images[&image];
+        }
+
+        int getWrapMode(osg::Texture::WrapMode mode) const
+        {
+            switch (mode)
+            {
+            case osg::Texture::CLAMP: case osg::Texture::CLAMP_TO_EDGE:
+            case osg::Texture::CLAMP_TO_BORDER: return TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
+            case osg::Texture::MIRROR: return TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT;
+            default: return TINYGLTF_TEXTURE_WRAP_REPEAT;
+            }
+        }
+
+        typedef std::pair<std::pair<osg::Texture*, osg::Material*>, bool> MaterialKey;
+        std::map<MaterialKey, int> _materials;
+        std::map<osg::Texture*, int> _textures;
+        std::map<osg::Image*, int> _images;
+        std::set<int> _flippedTextures;
+        std::vector<osg::Matrixd> _matrixStack;
+        std::vector<osg::StateSet*> _stateSetStack;
+        tinygltf::Model& _model;
+        bool _useDraco, _useKTX2, _useDracoForMesh;
+    };
+
+    bool saveGltf(const osg::Node& node, const std::string& file, bool isBinary,
+                  const osgDB::Options* opt)
+    {
+        std::ofstream out(file.c_str(), std::ios::out | std::ios::binary);
+        if (!out)
+        { OSG_WARN << "[SaverGLTF] Unable to write to " << file << std::endl; return false; }
+        return saveGltf2(node, out, isBinary, opt);
+    }
+
+    bool saveGltf2(const osg::Node& node, std::ostream& out, bool isBinary, const osgDB::Options* opt)
+    {
+        tinygltf::Model model;
+        SaverGLTF saver(model, opt);
+        const_cast<osg::Node&>(node).accept(saver);
+        saver.finish();
+        if (model.meshes.empty())
+        { OSG_NOTICE << "[SaverGLTF] No geometry to save" << std::endl; }
+
+        tinygltf::TinyGLTF writer;
+        return writer.WriteGltfSceneToStream(&model, out, !isBinary, isBinary);
+    }
+}
@@ -8,9 +8,13 @@
 #include <osgDB/Registry>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <OpenThreads/ScopedLock>
 #include <ghc/filesystem.hpp>
 #include <nanoid/nanoid.h>
 #include <libhv/all/base64.h>
+#include <iomanip>
+#define XXH_INLINE_ALL
+#include <xxhash.h>
 
 #include "modeling/Utilities.h"
 #include "LoadTextureKTX.h"
@@ -374,6 +378,197 @@ osg::Image* TextureOptimizer::compressImage(osg::Texture* tex, osg::Image* img,
     }
 }
 
+ContentDeduplicator::ContentDeduplicator(const std::string& blobPrefix)
+:   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _blobPrefix(blobPrefix),
+    _sharingArrays(true), _sharingImages(true)
+{
+}
+
+ContentDeduplicator::~ContentDeduplicator()
+{
+}
+
+ContentDeduplicator::ImageMap ContentDeduplicator::getNamedImages() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _namedImages;
+}
+
+void ContentDeduplicator::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _arrays.clear(); _images.clear(); _namedImages.clear();
+}
+
+typedef XXH_errorcode (*HashUpdateFunc)(XXH3_state_t*, const void*, size_t);
+static void updateImageHash(XXH3_state_t* state, const osg::Image& image, HashUpdateFunc func)
+{
+    int header[8] = { image.s(), image.t(), image.r(), (int)image.getPixelFormat(),
+                      (int)image.getDataType(), (int)image.getInternalTextureFormat(),
+                      (int)image.getPacking(), (int)image.getOrigin() };
+    (*func)(state, header, sizeof(header));
+
+    const osg::Image::MipmapDataType& mipmaps = image.getMipmapLevels();
+    if (!mipmaps.empty()) (*func)(state, &mipmaps[0], mipmaps.size() * sizeof(unsigned int));
+    for (osg::Image::DataIterator itr(&image); itr.valid(); ++itr)
+        (*func)(state, itr.data(), itr.size());
+}
+
+static bool isSameImage(const osg::Image& i0, const osg::Image& i1)
+{
+    if (i0.s() != i1.s() || i0.t() != i1.t() || i0.r() != i1.r() ||
+        i0.getPixelFormat() != i1.getPixelFormat() || i0.getDataType() != i1.getDataType() ||
+        i0.getInternalTextureFormat() != i1.getInternalTextureFormat() ||
+        i0.getPacking() != i1.getPacking() || i0.getOrigin() != i1.getOrigin() ||
+        i0.getMipmapLevels() != i1.getMipmapLevels()) return false;
+
+    // Data blocks of two images may be split differently, so compare them piece by piece
+    osg::Image::DataIterator itr0(&i0), itr1(&i1); unsigned int offset0 = 0, offset1 = 0;
+    while (itr0.valid() && itr1.valid())
+    {
+        unsigned int size = osg::minimum(itr0.size() - offset0, itr1.size() - offset1);
+        if (memcmp(itr0.data() + offset0, itr1.data() + offset1, size) != 0) return false;
+        offset0 += size; if (offset0 == itr0.size()) { ++itr0; offset0 = 0; }
+        offset1 += size; if (offset1 == itr1.size()) { ++itr1; offset1 = 0; }
+    }
+    return !itr0.valid() && !itr1.valid();
+}
+
+unsigned long long ContentDeduplicator::computeHash(const osg::Image& image)
+{
+    XXH3_state_t* state = XXH3_createState(); XXH3_64bits_reset(state);
+    updateImageHash(state, image, XXH3_64bits_update);
+    XXH64_hash_t hash = XXH3_64bits_digest(state);
+    XXH3_freeState(state); return hash;
+}
+
+std::string ContentDeduplicator::computeHashString(const osg::Image& image)
+{
+    XXH3_state_t* state = XXH3_createState(); XXH3_128bits_reset(state);
+    updateImageHash(state, image, XXH3_128bits_update);
+    XXH128_hash_t hash = XXH3_128bits_digest(state); XXH3_freeState(state);
+
+    std::stringstream ss; ss << std::hex << std::setfill('0') << std::setw(16) << hash.high64
+                             << std::setw(16) << hash.low64; return ss.str();
+}
+
+unsigned long long ContentDeduplicator::computeHash(const osg::Array& array)
+{
+    XXH64_hash_t seed = ((XXH64_hash_t)array.getType() << 32) | array.getDataSize();
+    return XXH3_64bits_withSeed(array.getDataPointer(), array.getTotalDataSize(), seed);
+}
+
+void ContentDeduplicator::apply(osg::Drawable& drawable)
+{
+    osg::Geometry* geom = drawable.asGeometry();
+    if (geom && _sharingArrays)
+    {
+        if (geom->getVertexArray()) geom->setVertexArray(share(geom->getVertexArray()));
+        if (geom->getNormalArray()) geom->setNormalArray(share(geom->getNormalArray()));
+        if (geom->getColorArray()) geom->setColorArray(share(geom->getColorArray()));
+        if (geom->getSecondaryColorArray())
+            geom->setSecondaryColorArray(share(geom->getSecondaryColorArray()));
+        if (geom->getFogCoordArray()) geom->setFogCoordArray(share(geom->getFogCoordArray()));
+        for (unsigned int i = 0; i < geom->getNumTexCoordArrays(); ++i)
+        { if (geom->getTexCoordArray(i)) geom->setTexCoordArray(i, share(geom->getTexCoordArray(i))); }
+        for (unsigned int i = 0; i < geom->getNumVertexAttribArrays(); ++i)
+        {
+            if (geom->getVertexAttribArray(i))
+                geom->setVertexAttribArray(i, share(geom->getVertexAttribArray(i)));
+        }
+    }
+
+    applyTextureAttributes(drawable.getStateSet());
+#if OSG_VERSION_GREATER_THAN(3, 4, 1)
+    traverse(drawable);
+#endif
+}
+
+void ContentDeduplicator::apply(osg::Geode& geode)
+{
+#if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
+    for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+        apply(*geode.getDrawable(i));
+#endif
+    applyTextureAttributes(geode.getStateSet());
+    NodeVisitor::apply(geode);
+}
+
+void ContentDeduplicator::apply(osg::Node& node)
+{
+    applyTextureAttributes(node.getStateSet());
+    NodeVisitor::apply(node);
+}
+
+void ContentDeduplicator::applyTextureAttributes(osg::StateSet* ssPtr)
+{
+    if (ssPtr == NULL || !_sharingImages) return;
+    const osg::StateSet::TextureAttributeList& texAttrs = ssPtr->getTextureAttributeList();
+    for (size_t i = 0; i < texAttrs.size(); ++i)
+    {
+        const osg::StateSet::AttributeList& attrs = texAttrs[i];
+        for (osg::StateSet::AttributeList::const_iterator itr = attrs.begin();
+             itr != attrs.end(); ++itr)
+        {
+            if (itr->first.first != osg::StateAttribute::TEXTURE) continue;
+            osg::Texture* tex = static_cast<osg::Texture*>(itr->second.first.get());
+            for (unsigned int n = 0; n < tex->getNumImages(); ++n)
+            {
+                osg::Image* image = tex->getImage(n);
+                if (image && image->valid()) tex->setImage(n, share(image));
+            }
+        }
+    }
+}
+
+osg::Array* ContentDeduplicator::share(osg::Array* array)
+{
+    if (!array->getDataPointer() || !array->getTotalDataSize()) return array;
+    unsigned long long hash = computeHash(*array);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    std::map<unsigned long long, osg::ref_ptr<osg::Array>>::iterator itr = _arrays.find(hash);
+    if (itr == _arrays.end()) { _arrays[hash] = array; return array; }
+
+    // Compare arrays in case of hash collisions, and keep binding / normalizing of each one
+    osg::Array* shared = itr->second.get(); if (shared == array) return array;
+    if (shared->getType() != array->getType() || shared->getNormalize() != array->getNormalize() ||
+        shared->getTotalDataSize() != array->getTotalDataSize()) return array;
+#if OSG_VERSION_GREATER_THAN(3, 1, 8)
+    if (shared->getBinding() != array->getBinding()) return array;
+#endif
+    if (memcmp(shared->getDataPointer(), array->getDataPointer(), array->getTotalDataSize()) != 0)
+        return array;
+    return shared;
+}
+
+osg::Image* ContentDeduplicator::share(osg::Image* image)
+{
+    unsigned long long hash = computeHash(*image);
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    std::pair<SharedImageMap::iterator, SharedImageMap::iterator> range = _images.equal_range(hash);
+    for (SharedImageMap::iterator itr = range.first; itr != range.second; ++itr)
+    {
+        // Compare images in case of hash collisions
+        const SharedImage& shared = itr->second;
+        if (shared.first == image || isSameImage(*shared.first, *image))
+            return shared.second.get();
+    }
+    if (_blobPrefix.empty())
+    { _images.insert(SharedImageMap::value_type(hash, SharedImage(image, image))); return image; }
+
+    // Blob names may be kept in database across sessions, so use 128-bit hash as the key,
+    // and append a suffix if it still collides with a different image
+    std::string name = _blobPrefix + computeHashString(*image), blobName = name + ".osgb";
+    for (int i = 1; _namedImages.find(blobName) != _namedImages.end(); ++i)
+        blobName = name + "_" + std::to_string(i) + ".osgb";
+
+    osg::ref_ptr<osg::Image> proxy = new osg::Image;
+    proxy->setFileName(blobName); proxy->setWriteHint(osg::Image::EXTERNAL_FILE);
+    _images.insert(SharedImageMap::value_type(hash, SharedImage(image, proxy)));
+    _namedImages[blobName] = image; return proxy.get();
+}
+
 struct MipmapHelpers
 {
     static inline float log2(float x) { static float inv2 = 1.f / logf(2.f); return logf(x) * inv2; }
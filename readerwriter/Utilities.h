@@ -5,6 +5,7 @@
 #include <osg/Geometry>
 #include <osg/Camera>
 #include <osgDB/ReaderWriter>
+#include <OpenThreads/Mutex>
 #ifdef __EMSCRIPTEN__
 #   include <emscripten/fetch.h>
 #   include <emscripten.h>
@@ -69,6 +70,48 @@ namespace osgVerse
         bool _saveAsInlineFile, _generateMipmaps;
     };
 
+    /** Find identical images and arrays by their content hashes (xxhash) and share them, so that
+        they are saved only once in the same file. One deduplicator can be applied to many nodes
+        (also from different threads) to find copies among all of them.
+        With a blob prefix, every unique image is named "<prefix><hash>.osgb" and textures use
+        empty proxy images of that name (with EXTERNAL_FILE write hint) instead. So apply it to a
+        copied scene for writing only, and store images from getNamedImages() once by yourselves */
+    class OSGVERSE_RW_EXPORT ContentDeduplicator : public osg::NodeVisitor
+    {
+    public:
+        ContentDeduplicator(const std::string& blobPrefix = "");
+        virtual ~ContentDeduplicator();
+
+        void setSharingArrays(bool b) { _sharingArrays = b; }
+        void setSharingImages(bool b) { _sharingImages = b; }
+
+        typedef std::map<std::string, osg::ref_ptr<osg::Image>> ImageMap;
+        ImageMap getNamedImages() const;
+        void clear();
+
+        static unsigned long long computeHash(const osg::Image& image);
+        static unsigned long long computeHash(const osg::Array& array);
+        static std::string computeHashString(const osg::Image& image);  // 128-bit hex
+
+        virtual void apply(osg::Drawable& drawable);
+        virtual void apply(osg::Geode& geode);
+        virtual void apply(osg::Node& node);
+        void applyTextureAttributes(osg::StateSet* ssPtr);
+
+    protected:
+        osg::Array* share(osg::Array* array);
+        osg::Image* share(osg::Image* image);
+
+        std::map<unsigned long long, osg::ref_ptr<osg::Array>> _arrays;
+        typedef std::pair<osg::ref_ptr<osg::Image>, osg::ref_ptr<osg::Image>> SharedImage;
+        typedef std::multimap<unsigned long long, SharedImage> SharedImageMap;  // (source, shared)
+        SharedImageMap _images;
+        ImageMap _namedImages;
+        mutable OpenThreads::Mutex _mutex;
+        std::string _blobPrefix;
+        bool _sharingArrays, _sharingImages;
+    };
+
 #ifdef __EMSCRIPTEN__
     struct WebFetcher : public osg::Referenced
     {
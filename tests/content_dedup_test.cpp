@@ -0,0 +1,156 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture2D>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/Archive>
+#include <readerwriter/Utilities.h>
+#include <iostream>
+#include <sstream>
+#include <ghc/filesystem.hpp>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+// Every tile has its own copy of the same texture and texture coordinates, like the ones
+// exported from oblique photography or 3D Tiles datasets
+static osg::Node* createTile(int i, int textureSize)
+{
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(textureSize, textureSize, 1, GL_RGB, GL_UNSIGNED_BYTE);
+    for (int y = 0; y < textureSize; ++y)
+        for (int x = 0; x < textureSize; ++x)
+        {
+            unsigned char* ptr = image->data(x, y);
+            ptr[0] = (unsigned char)x; ptr[1] = (unsigned char)y; ptr[2] = (unsigned char)(x ^ y);
+        }
+
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> ta = new osg::Vec2Array;
+    for (int y = 0; y < 32; ++y)
+        for (int x = 0; x < 32; ++x)
+        {
+            va->push_back(osg::Vec3(x + i * 32.0f, y, 0.0f));
+            ta->push_back(osg::Vec2(x / 31.0f, y / 31.0f));
+        }
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setVertexArray(va.get()); geom->setTexCoordArray(0, ta.get());
+    geom->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, va->size()));
+    geom->getOrCreateStateSet()->setTextureAttributeAndModes(0, new osg::Texture2D(image.get()));
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->setName("Tile" + std::to_string(i));
+    geode->addDrawable(geom.get()); return geode.release();
+}
+
+static osg::Geometry* getGeometry(osg::Node* node)
+{
+    osg::Geode* geode = node ? node->asGeode() : NULL;
+    return (geode && geode->getNumDrawables() > 0) ? geode->getDrawable(0)->asGeometry() : NULL;
+}
+
+static osg::Texture* getTexture(osg::Node* node)
+{
+    osg::Geometry* geom = getGeometry(node);
+    osg::StateSet* ss = geom ? geom->getStateSet() : NULL;
+    return ss ? static_cast<osg::Texture*>(
+        ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE)) : NULL;
+}
+
+static size_t getFolderSize(const std::string& folder)
+{
+    size_t size = 0; std::error_code ec;
+    for (ghc::filesystem::directory_iterator itr(folder, ec), end; !ec && itr != end; ++itr)
+    { if (itr->is_regular_file()) size += itr->file_size(); }
+    return size;
+}
+
+static size_t writeTiles(osgDB::ReaderWriter* rw, const std::string& dbName,
+                         const std::string& optionString, int numTiles, int textureSize)
+{
+    ghc::filesystem::remove_all(dbName);
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options(optionString);
+    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(rw->openArchive(
+        "leveldb://" + dbName, osgDB::ReaderWriter::CREATE, 4096, options.get()).getObject());
+    if (!archive) return 0;
+
+    for (int i = 0; i < numTiles; ++i)
+    {
+        osg::ref_ptr<osg::Node> tile = createTile(i, textureSize);
+        if (!archive->writeNode(*tile, "tile_" + std::to_string(i) + ".osgb").success()) return 0;
+    }
+    archive->close(); return getFolderSize(dbName);
+}
+
+int main(int argc, char** argv)
+{
+    int numTiles = (argc > 1) ? atoi(argv[1]) : 100;
+    int textureSize = (argc > 2) ? atoi(argv[2]) : 256;
+    bool success = true;
+
+    // Deduplicating in memory: all copies of the texture and texture coordinates are shared
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    for (int i = 0; i < 10; ++i) root->addChild(createTile(i, textureSize));
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osgVerse::ContentDeduplicator> deduplicator = new osgVerse::ContentDeduplicator;
+    root->accept(*deduplicator);
+    std::cout << "Deduplicating in memory: " << osg::Timer::instance()->delta_m(
+                 t0, osg::Timer::instance()->tick()) << "ms" << std::endl;
+    for (unsigned int i = 1; i < root->getNumChildren(); ++i)
+    {
+        osg::Geometry* geom0 = getGeometry(root->getChild(0));
+        osg::Geometry* geom1 = getGeometry(root->getChild(i));
+        osg::Image* image0 = getTexture(root->getChild(0))->getImage(0);
+        osg::Image* image1 = getTexture(root->getChild(i))->getImage(0);
+        if (image0 != image1 || geom0->getTexCoordArray(0) != geom1->getTexCoordArray(0) ||
+            geom0->getVertexArray() == geom1->getVertexArray())
+        { std::cout << "  Tile " << i << " is not deduplicated!" << std::endl; success = false; }
+    }
+
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_leveldb"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_leveldb");
+    if (!rw) { std::cout << "LevelDB plugin not found" << std::endl; return 1; }
+
+    // Deduplicating in LevelDB: the texture is stored only once, and shared by all loaded tiles
+    size_t size0 = writeTiles(rw, "content_dedup_test0.db", "", numTiles, textureSize);
+    size_t size1 = writeTiles(rw, "content_dedup_test1.db", "Deduplicate=1", numTiles, textureSize);
+    std::cout << "Database size: " << (size0 / 1024) << "KB, deduplicated: "
+              << (size1 / 1024) << "KB" << std::endl;
+    if (size0 == 0 || size1 == 0 || size1 * 2 > size0)
+    { std::cout << "  Deduplicating doesn't reduce database size!" << std::endl; success = false; }
+
+    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(rw->openArchive(
+        "leveldb://content_dedup_test1.db", osgDB::ReaderWriter::READ, 4096, NULL).getObject());
+    osg::ref_ptr<osg::Node> tile0, tile1;
+    if (archive.valid())
+    {
+        tile0 = archive->readNode("tile_0.osgb").getNode();
+        tile1 = archive->readNode("tile_1.osgb").getNode();
+    }
+
+    osg::Texture* tex0 = getTexture(tile0.get()), *tex1 = getTexture(tile1.get());
+    if (!tex0 || !tex1 || !tex0->getImage(0) || tex0->getImage(0)->s() != textureSize)
+    { std::cout << "  Failed to read deduplicated tiles!" << std::endl; success = false; }
+    else if (tex0 != tex1)
+    { std::cout << "  Loaded textures are not shared!" << std::endl; success = false; }
+    if (osgDB::Registry::instance()->getSharedStateManager() != NULL)
+    { std::cout << "  Global shared state manager is changed!" << std::endl; success = false; }
+
+    if (archive.valid()) archive->close();
+    ghc::filesystem::remove_all("content_dedup_test0.db");
+    ghc::filesystem::remove_all("content_dedup_test1.db");
+    std::cout << (success ? "Content dedup test passed" : "Content dedup test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geometry>
+#include <modeling/GeometryOptimizer.h>
+#include <modeling/GeometryMerger.h>
+#include "test_utilities.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static void printStatistics(const std::string& name, const osgVerse::GeometryOptimizer::Statistics& s)
+{
+    std::cout << name << ": Triangles = " << s.numTriangles << ", Vertices = " << s.numVertices
+              << ", ACMR = " << s.acmr << ", ATVR = " << s.atvr << ", Overfetch = " << s.overfetch
+              << std::endl;
+}
+
+static bool runOptimizer(const std::string& name, osgVerse::GeometryOptimizer* optimizer,
+                         float maxTriangleRatio, float minTriangleRatio)
+{
+    osg::ref_ptr<osg::Geometry> geom = shuffleTriangles(createUnweldedGrid(128, 128, true), 1);
+    osgVerse::GeometryOptimizer::Statistics s0 = osgVerse::GeometryOptimizer::analyze(*geom);
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    bool ok = optimizer->optimize(*geom);
+    double timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+    osgVerse::GeometryOptimizer::Statistics s1 = osgVerse::GeometryOptimizer::analyze(*geom);
+
+    std::cout << "[" << name << "] " << timeMs << "ms" << std::endl;
+    printStatistics("  Before", s0); printStatistics("  After ", s1);
+
+    float triangleRatio = (float)s1.numTriangles / (float)s0.numTriangles;
+    bool success = ok && s1.acmr < s0.acmr && triangleRatio <= maxTriangleRatio
+                && triangleRatio >= minTriangleRatio;
+    if (!success) std::cout << "  FAILED: triangle ratio = " << triangleRatio << std::endl;
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    bool success = true;
+    osg::ref_ptr<osgVerse::GeometryOptimizer> optimizer = new osgVerse::GeometryOptimizer;
+
+    // Reordering only: triangle count unchanged, welded vertices make ACMR close to 0.5-0.7
+    optimizer->setSimplifying(osgVerse::GeometryOptimizer::NO_SIMPLIFY);
+    success &= runOptimizer("Reorder", optimizer.get(), 1.0f, 1.0f);
+
+    optimizer->setSimplifying(osgVerse::GeometryOptimizer::SIMPLIFY, 0.25f, 0.05f);
+    success &= runOptimizer("Simplify", optimizer.get(), 0.3f, 0.05f);
+
+    optimizer->setSimplifying(osgVerse::GeometryOptimizer::SIMPLIFY_WITH_ATTRIBUTES, 0.25f, 0.05f);
+    success &= runOptimizer("Simplify with attributes", optimizer.get(), 0.3f, 0.05f);
+
+    optimizer->setSimplifying(osgVerse::GeometryOptimizer::SIMPLIFY_SLOPPY, 0.25f, 0.05f);
+    success &= runOptimizer("Simplify sloppy", optimizer.get(), 0.3f, 0.01f);
+
+    // Merger with optimizer enabled
+    std::vector<osg::ref_ptr<osg::Geometry>> geometries;
+    std::vector<std::pair<osg::Geometry*, osg::Matrix>> geomList;
+    for (int i = 0; i < 4; ++i)
+    {
+        geometries.push_back(shuffleTriangles(createUnweldedGrid(32, 32, true), i + 2));
+        geomList.push_back(std::pair<osg::Geometry*, osg::Matrix>(
+            geometries.back().get(), osg::Matrix::translate(32.0f * i, 0.0f, 0.0f)));
+    }
+
+    osgVerse::GeometryMerger merger;
+    osg::ref_ptr<osg::Geometry> merged0 = merger.process(geomList, 0);
+    optimizer->setSimplifying(osgVerse::GeometryOptimizer::NO_SIMPLIFY);
+    merger.setOptimizer(optimizer.get());
+    osg::ref_ptr<osg::Geometry> merged1 = merger.process(geomList, 0);
+    if (merged0.valid() && merged1.valid())
+    {
+        osgVerse::GeometryOptimizer::Statistics s0 = osgVerse::GeometryOptimizer::analyze(*merged0);
+        osgVerse::GeometryOptimizer::Statistics s1 = osgVerse::GeometryOptimizer::analyze(*merged1);
+        std::cout << "[Merger]" << std::endl;
+        printStatistics("  Before", s0); printStatistics("  After ", s1);
+        if (s1.acmr >= s0.acmr || s1.numTriangles != s0.numTriangles) success = false;
+    }
+    else success = false;
+
+    std::cout << (success ? "Geometry optimizer test passed" : "Geometry optimizer test FAILED")
+              << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geometry>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <readerwriter/LoadSceneGLTF.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+// Peak RSS is only measurable (and resettable) on Linux: write '5' to clear_refs to reset VmHWM
+static void resetPeakMemory()
+{
+#if defined(__linux__)
+    std::ofstream out("/proc/self/clear_refs"); out << "5";
+#endif
+}
+
+static long getMemoryKB(const std::string& key)
+{
+#if defined(__linux__)
+    std::ifstream in("/proc/self/status"); std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.find(key) == 0)
+            return atol(line.substr(key.size() + 1).c_str());
+    }
+#endif
+    return -1;
+}
+
+static void appendPadded(std::string& out, const std::string& data, char padding, size_t alignment)
+{
+    out += data; while (out.size() % alignment) out.push_back(padding);
+}
+
+static void appendInt(std::string& out, unsigned int value)
+{ out.append((const char*)&value, sizeof(unsigned int)); }
+
+// A glb grid with positions, normals, UVs and indices, all in one binary buffer
+static std::string createGlb(int gridSize)
+{
+    int numVertices = (gridSize + 1) * (gridSize + 1), numIndices = gridSize * gridSize * 6;
+    std::vector<float> positions, normals, uvs; std::vector<unsigned int> indices;
+    for (int y = 0; y <= gridSize; ++y)
+        for (int x = 0; x <= gridSize; ++x)
+        {
+            positions.push_back((float)x); positions.push_back(sinf(x * 0.05f) * cosf(y * 0.05f));
+            positions.push_back((float)y); normals.push_back(0.0f); normals.push_back(1.0f);
+            normals.push_back(0.0f); uvs.push_back((float)x / gridSize);
+            uvs.push_back((float)y / gridSize);
+        }
+
+    for (int y = 0; y < gridSize; ++y)
+        for (int x = 0; x < gridSize; ++x)
+        {
+            unsigned int i0 = y * (gridSize + 1) + x, i1 = i0 + 1;
+            unsigned int i2 = i0 + gridSize + 1, i3 = i2 + 1;
+            indices.push_back(i0); indices.push_back(i2); indices.push_back(i1);
+            indices.push_back(i1); indices.push_back(i2); indices.push_back(i3);
+        }
+
+    std::string bin;
+    size_t pSize = positions.size() * sizeof(float), nSize = normals.size() * sizeof(float);
+    size_t tSize = uvs.size() * sizeof(float), iSize = indices.size() * sizeof(unsigned int);
+    bin.append((const char*)&positions[0], pSize); bin.append((const char*)&normals[0], nSize);
+    bin.append((const char*)&uvs[0], tSize); bin.append((const char*)&indices[0], iSize);
+
+    std::stringstream json;
+    json << "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],"
+         << "\"nodes\":[{\"name\":\"Grid\",\"mesh\":0}],\"meshes\":[{\"name\":\"GridMesh\","
+         << "\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},"
+         << "\"indices\":3,\"mode\":4}]}],\"buffers\":[{\"byteLength\":" << bin.size() << "}],";
+
+    size_t viewSizes[4] = { pSize, nSize, tSize, iSize }, viewOffset = 0;
+    json << "\"bufferViews\":[";
+    for (int i = 0; i < 4; ++i)
+    {
+        json << (i > 0 ? "," : "") << "{\"buffer\":0,\"byteOffset\":" << viewOffset
+             << ",\"byteLength\":" << viewSizes[i] << ",\"target\":" << (i < 3 ? 34962 : 34963) << "}";
+        viewOffset += viewSizes[i];
+    }
+
+    const char* types[4] = { "VEC3", "VEC3", "VEC2", "SCALAR" };
+    json << "],\"accessors\":[";
+    for (int i = 0; i < 4; ++i)
+    {
+        json << (i > 0 ? "," : "") << "{\"bufferView\":" << i << ",\"componentType\":"
+             << (i < 3 ? 5126 : 5125) << ",\"count\":" << (i < 3 ? numVertices : numIndices)
+             << ",\"type\":\"" << types[i] << "\"}";
+    }
+    json << "]}";
+
+    std::string jsonChunk, binChunk, glb;
+    appendPadded(jsonChunk, json.str(), ' ', 4); appendPadded(binChunk, bin, '\0', 4);
+    glb = "glTF"; appendInt(glb, 2);
+    appendInt(glb, 12 + 8 + jsonChunk.size() + 8 + binChunk.size());
+    appendInt(glb, jsonChunk.size()); glb += "JSON"; glb += jsonChunk;
+    appendInt(glb, binChunk.size()); glb += std::string("BIN\0", 4); glb += binChunk;
+    return glb;
+}
+
+static std::string createB3dm(const std::string& glb)
+{
+    // The 28-byte header and the feature table JSON should end at 8-byte boundary
+    std::string featureTable = "{\"BATCH_LENGTH\":0}", body;
+    while ((28 + featureTable.size()) % 8) featureTable.push_back(' ');
+    appendPadded(body, featureTable + glb, '\0', 8);
+
+    std::string b3dm = "b3dm";
+    appendInt(b3dm, 1); appendInt(b3dm, 28 + body.size()); appendInt(b3dm, featureTable.size());
+    appendInt(b3dm, 0); appendInt(b3dm, 0); appendInt(b3dm, 0); return b3dm + body;
+}
+
+static std::string createCmpt(const std::vector<std::string>& tiles)
+{
+    std::string body, cmpt = "cmpt";
+    for (size_t i = 0; i < tiles.size(); ++i) body += tiles[i];
+    appendInt(cmpt, 1); appendInt(cmpt, 16 + body.size());
+    appendInt(cmpt, tiles.size()); return cmpt + body;
+}
+
+static bool writeFile(const std::string& fileName, const std::string& data)
+{
+    std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+    if (!out) return false; out.write(data.data(), data.size()); return true;
+}
+
+static std::string serialize(osg::Node* node)
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if (!rw || !node) return std::string();
+
+    std::stringstream ss; rw->writeNode(*node, ss);
+    return ss.str();
+}
+
+static std::string loadAndMeasure(const std::string& fileName, bool mapping,
+                                  long& peakKB, double& timeMs)
+{
+    resetPeakMemory(); long baseKB = getMemoryKB("VmRSS");
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osg::Group> root;
+    if (mapping)
+        root = osgVerse::loadGltf(fileName, true);
+    else
+    {
+        std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+        root = osgVerse::loadGltf2(in, ".", true);
+    }
+    timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+    peakKB = (baseKB < 0) ? -1 : (getMemoryKB("VmHWM") - baseKB);
+
+    if (root.valid()) root->setName(fileName);
+    return serialize(root.get());
+}
+
+int main(int argc, char** argv)
+{
+    int gridSize = (argc > 1) ? atoi(argv[1]) : 1024;
+    std::string glb = createGlb(gridSize), b3dm = createB3dm(glb);
+    std::vector<std::string> tiles; tiles.push_back(b3dm); tiles.push_back(b3dm);
+    if (!writeFile("gltf_mmap_test.glb", glb) || !writeFile("gltf_mmap_test.b3dm", b3dm) ||
+        !writeFile("gltf_mmap_test.cmpt", createCmpt(tiles)))
+    { std::cout << "Failed to write test files" << std::endl; return 1; }
+
+    bool success = true;
+    const char* files[] = { "gltf_mmap_test.glb", "gltf_mmap_test.b3dm" };
+    for (int i = 0; i < 2; ++i)
+    {
+        // Mapping first, so that any memory kept by the allocator can only favor the stream path
+        long peak0 = 0, peak1 = 0; double time0 = 0.0, time1 = 0.0;
+        std::string result0 = loadAndMeasure(files[i], true, peak0, time0);
+        std::string result1 = loadAndMeasure(files[i], false, peak1, time1);
+        std::cout << files[i] << ": Mapping = " << time0 << "ms, peak +" << peak0 << "KB; "
+                  << "Stream = " << time1 << "ms, peak +" << peak1 << "KB" << std::endl;
+
+        if (result0.empty() || result0 != result1)
+        { std::cout << "  Scene outputs are different!" << std::endl; success = false; }
+        if (peak0 >= 0 && peak1 >= 0 && peak0 >= peak1)
+        { std::cout << "  Mapping doesn't lower peak memory!" << std::endl; success = false; }
+    }
+
+    // Inner tiles of cmpt are loaded from the mapping, and should be same as the b3dm one
+    osg::ref_ptr<osg::Node> cmpt = osgDB::readNodeFile("gltf_mmap_test.cmpt");
+    osg::Group* cmptGroup = cmpt.valid() ? cmpt->asGroup() : NULL;
+    if (cmptGroup && cmptGroup->getNumChildren() == tiles.size())
+    {
+        std::ifstream in("gltf_mmap_test.b3dm", std::ios::in | std::ios::binary);
+        std::string expected = serialize(osgVerse::loadGltf2(in, ".", true).get());
+        for (unsigned int i = 0; i < cmptGroup->getNumChildren(); ++i)
+        {
+            if (serialize(cmptGroup->getChild(i)) == expected) continue;
+            std::cout << "  Cmpt inner tile " << i << " is different!" << std::endl; success = false;
+        }
+    }
+    else
+    { std::cout << "  Failed to read cmpt file" << std::endl; success = false; }
+
+    remove("gltf_mmap_test.glb"); remove("gltf_mmap_test.b3dm"); remove("gltf_mmap_test.cmpt");
+    std::cout << (success ? "GLTF mapping test passed" : "GLTF mapping test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
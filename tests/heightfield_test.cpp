@@ -0,0 +1,122 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+
+#include <modeling/Utilities.h>
+#include <iostream>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+typedef double (*HeightFunc)(double x, double y, bool& valid);
+static double planeHeight(double x, double y, bool& valid)
+{ valid = true; return 5.0 + 0.1 * x + 0.2 * y; }
+
+static double sphereTop(double x, double y, bool& valid)
+{
+    double d2 = x * x + y * y; valid = (d2 < 0.81 * 100.0);  // skip steep rim of R = 10
+    return valid ? sqrt(100.0 - d2) : 0.0;
+}
+
+static double sphereBottom(double x, double y, bool& valid)
+{ return -sphereTop(x, y, valid); }
+
+static osg::Node* createPlane(int segments)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    for (int y = 0; y <= segments; ++y)
+        for (int x = 0; x <= segments; ++x)
+        {
+            double px = 100.0 * x / segments, py = 100.0 * y / segments; bool valid = false;
+            va->push_back(osg::Vec3(px, py, planeHeight(px, py, valid) - 5.0));
+        }
+
+    for (int y = 0; y < segments; ++y)
+        for (int x = 0; x < segments; ++x)
+        {
+            unsigned int i0 = y * (segments + 1) + x, i1 = i0 + 1;
+            unsigned int i2 = i0 + segments + 1, i3 = i2 + 1;
+            de->push_back(i0); de->push_back(i1); de->push_back(i3);
+            de->push_back(i0); de->push_back(i3); de->push_back(i2);
+        }
+
+    // Put it under a transform to check world-space collection
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(osgVerse::createGeometry(va.get(), NULL, NULL, de.get()));
+    osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+    mt->setMatrix(osg::Matrix::translate(0.0f, 0.0f, 5.0f));
+    mt->addChild(geode.get()); return mt.release();
+}
+
+static osg::Node* createSphere()
+{
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(osgVerse::createEllipsoid(osg::Vec3(), 10.0f, 10.0f, 10.0f, 256));
+    return geode.release();
+}
+
+static bool compare(const std::string& name, osg::HeightField* hf, HeightFunc func,
+                    double tolerance, double timeMs)
+{
+    if (!hf) { std::cout << name << ": no heightfield created (FAILED)" << std::endl; return false; }
+    double maxError = 0.0; int numSamples = 0;
+    for (unsigned int y = 0; y < hf->getNumRows(); ++y)
+        for (unsigned int x = 0; x < hf->getNumColumns(); ++x)
+        {
+            osg::Vec3 pt = hf->getVertex(x, y); bool valid = false;
+            double h = func(pt.x(), pt.y(), valid); if (!valid) continue;
+            maxError = osg::maximum(maxError, fabs(h - pt.z())); numSamples++;
+        }
+
+    bool passed = (maxError < tolerance && numSamples > 0);
+    std::cout << name << ": " << hf->getNumColumns() << "x" << hf->getNumRows() << ", "
+              << timeMs << "ms, " << numSamples << " samples, max error = " << maxError
+              << (passed ? "" : " (FAILED)") << std::endl;
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    int resolution = (argc > 1) ? atoi(argv[1]) : 257;
+    osg::ref_ptr<osg::Node> plane = createPlane(50), sphere = createSphere();
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osg::HeightField> hfPlane =
+        osgVerse::createHeightFieldFromMeshes(plane.get(), resolution, resolution);
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osg::HeightField> hfTop =
+        osgVerse::createHeightFieldFromMeshes(sphere.get(), resolution, resolution);
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osg::HeightField> hfBottom = osgVerse::createHeightFieldFromMeshes(
+        sphere.get(), resolution, resolution, osg::BoundingBox(), false);
+    osg::Timer_t t3 = osg::Timer::instance()->tick();
+
+    // Sphere is tessellated, so allow a little error (0.5% of radius) comparing with analytic one
+    osg::Timer* timer = osg::Timer::instance(); bool success = true;
+    success &= compare("Plane", hfPlane.get(), planeHeight, 1e-3, timer->delta_m(t0, t1));
+    success &= compare("Sphere (max)", hfTop.get(), sphereTop, 0.05, timer->delta_m(t1, t2));
+    success &= compare("Sphere (min)", hfBottom.get(), sphereBottom, 0.05, timer->delta_m(t2, t3));
+
+    // Given bound: only the upper half of the sphere kept, lower part clipped like a camera
+    osg::ref_ptr<osg::HeightField> hfClipped = osgVerse::createHeightFieldFromMeshes(
+        sphere.get(), 65, 65, osg::BoundingBox(-10.0f, -10.0f, 0.0f, 10.0f, 10.0f, 10.0f), false);
+    if (hfClipped.valid())
+    {
+        float centerHeight = hfClipped->getHeight(32, 32), cornerHeight = hfClipped->getHeight(0, 0);
+        bool passed = fabs(centerHeight - 10.0f) < 0.05f && cornerHeight == 0.0f;
+        std::cout << "Clipped sphere (min): center = " << centerHeight << ", corner = "
+                  << cornerHeight << (passed ? "" : " (FAILED)") << std::endl;
+        success &= passed;
+    }
+    else success = false;
+
+    std::cout << (success ? "Heightfield test passed" : "Heightfield test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
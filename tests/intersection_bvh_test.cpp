@@ -0,0 +1,180 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/KdTree>
+#include <pipeline/IntersectionManager.h>
+#include <iostream>
+#include <algorithm>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+// A skewed mesh: a deep stack of triangles crossed by the same rays, with unevenly spaced
+// layers, and a row of tiny triangles spread exponentially along X
+static osg::Geometry* createSkewedMesh(int numLayers, int numTiny,
+                                       std::vector<osg::Vec3d>& tinyCenters)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    for (int i = 0; i < numLayers; ++i)
+    {
+        float z = i * i * 1e-4f;
+        va->push_back(osg::Vec3(0.0f, 0.0f, z)); va->push_back(osg::Vec3(2.0f, 0.0f, z));
+        va->push_back(osg::Vec3(0.0f, 2.0f, z));
+    }
+
+    for (int i = 0; i < numTiny; ++i)
+    {
+        float x = 3.0f + expf(i * 5e-4f) - 1.0f, size = 1e-3f;
+        osg::Vec3 v0(x, 5.0f, 0.0f), v1(x + size, 5.0f, 0.0f), v2(x, 5.0f + size, 0.0f);
+        va->push_back(v0); va->push_back(v1); va->push_back(v2);
+        tinyCenters.push_back((v0 + v1 + v2) / 3.0f);
+    }
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setVertexArray(va.get());
+    geom->addPrimitiveSet(new osg::DrawArrays(GL_TRIANGLES, 0, va->size()));
+    return geom.release();
+}
+
+static std::vector<double> findHitHeights(osg::Node* node, const osg::Vec3d& s, const osg::Vec3d& e,
+                                          unsigned int bvhMinTriangles)
+{
+    osgVerse::IntersectionCondition condition;
+    condition.bvhMinTriangles = bvhMinTriangles;  // 0 = osgUtil with KdTree
+
+    std::vector<osgVerse::IntersectionResult> results =
+        osgVerse::findAllIntersections(node, s, e, &condition);
+    std::vector<double> heights;
+    for (size_t i = 0; i < results.size(); ++i)
+        heights.push_back(results[i].getWorldIntersectPoint().z());
+    std::sort(heights.begin(), heights.end()); return heights;
+}
+
+static bool compareNearest(const osgVerse::IntersectionResult& r0,
+                           const osgVerse::IntersectionResult& r1)
+{
+    if (!r0.drawable || !r1.drawable) return r0.drawable == r1.drawable;
+    return r0.drawable == r1.drawable && osg::equivalent(
+        (r0.getWorldIntersectPoint() - r1.getWorldIntersectPoint()).length(), 0.0, 1e-4);
+}
+
+static bool compareHits(const std::vector<double>& bvh, const std::vector<double>& kd)
+{
+    if (bvh.size() != kd.size()) return false;
+    for (size_t i = 0; i < bvh.size(); ++i)
+    { if (!osg::equivalent(bvh[i], kd[i], 1e-4)) return false; }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int numLayers = (argc > 1) ? atoi(argv[1]) : 5000;
+    int numTiny = (argc > 2) ? atoi(argv[2]) : 50000;
+    std::vector<osg::Vec3d> tinyCenters;
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(createSkewedMesh(numLayers, numTiny, tinyCenters));
+
+    osg::ref_ptr<osg::KdTreeBuilder> kdBuilder = new osg::KdTreeBuilder;
+    geode->accept(*kdBuilder);
+
+    // Rays through all layers: every layer must be hit by both methods
+    bool success = true; double zMax = numLayers * numLayers * 1e-4 + 1.0;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int i = 0; i < 10; ++i)
+    {
+        osg::Vec3d s(0.1 + i * 0.05, 0.3 + i * 0.07, zMax), e = s; e.z() = -1.0;
+        std::vector<double> bvh = findHitHeights(geode.get(), s, e, 1);
+        std::vector<double> kd = findHitHeights(geode.get(), s, e, 0);
+        if (bvh.size() != (size_t)numLayers || !compareHits(bvh, kd))
+        {
+            std::cout << "  Layer ray " << i << ": BVH " << bvh.size() << " hits, KdTree "
+                      << kd.size() << " hits" << std::endl; success = false;
+        }
+    }
+
+    // Rays through tiny triangles, which are far from each other in the tree
+    for (size_t i = 0; i < tinyCenters.size(); i += tinyCenters.size() / 97 + 1)
+    {
+        osg::Vec3d s = tinyCenters[i] + osg::Z_AXIS, e = tinyCenters[i] - osg::Z_AXIS;
+        std::vector<double> bvh = findHitHeights(geode.get(), s, e, 1);
+        std::vector<double> kd = findHitHeights(geode.get(), s, e, 0);
+        if (bvh.size() != 1 || !compareHits(bvh, kd))
+        {
+            std::cout << "  Tiny ray " << i << ": BVH " << bvh.size() << " hits, KdTree "
+                      << kd.size() << " hits" << std::endl; success = false;
+        }
+    }
+
+    // Batched rays in one traversal must give the same nearest hits as picking them one by one
+    std::vector<std::pair<osg::Vec3d, osg::Vec3d>> segments;
+    for (int i = 0; i < 10; ++i)
+    {
+        osg::Vec3d s(0.1 + i * 0.05, 0.3 + i * 0.07, zMax), e = s; e.z() = -1.0;
+        segments.push_back(std::pair<osg::Vec3d, osg::Vec3d>(s, e));
+    }
+    for (size_t i = 0; i < tinyCenters.size(); i += tinyCenters.size() / 31 + 1)
+    {
+        segments.push_back(std::pair<osg::Vec3d, osg::Vec3d>(
+            tinyCenters[i] + osg::Z_AXIS, tinyCenters[i] - osg::Z_AXIS));
+    }
+    segments.push_back(std::pair<osg::Vec3d, osg::Vec3d>(  // missing everything
+        osg::Vec3d(-5.0, -5.0, zMax), osg::Vec3d(-5.0, -5.0, -1.0)));
+
+    osgVerse::IntersectionCondition condition; condition.bvhMinTriangles = 1;
+    std::vector<osgVerse::IntersectionResult> batched =
+        osgVerse::findNearestIntersections(geode.get(), segments, &condition);
+    if (batched.size() != segments.size())
+    {
+        std::cout << "  Batched rays: " << batched.size() << " results of "
+                  << segments.size() << " segments" << std::endl; success = false;
+    }
+    else
+    {
+        for (size_t i = 0; i < segments.size(); ++i)
+        {
+            osgVerse::IntersectionResult single = osgVerse::findNearestIntersection(
+                geode.get(), segments[i].first, segments[i].second, &condition);
+            bool hitExpected = (i + 1 < segments.size());
+            if (!compareNearest(batched[i], single) || hitExpected != batched[i].drawable.valid())
+            {
+                std::cout << "  Batched ray " << i << " differs from single ray" << std::endl;
+                success = false;
+            }
+        }
+    }
+
+    // Edit the top layer after its BVH is cached: the modified count must invalidate the BVH
+    osg::Geometry* geom = geode->getDrawable(0)->asGeometry();
+    osg::Vec3Array* va = static_cast<osg::Vec3Array*>(geom->getVertexArray());
+    osg::Vec3d rayStart(0.2, 0.2, zMax), rayEnd(0.2, 0.2, -1.0);
+    osgVerse::IntersectionResult before =
+        osgVerse::findNearestIntersection(geode.get(), rayStart, rayEnd, &condition);
+
+    float movedZ = zMax - 0.5f; int top = (numLayers - 1) * 3;
+    for (int i = 0; i < 3; ++i) (*va)[top + i].z() = movedZ;
+    va->dirty(); geom->dirtyBound();
+
+    osgVerse::IntersectionResult after =
+        osgVerse::findNearestIntersection(geode.get(), rayStart, rayEnd, &condition);
+    if (!before.drawable || !after.drawable ||
+        !osg::equivalent(after.getWorldIntersectPoint().z(), (double)movedZ, 1e-4))
+    {
+        std::cout << "  Edited vertices: hit at " << (after.drawable.valid()
+                  ? after.getWorldIntersectPoint().z() : 0.0) << ", expected " << movedZ
+                  << std::endl; success = false;
+    }
+    else if (osg::equivalent(before.getWorldIntersectPoint().z(), (double)movedZ, 1e-4))
+    { std::cout << "  Edited vertices: hit didn't move" << std::endl; success = false; }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    std::cout << "Compared in " << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
+    std::cout << (success ? "Intersection BVH test passed" : "Intersection BVH test FAILED")
+              << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/Archive>
+#include <iostream>
+#include <sstream>
+#include <ghc/filesystem.hpp>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static std::string dbName = "leveldb_benchmark_test.db";
+static std::string getTileName(int i) { return "tile_" + std::to_string(i) + ".osgb"; }
+
+// A tile of about 100KB by default, like a typical oblique photography tile without textures
+static osg::Node* createTile(int i, int numVertices = 8192)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(numVertices);
+    for (size_t v = 0; v < va->size(); ++v)
+        (*va)[v].set((float)(v % 91) + i, (float)(v / 91), (float)((v * 7 + i) % 13));
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setVertexArray(va.get());
+    geom->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, va->size()));
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->setName("Tile" + std::to_string(i));
+    geode->addDrawable(geom.get()); return geode.release();
+}
+
+static bool benchmark(osgDB::ReaderWriter* rw, const std::string& name,
+                      const std::string& optionString, int numTiles, int numReads)
+{
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options(optionString);
+    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(rw->openArchive(
+        "leveldb://" + dbName, osgDB::ReaderWriter::READ, 4096, options.get()).getObject());
+    if (!archive) { std::cout << "Failed to open " << dbName << std::endl; return false; }
+
+    // Random reads (80% of them on 20% hot tiles), and existence checks of present / missing tiles
+    unsigned int seed = 12345, numFailed = 0;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int r = 0; r < numReads; ++r)
+    {
+        seed = seed * 1103515245 + 12345; unsigned int value = seed >> 8;
+        int i = (value % 5 != 0) ? (value / 5) % (numTiles / 5) : (value / 5) % numTiles;
+        osg::ref_ptr<osg::Node> node = archive->readNode(getTileName(i)).getNode();
+        if (!node || node->getName() != ("Tile" + std::to_string(i))) numFailed++;
+    }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    for (int r = 0; r < numReads; ++r)
+    {
+        if (!archive->fileExists(getTileName(r % numTiles))) numFailed++;
+        if (archive->fileExists(getTileName(numTiles + r))) numFailed++;
+    }
+
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    archive->close();  // so that next benchmark can reopen it with new options
+    std::cout << name << " (" << optionString << "): " << numReads << " reads in "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms, " << (numReads * 2)
+              << " existence checks in " << osg::Timer::instance()->delta_m(t1, t2) << "ms"
+              << (numFailed > 0 ? ", FAILED" : "") << std::endl;
+    return numFailed == 0;
+}
+
+// Existence checks should not copy values out, so their cost should not grow with value sizes
+static bool benchmarkExistence(osgDB::ReaderWriter* rw, int numVertices, int numTiles, int numChecks,
+                               double& timeMs)
+{
+    std::string name = "leveldb_benchmark_test_" + std::to_string(numVertices) + ".db";
+    ghc::filesystem::remove_all(name);
+    for (int i = 0; i < numTiles; ++i)
+    {
+        osg::ref_ptr<osg::Node> tile = createTile(i, numVertices);
+        if (!rw->writeNode(*tile, "leveldb://" + name + "/" + getTileName(i), NULL).success())
+        { std::cout << "Failed to write tile " << i << std::endl; return false; }
+    }
+
+    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(
+        rw->openArchive("leveldb://" + name, osgDB::ReaderWriter::READ).getObject());
+    if (!archive) { std::cout << "Failed to open " << name << std::endl; return false; }
+
+    int numFailed = 0; osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int r = 0; r < numChecks; ++r)
+    { if (!archive->fileExists(getTileName(r % numTiles))) numFailed++; }
+    timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+    archive->close(); ghc::filesystem::remove_all(name);
+    std::cout << numChecks << " existence checks of " << (numVertices * 12 / 1024)
+              << "KB values in " << timeMs << "ms" << (numFailed > 0 ? ", FAILED" : "") << std::endl;
+    return numFailed == 0;
+}
+
+int main(int argc, char** argv)
+{
+    int numTiles = (argc > 1) ? atoi(argv[1]) : 2000;
+    int numReads = (argc > 2) ? atoi(argv[2]) : 10000;
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_leveldb"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_leveldb");
+    if (!rw) { std::cout << "LevelDB plugin not found" << std::endl; return 1; }
+
+    // Write tiles with a small write buffer, so that most of them are in table files already
+    ghc::filesystem::remove_all(dbName);
+    osg::ref_ptr<osgDB::Options> writeOptions = new osgDB::Options("WriteBufferSize=16777216");
+    for (int i = 0; i < numTiles; ++i)
+    {
+        osg::ref_ptr<osg::Node> tile = createTile(i);
+        std::string fileName = "leveldb://" + dbName + "/" + getTileName(i);
+        if (!rw->writeNode(*tile, fileName, writeOptions.get()).success())
+        { std::cout << "Failed to write tile " << i << std::endl; return 1; }
+    }
+
+    // The first close releases the database used for writing, and the second reopening will
+    // flush remaining logs to table files (with default bloom filter) before benchmarking
+    for (int i = 0; i < 2; ++i)
+    {
+        osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(
+            rw->openArchive("leveldb://" + dbName, osgDB::ReaderWriter::READ).getObject());
+        if (archive.valid()) archive->close();
+    }
+
+    bool success = true;
+    success &= benchmark(rw, "No cache / bloom", "CacheSize=0 BloomBitsPerKey=0", numTiles, numReads);
+    success &= benchmark(rw, "Default", "", numTiles, numReads);
+    success &= benchmark(rw, "Large cache", "CacheSize=268435456", numTiles, numReads);
+    success &= benchmark(rw, "Checksums", "VerifyChecksums=1", numTiles, numReads);
+    success &= benchmark(rw, "Not filling cache", "FillCache=0", numTiles, numReads);
+
+    // Same number of keys with values of about 1KB and 1MB
+    double smallTime = 0.0, largeTime = 0.0;
+    success &= benchmarkExistence(rw, 85, 64, numReads, smallTime);
+    success &= benchmarkExistence(rw, 87381, 64, numReads, largeTime);
+    std::cout << "Existence checks of 1MB values take " << (largeTime / osg::maximum(smallTime, 1e-3))
+              << "x time of 1KB values" << std::endl;
+    std::cout << (success ? "LevelDB benchmark passed" : "LevelDB benchmark FAILED") << std::endl;
+    return success ? 0 : 1;
+}
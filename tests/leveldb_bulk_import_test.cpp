@@ -0,0 +1,124 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/Archive>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <ghc/filesystem.hpp>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static std::string getTileName(int i) { return "Data/tile_" + std::to_string(i) + ".osgb"; }
+
+static osg::Node* createTile(int i)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(2048);
+    for (size_t v = 0; v < va->size(); ++v)
+        (*va)[v].set((float)(v % 47) + i, (float)(v / 47), (float)((v * 3 + i) % 11));
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setVertexArray(va.get());
+    geom->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, va->size()));
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->setName("Tile" + std::to_string(i));
+    geode->addDrawable(geom.get()); return geode.release();
+}
+
+static osg::ref_ptr<osgDB::Archive> openArchive(osgDB::ReaderWriter* rw, const std::string& dbName,
+                                                osgDB::ReaderWriter::ArchiveStatus status,
+                                                const std::string& optionString)
+{
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options(optionString);
+    return dynamic_cast<osgDB::Archive*>(
+        rw->openArchive("leveldb://" + dbName, status, 4096, options.get()).getObject());
+}
+
+// Write all tiles to a new database from multiple threads, and return time used (including closing)
+static double importTiles(osgDB::ReaderWriter* rw, const std::string& dbName, const std::string& opt,
+                          int numTiles, int numThreads)
+{
+    ghc::filesystem::remove_all(dbName);
+    osg::ref_ptr<osgDB::Archive> archive = openArchive(rw, dbName, osgDB::ReaderWriter::CREATE, opt);
+    if (!archive) return -1.0;
+
+    std::atomic<int> numFailures(0); std::vector<std::thread> threads;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([=, &numFailures]()
+        {
+            for (int i = t; i < numTiles; i += numThreads)
+            {
+                osg::ref_ptr<osg::Node> tile = createTile(i);
+                if (!archive->writeNode(*tile, getTileName(i)).success()) numFailures++;
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    archive->close();  // write remaining batch (and compact)
+    double timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+    return (numFailures > 0) ? -1.0 : timeMs;
+}
+
+static bool verifyTiles(osgDB::ReaderWriter* rw, const std::string& dbName, int numTiles)
+{
+    osg::ref_ptr<osgDB::Archive> archive = openArchive(rw, dbName, osgDB::ReaderWriter::READ, "");
+    if (!archive) return false;
+
+    bool success = true;
+    for (int i = 0; i < numTiles && success; ++i)
+    {
+        osg::ref_ptr<osg::Node> node = archive->readNode(getTileName(i)).getNode();
+        success = node.valid() && node->getName() == ("Tile" + std::to_string(i));
+    }
+
+    // Enumerate keys: all tiles are in the "Data" directory
+    osgDB::DirectoryContents allFiles, rootContents = archive->getDirectoryContents("");
+    success &= archive->getFileNames(allFiles) && allFiles.size() == (size_t)numTiles;
+    success &= rootContents.size() == 1 && rootContents[0] == "Data";
+    success &= archive->getDirectoryContents("Data").size() == (size_t)numTiles;
+    success &= archive->getFileType("Data") == osgDB::DIRECTORY;
+    archive->close(); return success;
+}
+
+int main(int argc, char** argv)
+{
+    int numTiles = (argc > 1) ? atoi(argv[1]) : 5000;
+    int numThreads = (argc > 2) ? atoi(argv[2]) : 8;
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_leveldb"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_leveldb");
+    if (!rw) { std::cout << "LevelDB plugin not found" << std::endl; return 1; }
+
+    const char* names[] = { "Put one by one", "Batched", "Batched + compaction" };
+    const char* optionStrings[] = { "", "BatchSize=500", "BatchSize=500 CompactOnClose=1" };
+    bool success = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string dbName = "leveldb_bulk_import_test" + std::to_string(i) + ".db";
+        double timeMs = importTiles(rw, dbName, optionStrings[i], numTiles, numThreads);
+        bool verified = (timeMs >= 0.0) && verifyTiles(rw, dbName, numTiles);
+        std::cout << names[i] << ": " << numTiles << " tiles in " << timeMs << "ms"
+                  << (verified ? "" : ", FAILED") << std::endl;
+        success &= verified; ghc::filesystem::remove_all(dbName);
+    }
+
+    std::cout << (success ? "LevelDB bulk import test passed" : "LevelDB bulk import test FAILED")
+              << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/ShapeDrawable>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/Archive>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <ghc/filesystem.hpp>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static std::string dbName = "leveldb_stress_test.db";
+static std::string getTileName(int i) { return "tile_" + std::to_string(i) + ".osgb"; }
+
+static bool checkNode(osg::Node* node, int i)
+{ return node != NULL && node->getName() == ("Tile" + std::to_string(i)); }
+
+int main(int argc, char** argv)
+{
+    int numTiles = 200, numThreads = (argc > 1) ? atoi(argv[1]) : 16;
+    int numReads = (argc > 2) ? atoi(argv[2]) : 2000;
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_leveldb"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_leveldb");
+    if (!rw) { std::cout << "LevelDB plugin not found" << std::endl; return 1; }
+
+    // Prepare tiles
+    ghc::filesystem::remove_all(dbName);
+    for (int i = 0; i < numTiles; ++i)
+    {
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->addDrawable(new osg::ShapeDrawable(new osg::Box(osg::Vec3(i, 0.0f, 0.0f), 1.0f)));
+        geode->setName("Tile" + std::to_string(i));
+        if (!rw->writeNode(*geode, "leveldb://" + dbName + "/" + getTileName(i)).success())
+        { std::cout << "Failed to write tile " << i << std::endl; return 1; }
+    }
+
+    // Most threads read tiles like pager threads do, while some others keep opening and closing
+    // archives of the same database, which shouldn't invalidate databases used by the readers
+    std::atomic<int> numFailures(0), numSucceed(0);
+    std::vector<std::thread> threads;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int t = 0; t < numThreads; ++t)
+    {
+        bool usingArchive = (t % 4) == 3;
+        threads.push_back(std::thread([=, &numFailures, &numSucceed]()
+        {
+            unsigned int seed = t * 7919 + 1;
+            for (int r = 0; r < numReads; ++r)
+            {
+                seed = seed * 1103515245 + 12345; int i = (seed >> 8) % numTiles;
+                if (usingArchive)
+                {
+                    osg::ref_ptr<osgDB::Archive> archive = dynamic_cast<osgDB::Archive*>(
+                        rw->openArchive("leveldb://" + dbName, osgDB::ReaderWriter::READ).getObject());
+                    bool ok = archive.valid() && archive->fileExists(getTileName(i)) &&
+                              checkNode(archive->readNode(getTileName(i)).getNode(), i);
+                    if (archive.valid()) archive->close();
+                    if (ok) numSucceed++; else numFailures++;
+                }
+                else
+                {
+                    osgDB::ReaderWriter::ReadResult result =
+                        rw->readNode("leveldb://" + dbName + "/" + getTileName(i), NULL);
+                    if (checkNode(result.getNode(), i)) numSucceed++; else numFailures++;
+                }
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    double timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+    std::cout << numThreads << " threads: " << numSucceed << " reads succeed, " << numFailures
+              << " failed, " << timeMs << "ms" << std::endl;
+
+    // Make sure the database can still be used after all
+    osgDB::ReaderWriter::ReadResult last =
+        rw->readNode("leveldb://" + dbName + "/" + getTileName(0), NULL);
+    bool success = (numFailures == 0) && checkNode(last.getNode(), 0);
+    std::cout << (success ? "LevelDB stress test passed" : "LevelDB stress test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
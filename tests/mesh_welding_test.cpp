@@ -0,0 +1,80 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <modeling/Utilities.h>
+#include "test_utilities.h"
+#include <iostream>
+#include <sstream>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static double collect(osgVerse::MeshCollector& collector, osg::Node* node)
+{
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    node->accept(collector);
+    return osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+}
+
+int main(int argc, char** argv)
+{
+    int gridSize = (argc > 1) ? atoi(argv[1]) : 600;
+    size_t expected = (size_t)(gridSize + 1) * (gridSize + 1);
+    bool success = true;
+
+    // Benchmark: legacy std::map welding vs. hash welding (both exact matching)
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(createUnweldedGrid(gridSize, gridSize, false));
+
+    osgVerse::MeshCollector mapCollector;
+    mapCollector.setWeldingVertices(true); mapCollector.setWeldingWithMap(true);
+    double mapTime = collect(mapCollector, geode.get());
+
+    osgVerse::MeshCollector hashCollector;
+    hashCollector.setWeldingVertices(true);
+    double hashTime = collect(hashCollector, geode.get());
+
+    std::cout << "Source vertices: " << gridSize * gridSize * 4 << std::endl;
+    std::cout << "Map welding: " << mapCollector.getVertices().size() << " vertices, "
+              << mapTime << "ms" << std::endl;
+    std::cout << "Hash welding: " << hashCollector.getVertices().size() << " vertices, "
+              << hashTime << "ms" << std::endl;
+    if (mapCollector.getVertices() != hashCollector.getVertices() ||
+        mapCollector.getTriangles() != hashCollector.getTriangles() ||
+        hashCollector.getVertices().size() != expected)
+    { std::cout << "  Results of map and hash welding are different!" << std::endl; success = false; }
+
+    // Jittered positions can only be welded with epsilon
+    osg::ref_ptr<osg::Geode> geode2 = new osg::Geode;
+    geode2->addDrawable(createUnweldedGrid(gridSize, gridSize, false, 1e-4f));
+
+    osgVerse::MeshCollector epsCollector;
+    epsCollector.setWeldingVertices(true); epsCollector.setWeldingTolerance(1e-3f);
+    double epsTime = collect(epsCollector, geode2.get());
+    std::cout << "Epsilon welding (jittered): " << epsCollector.getVertices().size()
+              << " vertices, " << epsTime << "ms" << std::endl;
+    if (epsCollector.getVertices().size() != expected) success = false;
+
+    // Faceted normals: welding on normals keeps vertices of different facets apart
+    osg::ref_ptr<osg::Geode> geode3 = new osg::Geode;
+    geode3->addDrawable(createUnweldedGrid(gridSize, gridSize, false, 0.0f, true));
+
+    osgVerse::MeshCollector normalCollector;
+    normalCollector.setWeldingVertices(true); normalCollector.setWeldingTolerance(0.0f, 1e-3f);
+    double normalTime = collect(normalCollector, geode3.get());
+    std::cout << "Normal-aware welding (faceted): " << normalCollector.getVertices().size()
+              << " vertices, " << normalTime << "ms" << std::endl;
+    if (normalCollector.getVertices().size() <= expected ||
+        normalCollector.getVertices().size() >= (size_t)gridSize * gridSize * 4) success = false;
+    if (normalCollector.getAttributes(osgVerse::MeshCollector::NormalAttr).size() !=
+        normalCollector.getVertices().size()) success = false;
+
+    std::cout << (success ? "Mesh welding test passed" : "Mesh welding test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
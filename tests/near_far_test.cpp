@@ -0,0 +1,97 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/MatrixTransform>
+#include <osg/ShapeDrawable>
+#include <osgUtil/SceneView>
+
+#include <pipeline/Pipeline.h>
+#include <pipeline/DeferredCallback.h>
+#include <iostream>
+#include <sstream>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static osg::Node* createScene(int numRows, int numColumns)
+{
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(new osg::ShapeDrawable(new osg::Box(osg::Vec3(), 2.0f)));
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    for (int y = 0; y < numRows; ++y)
+    {
+        osg::ref_ptr<osg::Group> row = new osg::Group;
+        for (int x = 0; x < numColumns; ++x)
+        {
+            osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+            mt->setMatrix(osg::Matrix::scale(1.0f, 1.0f, 1.0f + (x * y) % 5) *
+                          osg::Matrix::rotate((float)(x + y) * 0.1f, osg::Z_AXIS) *
+                          osg::Matrix::translate(x * 10.0f, y * 10.0f, 0.0f));
+            mt->addChild(geode.get()); row->addChild(mt.get());
+        }
+        root->addChild(row.get());
+    }
+    return root.release();
+}
+
+static osg::Vec2d computeNearFar(osgVerse::DeferredRenderCallback* cb, osgUtil::SceneView* sv,
+                                 const osg::Matrix& view, unsigned int frameNo, double& timeMs)
+{
+    sv->setViewMatrix(view);
+    sv->setProjectionMatrixAsPerspective(45.0, 16.0 / 9.0, 1.0, 10000.0);
+    sv->getFrameStamp()->setFrameNumber(frameNo);
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osg::Vec2d nearFar = cb->cullWithNearFarCalculation(sv);
+    timeMs = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+    return nearFar;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ref_ptr<osg::Node> scene = createScene(100, 100);
+    osg::ref_ptr<osg::FrameStamp> frameStamp = new osg::FrameStamp;
+    osg::ref_ptr<osgUtil::SceneView> sv = new osgUtil::SceneView;
+    sv->setDefaults(); sv->setFrameStamp(frameStamp.get());
+    sv->setViewport(0, 0, 1920, 1080); sv->setSceneData(scene.get());
+    sv->setComputeNearFarMode(osg::Camera::COMPUTE_NEAR_FAR_USING_BOUNDING_VOLUMES);
+
+    osg::ref_ptr<osgVerse::DeferredRenderCallback> cb = new osgVerse::DeferredRenderCallback(true);
+    std::vector<osg::Matrix> views;
+    views.push_back(osg::Matrix::lookAt(osg::Vec3(-50.0f, -50.0f, 30.0f),
+                                        osg::Vec3(500.0f, 500.0f, 0.0f), osg::Z_AXIS));
+    views.push_back(osg::Matrix::lookAt(osg::Vec3(500.0f, 500.0f, 800.0f),
+                                        osg::Vec3(500.0f, 500.0f, 0.0f), osg::Y_AXIS));
+    views.push_back(osg::Matrix::lookAt(osg::Vec3(495.0f, 495.0f, 3.0f),
+                                        osg::Vec3(900.0f, 600.0f, 0.0f), osg::Z_AXIS));
+    views.push_back(osg::Matrix::lookAt(osg::Vec3(1200.0f, -300.0f, 200.0f),
+                                        osg::Vec3(200.0f, 800.0f, 0.0f), osg::Z_AXIS));
+
+    // Compare estimated near/far with the ones computed by a full cull traversal
+    unsigned int frameNo = 1; bool success = true;
+    double cullTime = 0.0, estimateTime = 0.0, t = 0.0;
+    for (size_t i = 0; i < views.size(); ++i)
+    {
+        cb->setNearFarCalculation(osgVerse::DeferredRenderCallback::CULL_FOR_NEAR_FAR);
+        osg::Vec2d nf0 = computeNearFar(cb.get(), sv.get(), views[i], frameNo++, t); cullTime += t;
+
+        cb->setNearFarCalculation(osgVerse::DeferredRenderCallback::ESTIMATE_NEAR_FAR);
+        osg::Vec2d nf1 = computeNearFar(cb.get(), sv.get(), views[i], frameNo++, t); estimateTime += t;
+
+        double e0 = fabs(nf1[0] - nf0[0]) / osg::maximum(nf0[0], 1e-6);
+        double e1 = fabs(nf1[1] - nf0[1]) / osg::maximum(nf0[1], 1e-6);
+        bool matched = (e0 < 1e-3 && e1 < 1e-3); if (!matched) success = false;
+        std::cout << "View " << i << ": Culled = " << nf0 << ", Estimated = " << nf1
+                  << (matched ? "" : " (MISMATCHED)") << std::endl;
+    }
+
+    std::cout << "Culling for near/far: " << cullTime << "ms, Estimating: "
+              << estimateTime << "ms" << std::endl;
+    std::cout << (success ? "Near/far test passed" : "Near/far test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include <osg/io_utils>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osgDB/ReadFile>
+#include <osgUtil/SceneView>
+#include <osgUtil/RenderStage>
+#include <osgGA/TrackballManipulator>
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+
+#include <pipeline/Pipeline.h>
+#include <pipeline/OcclusionCuller.h>
+#include <pipeline/Utilities.h>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static void collectRenderLeaves(osgUtil::RenderBin* bin, std::vector<std::string>& names)
+{
+    const osgUtil::RenderBin::RenderLeafList& leaves = bin->getRenderLeafList();
+    for (size_t i = 0; i < leaves.size(); ++i) names.push_back(leaves[i]->_drawable->getName());
+
+    const osgUtil::RenderBin::StateGraphList& graphs = bin->getStateGraphList();
+    for (size_t i = 0; i < graphs.size(); ++i)
+    {
+        const osgUtil::StateGraph::LeafList& graphLeaves = graphs[i]->_leaves;
+        for (size_t j = 0; j < graphLeaves.size(); ++j)
+            names.push_back(graphLeaves[j]->_drawable->getName());
+    }
+
+    osgUtil::RenderBin::RenderBinList& bins = bin->getRenderBinList();
+    for (osgUtil::RenderBin::RenderBinList::iterator itr = bins.begin(); itr != bins.end(); ++itr)
+        collectRenderLeaves(itr->second.get(), names);
+}
+
+static osg::Geode* createBox(const std::string& name, const osg::Vec3& center, const osg::Vec3& size)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(8);
+    osg::Vec3 h = size * 0.5f;
+    for (int i = 0; i < 8; ++i)
+        (*va)[i] = center + osg::Vec3((i & 1) ? h.x() : -h.x(), (i & 2) ? h.y() : -h.y(),
+                                      (i & 4) ? h.z() : -h.z());
+
+    GLubyte indices[36] = { 0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6,  0, 1, 5, 0, 5, 4,
+                            2, 6, 7, 2, 7, 3,  0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5 };
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setName(name); geom->setVertexArray(va.get());
+    geom->addPrimitiveSet(new osg::DrawElementsUByte(GL_TRIANGLES, 36, indices));
+
+    osg::Geode* geode = new osg::Geode;
+    geode->addDrawable(geom.get()); return geode;
+}
+
+int main(int argc, char** argv)
+{
+    // Camera at (0, -50, 0) looking at +Y; a wall at Y = 0 will hide everything behind it
+    osg::Matrix view = osg::Matrix::lookAt(osg::Vec3(0.0f, -50.0f, 0.0f), osg::Vec3(), osg::Z_AXIS);
+    osg::Matrix proj = osg::Matrix::perspective(60.0, 16.0 / 9.0, 1.0, 1000.0);
+
+    osg::ref_ptr<osg::Node> wall = createBox("Wall", osg::Vec3(), osg::Vec3(40.0f, 1.0f, 30.0f));
+    osg::ref_ptr<osg::Group> objects = new osg::Group;
+    objects->addChild(createBox("Front", osg::Vec3(0.0f, -20.0f, 0.0f), osg::Vec3(4.0f, 4.0f, 4.0f)));
+    objects->addChild(createBox("Behind1", osg::Vec3(0.0f, 20.0f, 0.0f), osg::Vec3(4.0f, 4.0f, 4.0f)));
+    objects->addChild(createBox("Beside", osg::Vec3(45.0f, 20.0f, 0.0f), osg::Vec3(4.0f, 4.0f, 4.0f)));
+    objects->addChild(createBox("Above", osg::Vec3(0.0f, 20.0f, 40.0f), osg::Vec3(4.0f, 4.0f, 4.0f)));
+    objects->addChild(createBox("Large", osg::Vec3(0.0f, 20.0f, 0.0f), osg::Vec3(80.0f, 4.0f, 4.0f)));
+
+    osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+    mt->setMatrix(osg::Matrix::translate(5.0f, 30.0f, -5.0f));
+    mt->addChild(createBox("Behind2", osg::Vec3(), osg::Vec3(2.0f, 2.0f, 2.0f)));
+    objects->addChild(mt.get());
+
+    if (!osgVerse::OcclusionCuller::isSupported())
+    {
+        OSG_NOTICE << "Occlusion culler is not supported (requires AVX2)" << std::endl;
+        return 0;
+    }
+
+    // Cull the scene with the pipeline's scene view / cull visitor, without a graphics context
+    osg::ref_ptr<osgVerse::OcclusionCuller> culler = new osgVerse::OcclusionCuller(320, 192);
+    culler->addOccluder(wall.get());
+
+    osg::ref_ptr<osgVerse::DeferredRenderCallback> callback =
+        new osgVerse::DeferredRenderCallback(false);
+    callback->setOcclusionCuller(culler.get());
+
+    osg::ref_ptr<osg::Camera> camera = new osg::Camera;
+    camera->setViewMatrix(view); camera->setProjectionMatrix(proj);
+    camera->setViewport(0, 0, 1600, 900);
+    camera->setUserValue("NeedNearFarCalculation", true);
+    camera->addChild(wall.get()); camera->addChild(objects.get());
+
+    osg::ref_ptr<osg::FrameStamp> frameStamp = new osg::FrameStamp;
+    frameStamp->setFrameNumber(1);
+
+    osg::ref_ptr<osgUtil::SceneView> sceneView =
+        osgVerse::createPipelineSceneView(callback.get(), camera.get());
+    sceneView->setFrameStamp(frameStamp.get());
+    sceneView->cull();
+
+    std::vector<std::string> drawnNames, culledNames;
+    collectRenderLeaves(sceneView->getRenderStage(), drawnNames);
+    const char* objectNames[] = { "Front", "Behind1", "Beside", "Above", "Large", "Behind2" };
+    for (int i = 0; i < 6; ++i)
+    {
+        if (std::find(drawnNames.begin(), drawnNames.end(), objectNames[i]) == drawnNames.end())
+            culledNames.push_back(objectNames[i]);
+    }
+
+    bool wallDrawn = std::find(drawnNames.begin(), drawnNames.end(), "Wall") != drawnNames.end();
+    int numDrawn = (int)drawnNames.size() - (wallDrawn ? 1 : 0), numCulled = (int)culledNames.size();
+    std::cout << "Occluders: " << culler->getNumOccluders() << ", Render leaves: " << drawnNames.size()
+              << ", Drawn: " << numDrawn << ", Culled: " << numCulled << std::endl;
+    for (size_t i = 0; i < drawnNames.size(); ++i)
+        std::cout << "  Drawn: " << drawnNames[i] << std::endl;
+    for (size_t i = 0; i < culledNames.size(); ++i)
+        std::cout << "  Culled: " << culledNames[i] << std::endl;
+
+    // Expected: Wall (occluder) / Front / Beside / Above / Large drawn, Behind1 / Behind2 culled
+    bool success = (wallDrawn && numDrawn == 4 && numCulled == 2);
+    std::cout << (success ? "Occlusion culling test passed" : "Occlusion culling test FAILED")
+              << std::endl;
+    if (argc < 2) return success ? 0 : 1;
+
+    // Viewer mode: use --occluder <file> to specify occluders (e.g., simplified building shells)
+    osg::ArgumentParser arguments = osgVerse::globalInitialize(argc, argv);
+    std::string occluderFile; arguments.read("--occluder", occluderFile);
+    osg::ref_ptr<osg::Node> occluder = occluderFile.empty() ? NULL
+                                     : osgDB::readNodeFile(occluderFile);
+    osg::ref_ptr<osg::Node> scene = osgDB::readNodeFiles(arguments);
+    if (!scene) { OSG_WARN << "Failed to load scene model"; return 1; }
+
+    osgVerse::TangentSpaceVisitor tsv; scene->accept(tsv);
+    osgVerse::FixedFunctionOptimizer ffo; scene->accept(ffo);
+    osgVerse::Pipeline::setPipelineMask(*scene, DEFERRED_SCENE_MASK | SHADOW_CASTER_MASK);
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    root->addChild(scene.get());
+
+    osgVerse::StandardPipelineViewer viewer(false, true, true);
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.addEventHandler(new osgViewer::WindowSizeHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    viewer.realize();
+
+    culler->clearOccluders();
+    culler->addOccluder(occluder.valid() ? occluder.get() : scene.get());
+    viewer.getPipeline()->setOcclusionCuller(culler.get());
+    while (!viewer.done())
+    {
+        viewer.frame();
+        if (viewer.getFrameStamp()->getFrameNumber() % 100 == 0)
+            std::cout << "Tested: " << culler->getNumTested()
+                      << ", Culled: " << culler->getNumCulled() << std::endl;
+    }
+    return 0;
+}
@@ -163,12 +163,21 @@ int main(int argc, char** argv)
     osg::ArgumentParser arguments(&argc, argv);
     std::string output; arguments.read("--output", output);
 
+    // Use --meshopt to simplify and reorder merged tile geometries with meshoptimizer
+    osg::ref_ptr<osgVerse::GeometryOptimizer> geomOptimizer;
+    if (arguments.read("--meshopt"))
+    {
+        geomOptimizer = new osgVerse::GeometryOptimizer;
+        geomOptimizer->setSimplifying(osgVerse::GeometryOptimizer::SIMPLIFY_WITH_ATTRIBUTES, 0.4f);
+    }
+
     osgVerse::fixOsgBinaryWrappers();
     if (argc > 3 && std::string(argv[1]) == "adj")
     {
         std::string srcDir = std::string(argv[2]), dstDir = std::string(argv[3]);
         osg::ref_ptr<osgVerse::TileOptimizer> opt = new osgVerse::TileOptimizer(dstDir);
         if (!opt->prepare(srcDir)) { printf("Can't prepare for tiles\n"); return 1; }
+        opt->setGeometryOptimizer(geomOptimizer.get());
         opt->setUseThreads(10); opt->processAdjacency(2, 2); return 0;
     }
     else if (argc > 3 && std::string(argv[1]) == "top")
@@ -176,6 +185,7 @@ int main(int argc, char** argv)
         std::string srcDir = std::string(argv[2]), dstDir = std::string(argv[3]);
         osg::ref_ptr<osgVerse::TileOptimizer> opt = new osgVerse::TileOptimizer(dstDir);
         if (!opt->prepare(srcDir)) { printf("Can't prepare for tiles\n"); return 1; }
+        opt->setGeometryOptimizer(geomOptimizer.get());
         opt->setUseThreads(10); opt->processGroundLevel(2, 2); return 0;
     }
 
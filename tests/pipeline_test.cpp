@@ -83,9 +83,10 @@ static const char* inputFragmentShaderCode =
 
 int main(int argc, char** argv)
 {
-    osgVerse::globalInitialize(argc, argv);
+    osg::ArgumentParser arguments = osgVerse::globalInitialize(argc, argv);
+    bool cullOnce = arguments.read("--cull-once");  // share cull results between input stages
     osg::ref_ptr<osg::Node> scene = osgDB::readNodeFile(
-        argc > 1 ? argv[1] : BASE_DIR + "/models/Sponza/Sponza.gltf.125,125,125.scale");
+        arguments.argc() > 1 ? arguments[1] : BASE_DIR + "/models/Sponza/Sponza.gltf.125,125,125.scale");
     if (!scene) { OSG_WARN << "Failed to load GLTF model"; return 1; }
 
     // Add tangent/bi-normal arrays for normal mapping
@@ -199,6 +200,7 @@ int main(int argc, char** argv)
 
         // 7. Add gbuffer stage to depth bliting list
         pipeline->requireDepthBlit(gbuffer, true);
+        pipeline->getDeferredCallback()->setCullOnce(cullOnce);
     }
 
     // Start the viewer
@@ -210,5 +212,14 @@ int main(int argc, char** argv)
 
     // Must use single-threaded if you share buffers between stages!
     viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
-    return viewer.run();
+    if (!cullOnce) return viewer.run();
+
+    osgVerse::DeferredRenderCallback* cb = pipeline->getDeferredCallback();
+    while (!viewer.done())
+    {
+        viewer.frame();
+        if (viewer.getFrameStamp()->getFrameNumber() % 100 == 0)
+            std::cout << "Saved cull traversals: " << cb->getNumSavedTraversals() << std::endl;
+    }
+    return 0;
 }
@@ -0,0 +1,97 @@
+#include <osg/io_utils>
+#include <pipeline/SymbolManager.h>
+#include <pipeline/Utilities.h>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+/** Expose LRU slots of the persistent text atlas for testing */
+class TextAtlasTester : public osgVerse::SymbolManager
+{
+public:
+    void reset(int numSlots) { resetTextAtlas(numSlots); }
+    int acquire(osgVerse::Symbol* sym, unsigned int frameNo) { return getTextSlot(sym, frameNo); }
+
+    int findSlot(int symbolId) const
+    {
+        std::map<int, int>::const_iterator itr = _textSlotOfSymbol.find(symbolId);
+        return (itr != _textSlotOfSymbol.end()) ? itr->second : -1;
+    }
+
+    bool takeDirty(int slot)
+    {
+        bool found = std::find(_dirtyTextSlots.begin(), _dirtyTextSlots.end(), slot)
+                   != _dirtyTextSlots.end(); _dirtyTextSlots.clear(); return found;
+    }
+
+    size_t numDirty() const { return _dirtyTextSlots.size(); }
+};
+
+static osgVerse::Symbol* createSymbol(int id)
+{
+    osgVerse::Symbol* sym = new osgVerse::Symbol;
+    std::stringstream ss; ss << "Label" << id;
+    sym->id = id; sym->name = ss.str(); return sym;
+}
+
+#define CHECK(cond, msg) \
+    if (!(cond)) { std::cout << "  FAILED: " << msg << std::endl; success = false; }
+
+int main(int argc, char** argv)
+{
+    osg::ref_ptr<TextAtlasTester> tester = new TextAtlasTester;
+    std::vector<osg::ref_ptr<osgVerse::Symbol>> symbols;
+    for (int i = 0; i < 6; ++i) symbols.push_back(createSymbol(i));
+    bool success = true; tester->reset(4);
+
+    // Frame 1: four labels fill four different slots
+    std::set<int> usedSlots;
+    for (int i = 0; i < 4; ++i)
+    {
+        int slot = tester->acquire(symbols[i].get(), 1);
+        CHECK(slot >= 0 && usedSlots.find(slot) == usedSlots.end(), "Slot of symbol " << i);
+        usedSlots.insert(slot);
+    }
+    CHECK(tester->numDirty() == 4, "All new slots should be redrawn");
+    tester->takeDirty(-1);
+
+    // Frame 2: unchanged labels reuse their slots without redrawing; changed text is redrawn
+    int slot1 = tester->findSlot(1), slot2 = tester->findSlot(2);
+    CHECK(tester->acquire(symbols[1].get(), 2) == slot1, "Reuse slot of symbol 1");
+    CHECK(tester->numDirty() == 0, "Unchanged label should not be redrawn");
+    symbols[2]->name = "Changed";
+    CHECK(tester->acquire(symbols[2].get(), 2) == slot2, "Reuse slot of symbol 2");
+    CHECK(tester->takeDirty(slot2), "Changed label should be redrawn");
+
+    // Frame 3: a new label evicts the least recently used one (symbol 0 of frame 1)
+    int slot0 = tester->findSlot(0);
+    CHECK(tester->acquire(symbols[4].get(), 3) == slot0, "Evict least recently used slot");
+    CHECK(tester->findSlot(0) < 0, "Evicted symbol should lose its slot");
+    CHECK(tester->takeDirty(slot0), "Evicted slot should be redrawn");
+
+    // Still frame 3: slots used in current frame are never evicted
+    tester->acquire(symbols[1].get(), 3); tester->acquire(symbols[2].get(), 3);
+    tester->acquire(symbols[3].get(), 3); tester->takeDirty(-1);
+    CHECK(tester->acquire(symbols[5].get(), 3) < 0, "No slot available in a full frame");
+    CHECK(tester->findSlot(5) < 0 && tester->numDirty() == 0, "Full frame should change nothing");
+
+    // Frame 4: evicted symbol comes back and gets a slot again
+    int slot = tester->acquire(symbols[0].get(), 4);
+    CHECK(slot >= 0 && tester->findSlot(0) == slot, "Evicted symbol should be re-acquired");
+    CHECK(tester->takeDirty(slot), "Re-acquired slot should be redrawn");
+
+    // Resetting the atlas releases all slots
+    tester->reset(4);
+    CHECK(tester->findSlot(0) < 0 && tester->findSlot(1) < 0, "Reset should release all slots");
+    std::cout << (success ? "Symbol text atlas test passed" : "Symbol text atlas test FAILED")
+              << std::endl;
+    return success ? 0 : 1;
+}
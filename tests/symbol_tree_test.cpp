@@ -0,0 +1,135 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <pipeline/SymbolManager.h>
+#include <pipeline/Utilities.h>
+#include <iostream>
+#include <algorithm>
+#include <random>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+typedef std::map<int, osg::ref_ptr<osgVerse::Symbol>> SymbolMap;
+
+static std::vector<int> collectIds(const std::vector<osgVerse::Symbol*>& symbols)
+{
+    std::vector<int> ids;
+    for (size_t i = 0; i < symbols.size(); ++i) ids.push_back(symbols[i]->id);
+    std::sort(ids.begin(), ids.end()); return ids;
+}
+
+static std::vector<int> bruteForce(const SymbolMap& symbols, const osg::Vec3d& center, double radius)
+{
+    std::vector<int> ids;
+    for (SymbolMap::const_iterator itr = symbols.begin(); itr != symbols.end(); ++itr)
+    { if ((itr->second->position - center).length2() < radius * radius) ids.push_back(itr->first); }
+    return ids;
+}
+
+static std::vector<int> bruteForce(const SymbolMap& symbols, const osg::Polytope& polytope)
+{
+    std::vector<int> ids; const osg::Polytope::PlaneList& planes = polytope.getPlaneList();
+    for (SymbolMap::const_iterator itr = symbols.begin(); itr != symbols.end(); ++itr)
+    {
+        bool inside = true;
+        for (size_t i = 0; i < planes.size() && inside; ++i)
+            inside = planes[i].distance(itr->second->position) >= 0.0;
+        if (inside) ids.push_back(itr->first);
+    }
+    return ids;
+}
+
+// Compare sphere and box queries of the R-tree with brute-force scans of current positions
+static bool checkQueries(osgVerse::SymbolManager* manager, const SymbolMap& symbols,
+                         std::mt19937& rng, const std::string& phase)
+{
+    std::uniform_real_distribution<double> coord(-1000.0, 1000.0), size(1.0, 400.0);
+    bool success = true;
+    for (int i = 0; i < 200; ++i)
+    {
+        osg::Vec3d center(coord(rng), coord(rng), coord(rng) * 0.1); double radius = size(rng);
+        std::vector<int> expected = bruteForce(symbols, center, radius);
+        std::vector<int> result = collectIds(manager->querySymbols(center, radius));
+
+        osg::Vec3d halfSize(size(rng), size(rng), size(rng) * 0.1);
+        osg::Polytope polytope;
+        polytope.setToBoundingBox(osg::BoundingBox(center - halfSize, center + halfSize));
+        std::vector<int> expected2 = bruteForce(symbols, polytope);
+        std::vector<int> result2 = collectIds(manager->querySymbols(polytope));
+        if (result != expected || result2 != expected2)
+        {
+            std::cout << "  " << phase << ": query " << i << " found " << result.size() << "/"
+                      << result2.size() << " symbols, expected " << expected.size() << "/"
+                      << expected2.size() << std::endl; success = false;
+        }
+    }
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    int numSymbols = (argc > 1) ? atoi(argv[1]) : 5000;
+    std::mt19937 rng((argc > 2) ? atoi(argv[2]) : 0);
+    std::uniform_real_distribution<double> coord(-1000.0, 1000.0), offset(-50.0, 50.0);
+
+    osg::ref_ptr<osgVerse::SymbolManager> manager = new osgVerse::SymbolManager;
+    SymbolMap symbols, removed; bool success = true;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+    // Insert symbols, some of them at the same position
+    for (int i = 0; i < numSymbols; ++i)
+    {
+        osg::ref_ptr<osgVerse::Symbol> sym = new osgVerse::Symbol;
+        if (i % 10 == 9) sym->position = symbols.rbegin()->second->position;
+        else sym->position.set(coord(rng), coord(rng), coord(rng) * 0.1);
+        int id = manager->updateSymbol(sym.get()); symbols[id] = sym;
+    }
+    success &= checkQueries(manager.get(), symbols, rng, "Insert");
+
+    // Move half of the symbols, either a little or far away to another part of the tree
+    for (SymbolMap::iterator itr = symbols.begin(); itr != symbols.end(); ++itr)
+    {
+        osgVerse::Symbol* sym = itr->second.get();
+        if (rng() % 2) continue;
+        else if (rng() % 2) sym->position += osg::Vec3d(offset(rng), offset(rng), offset(rng) * 0.1);
+        else sym->position.set(coord(rng), coord(rng), coord(rng) * 0.1);
+        manager->updateSymbol(sym);
+    }
+    success &= checkQueries(manager.get(), symbols, rng, "Move");
+
+    // Remove most of the symbols to shrink the tree, then move the remaining ones again
+    for (SymbolMap::iterator itr = symbols.begin(); itr != symbols.end();)
+    {
+        if (rng() % 5 == 0) { ++itr; continue; }
+        manager->removeSymbol(itr->second.get());
+        removed[itr->first] = itr->second; symbols.erase(itr++);
+    }
+    success &= checkQueries(manager.get(), symbols, rng, "Remove");
+
+    for (SymbolMap::iterator itr = symbols.begin(); itr != symbols.end(); ++itr)
+    {
+        itr->second->position.set(coord(rng), coord(rng), coord(rng) * 0.1);
+        manager->updateSymbol(itr->second.get());
+    }
+    success &= checkQueries(manager.get(), symbols, rng, "Move after removing");
+
+    // Add some removed symbols back with their old IDs
+    for (SymbolMap::iterator itr = removed.begin(); itr != removed.end(); ++itr)
+    {
+        if (rng() % 4) continue;
+        itr->second->position.set(coord(rng), coord(rng), coord(rng) * 0.1);
+        manager->updateSymbol(itr->second.get()); symbols[itr->first] = itr->second;
+    }
+    success &= checkQueries(manager.get(), symbols, rng, "Add back");
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    std::cout << "Tested " << numSymbols << " symbols in "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
+    std::cout << (success ? "Symbol tree test passed" : "Symbol tree test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
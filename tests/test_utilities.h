@@ -0,0 +1,115 @@
+#ifndef MANA_TESTS_UTILITIES_HPP
+#define MANA_TESTS_UTILITIES_HPP
+
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osgDB/ReaderWriter>
+#include <algorithm>
+#include <vector>
+#include <stdlib.h>
+#include <cmath>
+
+/** Shared scene fixtures of test programs */
+
+// A grid with each quad owning its 4 vertices, which is common in scanned / exported meshes.
+// - wavy: terrain-like heights with smooth normals; otherwise flat, and normals can be faceted
+// - jitter: random offsets of XY positions, e.g. for testing welding with tolerance
+static inline osg::Geometry* createUnweldedGrid(int numRows, int numColumns, bool wavy,
+                                                float jitter = 0.0f, bool faceted = false)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> na = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> ta = new osg::Vec2Array;
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    for (int y = 0; y < numRows; ++y)
+    {
+        for (int x = 0; x < numColumns; ++x)
+        {
+            unsigned int start = va->size();
+            const int offsets[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+            osg::Vec3 N = faceted ? osg::Vec3((x % 2) * 0.2f, (y % 2) * 0.2f, 1.0f) : osg::Z_AXIS;
+            for (int i = 0; i < 4; ++i)
+            {
+                float px = x + offsets[i][0], py = y + offsets[i][1], h = 0.0f;
+                if (wavy)
+                {
+                    h = sinf(px * 0.1f) * cosf(py * 0.1f) * 4.0f;
+                    N.set(-cosf(px * 0.1f) * cosf(py * 0.1f) * 0.4f,
+                          sinf(px * 0.1f) * sinf(py * 0.1f) * 0.4f, 1.0f);
+                }
+
+                float dx = 0.0f, dy = 0.0f;
+                if (jitter > 0.0f)
+                {
+                    dx = jitter * ((rand() % 201) - 100) / 100.0f;
+                    dy = jitter * ((rand() % 201) - 100) / 100.0f;
+                }
+                va->push_back(osg::Vec3(px + dx, py + dy, h)); na->push_back(N / N.length());
+                ta->push_back(osg::Vec2(px / numColumns, py / numRows));
+            }
+
+            unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int i = 0; i < 6; ++i) de->push_back(start + quad[i]);
+        }
+    }
+
+    osg::Geometry* geom = new osg::Geometry;
+    geom->setVertexArray(va.get()); geom->setTexCoordArray(0, ta.get());
+    geom->setNormalArray(na.get()); geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    geom->addPrimitiveSet(de.get()); return geom;
+}
+
+// Shuffle triangles of the grid above, which is the worst case for vertex cache and vertex fetch
+static inline osg::Geometry* shuffleTriangles(osg::Geometry* geom, unsigned int seed)
+{
+    osg::DrawElementsUInt* de = static_cast<osg::DrawElementsUInt*>(geom->getPrimitiveSet(0));
+    std::vector<unsigned int> indices(de->begin(), de->end());
+    std::vector<unsigned int> triangles(indices.size() / 3);
+    for (size_t i = 0; i < triangles.size(); ++i) triangles[i] = i;
+    srand(seed);
+    for (size_t i = triangles.size() - 1; i > 0; --i)
+        std::swap(triangles[i], triangles[rand() % (i + 1)]);
+
+    de->clear();
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        unsigned int t = triangles[i];
+        de->push_back(indices[t * 3]); de->push_back(indices[t * 3 + 1]);
+        de->push_back(indices[t * 3 + 2]);
+    }
+    de->dirty(); return geom;
+}
+
+// Load all levels of paged tiles like the database pager does: file children of every PagedLOD
+// are read with its database options, recursively. Loaded nodes are returned with the root first,
+// or an empty list is returned if any file fails to load
+typedef std::vector<osg::ref_ptr<osg::Node>> NodeList;
+static inline NodeList loadAllLevels(osgDB::ReaderWriter* rw, osg::Node* root)
+{
+    class FindPagedLODVisitor : public osg::NodeVisitor
+    {
+    public:
+        FindPagedLODVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+        virtual void apply(osg::PagedLOD& node)
+        { if (node.getNumFileNames() > 1) pagedLODs.push_back(&node); traverse(node); }
+        std::vector<osg::PagedLOD*> pagedLODs;
+    };
+
+    NodeList loaded(1, root);
+    for (size_t n = 0; n < loaded.size(); ++n)
+    {
+        FindPagedLODVisitor finder; loaded[n]->accept(finder);
+        for (size_t i = 0; i < finder.pagedLODs.size(); ++i)
+        {
+            osg::PagedLOD* plod = finder.pagedLODs[i];
+            osg::ref_ptr<osg::Node> children = rw->readNode(
+                plod->getDatabasePath() + "/" + plod->getFileName(1),
+                dynamic_cast<const osgDB::Options*>(plod->getDatabaseOptions())).getNode();
+            if (!children) return NodeList();
+            loaded.push_back(children);
+        }
+    }
+    return loaded;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osg/TriangleIndexFunctor>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/Registry>
+#include <iostream>
+#include <sstream>
+#include <ghc/filesystem.hpp>
+#include "test_utilities.h"
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static std::string folder = "tiles_writer_test";
+
+struct CountTriangleOperator
+{
+    int numTriangles; CountTriangleOperator() : numTriangles(0) {}
+    void operator()(unsigned int, unsigned int, unsigned int) { numTriangles++; }
+};
+
+class CountTriangleVisitor : public osg::NodeVisitor
+{
+public:
+    CountTriangleVisitor()
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), numTriangles(0) {}
+
+    virtual void apply(osg::Geode& geode)
+    {
+        for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+        {
+            osg::TriangleIndexFunctor<CountTriangleOperator> functor;
+            geode.getDrawable(i)->accept(functor); numTriangles += functor.numTriangles;
+        }
+    }
+
+    int numTriangles;
+};
+
+static osg::Geode* createQuad(float x, float y, float size)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    va->push_back(osg::Vec3(x, y, 0.0f)); va->push_back(osg::Vec3(x + size, y, 0.0f));
+    va->push_back(osg::Vec3(x, y + size, 0.0f)); va->push_back(osg::Vec3(x + size, y + size, 0.0f));
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setVertexArray(va.get());
+    geom->setNormalArray(new osg::Vec3Array(4, osg::Z_AXIS), osg::Array::BIND_PER_VERTEX);
+    geom->addPrimitiveSet(new osg::DrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(geom.get()); return geode.release();
+}
+
+// An OSGB hierarchy like oblique photography data: each PagedLOD has a coarse quad in memory,
+// and 4 fine quads in file which are loaded when its pixel size on screen is large enough
+static osg::Node* createSource(const std::string& dir)
+{
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    for (int i = 0; i < 4; ++i)
+    {
+        float x = (i % 2) * 100.0f, y = (i / 2) * 100.0f;
+        osg::ref_ptr<osg::Group> fine = new osg::Group;
+        for (int j = 0; j < 4; ++j)
+            fine->addChild(createQuad(x + (j % 2) * 50.0f, y + (j / 2) * 50.0f, 50.0f));
+
+        std::string fileName = "L1_" + std::to_string(i) + ".osgb";
+        if (!osgDB::writeNodeFile(*fine, dir + "/" + fileName)) return NULL;
+
+        osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+        plod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+        plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+        plod->setCenter(osg::Vec3(x + 50.0f, y + 50.0f, 0.0f)); plod->setRadius(71.0f);
+        plod->setDatabasePath(dir + "/");
+        plod->addChild(createQuad(x, y, 100.0f), 0.0f, 100.0f);
+        plod->setFileName(1, fileName); plod->setRange(1, 100.0f, FLT_MAX);
+        root->addChild(plod.get());
+    }
+    return root.release();
+}
+
+// Load all levels like the pager does, and return number of all triangles
+static int countAllTriangles(osgDB::ReaderWriter* rw, osg::Node* root)
+{
+    std::vector<osg::ref_ptr<osg::Node>> loaded = loadAllLevels(rw, root);
+    if (loaded.empty()) return -1;
+
+    CountTriangleVisitor ctv;
+    for (size_t i = 0; i < loaded.size(); ++i) loaded[i]->accept(ctv);
+    return ctv.numTriangles;
+}
+
+int main(int argc, char** argv)
+{
+    std::string extraOptions = (argc > 1) ? argv[1] : "";  // e.g., "UseDraco=1 UseKTX2=1"
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_tiles"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_tiles");
+    if (!rw) { std::cout << "3D Tiles plugin not found" << std::endl; return 1; }
+
+    ghc::filesystem::create_directories(folder + "/source");
+    osg::ref_ptr<osg::Node> source = createSource(folder + "/source");
+    if (!source) { std::cout << "Failed to create source tiles" << std::endl; return 1; }
+
+    // 4 coarse quads and 16 fine quads, all of which should be found after loading all levels
+    const char* versions[] = { "1.0", "1.1" }; bool success = true;
+    for (int v = 0; v < 2; ++v)
+    {
+        std::string outFolder = folder + "/output" + std::to_string(v);
+        ghc::filesystem::create_directories(outFolder);
+
+        osg::ref_ptr<osgDB::Options> options = new osgDB::Options(
+            std::string("Version=") + versions[v] + " " + extraOptions);
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        bool written = rw->writeNode(*source, outFolder + "/tileset.json", options.get()).success();
+        osg::Timer_t t1 = osg::Timer::instance()->tick();
+
+        osg::ref_ptr<osg::Node> root = written ? rw->readNode(
+            outFolder + "/tileset.json.verse_tiles", NULL).getNode() : NULL;
+        int numTriangles = root.valid() ? countAllTriangles(rw, root.get()) : -1;
+        std::cout << "Version " << versions[v] << ": written in "
+                  << osg::Timer::instance()->delta_m(t0, t1) << "ms, " << numTriangles
+                  << " triangles loaded" << std::endl;
+        success &= (numTriangles == 40);
+    }
+
+    source = NULL;
+    ghc::filesystem::remove_all(folder);
+    std::cout << (success ? "Tiles writer test passed" : "Tiles writer test FAILED") << std::endl;
+    return success ? 0 : 1;
+}
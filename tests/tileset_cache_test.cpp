@@ -0,0 +1,114 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/PagedLOD>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <ghc/filesystem.hpp>
+#include "test_utilities.h"
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static std::string folder = "tileset_cache_test";
+
+// A tileset without contents, where each tile has 'branches' children until reaching 'depth'
+static void writeTile(std::ostream& out, int level, int depth, int branches, double x, double size)
+{
+    out << "{\"boundingVolume\":{\"sphere\":[" << (x + size * 0.5) << ",0,0," << size << "]},"
+        << "\"geometricError\":" << (depth - level) * 10.0 << ",\"refine\":\"REPLACE\"";
+    if (level < depth)
+    {
+        out << ",\"children\":[";
+        for (int i = 0; i < branches; ++i)
+        {
+            if (i > 0) out << ",";
+            writeTile(out, level + 1, depth, branches, x + size * i / branches, size / branches);
+        }
+        out << "]";
+    }
+    out << "}";
+}
+
+// Count leaf tiles; paged tiles are counted by their loaded children instead
+class CountLeafVisitor : public osg::NodeVisitor
+{
+public:
+    CountLeafVisitor()
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), numLeaves(0), jsonInOptions(false) {}
+
+    virtual void apply(osg::Node& node) { numLeaves++; }
+    virtual void apply(osg::Group& node) { traverse(node); }
+
+    virtual void apply(osg::PagedLOD& node)
+    {
+        if (node.getNumFileNames() < 2) { traverse(node); return; }
+        const osgDB::Options* options = dynamic_cast<const osgDB::Options*>(node.getDatabaseOptions());
+        if (!options || !options->getOptionString().empty()) jsonInOptions = true;
+    }
+
+    int numLeaves; bool jsonInOptions;
+};
+
+// Load all levels like the pager does, and return number of leaf tiles
+static int countAllLeaves(osgDB::ReaderWriter* rw, osg::Node* root)
+{
+    std::vector<osg::ref_ptr<osg::Node>> loaded = loadAllLevels(rw, root);
+    if (loaded.empty()) return -1;
+
+    CountLeafVisitor clv;
+    for (size_t i = 0; i < loaded.size(); ++i) loaded[i]->accept(clv);
+    return clv.jsonInOptions ? -1 : clv.numLeaves;  // no JSON should be kept in options
+}
+
+int main(int argc, char** argv)
+{
+    int depth = (argc > 1) ? atoi(argv[1]) : 5, branches = (argc > 2) ? atoi(argv[2]) : 4;
+#ifndef OSG_LIBRARY_STATIC
+    osgDB::Registry::instance()->loadLibrary(
+        osgDB::Registry::instance()->createLibraryNameForExtension("verse_tiles"));
+#endif
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_tiles");
+    if (!rw) { std::cout << "3D Tiles plugin not found" << std::endl; return 1; }
+
+    ghc::filesystem::create_directories(folder);
+    {
+        std::ofstream out(folder + "/tileset.json");
+        out << "{\"asset\":{\"version\":\"1.0\"},\"geometricError\":100,\"root\":";
+        writeTile(out, 0, depth, branches, 0.0, 1000.0); out << "}";
+    }
+
+    int expected = 1;
+    for (int i = 0; i < depth; ++i) expected *= branches;
+
+    // Children are created from the parsed tileset kept by PagedLODs
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osg::ref_ptr<osg::Node> root = rw->readNode(folder + "/tileset.json.verse_tiles", NULL).getNode();
+    int numLeaves = root.valid() ? countAllLeaves(rw, root.get()) : -1;
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    std::cout << "Loaded " << numLeaves << " leaf tiles in "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
+    bool success = (numLeaves == expected);
+
+    // Options without the tileset object (e.g., replaced by the application) find it from cache
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+    options->setPluginStringData("tileset", folder + "/tileset.json");
+    options->setPluginStringData("tile_index", "0");
+    osg::PagedLOD* plod = dynamic_cast<osg::PagedLOD*>(root.get());
+    osg::ref_ptr<osg::Node> children = plod ? rw->readNode(
+        plod->getDatabasePath() + "/" + plod->getFileName(1), options.get()).getNode() : NULL;
+    success &= children.valid() && children->asGroup() &&
+               children->asGroup()->getNumChildren() == (unsigned int)branches;
+
+    root = NULL; children = NULL;
+    ghc::filesystem::remove_all(folder);
+    std::cout << (success ? "Tileset cache test passed" : "Tileset cache test FAILED") << std::endl;
+    return success ? 0 : 1;
+}